@@ -1550,6 +1550,55 @@ static void test_kmeans(void)
 	return;
 }
 
+static void test_kmeans_separated(void)
+{
+	/* Four tight groups of points far apart, with a NULL, an empty
+	 * point and a polygon in among them */
+	static int num_groups = 4;
+	static int group_size = 50;
+	int N = num_groups * group_size + 3;
+	LWGEOM **geoms;
+	int i, j, k = 0;
+	int *r;
+
+	geoms = lwalloc(sizeof(LWGEOM*) * N);
+	for (i = 0; i < group_size; i++)
+	{
+		for (j = 0; j < num_groups; j++)
+		{
+			double x = 1000 * (j % 2) + (i % 7);
+			double y = 1000 * (j / 2) + (i % 5);
+			geoms[k++] = lwpoint_as_lwgeom(lwpoint_make2d(SRID_UNKNOWN, x, y));
+		}
+	}
+	geoms[k++] = NULL;
+	geoms[k++] = lwpoint_as_lwgeom(lwpoint_construct_empty(SRID_UNKNOWN, 0, 0));
+	geoms[k++] = lwgeom_from_wkt("POLYGON((998 998,1002 998,1002 1002,998 1002,998 998))", LW_PARSER_CHECK_NONE);
+
+	r = lwgeom_cluster_2d_kmeans((const LWGEOM **)geoms, N, num_groups);
+	CU_ASSERT_FATAL(r != NULL);
+
+	/* Every group in its own cluster */
+	for (i = 0; i < num_groups * group_size; i++)
+	{
+		ASSERT_INT_EQUAL(r[i], r[i % num_groups]);
+		if (i < num_groups)
+		{
+			for (j = 0; j < i; j++)
+				CU_ASSERT_NOT_EQUAL(r[i], r[j]);
+		}
+	}
+	ASSERT_INT_EQUAL(r[N - 3], -1);
+	ASSERT_INT_EQUAL(r[N - 2], -1);
+	ASSERT_INT_EQUAL(r[N - 1], r[3]);
+
+	lwfree(r);
+	for (i = 0; i < N; i++)
+		if (geoms[i])
+			lwgeom_free(geoms[i]);
+	lwfree(geoms);
+}
+
 static void test_trim_bits(void)
 {
 	POINTARRAY *pta = ptarray_construct_empty(LW_TRUE, LW_TRUE, 2);
@@ -1625,6 +1674,7 @@ void algorithms_suite_setup(void)
 	PG_ADD_TEST(suite,test_lw_arc_center);
 	PG_ADD_TEST(suite,test_point_density);
 	PG_ADD_TEST(suite,test_kmeans);
+	PG_ADD_TEST(suite,test_kmeans_separated);
 	PG_ADD_TEST(suite,test_median_handles_3d_correctly);
 	PG_ADD_TEST(suite,test_median_robustness);
 	PG_ADD_TEST(suite,test_lwpoly_construct_circle);
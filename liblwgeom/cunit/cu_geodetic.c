@@ -786,6 +786,63 @@ static void test_edge_distance_to_edge(void)
 	CU_ASSERT_DOUBLE_EQUAL(c2.lon, 0.0, 0.00001);
 }
 
+static void test_cart_edge(void)
+{
+	/* Pairs of edges, crossing, touching, co-linear, apart, zero length */
+	double e[][8] = {
+		{-50, 0, 50, 0, -5, 20, 0, 1},
+		{-10, 10, 10, -10, -10, -10, 10, 10},
+		{0, 0, 10, 10, 10, 10, 20, 0},
+		{0, 0, 10, 0, 5, 0, 20, 0},
+		{170, 10, -170, 10, 175, -5, 179, 30},
+		{-60, 85, 120, 85, 30, 89, 31, 89.5},
+		{1, 1, 1.0000001, 1.0000001, 1, 2, 2, 1},
+		{3, 3, 3, 3, -3, 3, 3, -3}
+	};
+	int i, j, n = sizeof(e) / sizeof(e[0]);
+
+	for ( i = 0; i < n; i++ )
+	{
+		POINT2D a1, a2, b1, b2;
+		CART_EDGE ca, cb;
+		GEOGRAPHIC_POINT c1, c2, k1, k2;
+		POINT3D A1, A2, B1, B2;
+		double d, k;
+
+		a1.x = e[i][0]; a1.y = e[i][1]; a2.x = e[i][2]; a2.y = e[i][3];
+		b1.x = e[i][4]; b1.y = e[i][5]; b2.x = e[i][6]; b2.y = e[i][7];
+		cart_edge_init(&a1, &a2, &ca);
+		cart_edge_init(&b1, &b2, &cb);
+
+		/* Same answers as on the plain edges, to the bit */
+		geog2cart(&(ca.e.start), &A1);
+		geog2cart(&(ca.e.end), &A2);
+		geog2cart(&(cb.e.start), &B1);
+		geog2cart(&(cb.e.end), &B2);
+		CU_ASSERT_EQUAL(cart_edge_intersects(&ca, &cb), edge_intersects(&A1, &A2, &B1, &B2));
+		CU_ASSERT_EQUAL(cart_edge_intersects(&cb, &ca), edge_intersects(&B1, &B2, &A1, &A2));
+
+		for ( j = 0; j < 2; j++ )
+		{
+			const CART_EDGE *ce = j ? &cb : &ca;
+			const CART_EDGE *co = j ? &ca : &cb;
+			d = cart_edge_distance_to_point(ce, &(co->e.end), &(co->end), &c1);
+			k = edge_distance_to_point(&(ce->e), &(co->e.end), &k1);
+			CU_ASSERT_EQUAL(d, k);
+			CU_ASSERT_EQUAL(c1.lon, k1.lon);
+			CU_ASSERT_EQUAL(c1.lat, k1.lat);
+		}
+
+		d = cart_edge_distance_to_edge(&ca, &cb, &c1, &c2);
+		k = edge_distance_to_edge(&(ca.e), &(cb.e), &k1, &k2);
+		CU_ASSERT_EQUAL(d, k);
+		CU_ASSERT_EQUAL(c1.lon, k1.lon);
+		CU_ASSERT_EQUAL(c1.lat, k1.lat);
+		CU_ASSERT_EQUAL(c2.lon, k2.lon);
+		CU_ASSERT_EQUAL(c2.lat, k2.lat);
+	}
+}
+
 
 
 /*
@@ -1614,6 +1671,7 @@ void geodetic_suite_setup(void)
 	PG_ADD_TEST(suite, test_edge_intersects);
 	PG_ADD_TEST(suite, test_edge_distance_to_point);
 	PG_ADD_TEST(suite, test_edge_distance_to_edge);
+	PG_ADD_TEST(suite, test_cart_edge);
 	PG_ADD_TEST(suite, test_lwgeom_distance_sphere);
 	PG_ADD_TEST(suite, test_lwgeom_check_geodetic);
 	PG_ADD_TEST(suite, test_gserialized_from_lwgeom);
@@ -365,6 +365,163 @@ static void dbscan_test_3612c(void)
 	do_dbscan_test(test);
 }
 
+/* Points on a lattice of spacing 0.5, so many pairs are exactly eps apart,
+ * clustered through the point grid and, with an empty line added to the
+ * end of the inputs, through the STRtree */
+static void dbscan_point_grid_test(void)
+{
+	uint32_t num_points = 200;
+	uint32_t min_points, i, j;
+	LWGEOM** geoms = lwalloc((num_points + 1) * sizeof(LWGEOM*));
+
+	for (i = 0; i < num_points; i++)
+	{
+		double x = ((i * 37) % 23) * 0.5;
+		double y = ((i * 11) % 17) * 0.5;
+		if (i % 50 == 3)
+			geoms[i] = lwpoint_as_lwgeom(lwpoint_construct_empty(SRID_UNKNOWN, 0, 0));
+		else
+			geoms[i] = lwpoint_as_lwgeom(lwpoint_make2d(SRID_UNKNOWN, x, y));
+	}
+	geoms[num_points] = lwline_as_lwgeom(lwline_construct_empty(SRID_UNKNOWN, 0, 0));
+
+	for (min_points = 1; min_points <= 7; min_points += 3)
+	{
+		UNIONFIND* uf_grid = UF_create(num_points);
+		UNIONFIND* uf_tree = UF_create(num_points + 1);
+		char* in_grid = NULL;
+		char* in_tree = NULL;
+
+		ASSERT_INT_EQUAL(union_dbscan(geoms, num_points, uf_grid, 1.0, min_points, &in_grid), LW_SUCCESS);
+		ASSERT_INT_EQUAL(union_dbscan(geoms, num_points + 1, uf_tree, 1.0, min_points, &in_tree), LW_SUCCESS);
+
+		for (i = 0; i < num_points; i++)
+		{
+			ASSERT_INT_EQUAL(in_grid[i], in_tree[i]);
+			for (j = 0; j < num_points; j++)
+			{
+				if (in_grid[i] && in_grid[j])
+					ASSERT_INT_EQUAL((UF_find(uf_grid, i) == UF_find(uf_grid, j)), (UF_find(uf_tree, i) == UF_find(uf_tree, j)));
+			}
+		}
+
+		UF_destroy(uf_grid);
+		UF_destroy(uf_tree);
+		lwfree(in_grid);
+		lwfree(in_tree);
+	}
+
+	for (i = 0; i <= num_points; i++)
+		lwgeom_free(geoms[i]);
+	lwfree(geoms);
+}
+
+static void dbscan_threads_test(void)
+{
+	uint32_t num_points = 5000;
+	uint32_t min_points, i;
+	LWGEOM** geoms = lwalloc(num_points * sizeof(LWGEOM*));
+
+	for (i = 0; i < num_points; i++)
+	{
+		double x = ((i * 37) % 101) * 0.5;
+		double y = ((i * 11) % 97) * 0.5 + (i % 7) * 0.01;
+		if (i % 500 == 3)
+			geoms[i] = lwpoint_as_lwgeom(lwpoint_construct_empty(SRID_UNKNOWN, 0, 0));
+		else
+			geoms[i] = lwpoint_as_lwgeom(lwpoint_make2d(SRID_UNKNOWN, x, y));
+	}
+
+	for (min_points = 1; min_points <= 7; min_points += 3)
+	{
+		UNIONFIND* uf_one = UF_create(num_points);
+		UNIONFIND* uf_many = UF_create(num_points);
+		uint32_t* one_to_many = lwalloc(num_points * sizeof(uint32_t));
+		char* in_one = NULL;
+		char* in_many = NULL;
+
+		lwgeom_set_cluster_threads(1);
+		ASSERT_INT_EQUAL(union_dbscan(geoms, num_points, uf_one, 0.6, min_points, &in_one), LW_SUCCESS);
+		lwgeom_set_cluster_threads(4);
+		ASSERT_INT_EQUAL(union_dbscan(geoms, num_points, uf_many, 0.6, min_points, &in_many), LW_SUCCESS);
+		lwgeom_set_cluster_threads(1);
+
+		/* Same clusters, possibly with other ids */
+		ASSERT_INT_EQUAL(uf_one->num_clusters, uf_many->num_clusters);
+		for (i = 0; i < num_points; i++)
+			one_to_many[UF_find(uf_one, i)] = UF_find(uf_many, i);
+		for (i = 0; i < num_points; i++)
+		{
+			ASSERT_INT_EQUAL(in_one[i], in_many[i]);
+			ASSERT_INT_EQUAL(one_to_many[UF_find(uf_one, i)], UF_find(uf_many, i));
+			ASSERT_INT_EQUAL(UF_size(uf_one, i), UF_size(uf_many, i));
+		}
+
+		UF_destroy(uf_one);
+		UF_destroy(uf_many);
+		lwfree(one_to_many);
+		lwfree(in_one);
+		lwfree(in_many);
+	}
+
+	for (i = 0; i < num_points; i++)
+		lwgeom_free(geoms[i]);
+	lwfree(geoms);
+}
+
+static void union_clustered_polygons_test(void)
+{
+	/* Forty overlapping squares in a row, shuffled, with two lone squares
+	 * and a multipolygon of two overlapping squares in among them */
+	char* wkt_others[] = { "POLYGON((100 100,101 100,101 101,100 101,100 100))",
+	                       "MULTIPOLYGON(((300 0,302 0,302 2,300 2,300 0)),((301 0,303 0,303 2,301 2,301 0)))",
+	                       "POLYGON((200 0,201 0,201 1,200 1,200 0))" };
+	uint32_t num_geoms = 43;
+	GEOSGeometry** geoms = lwalloc(num_geoms * sizeof(GEOSGeometry*));
+	GBOX* boxes = lwalloc(num_geoms * sizeof(GBOX));
+	GEOSGeometry* result;
+	LWGEOM* square;
+	double area;
+	uint32_t i, j = 0;
+
+	for (i = 0; i < num_geoms; i++)
+	{
+		LWGEOM* lwg;
+		if (i % 15 == 7)
+		{
+			lwg = lwgeom_from_wkt(wkt_others[i / 15], LW_PARSER_CHECK_NONE);
+		}
+		else
+		{
+			double x = (j++ * 7) % 40;
+			lwg = lwpoly_as_lwgeom(lwpoly_construct_envelope(SRID_UNKNOWN, x, 0, x + 2, 2));
+		}
+		geoms[i] = LWGEOM2GEOS(lwg, 0);
+		lwgeom_calculate_gbox(lwg, &boxes[i]);
+		lwgeom_free(lwg);
+	}
+
+	result = union_clustered_polygons(geoms, boxes, num_geoms);
+	CU_ASSERT_FATAL(result != NULL);
+	CU_ASSERT_EQUAL(GEOSGeomTypeId(result), GEOS_MULTIPOLYGON);
+	CU_ASSERT_EQUAL(GEOSGetNumGeometries(result), 4);
+	GEOSArea(result, &area);
+	CU_ASSERT_DOUBLE_EQUAL(area, 82 + 1 + 6 + 1, 1e-9);
+	GEOSGeom_destroy(result);
+
+	/* A single polygon comes back as it is */
+	square = lwpoly_as_lwgeom(lwpoly_construct_envelope(SRID_UNKNOWN, 0, 0, 1, 1));
+	geoms[0] = LWGEOM2GEOS(square, 0);
+	lwgeom_calculate_gbox(square, &boxes[0]);
+	lwgeom_free(square);
+	result = union_clustered_polygons(geoms, boxes, 1);
+	CU_ASSERT_EQUAL(GEOSGeomTypeId(result), GEOS_POLYGON);
+	GEOSGeom_destroy(result);
+
+	lwfree(geoms);
+	lwfree(boxes);
+}
+
 void geos_cluster_suite_setup(void);
 void geos_cluster_suite_setup(void)
 {
@@ -379,4 +536,7 @@ void geos_cluster_suite_setup(void)
 	PG_ADD_TEST(suite, dbscan_test_3612a);
 	PG_ADD_TEST(suite, dbscan_test_3612b);
 	PG_ADD_TEST(suite, dbscan_test_3612c);
+	PG_ADD_TEST(suite, dbscan_point_grid_test);
+	PG_ADD_TEST(suite, dbscan_threads_test);
+	PG_ADD_TEST(suite, union_clustered_polygons_test);
 }
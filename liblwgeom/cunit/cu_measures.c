@@ -21,6 +21,7 @@
 #include "measures.h"
 #include "measures3d.h"
 #include "lwtree.h"
+#include "lwtree3d.h"
 
 static LWGEOM* lwgeom_from_text(const char *str)
 {
@@ -550,6 +551,54 @@ test_rect_tree_distance_tree(void)
 	wkt = "POLYGON((0 0,0 10,10 10,10 0,0 0), (4 4,4 6,6 6,6 4,4 4))";
 	TDT(wkt, "POINT(5 5)", 1);
 	TDT(wkt, "POLYGON((5 5,5 5.5,5.5 5.5,5.5 5, 5 5))", 0.5);
+
+	wkt = "MULTIPOLYGON(((0 0,0 10,10 10,10 0,0 0)),((20 0,20 10,30 10,30 0,20 0)))";
+	TDT(wkt, "LINESTRING(4 4,5 5)", 0);
+	TDT(wkt, "LINESTRING(24 4,25 5)", 0);
+	TDT(wkt, "POINT(15 5)", 5);
+}
+
+/*
+** Check the tree maximum distance against lwgeom_maxdistance2d,
+** and that with a threshold it stops on the right side of it
+*/
+static void
+test_rect_tree_max_distance_tree_case(const char *wkt1, const char *wkt2)
+{
+	LWGEOM *lw1 = lwgeom_from_wkt(wkt1, LW_PARSER_CHECK_NONE);
+	LWGEOM *lw2 = lwgeom_from_wkt(wkt2, LW_PARSER_CHECK_NONE);
+	RECT_NODE *n1 = rect_tree_from_lwgeom(lw1);
+	RECT_NODE *n2 = rect_tree_from_lwgeom(lw2);
+	double expected = lwgeom_maxdistance2d(lw1, lw2);
+	double dist;
+
+	dist = rect_tree_max_distance_tree(n1, n2, 0.0);
+	CU_ASSERT_DOUBLE_EQUAL(dist, expected, 0.00001);
+	dist = rect_tree_max_distance_tree(n2, n1, 0.0);
+	CU_ASSERT_DOUBLE_EQUAL(dist, expected, 0.00001);
+	dist = rect_tree_max_distance_tree(n1, n2, expected / 2);
+	CU_ASSERT(dist > expected / 2);
+	dist = rect_tree_max_distance_tree(n1, n2, expected);
+	CU_ASSERT(dist <= expected);
+
+	rect_tree_free(n1);
+	rect_tree_free(n2);
+	lwgeom_free(lw1);
+	lwgeom_free(lw2);
+}
+
+static void
+test_rect_tree_max_distance_tree(void)
+{
+	test_rect_tree_max_distance_tree_case("POINT(0 0)", "POINT(3 4)");
+	test_rect_tree_max_distance_tree_case("POINT(0 0)", "MULTIPOINT(0 1.5,0 2,-7 2.5)");
+	test_rect_tree_max_distance_tree_case("LINESTRING(0 0,1 0)", "LINESTRING(0 1,1 1,5 3)");
+	test_rect_tree_max_distance_tree_case("LINESTRING(0 0,10 0)", "LINESTRING(4 0,5 0)");
+	test_rect_tree_max_distance_tree_case("POLYGON((0 0,0 10,10 10,10 0,0 0),(4 4,4 6,6 6,6 4,4 4))", "POINT(5 5)");
+	test_rect_tree_max_distance_tree_case("POLYGON((0 0,0 10,10 10,10 0,0 0))", "MULTILINESTRING((20 20,21 21),(-3 2,-4 -1))");
+	test_rect_tree_max_distance_tree_case(
+		"MULTIPOLYGON(((-123.35702791281 48.4232302445918,-123.35689654493 48.4237265810249,-123.354053908057 48.4234039978588,-123.35417179975 48.4229151379279,-123.354369811539 48.4220987102936,-123.355779071731 48.4222571534228,-123.357238860904 48.4224209369449,-123.35702791281 48.4232302445918)))",
+		"MULTIPOLYGON(((-123.353452578038 48.4259519079838,-123.35072012771 48.4256699150083,-123.347337809991 48.4254740864963,-123.347469111645 48.4245757659326,-123.349409235923 48.4246224093429,-123.349966167324 48.4246562342604,-123.353650661317 48.4250703224683,-123.353452578038 48.4259519079838)))");
 }
 
 
@@ -1436,6 +1485,250 @@ test_lwgeom_is_trajectory(void)
 	ASSERT_INT_EQUAL(ret, LW_TRUE); /* ok (corner case) */
 }
 
+/*
+** Long arrays go through the screened loops, which have to find the
+** same closest points as testing every pair of segments does.
+*/
+static POINTARRAY *
+wavy_ptarray(int npoints, double x0, double y0, double amp, int closed)
+{
+	POINTARRAY *pa = ptarray_construct(0, 0, npoints);
+	POINT4D p = {0, 0, 0, 0};
+	int i;
+
+	for (i = 0; i < npoints; i++)
+	{
+		double a = 2 * M_PI * i / (closed ? npoints - 1 : npoints);
+		if (closed)
+		{
+			p.x = x0 + (10 + amp * sin(7 * a)) * cos(a);
+			p.y = y0 + (10 + amp * sin(7 * a)) * sin(a);
+		}
+		else
+		{
+			p.x = x0 + 0.05 * i;
+			p.y = y0 + amp * sin(0.3 * i) + 0.01 * (i % 3);
+		}
+		ptarray_set_point4d(pa, i, &p);
+	}
+	if (closed)
+		ptarray_set_point4d(pa, npoints - 1, getPoint4d_cp(pa, 0));
+	return pa;
+}
+
+static void
+do_screened_distance_test(POINTARRAY *l1, POINTARRAY *l2, int fast)
+{
+	DISTPTS dl, ref;
+	uint32_t t, u;
+
+	lw_dist2d_distpts_init(&ref, DIST_MIN);
+	for (t = 1; t < l1->npoints && ref.distance > ref.tolerance; t++)
+		for (u = 1; u < l2->npoints && ref.distance > ref.tolerance; u++)
+		{
+			ref.twisted = 1;
+			lw_dist2d_seg_seg(getPoint2d_cp(l1, t - 1), getPoint2d_cp(l1, t),
+			                  getPoint2d_cp(l2, u - 1), getPoint2d_cp(l2, u), &ref);
+		}
+
+	lw_dist2d_distpts_init(&dl, DIST_MIN);
+	dl.twisted = 1;
+	CU_ASSERT(lw_dist2d_ptarray_ptarray(l1, l2, &dl));
+	CU_ASSERT_EQUAL(dl.distance, ref.distance);
+	CU_ASSERT_EQUAL(dl.p1.x, ref.p1.x);
+	CU_ASSERT_EQUAL(dl.p1.y, ref.p1.y);
+	CU_ASSERT_EQUAL(dl.p2.x, ref.p2.x);
+	CU_ASSERT_EQUAL(dl.p2.y, ref.p2.y);
+	CU_ASSERT_EQUAL(dl.twisted, ref.twisted);
+
+	if (fast)
+	{
+		GBOX box1, box2;
+		ptarray_calculate_gbox_cartesian(l1, &box1);
+		ptarray_calculate_gbox_cartesian(l2, &box2);
+		lw_dist2d_distpts_init(&dl, DIST_MIN);
+		dl.twisted = 1;
+		CU_ASSERT(lw_dist2d_fast_ptarray_ptarray(l1, l2, &dl, &box1, &box2));
+		CU_ASSERT_DOUBLE_EQUAL(dl.distance, ref.distance, 1e-12);
+	}
+}
+
+static void
+test_lw_dist2d_ptarray_ptarray_screened(void)
+{
+	POINTARRAY *l1, *l2;
+
+	/* Interleaved waves, brute force only */
+	l1 = wavy_ptarray(300, 0, 0, 1, LW_FALSE);
+	l2 = wavy_ptarray(250, 0.3, 0.7, 1.2, LW_FALSE);
+	do_screened_distance_test(l1, l2, LW_FALSE);
+	do_screened_distance_test(l2, l1, LW_FALSE);
+	ptarray_free(l2);
+
+	/* Apart, through the sorted projections as well */
+	l2 = wavy_ptarray(250, 20, 5, 1.2, LW_FALSE);
+	do_screened_distance_test(l1, l2, LW_TRUE);
+	do_screened_distance_test(l2, l1, LW_TRUE);
+	ptarray_free(l2);
+
+	/* Crossing lines are at zero */
+	l2 = wavy_ptarray(40, 3, 3, 0, LW_FALSE);
+	ptarray_set_point4d(l2, 0, getPoint4d_cp(l2, 39));
+	do_screened_distance_test(l1, l2, LW_FALSE);
+	ptarray_free(l2);
+	ptarray_free(l1);
+
+	/* Rings, which wrap around in the sorted projections */
+	l1 = wavy_ptarray(200, 0, 0, 1, LW_TRUE);
+	l2 = wavy_ptarray(180, 25, 3, 2, LW_TRUE);
+	do_screened_distance_test(l1, l2, LW_TRUE);
+	do_screened_distance_test(l2, l1, LW_TRUE);
+	ptarray_free(l2);
+	ptarray_free(l1);
+
+	/* Few points on one side, many on the other */
+	l1 = wavy_ptarray(5, 8, -4, 0.5, LW_FALSE);
+	l2 = wavy_ptarray(400, 0, 0, 2, LW_FALSE);
+	do_screened_distance_test(l1, l2, LW_TRUE);
+	do_screened_distance_test(l2, l1, LW_TRUE);
+	ptarray_free(l2);
+	ptarray_free(l1);
+}
+
+/*
+** The 3D tree distance and closest points against the brute force
+** ones of lwgeom_mindistance3d.
+*/
+static void
+do_rect3d_tree_distance_test(const LWGEOM *lw1, const LWGEOM *lw2)
+{
+	RECT3D_NODE *n1 = rect3d_tree_from_lwgeom(lw1);
+	RECT3D_NODE *n2 = rect3d_tree_from_lwgeom(lw2);
+	double d_brute = lwgeom_mindistance3d(lw1, lw2);
+	double d_tree, d;
+	POINT3DZ p1, p2;
+	LWGEOM *pt;
+
+	CU_ASSERT_FATAL(n1 != NULL);
+	CU_ASSERT_FATAL(n2 != NULL);
+
+	d_tree = rect3d_tree_distance_tree(n1, n2, 0.0, &p1, &p2);
+	CU_ASSERT_DOUBLE_EQUAL(d_tree, d_brute, 1e-9);
+
+	/* The closest points are on their own side, that far apart */
+	CU_ASSERT_DOUBLE_EQUAL(distance3d_pt_pt((POINT3D*)&p1, (POINT3D*)&p2), d_tree, 1e-9);
+	pt = (LWGEOM*)lwpoint_make3dz(0, p1.x, p1.y, p1.z);
+	CU_ASSERT_DOUBLE_EQUAL(lwgeom_mindistance3d(pt, lw1), 0.0, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(lwgeom_mindistance3d(pt, lw2), d_tree, 1e-9);
+	lwgeom_free(pt);
+	pt = (LWGEOM*)lwpoint_make3dz(0, p2.x, p2.y, p2.z);
+	CU_ASSERT_DOUBLE_EQUAL(lwgeom_mindistance3d(pt, lw2), 0.0, 1e-9);
+	lwgeom_free(pt);
+
+	/* Under a threshold, anything no further than it will do */
+	d = rect3d_tree_distance_tree(n1, n2, d_brute + 1, NULL, NULL);
+	CU_ASSERT(d <= d_brute + 1);
+	CU_ASSERT(d >= d_brute - 1e-9);
+
+	rect3d_tree_free(n1);
+	rect3d_tree_free(n2);
+}
+
+static void
+do_rect3d_tree_distance_wkt(const char *wkt1, const char *wkt2)
+{
+	LWGEOM *lw1 = lwgeom_from_wkt(wkt1, LW_PARSER_CHECK_NONE);
+	LWGEOM *lw2 = lwgeom_from_wkt(wkt2, LW_PARSER_CHECK_NONE);
+	do_rect3d_tree_distance_test(lw1, lw2);
+	do_rect3d_tree_distance_test(lw2, lw1);
+	lwgeom_free(lw1);
+	lwgeom_free(lw2);
+}
+
+static void
+test_rect3d_tree_distance_tree(void)
+{
+	const char *cube = "POLYHEDRALSURFACE Z(((0 0 0,0 1 0,1 1 0,1 0 0,0 0 0)),((0 0 1,1 0 1,1 1 1,0 1 1,0 0 1)),((0 0 0,1 0 0,1 0 1,0 0 1,0 0 0)),((0 1 0,0 1 1,1 1 1,1 1 0,0 1 0)),((0 0 0,0 0 1,0 1 1,0 1 0,0 0 0)),((1 0 0,1 1 0,1 1 1,1 0 1,1 0 0)))";
+	const char *holed = "POLYGON Z((0 0 0,10 0 0,10 10 5,0 10 5,0 0 0),(4 4 2,6 4 2,6 6 3,4 6 3,4 4 2))";
+	LWGEOM *lw1, *lw2;
+	LWCOLLECTION *col;
+	POINTARRAY *pa;
+	POINT4D p = {0, 0, 0, 0};
+	int i, j;
+
+	/* Points and lines */
+	do_rect3d_tree_distance_wkt("POINT Z(1 2 3)", "LINESTRING Z(0 0 0,5 5 5,10 0 0)");
+	do_rect3d_tree_distance_wkt("LINESTRING Z(0 0 0,1 1 1)", "LINESTRING Z(0 1 0,1 0 2)");
+	do_rect3d_tree_distance_wkt("MULTIPOINT Z(5 5 5,-1 -1 -1)", "LINESTRING Z(1 1 1,1 1 1)");
+
+	/* Over the inside of a tilted polygon, over its hole, and off it */
+	do_rect3d_tree_distance_wkt("POINT Z(2 2 9)", holed);
+	do_rect3d_tree_distance_wkt("POINT Z(5 5 9)", holed);
+	do_rect3d_tree_distance_wkt("POINT Z(15 5 9)", holed);
+
+	/* Through the polygon, through its hole, and along it */
+	do_rect3d_tree_distance_wkt("LINESTRING Z(2 2 -5,2 2 5)", holed);
+	do_rect3d_tree_distance_wkt("LINESTRING Z(5 5 -5,5 5 5)", holed);
+	do_rect3d_tree_distance_wkt("LINESTRING Z(1 1 8,9 1 8,9 9 12)", holed);
+
+	/* A vertical polygon, and one that doesn't define a plane */
+	do_rect3d_tree_distance_wkt("POINT Z(3 1 1)", "POLYGON Z((0 0 0,0 2 0,0 2 2,0 0 2,0 0 0))");
+	do_rect3d_tree_distance_wkt("POINT Z(3 1 1)", "POLYGON Z((0 0 0,1 1 1,2 2 2,0 0 0))");
+
+	/* Solids are surfaces */
+	do_rect3d_tree_distance_wkt("POINT Z(0.3 0.6 0.45)", cube);
+	do_rect3d_tree_distance_wkt("LINESTRING Z(2 2 2,3 -1 0.5)", cube);
+	do_rect3d_tree_distance_wkt(cube, "POLYGON Z((2 0 0.5,3 0 0.5,3 1 0.5,2 0 0.5))");
+	do_rect3d_tree_distance_wkt("GEOMETRYCOLLECTION(POINT Z(3 3 3),LINESTRING Z(-1 -1 5,-2 0 4))", cube);
+
+	/* A long 3D helix against a sloped grid of squares */
+	pa = ptarray_construct(1, 0, 500);
+	for (i = 0; i < 500; i++)
+	{
+		p.x = 10 + 8 * cos(i * 0.05);
+		p.y = 10 + 8 * sin(i * 0.05);
+		p.z = 2 + i * 0.01;
+		ptarray_set_point4d(pa, i, &p);
+	}
+	lw1 = (LWGEOM*)lwline_construct(0, NULL, pa);
+	col = lwcollection_construct_empty(MULTIPOLYGONTYPE, 0, 1, 0);
+	for (i = 0; i < 10; i++)
+	{
+		for (j = 0; j < 10; j++)
+		{
+			POINTARRAY **rings = lwalloc(sizeof(POINTARRAY*));
+			POINT4D q = {0, 0, 0, 0};
+			rings[0] = ptarray_construct_empty(1, 0, 5);
+			q.x = 2 * i; q.y = 2 * j; q.z = 0.1 * (i + j) * (i + j);
+			ptarray_append_point(rings[0], &q, LW_TRUE);
+			q.x += 1.5; q.z += 0.3;
+			ptarray_append_point(rings[0], &q, LW_TRUE);
+			q.y += 1.5; q.z += 0.3;
+			ptarray_append_point(rings[0], &q, LW_TRUE);
+			q.x -= 1.5; q.z -= 0.3;
+			ptarray_append_point(rings[0], &q, LW_TRUE);
+			ptarray_append_point(rings[0], getPoint4d_cp(rings[0], 0), LW_TRUE);
+			lwcollection_add_lwgeom(col, (LWGEOM*)lwpoly_construct(0, NULL, 1, rings));
+		}
+	}
+	lw2 = (LWGEOM*)col;
+	do_rect3d_tree_distance_test(lw1, lw2);
+	do_rect3d_tree_distance_test(lw2, lw1);
+	lwgeom_free(lw1);
+	lwgeom_free(lw2);
+
+	/* What the 3D distance doesn't measure, or stops short on */
+	lw1 = lwgeom_from_wkt("TIN Z(((0 0 0,0 1 0,1 0 0,0 0 0)))", LW_PARSER_CHECK_NONE);
+	CU_ASSERT(rect3d_tree_from_lwgeom(lw1) == NULL);
+	lwgeom_free(lw1);
+	lw1 = lwgeom_from_wkt("GEOMETRYCOLLECTION(POINT Z(1 1 1),LINESTRING EMPTY)", LW_PARSER_CHECK_NONE);
+	CU_ASSERT(rect3d_tree_from_lwgeom(lw1) == NULL);
+	lwgeom_free(lw1);
+	lw1 = lwgeom_from_wkt("CIRCULARSTRING Z(0 0 0,1 1 1,2 0 2)", LW_PARSER_CHECK_NONE);
+	CU_ASSERT(rect3d_tree_from_lwgeom(lw1) == NULL);
+	lwgeom_free(lw1);
+}
+
 /*
 ** Used by test harness to register the tests in this file.
 */
@@ -1458,4 +1751,7 @@ void measures_suite_setup(void)
 	PG_ADD_TEST(suite, test_lwgeom_tcpa);
 	PG_ADD_TEST(suite, test_lwgeom_is_trajectory);
 	PG_ADD_TEST(suite, test_rect_tree_distance_tree);
+	PG_ADD_TEST(suite, test_rect_tree_max_distance_tree);
+	PG_ADD_TEST(suite, test_lw_dist2d_ptarray_ptarray_screened);
+	PG_ADD_TEST(suite, test_rect3d_tree_distance_tree);
 }
@@ -67,6 +67,7 @@ extern void sfcgal_suite_setup(void);
 #endif
 extern void split_suite_setup(void);
 extern void stringbuffer_suite_setup(void);
+extern void transform_suite_setup(void);
 extern void tree_suite_setup(void);
 extern void triangulate_suite_setup(void);
 extern void varint_suite_setup(void);
@@ -120,6 +121,7 @@ PG_SuiteSetup setupfuncs[] =
 	split_suite_setup,
 	stringbuffer_suite_setup,
 	surface_suite_setup,
+	transform_suite_setup,
 	tree_suite_setup,
 	triangulate_suite_setup,
 	twkb_out_suite_setup,
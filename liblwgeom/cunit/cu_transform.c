@@ -0,0 +1,147 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * This is free software; you can redistribute and/or modify it under
+ * the terms of the GNU General Public Licence. See the COPYING file.
+ *
+ **********************************************************************/
+
+#include "CUnit/Basic.h"
+#include "cu_tester.h"
+
+#include "liblwgeom.h"
+#include "liblwgeom_internal.h"
+
+#define WGS84_PROJ4 "+proj=longlat +datum=WGS84 +no_defs"
+#define WEBMERC_PROJ4 "+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs"
+
+static void test_lwproj_smerc_kind(void)
+{
+	projPJ pj;
+	int kind;
+
+	pj = lwproj_from_string(WGS84_PROJ4);
+	kind = lwproj_smerc_kind(pj);
+	ASSERT_INT_EQUAL(kind, LW_SMERC_LONGLAT);
+	pj_free(pj);
+
+	pj = lwproj_from_string(WEBMERC_PROJ4);
+	kind = lwproj_smerc_kind(pj);
+	ASSERT_INT_EQUAL(kind, LW_SMERC_MERCATOR);
+	pj_free(pj);
+
+	/* World mercator is on the ellipsoid */
+	pj = lwproj_from_string("+proj=merc +lon_0=0 +k=1 +x_0=0 +y_0=0 +ellps=WGS84 +datum=WGS84 +units=m +no_defs");
+	kind = lwproj_smerc_kind(pj);
+	ASSERT_INT_EQUAL(kind, LW_SMERC_NONE);
+	pj_free(pj);
+
+	/* Without the null grid PROJ shifts datums */
+	pj = lwproj_from_string("+proj=merc +a=6378137 +b=6378137 +units=m +no_defs");
+	kind = lwproj_smerc_kind(pj);
+	ASSERT_INT_EQUAL(kind, LW_SMERC_NONE);
+	pj_free(pj);
+
+	pj = lwproj_from_string("+proj=merc +a=6378137 +b=6378137 +lon_0=10 +nadgrids=@null +no_defs");
+	kind = lwproj_smerc_kind(pj);
+	ASSERT_INT_EQUAL(kind, LW_SMERC_NONE);
+	pj_free(pj);
+
+	pj = lwproj_from_string("+proj=longlat +ellps=GRS80 +no_defs");
+	kind = lwproj_smerc_kind(pj);
+	ASSERT_INT_EQUAL(kind, LW_SMERC_NONE);
+	pj_free(pj);
+
+	pj = lwproj_from_string("+proj=longlat +ellps=WGS84 +towgs84=1,2,3 +no_defs");
+	kind = lwproj_smerc_kind(pj);
+	ASSERT_INT_EQUAL(kind, LW_SMERC_NONE);
+	pj_free(pj);
+}
+
+/*
+** Transform wkt both through PROJ and with the built-in formulas,
+** and check every ordinate agrees within 1e-9
+*/
+static void do_smerc_test(const char *wkt, int forward)
+{
+	projPJ pj_ll = lwproj_from_string(WGS84_PROJ4);
+	projPJ pj_merc = lwproj_from_string(WEBMERC_PROJ4);
+	projPJ inpj = forward ? pj_ll : pj_merc;
+	projPJ outpj = forward ? pj_merc : pj_ll;
+	LWGEOM *g_proj = lwgeom_from_wkt(wkt, LW_PARSER_CHECK_NONE);
+	LWGEOM *g_smerc = lwgeom_from_wkt(wkt, LW_PARSER_CHECK_NONE);
+	LWPOINTITERATOR *it_proj, *it_smerc;
+	POINT4D p_proj, p_smerc;
+	int rv;
+
+	CU_ASSERT_FATAL(g_proj != NULL);
+	rv = lwgeom_transform(g_proj, inpj, outpj);
+	ASSERT_INT_EQUAL(rv, LW_SUCCESS);
+	rv = lwgeom_transform_smerc(g_smerc, inpj, outpj, forward);
+	ASSERT_INT_EQUAL(rv, LW_SUCCESS);
+
+	it_proj = lwpointiterator_create(g_proj);
+	it_smerc = lwpointiterator_create(g_smerc);
+	while ( lwpointiterator_next(it_proj, &p_proj) )
+	{
+		CU_ASSERT_FATAL(lwpointiterator_next(it_smerc, &p_smerc));
+		ASSERT_POINT4D_EQUAL(p_smerc, p_proj, 1e-9);
+	}
+	CU_ASSERT_FALSE(lwpointiterator_has_next(it_smerc));
+
+	lwpointiterator_destroy(it_proj);
+	lwpointiterator_destroy(it_smerc);
+	lwgeom_free(g_proj);
+	lwgeom_free(g_smerc);
+	pj_free(pj_ll);
+	pj_free(pj_merc);
+}
+
+static void test_lwgeom_transform_smerc(void)
+{
+	LWGEOM *g;
+	projPJ pj_ll = lwproj_from_string(WGS84_PROJ4);
+	projPJ pj_merc = lwproj_from_string(WEBMERC_PROJ4);
+	POINT4D p;
+
+	/* Known values */
+	g = lwgeom_from_wkt("POINT(10 50)", LW_PARSER_CHECK_NONE);
+	lwgeom_transform_smerc(g, pj_ll, pj_merc, LW_TRUE);
+	lwpoint_getPoint4d_p((LWPOINT*)g, &p);
+	CU_ASSERT_DOUBLE_EQUAL(p.x, 1113194.9079327357, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(p.y, 6446275.841017158, 1e-9);
+	lwgeom_transform_smerc(g, pj_merc, pj_ll, LW_FALSE);
+	lwpoint_getPoint4d_p((LWPOINT*)g, &p);
+	CU_ASSERT_DOUBLE_EQUAL(p.x, 10, 1e-9);
+	CU_ASSERT_DOUBLE_EQUAL(p.y, 50, 1e-9);
+	lwgeom_free(g);
+	pj_free(pj_ll);
+	pj_free(pj_merc);
+
+	/* Same as PROJ, forward */
+	do_smerc_test("POINT(0 0)", LW_TRUE);
+	do_smerc_test("LINESTRING(-180 -85.0511287798066,180 85.0511287798066)", LW_TRUE);
+	do_smerc_test("POLYGON Z((-73.98 40.75 10,2.35 48.86 20,151.2 -33.87 30,-73.98 40.75 10))", LW_TRUE);
+	/* Longitudes past the antimeridian wrap */
+	do_smerc_test("MULTIPOINT M(190 10 1,-200 -10 2,540 0 3)", LW_TRUE);
+	do_smerc_test("GEOMETRYCOLLECTION(POINT(1 2),LINESTRING EMPTY,LINESTRING(3 4,5 6))", LW_TRUE);
+
+	/* Same as PROJ, inverse */
+	do_smerc_test("POINT(0 0)", LW_FALSE);
+	do_smerc_test("LINESTRING(-20037508.342789244 -20037508.342789244,20037508.342789244 20037508.342789244)", LW_FALSE);
+	do_smerc_test("MULTIPOINT(30000000 100,-30000000 -100,1113194.9079327357 6446275.841017158)", LW_FALSE);
+}
+
+
+/*
+** Used by test harness to register the tests in this file.
+*/
+void transform_suite_setup(void);
+void transform_suite_setup(void)
+{
+	CU_pSuite suite = CU_add_suite("transform", NULL, NULL);
+	PG_ADD_TEST(suite, test_lwproj_smerc_kind);
+	PG_ADD_TEST(suite, test_lwgeom_transform_smerc);
+}
@@ -686,21 +686,15 @@ int crosses_dateline(const GEOGRAPHIC_POINT *s, const GEOGRAPHIC_POINT *e)
 }
 
 /**
-* Returns -1 if the point is to the left of the plane formed
-* by the edge, 1 if the point is to the right, and 0 if the
-* point is on the plane.
+* Side test of edge_point_side() on the unit normal of the
+* edge plane and the unit vector of the point.
 */
 static int
-edge_point_side(const GEOGRAPHIC_EDGE *e, const GEOGRAPHIC_POINT *p)
+cart_point_side(const POINT3D *normal, const POINT3D *pt)
 {
-	POINT3D normal, pt;
 	double w;
-	/* Normal to the plane defined by e */
-	robust_cross_product(&(e->start), &(e->end), &normal);
-	normalize(&normal);
-	geog2cart(p, &pt);
 	/* We expect the dot product of with normal with any vector in the plane to be zero */
-	w = dot_product(&normal, &pt);
+	w = dot_product(normal, pt);
 	LWDEBUGF(4,"dot product %.9g",w);
 	if ( FP_IS_ZERO(w) )
 	{
@@ -714,6 +708,22 @@ edge_point_side(const GEOGRAPHIC_EDGE *e, const GEOGRAPHIC_POINT *p)
 		return 1;
 }
 
+/**
+* Returns -1 if the point is to the left of the plane formed
+* by the edge, 1 if the point is to the right, and 0 if the
+* point is on the plane.
+*/
+static int
+edge_point_side(const GEOGRAPHIC_EDGE *e, const GEOGRAPHIC_POINT *p)
+{
+	POINT3D normal, pt;
+	/* Normal to the plane defined by e */
+	robust_cross_product(&(e->start), &(e->end), &normal);
+	normalize(&normal);
+	geog2cart(p, &pt);
+	return cart_point_side(&normal, &pt);
+}
+
 /**
 * Returns the angle in radians at point B of the triangle formed by A-B-C
 */
@@ -782,27 +792,25 @@ int edge_point_on_plane(const GEOGRAPHIC_EDGE *e, const GEOGRAPHIC_POINT *p)
 }
 
 /**
-* Returns true if the point p is inside the cone defined by the
-* two ends of the edge e.
+* Cone test of edge_point_in_cone() on the unit vectors of the edge
+* ends vs, ve and of the point vp.
 */
-int edge_point_in_cone(const GEOGRAPHIC_EDGE *e, const GEOGRAPHIC_POINT *p)
+static int
+cart_point_in_cone(const POINT3D *vs, const POINT3D *ve, const POINT3D *vp)
 {
-	POINT3D vcp, vs, ve, vp;
+	POINT3D vcp;
 	double vs_dot_vcp, vp_dot_vcp;
-	geog2cart(&(e->start), &vs);
-	geog2cart(&(e->end), &ve);
 	/* Antipodal case, everything is inside. */
-	if ( vs.x == -1.0 * ve.x && vs.y == -1.0 * ve.y && vs.z == -1.0 * ve.z )
+	if ( vs->x == -1.0 * ve->x && vs->y == -1.0 * ve->y && vs->z == -1.0 * ve->z )
 		return LW_TRUE;
-	geog2cart(p, &vp);
 	/* The normalized sum bisects the angle between start and end. */
-	vector_sum(&vs, &ve, &vcp);
+	vector_sum(vs, ve, &vcp);
 	normalize(&vcp);
 	/* The projection of start onto the center defines the minimum similarity */
-	vs_dot_vcp = dot_product(&vs, &vcp);
+	vs_dot_vcp = dot_product(vs, &vcp);
 	LWDEBUGF(4,"vs_dot_vcp %.19g",vs_dot_vcp);
 	/* The projection of candidate p onto the center */
-	vp_dot_vcp = dot_product(&vp, &vcp);
+	vp_dot_vcp = dot_product(vp, &vcp);
 	LWDEBUGF(4,"vp_dot_vcp %.19g",vp_dot_vcp);
 	/* If p is more similar than start then p is inside the cone */
 	LWDEBUGF(4,"fabs(vp_dot_vcp - vs_dot_vcp) %.39g",fabs(vp_dot_vcp - vs_dot_vcp));
@@ -829,6 +837,19 @@ int edge_point_in_cone(const GEOGRAPHIC_EDGE *e, const GEOGRAPHIC_POINT *p)
 	return LW_FALSE;
 }
 
+/**
+* Returns true if the point p is inside the cone defined by the
+* two ends of the edge e.
+*/
+int edge_point_in_cone(const GEOGRAPHIC_EDGE *e, const GEOGRAPHIC_POINT *p)
+{
+	POINT3D vs, ve, vp;
+	geog2cart(&(e->start), &vs);
+	geog2cart(&(e->end), &ve);
+	geog2cart(p, &vp);
+	return cart_point_in_cone(&vs, &ve, &vp);
+}
+
 /**
 * True if the longitude of p is within the range of the longitude of the ends of e
 */
@@ -1217,8 +1238,34 @@ int edge_intersection(const GEOGRAPHIC_EDGE *e1, const GEOGRAPHIC_EDGE *e2, GEOG
 
 double edge_distance_to_point(const GEOGRAPHIC_EDGE *e, const GEOGRAPHIC_POINT *gp, GEOGRAPHIC_POINT *closest)
 {
+	CART_EDGE ce;
+	POINT3D p;
+
+	/* Zero length edge, */
+	if ( geographic_point_equals(&(e->start), &(e->end)) )
+	{
+		*closest = e->start;
+		return sphere_distance(&(e->start), gp);
+	}
+
+	ce.e = *e;
+	geog2cart(&(e->start), &(ce.start));
+	geog2cart(&(e->end), &(ce.end));
+	robust_cross_product(&(e->start), &(e->end), &(ce.pole));
+	normalize(&(ce.pole));
+	geog2cart(gp, &p);
+	return cart_edge_distance_to_point(&ce, gp, &p, closest);
+}
+
+/**
+* As edge_distance_to_point(), with the unit vectors of the edge
+* ends and the edge pole taken from ce and that of gp given as p.
+*/
+double cart_edge_distance_to_point(const CART_EDGE *ce, const GEOGRAPHIC_POINT *gp, const POINT3D *p, GEOGRAPHIC_POINT *closest)
+{
+	const GEOGRAPHIC_EDGE *e = &(ce->e);
 	double d1 = 1000000000.0, d2, d3, d_nearest;
-	POINT3D n, p, k;
+	POINT3D n, k, pk;
 	GEOGRAPHIC_POINT gk, g_nearest;
 
 	/* Zero length edge, */
@@ -1228,14 +1275,14 @@ double edge_distance_to_point(const GEOGRAPHIC_EDGE *e, const GEOGRAPHIC_POINT *
 		return sphere_distance(&(e->start), gp);
 	}
 
-	robust_cross_product(&(e->start), &(e->end), &n);
-	normalize(&n);
-	geog2cart(gp, &p);
-	vector_scale(&n, dot_product(&p, &n));
-	vector_difference(&p, &n, &k);
+	n = ce->pole;
+	vector_scale(&n, dot_product(p, &n));
+	vector_difference(p, &n, &k);
 	normalize(&k);
 	cart2geog(&k, &gk);
-	if ( edge_contains_point(e, &gk) )
+	/* Same test as edge_contains_point() */
+	geog2cart(&gk, &pk);
+	if ( cart_point_in_cone(&(ce->start), &(ce->end), &pk) && cart_point_side(&(ce->pole), &pk) == 0 )
 	{
 		d1 = sphere_distance(gp, &gk);
 	}
@@ -1306,6 +1353,50 @@ double edge_distance_to_edge(const GEOGRAPHIC_EDGE *e1, const GEOGRAPHIC_EDGE *e
 	return d;
 }
 
+/**
+* As edge_distance_to_edge(), on two prepared edges.
+* IMPORTANT: this test does not check for edge intersection either.
+*/
+double cart_edge_distance_to_edge(const CART_EDGE *ce1, const CART_EDGE *ce2, GEOGRAPHIC_POINT *closest1, GEOGRAPHIC_POINT *closest2)
+{
+	double d;
+	GEOGRAPHIC_POINT gcp1s, gcp1e, gcp2s, gcp2e, c1, c2;
+	double d1s = cart_edge_distance_to_point(ce1, &(ce2->e.start), &(ce2->start), &gcp1s);
+	double d1e = cart_edge_distance_to_point(ce1, &(ce2->e.end), &(ce2->end), &gcp1e);
+	double d2s = cart_edge_distance_to_point(ce2, &(ce1->e.start), &(ce1->start), &gcp2s);
+	double d2e = cart_edge_distance_to_point(ce2, &(ce1->e.end), &(ce1->end), &gcp2e);
+
+	d = d1s;
+	c1 = gcp1s;
+	c2 = ce2->e.start;
+
+	if ( d1e < d )
+	{
+		d = d1e;
+		c1 = gcp1e;
+		c2 = ce2->e.end;
+	}
+
+	if ( d2s < d )
+	{
+		d = d2s;
+		c1 = ce1->e.start;
+		c2 = gcp2s;
+	}
+
+	if ( d2e < d )
+	{
+		d = d2e;
+		c1 = ce1->e.end;
+		c2 = gcp2e;
+	}
+
+	if ( closest1 ) *closest1 = c1;
+	if ( closest2 ) *closest2 = c2;
+
+	return d;
+}
+
 
 /**
 * Given a starting location r, a distance and an azimuth
@@ -3533,23 +3624,20 @@ dot_product_side(const POINT3D *p, const POINT3D *q)
 }
 
 /**
-* Returns non-zero if edges A and B interact. The type of interaction is given in the
-* return value with the bitmask elements defined above.
+* Body of edge_intersects(), given the unit normals AN and BN
+* to the A-plane and B-plane.
 */
-uint32_t
-edge_intersects(const POINT3D *A1, const POINT3D *A2, const POINT3D *B1, const POINT3D *B2)
+static uint32_t
+edge_intersects_normals(const POINT3D *A1, const POINT3D *A2, const POINT3D *AN,
+                        const POINT3D *B1, const POINT3D *B2, const POINT3D *BN)
 {
-	POINT3D AN, BN, VN;  /* Normals to plane A and plane B */
+	POINT3D VN;
 	double ab_dot;
 	int a1_side, a2_side, b1_side, b2_side;
 	int rv = PIR_NO_INTERACT;
 
-	/* Normals to the A-plane and B-plane */
-	unit_normal(A1, A2, &AN);
-	unit_normal(B1, B2, &BN);
-
 	/* Are A-plane and B-plane basically the same? */
-	ab_dot = dot_product(&AN, &BN);
+	ab_dot = dot_product(AN, BN);
 	if ( FP_EQUALS(fabs(ab_dot), 1.0) )
 	{
 		/* Co-linear case */
@@ -3564,10 +3652,10 @@ edge_intersects(const POINT3D *A1, const POINT3D *A2, const POINT3D *B1, const P
 
 	/* What side of plane-A and plane-B do the end points */
 	/* of A and B fall? */
-	a1_side = dot_product_side(&BN, A1);
-	a2_side = dot_product_side(&BN, A2);
-	b1_side = dot_product_side(&AN, B1);
-	b2_side = dot_product_side(&AN, B2);
+	a1_side = dot_product_side(BN, A1);
+	a2_side = dot_product_side(BN, A2);
+	b1_side = dot_product_side(AN, B1);
+	b2_side = dot_product_side(AN, B2);
 
 	/* Both ends of A on the same side of plane B. */
 	if ( a1_side == a2_side && a1_side != 0 )
@@ -3588,7 +3676,7 @@ edge_intersects(const POINT3D *A1, const POINT3D *A2, const POINT3D *B1, const P
 	     b1_side != b2_side && (b1_side + b2_side) == 0 )
 	{
 		/* Have to check if intersection point is inside both arcs */
-		unit_normal(&AN, &BN, &VN);
+		unit_normal(AN, BN, &VN);
 		if ( point_in_cone(A1, A2, &VN) && point_in_cone(B1, B2, &VN) )
 		{
 			return PIR_INTERSECTS;
@@ -3634,6 +3722,48 @@ edge_intersects(const POINT3D *A1, const POINT3D *A2, const POINT3D *B1, const P
 	return rv;
 }
 
+/**
+* Returns non-zero if edges A and B interact. The type of interaction is given in the
+* return value with the bitmask elements defined above.
+*/
+uint32_t
+edge_intersects(const POINT3D *A1, const POINT3D *A2, const POINT3D *B1, const POINT3D *B2)
+{
+	POINT3D AN, BN;  /* Normals to plane A and plane B */
+
+	/* Normals to the A-plane and B-plane */
+	unit_normal(A1, A2, &AN);
+	unit_normal(B1, B2, &BN);
+
+	return edge_intersects_normals(A1, A2, &AN, B1, B2, &BN);
+}
+
+/**
+* As edge_intersects(), on two prepared edges.
+*/
+uint32_t
+cart_edge_intersects(const CART_EDGE *a, const CART_EDGE *b)
+{
+	return edge_intersects_normals(&(a->start), &(a->end), &(a->normal),
+	                               &(b->start), &(b->end), &(b->normal));
+}
+
+/**
+* Prepare the edge from p1 to p2, given in degrees, for repeated
+* tests with cart_edge_intersects() and cart_edge_distance_to_*().
+*/
+void
+cart_edge_init(const POINT2D *p1, const POINT2D *p2, CART_EDGE *ce)
+{
+	geographic_point_init(p1->x, p1->y, &(ce->e.start));
+	geographic_point_init(p2->x, p2->y, &(ce->e.end));
+	geog2cart(&(ce->e.start), &(ce->start));
+	geog2cart(&(ce->e.end), &(ce->end));
+	unit_normal(&(ce->start), &(ce->end), &(ce->normal));
+	robust_cross_product(&(ce->e.start), &(ce->e.end), &(ce->pole));
+	normalize(&(ce->pole));
+}
+
 /**
 * This routine returns LW_TRUE if the stabline joining the pt_outside and pt_to_test
 * crosses the ring an odd number of times, or if the pt_to_test is on the ring boundary itself,
@@ -3644,8 +3774,8 @@ edge_intersects(const POINT3D *A1, const POINT3D *A2, const POINT3D *B1, const P
 */
 int ptarray_contains_point_sphere(const POINTARRAY *pa, const POINT2D *pt_outside, const POINT2D *pt_to_test)
 {
-	POINT3D S1, S2; /* Stab line end points */
-	POINT3D E1, E2; /* Edge end points (3-space) */
+	POINT3D S1, S2, SN; /* Stab line end points and normal */
+	POINT3D E1, E2, EN; /* Edge end points (3-space) and normal */
 	POINT2D p; /* Edge end points (lon/lat) */
 	uint32_t count = 0, i, inter;
 
@@ -3653,9 +3783,10 @@ int ptarray_contains_point_sphere(const POINTARRAY *pa, const POINT2D *pt_outsid
 	if ( ! pa || pa->npoints < 4 )
 		return LW_FALSE;
 
-	/* Set up our stab line */
+	/* Set up our stab line, its plane is the same for every edge */
 	ll2cart(pt_to_test, &S1);
 	ll2cart(pt_outside, &S2);
+	unit_normal(&S1, &S2, &SN);
 
 	/* Initialize first point */
 	getPoint2d_p(pa, 0, &p);
@@ -3684,7 +3815,8 @@ int ptarray_contains_point_sphere(const POINTARRAY *pa, const POINT2D *pt_outsid
 		}
 
 		/* Calculate relationship between stab line and edge */
-		inter = edge_intersects(&S1, &S2, &E1, &E2);
+		unit_normal(&E1, &E2, &EN);
+		inter = edge_intersects_normals(&S1, &S2, &SN, &E1, &E2, &EN);
 
 		/* We have some kind of interaction... */
 		if ( inter & PIR_INTERSECTS )
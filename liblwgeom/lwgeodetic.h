@@ -64,6 +64,21 @@ typedef struct
 	GEOGRAPHIC_POINT end;
 } GEOGRAPHIC_EDGE;
 
+/**
+* Great circle segment with its unit sphere vectors worked out once,
+* for edges that get tested over and over (tree leaves, stab lines).
+* normal is the unit_normal() edge_intersects() uses, pole the
+* normalized robust_cross_product() the distance functions use.
+*/
+typedef struct
+{
+	GEOGRAPHIC_EDGE e;
+	POINT3D start;
+	POINT3D end;
+	POINT3D normal;
+	POINT3D pole;
+} CART_EDGE;
+
 /**
 * Holder for sorting points in distance algorithm
 */
@@ -116,6 +131,10 @@ int edge_intersection(const GEOGRAPHIC_EDGE *e1, const GEOGRAPHIC_EDGE *e2, GEOG
 uint32_t edge_intersects(const POINT3D *A1, const POINT3D *A2, const POINT3D *B1, const POINT3D *B2);
 double edge_distance_to_point(const GEOGRAPHIC_EDGE *e, const GEOGRAPHIC_POINT *gp, GEOGRAPHIC_POINT *closest);
 double edge_distance_to_edge(const GEOGRAPHIC_EDGE *e1, const GEOGRAPHIC_EDGE *e2, GEOGRAPHIC_POINT *closest1, GEOGRAPHIC_POINT *closest2);
+void cart_edge_init(const POINT2D *p1, const POINT2D *p2, CART_EDGE *ce);
+uint32_t cart_edge_intersects(const CART_EDGE *a, const CART_EDGE *b);
+double cart_edge_distance_to_point(const CART_EDGE *ce, const GEOGRAPHIC_POINT *gp, const POINT3D *p, GEOGRAPHIC_POINT *closest);
+double cart_edge_distance_to_edge(const CART_EDGE *ce1, const CART_EDGE *ce2, GEOGRAPHIC_POINT *closest1, GEOGRAPHIC_POINT *closest2);
 void geographic_point_init(double lon, double lat, GEOGRAPHIC_POINT *g);
 int ptarray_contains_point_sphere(const POINTARRAY *pa, const POINT2D *pt_outside, const POINT2D *pt_to_test);
 int lwpoly_covers_point2d(const LWPOLY *poly, const POINT2D *pt_to_test);
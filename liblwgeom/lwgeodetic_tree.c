@@ -69,19 +69,19 @@ static CIRC_NODE*
 circ_node_leaf_new(const POINTARRAY* pa, int i)
 {
 	POINT2D *p1, *p2;
-	POINT3D q1, q2, c;
-	GEOGRAPHIC_POINT g1, g2, gc;
+	POINT3D c;
+	GEOGRAPHIC_POINT gc;
+	CART_EDGE edge;
 	CIRC_NODE *node;
 	double diameter;
 
 	p1 = (POINT2D*)getPoint_internal(pa, i);
 	p2 = (POINT2D*)getPoint_internal(pa, i+1);
-	geographic_point_init(p1->x, p1->y, &g1);
-	geographic_point_init(p2->x, p2->y, &g2);
+	cart_edge_init(p1, p2, &edge);
 
 	LWDEBUGF(3,"edge #%d (%g %g, %g %g)", i, p1->x, p1->y, p2->x, p2->y);
 
-	diameter = sphere_distance(&g1, &g2);
+	diameter = sphere_distance(&(edge.e.start), &(edge.e.end));
 
 	/* Zero length edge, doesn't get a node */
 	if ( FP_EQUALS(diameter, 0.0) )
@@ -91,14 +91,14 @@ circ_node_leaf_new(const POINTARRAY* pa, int i)
 	node = lwalloc(sizeof(CIRC_NODE));
 	node->p1 = p1;
 	node->p2 = p2;
+	node->edge = edge;
 
-	/* Convert ends to X/Y/Z, sum, and normalize to get mid-point */
-	geog2cart(&g1, &q1);
-	geog2cart(&g2, &q2);
-	vector_sum(&q1, &q2, &c);
+	/* Sum the X/Y/Z ends and normalize to get mid-point */
+	vector_sum(&(edge.start), &(edge.end), &c);
 	normalize(&c);
 	cart2geog(&c, &gc);
 	node->center = gc;
+	geog2cart(&gc, &(node->center3d));
 	node->radius = diameter / 2.0;
 
 	LWDEBUGF(3,"edge #%d CENTER(%g %g) RADIUS=%g", i, gc.lon, gc.lat, node->radius);
@@ -124,7 +124,9 @@ circ_node_leaf_point_new(const POINTARRAY* pa)
 {
 	CIRC_NODE* tree = lwalloc(sizeof(CIRC_NODE));
 	tree->p1 = tree->p2 = (POINT2D*)getPoint_internal(pa, 0);
-	geographic_point_init(tree->p1->x, tree->p1->y, &(tree->center));
+	cart_edge_init(tree->p1, tree->p2, &(tree->edge));
+	tree->center = tree->edge.e.start;
+	tree->center3d = tree->edge.start;
 	tree->radius = 0.0;
 	tree->nodes = NULL;
 	tree->num_nodes = 0;
@@ -338,6 +340,7 @@ circ_node_internal_new(CIRC_NODE** c, uint32_t num_nodes)
 	node->p1 = NULL;
 	node->p2 = NULL;
 	node->center = new_center;
+	geog2cart(&new_center, &(node->center3d));
 	node->radius = new_radius;
 	node->num_nodes = num_nodes;
 	node->nodes = c;
@@ -487,34 +490,22 @@ int circ_tree_get_point_outside(const CIRC_NODE* node, POINT2D* pt)
 
 
 /**
-* Walk the tree and count intersections between the stab line and the edges.
-* odd => containment, even => no containment.
-* KNOWN PROBLEM: Grazings (think of a sharp point, just touching the
-*   stabline) will be counted for one, which will throw off the count.
+* Crossing number of the prepared stab line against the edges under node.
 */
-int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POINT2D* pt_outside, int* on_boundary)
+static int
+circ_tree_contains_point_cart(const CIRC_NODE* node, const CART_EDGE* stab_edge)
 {
 	GEOGRAPHIC_POINT closest;
-	GEOGRAPHIC_EDGE stab_edge, edge;
-	POINT3D S1, S2, E1, E2;
 	double d;
 	uint32_t i, c;
 
-	/* Construct a stabline edge from our "inside" to our known outside point */
-	geographic_point_init(pt->x, pt->y, &(stab_edge.start));
-	geographic_point_init(pt_outside->x, pt_outside->y, &(stab_edge.end));
-	geog2cart(&(stab_edge.start), &S1);
-	geog2cart(&(stab_edge.end), &S2);
-
-	LWDEBUG(3, "entered");
-
 	/*
 	* If the stabline doesn't cross within the radius of a node, there's no
 	* way it can cross.
 	*/
 
 	LWDEBUGF(3, "working on node %p, edge_num %d, radius %g, center POINT(%g %g)", node, node->edge_num, node->radius, rad2deg(node->center.lon), rad2deg(node->center.lat));
-	d = edge_distance_to_point(&stab_edge, &(node->center), &closest);
+	d = cart_edge_distance_to_point(stab_edge, &(node->center), &(node->center3d), &closest);
 	LWDEBUGF(3, "edge_distance_to_point=%g, node_radius=%g", d, node->radius);
 	if ( FP_LTEQ(d, node->radius) )
 	{
@@ -525,12 +516,8 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 		{
 			int inter;
 			LWDEBUGF(3, "leaf node calculation (edge %d)", node->edge_num);
-			geographic_point_init(node->p1->x, node->p1->y, &(edge.start));
-			geographic_point_init(node->p2->x, node->p2->y, &(edge.end));
-			geog2cart(&(edge.start), &E1);
-			geog2cart(&(edge.end), &E2);
 
-			inter = edge_intersects(&S1, &S2, &E1, &E2);
+			inter = cart_edge_intersects(stab_edge, &(node->edge));
 
 			if ( inter & PIR_INTERSECTS )
 			{
@@ -557,8 +544,8 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 			for ( i = 0; i < node->num_nodes; i++ )
 			{
 				LWDEBUG(3,"internal node calculation");
-				LWDEBUGF(3," calling circ_tree_contains_point on child %d!", i);
-				c += circ_tree_contains_point(node->nodes[i], pt, pt_outside, on_boundary);
+				LWDEBUGF(3," calling circ_tree_contains_point_cart on child %d!", i);
+				c += circ_tree_contains_point_cart(node->nodes[i], stab_edge);
 			}
 			return c % 2;
 		}
@@ -571,6 +558,24 @@ int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POI
 	return 0;
 }
 
+/**
+* Walk the tree and count intersections between the stab line and the edges.
+* odd => containment, even => no containment.
+* KNOWN PROBLEM: Grazings (think of a sharp point, just touching the
+*   stabline) will be counted for one, which will throw off the count.
+*/
+int circ_tree_contains_point(const CIRC_NODE* node, const POINT2D* pt, const POINT2D* pt_outside, int* on_boundary)
+{
+	CART_EDGE stab_edge;
+
+	LWDEBUG(3, "entered");
+
+	/* Construct a stabline edge from our "inside" to our known outside point */
+	cart_edge_init(pt, pt_outside, &stab_edge);
+
+	return circ_tree_contains_point_cart(node, &stab_edge);
+}
+
 static double
 circ_node_min_distance(const CIRC_NODE* n1, const CIRC_NODE* n2)
 {
@@ -731,60 +736,40 @@ circ_tree_distance_tree_internal(const CIRC_NODE* n1, const CIRC_NODE* n2, doubl
 		/* One of the nodes is a point */
 		if ( n1->p1 == n1->p2 || n2->p1 == n2->p2 )
 		{
-			GEOGRAPHIC_EDGE e;
-			GEOGRAPHIC_POINT gp1, gp2;
-
 			/* Both nodes are points! */
 			if ( n1->p1 == n1->p2 && n2->p1 == n2->p2 )
 			{
-				geographic_point_init(n1->p1->x, n1->p1->y, &gp1);
-				geographic_point_init(n2->p1->x, n2->p1->y, &gp2);
-				close1 = gp1; close2 = gp2;
-				d = sphere_distance(&gp1, &gp2);
+				close1 = n1->edge.e.start;
+				close2 = n2->edge.e.start;
+				d = sphere_distance(&close1, &close2);
 			}
 			/* Node 1 is a point */
 			else if ( n1->p1 == n1->p2 )
 			{
-				geographic_point_init(n1->p1->x, n1->p1->y, &gp1);
-				geographic_point_init(n2->p1->x, n2->p1->y, &(e.start));
-				geographic_point_init(n2->p2->x, n2->p2->y, &(e.end));
-				close1 = gp1;
-				d = edge_distance_to_point(&e, &gp1, &close2);
+				close1 = n1->edge.e.start;
+				d = cart_edge_distance_to_point(&(n2->edge), &close1, &(n1->edge.start), &close2);
 			}
 			/* Node 2 is a point */
 			else
 			{
-				geographic_point_init(n2->p1->x, n2->p1->y, &gp1);
-				geographic_point_init(n1->p1->x, n1->p1->y, &(e.start));
-				geographic_point_init(n1->p2->x, n1->p2->y, &(e.end));
-				close1 = gp1;
-				d = edge_distance_to_point(&e, &gp1, &close2);
+				close1 = n2->edge.e.start;
+				d = cart_edge_distance_to_point(&(n1->edge), &close1, &(n2->edge.start), &close2);
 			}
 			LWDEBUGF(4, "  got distance %g", d);
 		}
 		/* Both nodes are edges */
 		else
 		{
-			GEOGRAPHIC_EDGE e1, e2;
 			GEOGRAPHIC_POINT g;
-			POINT3D A1, A2, B1, B2;
-			geographic_point_init(n1->p1->x, n1->p1->y, &(e1.start));
-			geographic_point_init(n1->p2->x, n1->p2->y, &(e1.end));
-			geographic_point_init(n2->p1->x, n2->p1->y, &(e2.start));
-			geographic_point_init(n2->p2->x, n2->p2->y, &(e2.end));
-			geog2cart(&(e1.start), &A1);
-			geog2cart(&(e1.end), &A2);
-			geog2cart(&(e2.start), &B1);
-			geog2cart(&(e2.end), &B2);
-			if ( edge_intersects(&A1, &A2, &B1, &B2) )
+			if ( cart_edge_intersects(&(n1->edge), &(n2->edge)) )
 			{
 				d = 0.0;
-				edge_intersection(&e1, &e2, &g);
+				edge_intersection(&(n1->edge.e), &(n2->edge.e), &g);
 				close1 = close2 = g;
 			}
 			else
 			{
-				d = edge_distance_to_edge(&e1, &e2, &close1, &close2);
+				d = cart_edge_distance_to_edge(&(n1->edge), &(n2->edge), &close1, &close2);
 			}
 			LWDEBUGF(4, "edge_distance_to_edge returned %g", d);
 		}
@@ -32,10 +32,13 @@
 
 /**
 * Note that p1 and p2 are pointers into an independent POINTARRAY, do not free them.
+* Leaves also keep their edge from p1 to p2 ready on the unit sphere, and every
+* node its center, so the tree walks don't redo the trigonometry on each visit.
 */
 typedef struct circ_node
 {
 	GEOGRAPHIC_POINT center;
+	POINT3D center3d;
 	double radius;
 	uint32_t num_nodes;
 	struct circ_node** nodes;
@@ -45,6 +48,7 @@ typedef struct circ_node
 	POINT2D pt_outside;
 	POINT2D* p1;
 	POINT2D* p2;
+	CART_EDGE edge;
 } CIRC_NODE;
 
 void circ_tree_print(const CIRC_NODE* node, int depth);
@@ -24,6 +24,7 @@
  *
  **********************************************************************/
 
+#include "../postgis_config.h"
 #include "lwgeom_geos.h"
 #include "liblwgeom.h"
 #include "liblwgeom_internal.h"
@@ -109,8 +110,12 @@ static void geos_destroy(size_t count, ...) {
 /*
 **  GEOS <==> PostGIS conversion functions
 **
-** Default conversion creates a GEOS point array, then iterates through the
-** PostGIS points, setting each value in the GEOS array one at a time.
+** Coordinates are copied a whole point array at a time with the
+** buffer based coordinate sequence API of GEOS 3.10 and up, when
+** the memory layout of the POINTARRAY is what GEOS expects (no M,
+** nothing to append). Otherwise we loop over the points, setting
+** all the ordinates of a point in one call where GEOS (3.8 and up)
+** allows it.
 **
 */
 
@@ -119,9 +124,11 @@ POINTARRAY*
 ptarray_from_GEOSCoordSeq(const GEOSCoordSequence* cs, uint8_t want3d)
 {
 	uint32_t dims = 2;
-	uint32_t size = 0, i;
+	uint32_t size = 0;
+#if POSTGIS_GEOS_VERSION < 310
+	uint32_t i;
+#endif
 	POINTARRAY* pa;
-	POINT4D point = { 0.0, 0.0, 0.0, 0.0 };
 
 	LWDEBUG(2, "ptarray_fromGEOSCoordSeq called");
 
@@ -142,14 +149,30 @@ ptarray_from_GEOSCoordSeq(const GEOSCoordSequence* cs, uint8_t want3d)
 	LWDEBUGF(4, " output dimensions: %d", dims);
 
 	pa = ptarray_construct((dims == 3), 0, size);
+	if (!size) return pa;
 
-	for (i = 0; i < size; i++)
+#if POSTGIS_GEOS_VERSION >= 310
+	if (!GEOSCoordSeq_copyToBuffer(cs, (double*)(pa->serialized_pointlist), (dims == 3), 0))
+		lwerror("Exception thrown");
+#else
 	{
-		GEOSCoordSeq_getX(cs, i, &(point.x));
-		GEOSCoordSeq_getY(cs, i, &(point.y));
-		if (dims >= 3) GEOSCoordSeq_getZ(cs, i, &(point.z));
-		ptarray_set_point4d(pa, i, &point);
+		double *coords = (double*)(pa->serialized_pointlist);
+		for (i = 0; i < size; i++)
+		{
+#if POSTGIS_GEOS_VERSION >= 38
+			if (dims == 3)
+				GEOSCoordSeq_getXYZ(cs, i, coords, coords + 1, coords + 2);
+			else
+				GEOSCoordSeq_getXY(cs, i, coords, coords + 1);
+#else
+			GEOSCoordSeq_getX(cs, i, coords);
+			GEOSCoordSeq_getY(cs, i, coords + 1);
+			if (dims == 3) GEOSCoordSeq_getZ(cs, i, coords + 2);
+#endif
+			coords += dims;
+		}
 	}
+#endif
 
 	return pa;
 }
@@ -243,8 +266,8 @@ ptarray_to_GEOSCoordSeq(const POINTARRAY* pa, uint8_t fix_ring)
 	uint32_t dims = 2;
 	uint32_t i;
 	int append_points = 0;
-	const POINT3D *p3d = NULL;
-	const POINT2D* p2d = NULL;
+	size_t stride = FLAGS_NDIMS(pa->flags);
+	const double* coords = (const double*)(pa->serialized_pointlist);
 	GEOSCoordSeq sq;
 
 	if (FLAGS_GET_Z(pa->flags)) dims = 3;
@@ -263,48 +286,39 @@ ptarray_to_GEOSCoordSeq(const POINTARRAY* pa, uint8_t fix_ring)
 		}
 	}
 
-	if (!(sq = GEOSCoordSeq_create(pa->npoints + append_points, dims)))
-	{
-		lwerror("Error creating GEOS Coordinate Sequence");
-		return NULL;
-	}
-
-	for (i = 0; i < pa->npoints; i++)
+#if POSTGIS_GEOS_VERSION >= 310
+	/* Same layout as GEOS, hand it the whole block */
+	if (!append_points && stride == dims)
 	{
-		if (dims == 3)
+		if (!(sq = GEOSCoordSeq_copyFromBuffer(coords, pa->npoints, (dims == 3), 0)))
 		{
-			p3d = getPoint3d_cp(pa, i);
-			p2d = (const POINT2D*)p3d;
-			LWDEBUGF(4, "Point: %g,%g,%g", p3d->x, p3d->y, p3d->z);
-		}
-		else
-		{
-			p2d = getPoint2d_cp(pa, i);
-			LWDEBUGF(4, "Point: %g,%g", p2d->x, p2d->y);
+			lwerror("Error creating GEOS Coordinate Sequence");
+			return NULL;
 		}
+		return sq;
+	}
+#endif
 
-		GEOSCoordSeq_setX(sq, i, p2d->x);
-		GEOSCoordSeq_setY(sq, i, p2d->y);
-
-		if (dims == 3) GEOSCoordSeq_setZ(sq, i, p3d->z);
+	if (!(sq = GEOSCoordSeq_create(pa->npoints + append_points, dims)))
+	{
+		lwerror("Error creating GEOS Coordinate Sequence");
+		return NULL;
 	}
 
-	if (append_points)
+	for (i = 0; i < pa->npoints + append_points; i++)
 	{
+		/* Points appended to fix a ring repeat the first one */
+		const double* c = coords + stride * (i < pa->npoints ? i : 0);
+#if POSTGIS_GEOS_VERSION >= 38
 		if (dims == 3)
-		{
-			p3d = getPoint3d_cp(pa, 0);
-			p2d = (const POINT2D*)p3d;
-		}
+			GEOSCoordSeq_setXYZ(sq, i, c[0], c[1], c[2]);
 		else
-			p2d = getPoint2d_cp(pa, 0);
-		for (i = pa->npoints; i < pa->npoints + append_points; i++)
-		{
-			GEOSCoordSeq_setX(sq, i, p2d->x);
-			GEOSCoordSeq_setY(sq, i, p2d->y);
-
-			if (dims == 3) GEOSCoordSeq_setZ(sq, i, p3d->z);
-		}
+			GEOSCoordSeq_setXY(sq, i, c[0], c[1]);
+#else
+		GEOSCoordSeq_setX(sq, i, c[0]);
+		GEOSCoordSeq_setY(sq, i, c[1]);
+		if (dims == 3) GEOSCoordSeq_setZ(sq, i, c[2]);
+#endif
 	}
 
 	return sq;
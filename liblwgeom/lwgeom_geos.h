@@ -43,6 +43,13 @@ GEOSGeometry* make_geos_segment(double x1, double y1, double x2, double y2);
 int cluster_intersecting(GEOSGeometry **geoms, uint32_t num_geoms, GEOSGeometry ***clusterGeoms, uint32_t *num_clusters);
 int cluster_within_distance(LWGEOM **geoms, uint32_t num_geoms, double tolerance, LWGEOM ***clusterGeoms, uint32_t *num_clusters);
 int union_dbscan(LWGEOM **geoms, uint32_t num_geoms, UNIONFIND *uf, double eps, uint32_t min_points, char **is_in_cluster_ret);
+GEOSGeometry* union_clustered_polygons(GEOSGeometry **geoms, const GBOX *boxes, uint32_t num_geoms);
+
+/* Upper bound of the number of threads union_dbscan may use */
+#define CLUSTER_MAX_THREADS 64
+
+/* Let union_dbscan use up to num_threads threads (1, the default, for none) */
+void lwgeom_set_cluster_threads(uint32_t num_threads);
 
 POINTARRAY* ptarray_from_GEOSCoordSeq(const GEOSCoordSequence* cs, uint8_t want3d);
 
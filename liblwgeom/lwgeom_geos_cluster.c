@@ -23,14 +23,34 @@
  **********************************************************************/
 
 #include <string.h>
+#include "../postgis_config.h"
 #include "liblwgeom.h"
 #include "liblwgeom_internal.h"
 #include "lwgeom_log.h"
 #include "lwgeom_geos.h"
 #include "lwunionfind.h"
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <signal.h>
+#endif
+
 static const int STRTREE_NODE_CAPACITY = 10;
 
+/* A DBSCAN point grid is used while |coordinate| / cell size stays under this */
+static const double POINT_GRID_MAX_CELLS = 1099511627776.0; /* 2^40 */
+
+/* Clustered unions work on blocks of this many neighbouring geometries */
+static const uint32_t UNION_BLOCK_SIZE = 32;
+
+/* Fewest DBSCAN inputs worth starting threads for, and how many points
+ * a thread claims at a time */
+static const uint32_t DBSCAN_THREADS_MIN_GEOMS = 4096;
+static const uint32_t DBSCAN_THREADS_CHUNK = 1024;
+
+/* Set by lwgeom_set_cluster_threads */
+static uint32_t cluster_threads = 1;
+
 /* Utility struct used to accumulate items in GEOSSTRtree_query callback */
 struct QueryContext
 {
@@ -51,6 +71,7 @@ struct STRTree
 static struct STRTree make_strtree(void** geoms, uint32_t num_geoms, char is_lwgeom);
 static void destroy_strtree(struct STRTree * tree);
 static int union_intersecting_pairs(GEOSGeometry** geoms, uint32_t num_geoms, UNIONFIND* uf);
+static int union_overlapping_envelopes(GEOSGeometry** geoms, uint32_t num_geoms, UNIONFIND* uf);
 static int combine_geometries(UNIONFIND* uf, void** geoms, uint32_t num_geoms, void*** clustersGeoms, uint32_t* num_clusters, char is_lwgeom);
 
 /* Make a minimal GEOSGeometry* whose Envelope covers the same 2D extent as
@@ -240,6 +261,48 @@ union_intersecting_pairs(GEOSGeometry** geoms, uint32_t num_geoms, UNIONFIND* uf
 	return success;
 }
 
+/* Identify geometries with overlapping envelopes and mark them as being in the same set */
+static int
+union_overlapping_envelopes(GEOSGeometry** geoms, uint32_t num_geoms, UNIONFIND* uf)
+{
+	uint32_t p, i;
+	struct STRTree tree;
+	struct QueryContext cxt =
+	{
+		.items_found = NULL,
+		.num_items_found = 0,
+		.items_found_size = 0
+	};
+
+	if (num_geoms <= 1)
+		return LW_SUCCESS;
+
+	tree = make_strtree((void**) geoms, num_geoms, LW_FALSE);
+	if (tree.tree == NULL)
+	{
+		destroy_strtree(&tree);
+		return LW_FAILURE;
+	}
+
+	for (p = 0; p < num_geoms; p++)
+	{
+		cxt.num_items_found = 0;
+		GEOSSTRtree_query(tree.tree, geoms[p], &query_accumulate, &cxt);
+
+		for (i = 0; i < cxt.num_items_found; i++)
+		{
+			uint32_t q = *((uint32_t*) cxt.items_found[i]);
+			UF_union(uf, p, q);
+		}
+	}
+
+	if (cxt.items_found)
+		lwfree(cxt.items_found);
+
+	destroy_strtree(&tree);
+	return LW_SUCCESS;
+}
+
 /** Takes an array of GEOSGeometry* and constructs an array of GEOSGeometry*, where each element in the constructed
  *  array is a GeometryCollection representing a set of interconnected geometries. Caller is responsible for
  *  freeing the input array, but not for destroying the GEOSGeometry* items inside it.  */
@@ -260,11 +323,233 @@ cluster_intersecting(GEOSGeometry** geoms, uint32_t num_geoms, GEOSGeometry*** c
 	return cluster_success;
 }
 
+/* DBSCAN inputs that are all points are bucketed in a uniform grid of cells
+ * slightly wider than eps, keyed by a hash table, so a neighbour search only
+ * has to scan the 3x3 cells around a point. */
+struct PointGrid
+{
+	double* x;             /* coordinates of each input, by input id */
+	double* y;
+	uint32_t* ids;         /* ids of the non-empty inputs, grouped by cell */
+	uint32_t* cell_start;  /* first position in ids of each cell, plus one past the end */
+	int64_t* cell_x;       /* grid coordinates of each cell */
+	int64_t* cell_y;
+	uint32_t* slots;       /* hash table of cell numbers, UINT32_MAX when free */
+	uint32_t num_slots;    /* a power of two */
+	uint32_t num_points;   /* number of non-empty inputs */
+	double xmin, ymin, size;
+};
+
+struct PointGridItem
+{
+	int64_t cx;
+	int64_t cy;
+	uint32_t id;
+};
+
+static int
+cmp_point_grid_items(const void* a, const void* b)
+{
+	const struct PointGridItem* ia = a;
+	const struct PointGridItem* ib = b;
+
+	if (ia->cx != ib->cx)
+		return ia->cx < ib->cx ? -1 : 1;
+	if (ia->cy != ib->cy)
+		return ia->cy < ib->cy ? -1 : 1;
+	if (ia->id != ib->id)
+		return ia->id < ib->id ? -1 : 1;
+	return 0;
+}
+
+static inline uint32_t
+point_grid_hash(int64_t cx, int64_t cy, uint32_t num_slots)
+{
+	uint64_t h = (uint64_t) cx * 0x9E3779B97F4A7C15ULL ^ (uint64_t) cy * 0xC2B2AE3D27D4EB4FULL;
+	h ^= h >> 32;
+	return (uint32_t) h & (num_slots - 1);
+}
+
+/* Cell number of the cell at (cx, cy), or UINT32_MAX if it holds no point */
+static uint32_t
+point_grid_find(const struct PointGrid* grid, int64_t cx, int64_t cy)
+{
+	uint32_t slot = point_grid_hash(cx, cy, grid->num_slots);
+	while (grid->slots[slot] != UINT32_MAX)
+	{
+		uint32_t cell = grid->slots[slot];
+		if (grid->cell_x[cell] == cx && grid->cell_y[cell] == cy)
+			return cell;
+		slot = (slot + 1) & (grid->num_slots - 1);
+	}
+	return UINT32_MAX;
+}
+
+static void
+destroy_point_grid(struct PointGrid* grid)
+{
+	lwfree(grid->x);
+	lwfree(grid->y);
+	lwfree(grid->ids);
+	lwfree(grid->cell_start);
+	lwfree(grid->cell_x);
+	lwfree(grid->cell_y);
+	lwfree(grid->slots);
+	lwfree(grid);
+}
+
+/* Build a PointGrid over the inputs, or return NULL when they are not all
+ * points (or empty), or when the grid could not tell neighbouring cells
+ * apart: a zero or non-finite eps, or coordinates too large for it. */
+static struct PointGrid*
+make_point_grid(LWGEOM** geoms, uint32_t num_geoms, double eps)
+{
+	struct PointGrid* grid;
+	struct PointGridItem* items;
+	uint32_t i, num_points = 0, num_cells = 0;
+	double xmin = DBL_MAX, ymin = DBL_MAX, maxabs = 0.0;
+
+	if (!(eps > 0.0) || !isfinite(eps))
+		return NULL;
+
+	for (i = 0; i < num_geoms; i++)
+	{
+		const POINT2D* pt;
+		if (geoms[i]->type != POINTTYPE)
+			return NULL;
+		if (lwgeom_is_empty(geoms[i]))
+			continue;
+		pt = getPoint2d_cp(lwgeom_as_lwpoint(geoms[i])->point, 0);
+		if (!isfinite(pt->x) || !isfinite(pt->y))
+			return NULL;
+		xmin = FP_MIN(xmin, pt->x);
+		ymin = FP_MIN(ymin, pt->y);
+		maxabs = FP_MAX(maxabs, FP_MAX(fabs(pt->x), fabs(pt->y)));
+		num_points++;
+	}
+
+	grid = lwalloc(sizeof(struct PointGrid));
+	/* The margin keeps rounding from putting points within eps two cells apart */
+	grid->size = eps * (1.0 + 1.0 / 64);
+	grid->xmin = xmin;
+	grid->ymin = ymin;
+
+	if (num_points == 0 || 2 * maxabs / grid->size >= POINT_GRID_MAX_CELLS)
+	{
+		lwfree(grid);
+		return NULL;
+	}
+
+	grid->x = lwalloc(num_geoms * sizeof(double));
+	grid->y = lwalloc(num_geoms * sizeof(double));
+	items = lwalloc(num_points * sizeof(struct PointGridItem));
+	for (i = 0, num_points = 0; i < num_geoms; i++)
+	{
+		const POINT2D* pt;
+		if (lwgeom_is_empty(geoms[i]))
+			continue;
+		pt = getPoint2d_cp(lwgeom_as_lwpoint(geoms[i])->point, 0);
+		grid->x[i] = pt->x;
+		grid->y[i] = pt->y;
+		items[num_points].cx = (int64_t) floor((pt->x - xmin) / grid->size);
+		items[num_points].cy = (int64_t) floor((pt->y - ymin) / grid->size);
+		items[num_points].id = i;
+		num_points++;
+	}
+	qsort(items, num_points, sizeof(struct PointGridItem), cmp_point_grid_items);
+
+	for (i = 0; i < num_points; i++)
+	{
+		if (i == 0 || items[i].cx != items[i-1].cx || items[i].cy != items[i-1].cy)
+			num_cells++;
+	}
+
+	grid->ids = lwalloc(num_points * sizeof(uint32_t));
+	grid->cell_start = lwalloc((num_cells + 1) * sizeof(uint32_t));
+	grid->cell_x = lwalloc(num_cells * sizeof(int64_t));
+	grid->cell_y = lwalloc(num_cells * sizeof(int64_t));
+	for (grid->num_slots = 16; grid->num_slots < 2 * num_cells; grid->num_slots *= 2);
+	grid->slots = lwalloc(grid->num_slots * sizeof(uint32_t));
+	memset(grid->slots, 0xFF, grid->num_slots * sizeof(uint32_t));
+
+	for (i = 0, num_cells = 0; i < num_points; i++)
+	{
+		if (i == 0 || items[i].cx != items[i-1].cx || items[i].cy != items[i-1].cy)
+		{
+			uint32_t slot = point_grid_hash(items[i].cx, items[i].cy, grid->num_slots);
+			while (grid->slots[slot] != UINT32_MAX)
+				slot = (slot + 1) & (grid->num_slots - 1);
+			grid->slots[slot] = num_cells;
+			grid->cell_x[num_cells] = items[i].cx;
+			grid->cell_y[num_cells] = items[i].cy;
+			grid->cell_start[num_cells++] = i;
+		}
+		grid->ids[i] = items[i].id;
+	}
+	grid->cell_start[num_cells] = num_points;
+	grid->num_points = num_points;
+
+	lwfree(items);
+	return grid;
+}
+
+/* Accumulate the points of the 3x3 cells around p that fall in the same
+ * eps-expanded box an STRtree query would use */
+static void
+point_grid_query(const struct PointGrid* grid, struct QueryContext* cxt, uint32_t p, double eps)
+{
+	double x = grid->x[p];
+	double y = grid->y[p];
+	double qxmin = x - eps, qymin = y - eps, qxmax = x + eps, qymax = y + eps;
+	int64_t cx = (int64_t) floor((x - grid->xmin) / grid->size);
+	int64_t cy = (int64_t) floor((y - grid->ymin) / grid->size);
+	int64_t i, j;
+	uint32_t k;
+
+	for (i = cx - 1; i <= cx + 1; i++)
+	{
+		for (j = cy - 1; j <= cy + 1; j++)
+		{
+			uint32_t cell = point_grid_find(grid, i, j);
+			if (cell == UINT32_MAX)
+				continue;
+
+			for (k = grid->cell_start[cell]; k < grid->cell_start[cell + 1]; k++)
+			{
+				uint32_t q = grid->ids[k];
+				if (grid->x[q] >= qxmin && grid->x[q] <= qxmax &&
+				    grid->y[q] >= qymin && grid->y[q] <= qymax)
+					query_accumulate(&(grid->ids[k]), cxt);
+			}
+		}
+	}
+}
+
+/* Same as lwgeom_mindistance2d_tolerance, read from the grid for points */
+static inline double
+dbscan_distance(const struct PointGrid* grid, LWGEOM** geoms, uint32_t p, uint32_t q, double eps)
+{
+	if (grid)
+	{
+		double hside = grid->x[q] - grid->x[p];
+		double vside = grid->y[q] - grid->y[p];
+		double dist = sqrt(hside*hside + vside*vside);
+		return dist < FLT_MAX ? dist : FLT_MAX;
+	}
+	return lwgeom_mindistance2d_tolerance(geoms[p], geoms[q], eps);
+}
+
 static int
-dbscan_update_context(GEOSSTRtree* tree, struct QueryContext* cxt, LWGEOM** geoms, uint32_t p, double eps)
+dbscan_update_context(GEOSSTRtree* tree, const struct PointGrid* grid, struct QueryContext* cxt, LWGEOM** geoms, uint32_t p, double eps)
 {
 	cxt->num_items_found = 0;
 
+	if (grid)
+	{
+		point_grid_query(grid, cxt, p, eps);
+		return LW_SUCCESS;
+	}
+
 	GEOSGeometry* query_envelope;
 	if (geoms[p]->type == POINTTYPE)
 	{
@@ -315,7 +600,7 @@ union_if_available(UNIONFIND* uf, uint32_t p, uint32_t q, char* is_in_core, char
  * to avoid some distance computations altogether.
  */
 static int
-union_dbscan_minpoints_1(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double eps, char** in_a_cluster_ret)
+union_dbscan_minpoints_1(LWGEOM** geoms, uint32_t num_geoms, const struct PointGrid* grid, UNIONFIND* uf, double eps, char** in_a_cluster_ret)
 {
 	uint32_t p, i;
 	struct STRTree tree;
@@ -338,11 +623,18 @@ union_dbscan_minpoints_1(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, doub
 	if (num_geoms <= 1)
 		return LW_SUCCESS;
 
-	tree = make_strtree((void**) geoms, num_geoms, LW_TRUE);
-	if (tree.tree == NULL)
+	if (grid)
 	{
-		destroy_strtree(&tree);
-		return LW_FAILURE;
+		tree.tree = NULL;
+	}
+	else
+	{
+		tree = make_strtree((void**) geoms, num_geoms, LW_TRUE);
+		if (tree.tree == NULL)
+		{
+			destroy_strtree(&tree);
+			return LW_FAILURE;
+		}
 	}
 
 	for (p = 0; p < num_geoms; p++)
@@ -350,14 +642,14 @@ union_dbscan_minpoints_1(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, doub
 		if (lwgeom_is_empty(geoms[p]))
 			continue;
 
-		dbscan_update_context(tree.tree, &cxt, geoms, p, eps);
+		dbscan_update_context(tree.tree, grid, &cxt, geoms, p, eps);
 		for (i = 0; i < cxt.num_items_found; i++)
 		{
 			uint32_t q = *((uint32_t*) cxt.items_found[i]);
 
 			if (UF_find(uf, p) != UF_find(uf, q))
 			{
-				double mindist = lwgeom_mindistance2d_tolerance(geoms[p], geoms[q], eps);
+				double mindist = dbscan_distance(grid, geoms, p, q, eps);
 				if (mindist == FLT_MAX)
 				{
 					success = LW_FAILURE;
@@ -373,13 +665,14 @@ union_dbscan_minpoints_1(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, doub
 	if (cxt.items_found)
 		lwfree(cxt.items_found);
 
-	destroy_strtree(&tree);
+	if (!grid)
+		destroy_strtree(&tree);
 
 	return success;
 }
 
 static int
-union_dbscan_general(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double eps, uint32_t min_points, char** in_a_cluster_ret)
+union_dbscan_general(LWGEOM** geoms, uint32_t num_geoms, const struct PointGrid* grid, UNIONFIND* uf, double eps, uint32_t min_points, char** in_a_cluster_ret)
 {
 	uint32_t p, i;
 	struct STRTree tree;
@@ -408,11 +701,18 @@ union_dbscan_general(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double e
 		return LW_SUCCESS;
 	}
 
-	tree = make_strtree((void**) geoms, num_geoms, LW_TRUE);
-	if (tree.tree == NULL)
+	if (grid)
 	{
-		destroy_strtree(&tree);
-		return LW_FAILURE;
+		tree.tree = NULL;
+	}
+	else
+	{
+		tree = make_strtree((void**) geoms, num_geoms, LW_TRUE);
+		if (tree.tree == NULL)
+		{
+			destroy_strtree(&tree);
+			return LW_FAILURE;
+		}
 	}
 
 	is_in_core = lwalloc(num_geoms * sizeof(char));
@@ -426,7 +726,7 @@ union_dbscan_general(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double e
 		if (lwgeom_is_empty(geoms[p]))
 			continue;
 
-		dbscan_update_context(tree.tree, &cxt, geoms, p, eps);
+		dbscan_update_context(tree.tree, grid, &cxt, geoms, p, eps);
 
 		/* We didn't find enough points to do anything, even if they are all within eps. */
 		if (cxt.num_items_found < min_points)
@@ -452,7 +752,7 @@ union_dbscan_general(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double e
 					continue;
 			}
 
-			double mindist = lwgeom_mindistance2d_tolerance(geoms[p], geoms[q], eps);
+			double mindist = dbscan_distance(grid, geoms, p, q, eps);
 			if (mindist == FLT_MAX)
 			{
 				success = LW_FAILURE;
@@ -507,16 +807,245 @@ union_dbscan_general(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double e
 	if (cxt.items_found)
 		lwfree(cxt.items_found);
 
-	destroy_strtree(&tree);
+	if (!grid)
+		destroy_strtree(&tree);
 	return success;
 }
 
+void
+lwgeom_set_cluster_threads(uint32_t num_threads)
+{
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > CLUSTER_MAX_THREADS)
+		num_threads = CLUSTER_MAX_THREADS;
+	cluster_threads = num_threads;
+}
+
+#ifdef HAVE_PTHREAD
+
+/* State shared by the threads of union_dbscan_threaded. Everything is
+ * allocated up front: the threads only read the grid, write the entries
+ * of the points they claimed and link the union-find, and never call
+ * lwalloc, lwerror or GEOS, which are not safe off the main thread. */
+struct DBSCANThreads
+{
+	const struct PointGrid* grid;
+	UNIONFIND* uf;
+	double eps;
+	uint32_t min_points;
+	char* is_core;        /* has min_points inputs within eps, itself included */
+	uint32_t* border_of;  /* smallest core point within eps of a non-core point */
+	size_t next;          /* next position in grid->ids to hand out */
+	int link;             /* LW_FALSE to find the core points, LW_TRUE to link them */
+	int failed;
+};
+
+/* With link unset, count the points within eps of p until there are
+ * min_points of them. With link set, union core point p with the core
+ * points after it within eps, or find the smallest such core point of
+ * non-core point p. */
+static void
+dbscan_thread_point(struct DBSCANThreads* state, uint32_t p)
+{
+	const struct PointGrid* grid = state->grid;
+	double eps = state->eps;
+	double x = grid->x[p];
+	double y = grid->y[p];
+	double qxmin = x - eps, qymin = y - eps, qxmax = x + eps, qymax = y + eps;
+	int64_t cx = (int64_t) floor((x - grid->xmin) / grid->size);
+	int64_t cy = (int64_t) floor((y - grid->ymin) / grid->size);
+	uint32_t num_neighbors = 0;
+	int64_t i, j;
+	uint32_t k;
+
+	for (i = cx - 1; i <= cx + 1; i++)
+	{
+		for (j = cy - 1; j <= cy + 1; j++)
+		{
+			uint32_t cell = point_grid_find(grid, i, j);
+			if (cell == UINT32_MAX)
+				continue;
+
+			for (k = grid->cell_start[cell]; k < grid->cell_start[cell + 1]; k++)
+			{
+				uint32_t q = grid->ids[k];
+				double dist;
+
+				if (!(grid->x[q] >= qxmin && grid->x[q] <= qxmax &&
+				      grid->y[q] >= qymin && grid->y[q] <= qymax))
+					continue;
+
+				if (state->link)
+				{
+					if (!state->is_core[q])
+						continue;
+					if (state->is_core[p] ? q <= p : q >= state->border_of[p])
+						continue;
+				}
+
+				dist = dbscan_distance(grid, NULL, p, q, eps);
+				if (dist == FLT_MAX)
+				{
+					__atomic_store_n(&state->failed, LW_TRUE, __ATOMIC_RELAXED);
+					return;
+				}
+				if (dist > eps)
+					continue;
+
+				if (!state->link)
+				{
+					if (++num_neighbors >= state->min_points)
+					{
+						state->is_core[p] = LW_TRUE;
+						return;
+					}
+				}
+				else if (state->is_core[p])
+					UF_atomic_union(state->uf, p, q);
+				else
+					state->border_of[p] = q;
+			}
+		}
+	}
+}
+
+static void*
+dbscan_thread(void* arg)
+{
+	struct DBSCANThreads* state = arg;
+	size_t num_points = state->grid->num_points;
+
+	for (;;)
+	{
+		size_t start = __atomic_fetch_add(&state->next, DBSCAN_THREADS_CHUNK, __ATOMIC_RELAXED);
+		size_t end = start + DBSCAN_THREADS_CHUNK;
+		size_t k;
+
+		if (start >= num_points || __atomic_load_n(&state->failed, __ATOMIC_RELAXED) ||
+		    _lwgeom_interrupt_requested)
+			break;
+
+		if (end > num_points)
+			end = num_points;
+		for (k = start; k < end; k++)
+			dbscan_thread_point(state, state->grid->ids[k]);
+	}
+
+	return NULL;
+}
+
+/* Run dbscan_thread on the calling thread and up to num_threads - 1 more,
+ * fewer if they cannot be started. The new threads block all signals, so
+ * the signal handlers keep running on the calling thread only. */
+static void
+dbscan_run_threads(struct DBSCANThreads* state, uint32_t num_threads)
+{
+	pthread_t threads[CLUSTER_MAX_THREADS];
+	sigset_t all_signals, old_signals;
+	uint32_t i, num_started = 0;
+
+	state->next = 0;
+
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+	for (i = 1; i < num_threads; i++)
+	{
+		if (pthread_create(&threads[num_started], NULL, dbscan_thread, state) == 0)
+			num_started++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+	dbscan_thread(state);
+
+	for (i = 0; i < num_started; i++)
+		pthread_join(threads[i], NULL);
+}
+
+/* DBSCAN of point inputs on several threads. The neighbours of every point
+ * are counted to find the core points first, then the core points within
+ * eps of each other are unioned, and each remaining point joins the
+ * cluster of the smallest core point within eps of it, which is the
+ * cluster the sequential functions above put it in. */
+static int
+union_dbscan_threaded(const struct PointGrid* grid, uint32_t num_geoms, UNIONFIND* uf, double eps, uint32_t min_points, char** in_a_cluster_ret)
+{
+	struct DBSCANThreads state;
+	uint32_t p;
+
+	state.grid = grid;
+	state.uf = uf;
+	state.eps = eps;
+	state.min_points = min_points;
+	state.failed = LW_FALSE;
+	state.is_core = lwalloc(num_geoms * sizeof(char));
+	state.border_of = lwalloc(num_geoms * sizeof(uint32_t));
+	for (p = 0; p < num_geoms; p++)
+		state.border_of[p] = UINT32_MAX;
+
+	if (min_points <= 1)
+	{
+		memset(state.is_core, LW_TRUE, num_geoms * sizeof(char));
+	}
+	else
+	{
+		memset(state.is_core, LW_FALSE, num_geoms * sizeof(char));
+		state.link = LW_FALSE;
+		dbscan_run_threads(&state, cluster_threads);
+	}
+
+	if (!state.failed)
+	{
+		state.link = LW_TRUE;
+		dbscan_run_threads(&state, cluster_threads);
+	}
+
+	LW_ON_INTERRUPT(state.failed = LW_TRUE);
+
+	/* Every point in a cluster ends up marked in is_core */
+	for (p = 0; p < num_geoms && !state.failed; p++)
+	{
+		if (state.border_of[p] != UINT32_MAX)
+		{
+			UF_atomic_union(uf, p, state.border_of[p]);
+			state.is_core[p] = LW_TRUE;
+		}
+	}
+	UF_atomic_finish(uf);
+
+	lwfree(state.border_of);
+	if (in_a_cluster_ret)
+		*in_a_cluster_ret = state.is_core;
+	else
+		lwfree(state.is_core);
+
+	return state.failed ? LW_FAILURE : LW_SUCCESS;
+}
+
+#endif /* HAVE_PTHREAD */
+
 int union_dbscan(LWGEOM** geoms, uint32_t num_geoms, UNIONFIND* uf, double eps, uint32_t min_points, char** in_a_cluster_ret)
 {
+	struct PointGrid* grid = NULL;
+	int success;
+
+	if (num_geoms > 1 && num_geoms > min_points)
+		grid = make_point_grid(geoms, num_geoms, eps);
+
+#ifdef HAVE_PTHREAD
+	if (grid && cluster_threads > 1 && num_geoms >= DBSCAN_THREADS_MIN_GEOMS)
+		success = union_dbscan_threaded(grid, num_geoms, uf, eps, min_points, in_a_cluster_ret);
+	else
+#endif
 	if (min_points <= 1)
-		return union_dbscan_minpoints_1(geoms, num_geoms, uf, eps, in_a_cluster_ret);
+		success = union_dbscan_minpoints_1(geoms, num_geoms, grid, uf, eps, in_a_cluster_ret);
 	else
-		return union_dbscan_general(geoms, num_geoms, uf, eps, min_points, in_a_cluster_ret);
+		success = union_dbscan_general(geoms, num_geoms, grid, uf, eps, min_points, in_a_cluster_ret);
+
+	if (grid)
+		destroy_point_grid(grid);
+
+	return success;
 }
 
 /** Takes an array of LWGEOM* and constructs an array of LWGEOM*, where each element in the constructed array is a
@@ -588,3 +1117,238 @@ combine_geometries(UNIONFIND* uf, void** geoms, uint32_t num_geoms, void*** clus
 
 	return LW_SUCCESS;
 }
+
+/* Position of (x, y) along a Hilbert curve filling a 65536 x 65536 grid */
+static uint32_t
+hilbert_index(uint32_t x, uint32_t y)
+{
+	const uint32_t n = 1 << 16;
+	uint32_t s, rx, ry, t;
+	uint32_t d = 0;
+
+	for (s = n / 2; s > 0; s /= 2)
+	{
+		rx = (x & s) > 0;
+		ry = (y & s) > 0;
+		d += s * s * ((3 * rx) ^ ry);
+
+		/* Rotate the quadrant */
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			t = x;
+			x = y;
+			y = t;
+		}
+	}
+
+	return d;
+}
+
+/* An input of a clustered union, in cluster and then Hilbert order */
+struct UnionItem
+{
+	uint32_t cluster_key;
+	uint32_t cluster;
+	uint32_t key;
+	uint32_t id;
+};
+
+static int
+cmp_union_items(const void* a, const void* b)
+{
+	const struct UnionItem* ia = a;
+	const struct UnionItem* ib = b;
+
+	if (ia->cluster_key != ib->cluster_key)
+		return ia->cluster_key < ib->cluster_key ? -1 : 1;
+	if (ia->cluster != ib->cluster)
+		return ia->cluster < ib->cluster ? -1 : 1;
+	if (ia->key != ib->key)
+		return ia->key < ib->key ? -1 : 1;
+	if (ia->id != ib->id)
+		return ia->id < ib->id ? -1 : 1;
+	return 0;
+}
+
+/* Union the geometries a block of neighbours at a time, then the block
+ * results the same way, until one is left. Takes ownership of the
+ * geometries and reuses the array. */
+static GEOSGeometry*
+union_in_blocks(GEOSGeometry** geoms, uint32_t num_geoms)
+{
+	uint32_t i, j, n;
+
+	do
+	{
+		for (i = 0, n = 0; i < num_geoms; i += UNION_BLOCK_SIZE)
+		{
+			uint32_t size = num_geoms - i < UNION_BLOCK_SIZE ? num_geoms - i : UNION_BLOCK_SIZE;
+			GEOSGeometry* u = NULL;
+			GEOSGeometry* coll = GEOSGeom_createCollection(GEOS_GEOMETRYCOLLECTION, geoms + i, size);
+
+			if (coll)
+			{
+				u = GEOSUnaryUnion(coll);
+				GEOSGeom_destroy(coll);
+			}
+
+			if (!u)
+			{
+				for (j = 0; j < n; j++)
+					GEOSGeom_destroy(geoms[j]);
+				for (j = i + size; j < num_geoms; j++)
+					GEOSGeom_destroy(geoms[j]);
+				return NULL;
+			}
+			geoms[n++] = u;
+		}
+		num_geoms = n;
+	}
+	while (num_geoms > 1);
+
+	return geoms[0];
+}
+
+/** Union an array of polygonal GEOSGeometry*. Geometries are grouped by
+ *  overlapping envelopes; a group of a single POLYGON is passed through as
+ *  it is, the others are unioned in blocks of neighbours along the Hilbert
+ *  curve through their bounding box centres, so that GEOS works on small,
+ *  overlapping sets. The groups are disjoint, so their polygons are then
+ *  simply gathered in a MultiPolygon. Takes ownership of the geometries,
+ *  not of the arrays; boxes holds the bounding box of each geometry.
+ *  Returns NULL on a GEOS error. */
+GEOSGeometry*
+union_clustered_polygons(GEOSGeometry** geoms, const GBOX* boxes, uint32_t num_geoms)
+{
+	UNIONFIND* uf;
+	struct UnionItem* items;
+	GEOSGeometry** members;
+	GEOSGeometry** parts;
+	uint32_t num_parts = 0, parts_size = num_geoms;
+	uint32_t i, j, k;
+	double xmin, ymin, xmax, ymax, xscale, yscale;
+	GEOSGeometry* result;
+
+	if (num_geoms == 0)
+		return GEOSGeom_createEmptyPolygon();
+
+	uf = UF_create(num_geoms);
+	if (union_overlapping_envelopes(geoms, num_geoms, uf) == LW_FAILURE)
+	{
+		UF_destroy(uf);
+		for (i = 0; i < num_geoms; i++)
+			GEOSGeom_destroy(geoms[i]);
+		return NULL;
+	}
+
+	/* Hilbert keys of the box centres, on a grid over the whole extent */
+	xmin = boxes[0].xmin;
+	ymin = boxes[0].ymin;
+	xmax = boxes[0].xmax;
+	ymax = boxes[0].ymax;
+	for (i = 1; i < num_geoms; i++)
+	{
+		xmin = FP_MIN(xmin, boxes[i].xmin);
+		ymin = FP_MIN(ymin, boxes[i].ymin);
+		xmax = FP_MAX(xmax, boxes[i].xmax);
+		ymax = FP_MAX(ymax, boxes[i].ymax);
+	}
+	xscale = xmax > xmin ? 65535.0 / (xmax - xmin) : 0.0;
+	yscale = ymax > ymin ? 65535.0 / (ymax - ymin) : 0.0;
+
+	items = lwalloc(num_geoms * sizeof(struct UnionItem));
+	for (i = 0; i < num_geoms; i++)
+	{
+		double cx = (boxes[i].xmin + boxes[i].xmax) / 2.0;
+		double cy = (boxes[i].ymin + boxes[i].ymax) / 2.0;
+		items[i].id = i;
+		items[i].cluster = UF_find(uf, i);
+		items[i].cluster_key = UINT32_MAX;
+		items[i].key = hilbert_index((uint32_t) ((cx - xmin) * xscale), (uint32_t) ((cy - ymin) * yscale));
+	}
+
+	/* Order the groups by the lowest key of their members */
+	for (i = 0; i < num_geoms; i++)
+	{
+		struct UnionItem* root = &items[items[i].cluster];
+		if (items[i].key < root->cluster_key)
+			root->cluster_key = items[i].key;
+	}
+	for (i = 0; i < num_geoms; i++)
+		items[i].cluster_key = items[items[i].cluster].cluster_key;
+
+	UF_destroy(uf);
+	qsort(items, num_geoms, sizeof(struct UnionItem), cmp_union_items);
+
+	members = lwalloc(num_geoms * sizeof(GEOSGeometry*));
+	parts = lwalloc(parts_size * sizeof(GEOSGeometry*));
+
+	for (i = 0; i < num_geoms; i = j)
+	{
+		uint32_t num_members;
+		int num_polys;
+		GEOSGeometry* u;
+
+		for (j = i; j < num_geoms && items[j].cluster == items[i].cluster; j++)
+			members[j - i] = geoms[items[j].id];
+		num_members = j - i;
+
+		if (num_parts + 1 > parts_size)
+		{
+			parts_size *= 2;
+			parts = lwrealloc(parts, parts_size * sizeof(GEOSGeometry*));
+		}
+
+		/* A polygon on its own goes straight through */
+		if (num_members == 1 && GEOSGeomTypeId(members[0]) == GEOS_POLYGON)
+		{
+			parts[num_parts++] = members[0];
+			continue;
+		}
+
+		u = union_in_blocks(members, num_members);
+		if (!u)
+		{
+			for (k = 0; k < num_parts; k++)
+				GEOSGeom_destroy(parts[k]);
+			for (k = j; k < num_geoms; k++)
+				GEOSGeom_destroy(geoms[items[k].id]);
+			lwfree(parts);
+			lwfree(members);
+			lwfree(items);
+			return NULL;
+		}
+
+		num_polys = GEOSGetNumGeometries(u);
+		if (num_parts + num_polys > parts_size)
+		{
+			parts_size = FP_MAX(2 * parts_size, num_parts + num_polys);
+			parts = lwrealloc(parts, parts_size * sizeof(GEOSGeometry*));
+		}
+		for (k = 0; k < (uint32_t) num_polys; k++)
+		{
+			const GEOSGeometry* poly = GEOSGetGeometryN(u, k);
+			if (GEOSGeomTypeId(poly) == GEOS_POLYGON && !GEOSisEmpty(poly))
+				parts[num_parts++] = GEOSGeom_clone(poly);
+		}
+		GEOSGeom_destroy(u);
+	}
+
+	lwfree(members);
+	lwfree(items);
+
+	if (num_parts == 0)
+		result = GEOSGeom_createEmptyPolygon();
+	else if (num_parts == 1)
+		result = parts[0];
+	else
+		result = GEOSGeom_createCollection(GEOS_MULTIPOLYGON, parts, num_parts);
+
+	lwfree(parts);
+	return result;
+}
@@ -66,12 +66,209 @@ ptarray_transform(POINTARRAY *pa, projPJ inpj, projPJ outpj)
 }
 
 
+/*
+ * Spherical mercator without PROJ
+ *
+ * These are the constants and formulas of the spherical case of
+ * PROJ's merc projection and of its pj_fwd/pj_inv wrappers, with
+ * the operations in the same order, so the results agree with
+ * PROJ's to the last few bits while skipping the per-point
+ * overhead of pj_transform and the separate radian passes.
+ */
+#define SMERC_RADIUS 6378137.0
+#define SMERC_POLE_EPS 1.0e-10 /* merc refuses latitudes this close to a pole */
+#define SMERC_MAX_LAMBDA 10.0  /* pj_fwd refuses longitudes past this, in radians */
+#define SMERC_SPI 3.14159265359 /* adjlon only wraps past this rounded pi */
+#define SMERC_TWOPI 6.2831853071795864769
+
+/** Bring a longitude in radians back to -pi..pi, as adjlon does */
+static inline double
+smerc_adjlon(double lon)
+{
+	if ( fabs(lon) <= SMERC_SPI ) return lon;
+	lon += M_PI;
+	lon -= SMERC_TWOPI * floor(lon / SMERC_TWOPI);
+	lon -= M_PI;
+	return lon;
+}
+
 /**
- * Transform given SERIALIZED geometry
- * from inpj projection to outpj projection
+ * Transform given POINTARRAY between longitude/latitude on
+ * WGS84 and spherical mercator. If any point is one the
+ * formulas don't cover, the whole array goes through PROJ
+ * instead, which will report it the usual way.
  */
 int
-lwgeom_transform(LWGEOM *geom, projPJ inpj, projPJ outpj)
+ptarray_transform_smerc(POINTARRAY *pa, projPJ inpj, projPJ outpj, int forward)
+{
+	uint32_t i;
+	size_t stride = FLAGS_NDIMS(pa->flags);
+	double *xy = (double*)(pa->serialized_pointlist);
+
+	/* Check the whole array first, so it is done either all here or all by PROJ */
+	for ( i = 0; i < pa->npoints; i++ )
+	{
+		const double *p = xy + i * stride;
+		if ( forward )
+		{
+			double lam = p[0] * (M_PI/180.0);
+			double phi = p[1] * (M_PI/180.0);
+			if ( ! (fabs(lam) <= SMERC_MAX_LAMBDA && fabs(phi) < M_PI_2 - SMERC_POLE_EPS) )
+				return ptarray_transform(pa, inpj, outpj);
+		}
+		else if ( ! (isfinite(p[0]) && isfinite(p[1])) )
+		{
+			return ptarray_transform(pa, inpj, outpj);
+		}
+	}
+
+	/* Straight loops over the coordinates, for the compiler to unroll */
+	if ( forward )
+	{
+		for ( i = 0; i < pa->npoints; i++ )
+		{
+			double *p = xy + i * stride;
+			double lam = smerc_adjlon(p[0] * (M_PI/180.0));
+			double phi = p[1] * (M_PI/180.0);
+			p[0] = SMERC_RADIUS * lam;
+			p[1] = SMERC_RADIUS * log(tan(M_PI_4 + 0.5 * phi));
+		}
+	}
+	else
+	{
+		for ( i = 0; i < pa->npoints; i++ )
+		{
+			double *p = xy + i * stride;
+			double x = p[0] * (1.0 / SMERC_RADIUS);
+			double y = p[1] * (1.0 / SMERC_RADIUS);
+			p[0] = smerc_adjlon(x) * (180.0/M_PI);
+			p[1] = (M_PI_2 - 2.0 * atan(exp(-y))) * (180.0/M_PI);
+		}
+	}
+
+	return LW_SUCCESS;
+}
+
+/** True if val is a number equal to want */
+static int
+lwproj_param_equals(const char *val, double want)
+{
+	char *end;
+	double d;
+
+	if ( ! val ) return LW_FALSE;
+	d = strtod(val, &end);
+	return end != val && *end == '\0' && d == want;
+}
+
+/** True if val is a comma separated list of zeros */
+static int
+lwproj_param_zeros(const char *val)
+{
+	char *end;
+
+	if ( ! val ) return LW_FALSE;
+	while ( LW_TRUE )
+	{
+		if ( strtod(val, &end) != 0.0 || end == val ) return LW_FALSE;
+		if ( *end == '\0' ) return LW_TRUE;
+		if ( *end != ',' ) return LW_FALSE;
+		val = end + 1;
+	}
+}
+
+int
+lwproj_smerc_kind(projPJ pj)
+{
+	char *def, *tok;
+	int ok = LW_TRUE;
+	int is_merc = LW_FALSE;
+	int has_wgs84 = LW_FALSE;
+	int has_null_grid = LW_FALSE;
+	int has_units = LW_FALSE;
+	int has_towgs84 = LW_FALSE;
+	int nradius = 0;
+	int is_sphere = LW_FALSE;
+
+	if ( ! pj ) return LW_SMERC_NONE;
+	def = pj_get_def(pj, 0);
+	if ( ! def ) return LW_SMERC_NONE;
+
+	/*
+	 * Walk the "+key=value" parameters, accepting only the
+	 * ones we know leave the formulas alone
+	 */
+	tok = def;
+	while ( ok && *tok )
+	{
+		char *key, *val = NULL;
+
+		while ( *tok == ' ' ) tok++;
+		if ( ! *tok ) break;
+		if ( *tok != '+' ) { ok = LW_FALSE; break; }
+		key = ++tok;
+		while ( *tok && *tok != ' ' )
+		{
+			if ( *tok == '=' && ! val )
+			{
+				*tok = '\0';
+				val = tok + 1;
+			}
+			tok++;
+		}
+		if ( *tok ) *tok++ = '\0';
+
+		if ( ! strcmp(key, "proj") )
+			is_merc = val && ! strcmp(val, "merc");
+		else if ( ! strcmp(key, "datum") || ! strcmp(key, "ellps") )
+			ok = has_wgs84 = val && ! strcmp(val, "WGS84");
+		else if ( ! strcmp(key, "towgs84") )
+			ok = has_towgs84 = lwproj_param_zeros(val);
+		else if ( ! strcmp(key, "R") )
+			ok = is_sphere = lwproj_param_equals(val, SMERC_RADIUS);
+		else if ( ! strcmp(key, "a") || ! strcmp(key, "b") )
+		{
+			ok = lwproj_param_equals(val, SMERC_RADIUS);
+			nradius++;
+		}
+		else if ( ! strcmp(key, "lat_ts") || ! strcmp(key, "lon_0") ||
+		          ! strcmp(key, "x_0") || ! strcmp(key, "y_0") )
+			ok = lwproj_param_equals(val, 0.0);
+		else if ( ! strcmp(key, "k") || ! strcmp(key, "k_0") )
+			ok = lwproj_param_equals(val, 1.0);
+		else if ( ! strcmp(key, "units") )
+			ok = has_units = val && ! strcmp(val, "m");
+		else if ( ! strcmp(key, "nadgrids") )
+			ok = has_null_grid = val && ! strcmp(val, "@null");
+		else if ( strcmp(key, "no_defs") && strcmp(key, "wktext") )
+			ok = LW_FALSE;
+	}
+	pj_dalloc(def);
+
+	if ( ! ok )
+		return LW_SMERC_NONE;
+
+	/* Plain WGS84 longitude/latitude */
+	if ( pj_is_latlong(pj) && has_wgs84 && ! (nradius || is_sphere || has_null_grid || has_units) )
+		return LW_SMERC_LONGLAT;
+
+	/*
+	 * Mercator on a sphere; without the null grid PROJ would
+	 * shift datums between the sphere and WGS84
+	 */
+	if ( is_merc && (is_sphere || nradius == 2) && has_null_grid && ! (has_wgs84 || has_towgs84) )
+		return LW_SMERC_MERCATOR;
+
+	return LW_SMERC_NONE;
+}
+
+/* How lwgeom_transform_points moves each point array */
+#define LW_TRANSFORM_PROJ 0
+#define LW_TRANSFORM_SMERC_FORWARD 1
+#define LW_TRANSFORM_SMERC_INVERSE 2
+
+static int
+lwgeom_transform_points(LWGEOM *geom, projPJ inpj, projPJ outpj, int how)
 {
 	uint32_t i;
 
@@ -87,7 +284,14 @@ lwgeom_transform(LWGEOM *geom, projPJ inpj, projPJ outpj)
 		case TRIANGLETYPE:
 		{
 			LWLINE *g = (LWLINE*)geom;
-			if ( ! ptarray_transform(g->points, inpj, outpj) ) return LW_FAILURE;
+			if ( how == LW_TRANSFORM_PROJ )
+			{
+				if ( ! ptarray_transform(g->points, inpj, outpj) ) return LW_FAILURE;
+			}
+			else
+			{
+				if ( ! ptarray_transform_smerc(g->points, inpj, outpj, how == LW_TRANSFORM_SMERC_FORWARD) ) return LW_FAILURE;
+			}
 			break;
 		}
 		case POLYGONTYPE:
@@ -95,7 +299,14 @@ lwgeom_transform(LWGEOM *geom, projPJ inpj, projPJ outpj)
 			LWPOLY *g = (LWPOLY*)geom;
 			for ( i = 0; i < g->nrings; i++ )
 			{
-				if ( ! ptarray_transform(g->rings[i], inpj, outpj) ) return LW_FAILURE;
+				if ( how == LW_TRANSFORM_PROJ )
+				{
+					if ( ! ptarray_transform(g->rings[i], inpj, outpj) ) return LW_FAILURE;
+				}
+				else
+				{
+					if ( ! ptarray_transform_smerc(g->rings[i], inpj, outpj, how == LW_TRANSFORM_SMERC_FORWARD) ) return LW_FAILURE;
+				}
 			}
 			break;
 		}
@@ -113,7 +324,7 @@ lwgeom_transform(LWGEOM *geom, projPJ inpj, projPJ outpj)
 			LWCOLLECTION *g = (LWCOLLECTION*)geom;
 			for ( i = 0; i < g->ngeoms; i++ )
 			{
-				if ( ! lwgeom_transform(g->geoms[i], inpj, outpj) ) return LW_FAILURE;
+				if ( ! lwgeom_transform_points(g->geoms[i], inpj, outpj, how) ) return LW_FAILURE;
 			}
 			break;
 		}
@@ -127,6 +338,28 @@ lwgeom_transform(LWGEOM *geom, projPJ inpj, projPJ outpj)
 	return LW_SUCCESS;
 }
 
+/**
+ * Transform given SERIALIZED geometry
+ * from inpj projection to outpj projection
+ */
+int
+lwgeom_transform(LWGEOM *geom, projPJ inpj, projPJ outpj)
+{
+	return lwgeom_transform_points(geom, inpj, outpj, LW_TRANSFORM_PROJ);
+}
+
+/**
+ * Transform given geometry between longitude/latitude on WGS84
+ * and spherical mercator, inpj and outpj being the PROJ
+ * definitions of those (see lwproj_smerc_kind)
+ */
+int
+lwgeom_transform_smerc(LWGEOM *geom, projPJ inpj, projPJ outpj, int forward)
+{
+	return lwgeom_transform_points(geom, inpj, outpj,
+	           forward ? LW_TRANSFORM_SMERC_FORWARD : LW_TRANSFORM_SMERC_INVERSE);
+}
+
 int
 point4d_transform(POINT4D *pt, projPJ srcpj, projPJ dstpj)
 {
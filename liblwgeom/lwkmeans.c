@@ -22,151 +22,247 @@
  */
 #define KMEANS_MAX_ITERATIONS 1000
 
-static void
-update_r(POINT2D** objs, int* clusters, uint32_t n, POINT2D** centers, uint32_t k)
-{
-	POINT2D* obj;
-	unsigned int i;
-	double distance, curr_distance;
-	uint32_t cluster, curr_cluster;
-
-	for (i = 0; i < n; i++)
-	{
-		obj = objs[i];
+/*
+ * Seed of the random choices of k-means++, fixed so that the same input
+ * always gets the same clusters.
+ */
+#define KMEANS_SEED 0x853C49E6748FEA9BULL
 
-		/* Don't try to cluster NULL objects, just add them to the "unclusterable cluster" */
-		if (!obj)
-		{
-			clusters[i] = KMEANS_NULL_CLUSTER;
-			continue;
-		}
+/* Uniform double in [0, 1) from an xorshift64* generator */
+static double
+kmeans_random(uint64_t* state)
+{
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return ((*state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
 
-		/* Initialize with distance to first cluster */
-		curr_distance = distance2d_sqr_pt_pt(obj, centers[0]);
-		curr_cluster = 0;
+/*
+ * Find the nearest and second nearest centers to (x, y), with their
+ * distances. Ties go to the lowest center number.
+ */
+static inline void
+kmeans_nearest(double x, double y, const double* cx, const double* cy, uint32_t k,
+	       int* nearest, double* nearest_distance, double* second_distance)
+{
+	double d1 = DBL_MAX, d2 = DBL_MAX;
+	uint32_t c, c1 = 0;
 
-		/* Check all other cluster centers and find the nearest */
-		for (cluster = 1; cluster < k; cluster++)
+	for (c = 0; c < k; c++)
+	{
+		double dx = cx[c] - x;
+		double dy = cy[c] - y;
+		double d = dx * dx + dy * dy;
+		if (d < d1)
 		{
-			distance = distance2d_sqr_pt_pt(obj, centers[cluster]);
-			if (distance < curr_distance)
-			{
-				curr_distance = distance;
-				curr_cluster = cluster;
-			}
+			d2 = d1;
+			d1 = d;
+			c1 = c;
 		}
-
-		/* Store the nearest cluster this object is in */
-		clusters[i] = (int) curr_cluster;
+		else if (d < d2)
+			d2 = d;
 	}
+
+	*nearest = (int) c1;
+	*nearest_distance = sqrt(d1);
+	*second_distance = sqrt(d2);
 }
 
-static void
-update_means(POINT2D** objs, int* clusters, uint32_t n, POINT2D** centers, uint32_t* weights, uint32_t k)
+/*
+ * Lloyd's iterations, with the bounds of Hamerly's algorithm to skip the
+ * points that cannot have changed cluster: upper[i] is at least the
+ * distance of point i to its center, lower[i] at most its distance to any
+ * other center, and no point within half_gap[c] of center c can be nearer
+ * to another center. Only the points whose bounds overlap are measured
+ * against every center again.
+ */
+static int
+kmeans(const double* x, const double* y, int* clusters, uint32_t n, double* cx, double* cy, uint32_t k)
 {
-	uint32_t i;
-	int cluster;
-
-	memset(weights, 0, sizeof(uint32_t) * k);
-	for (i = 0; i < k; i++)
-	{
-		centers[i]->x = 0.0;
-		centers[i]->y = 0.0;
-	}
-	for (i = 0; i < n; i++)
+	uint32_t i, j, c;
+	int converged = LW_FALSE;
+	double* upper = lwalloc(sizeof(double) * n);
+	double* lower = lwalloc(sizeof(double) * n);
+	double* half_gap = lwalloc(sizeof(double) * k);
+	double* moved = lwalloc(sizeof(double) * k);
+	double* sum_x = lwalloc(sizeof(double) * k);
+	double* sum_y = lwalloc(sizeof(double) * k);
+	uint32_t* weights = lwalloc(sizeof(uint32_t) * k);
+
+	for (j = 0; j < n; j++)
+		kmeans_nearest(x[j], y[j], cx, cy, k, &clusters[j], &upper[j], &lower[j]);
+
+	for (i = 1; i < KMEANS_MAX_ITERATIONS; i++)
 	{
-		cluster = clusters[i];
-		if (cluster != KMEANS_NULL_CLUSTER)
+		uint32_t num_changed = 0;
+		uint32_t most_moved = 0;
+		double max_moved = 0.0, second_max_moved = 0.0;
+
+		LW_ON_INTERRUPT(break);
+
+		/* move the centers to the means of their points */
+		memset(weights, 0, sizeof(uint32_t) * k);
+		memset(sum_x, 0, sizeof(double) * k);
+		memset(sum_y, 0, sizeof(double) * k);
+		for (j = 0; j < n; j++)
 		{
-			centers[cluster]->x += objs[i]->x;
-			centers[cluster]->y += objs[i]->y;
-			weights[cluster] += 1;
+			sum_x[clusters[j]] += x[j];
+			sum_y[clusters[j]] += y[j];
+			weights[clusters[j]]++;
 		}
-	}
-	for (i = 0; i < k; i++)
-	{
-		if (weights[i])
+		for (c = 0; c < k; c++)
 		{
-			centers[i]->x /= weights[i];
-			centers[i]->y /= weights[i];
+			double dx, dy;
+
+			/* a center left without points stays put */
+			if (!weights[c])
+			{
+				moved[c] = 0.0;
+				continue;
+			}
+
+			dx = sum_x[c] / weights[c] - cx[c];
+			dy = sum_y[c] / weights[c] - cy[c];
+			cx[c] = sum_x[c] / weights[c];
+			cy[c] = sum_y[c] / weights[c];
+			moved[c] = sqrt(dx * dx + dy * dy);
+			if (moved[c] > max_moved)
+			{
+				second_max_moved = max_moved;
+				max_moved = moved[c];
+				most_moved = c;
+			}
+			else if (moved[c] > second_max_moved)
+				second_max_moved = moved[c];
 		}
-	}
-}
 
-static int
-kmeans(POINT2D** objs, int* clusters, uint32_t n, POINT2D** centers, uint32_t k)
-{
-	uint32_t i = 0;
-	int* clusters_last;
-	int converged = LW_FALSE;
-	size_t clusters_sz = sizeof(int) * n;
-	uint32_t* weights;
+		/* loosen the bounds by how far the centers moved */
+		for (j = 0; j < n; j++)
+		{
+			upper[j] += moved[clusters[j]];
+			lower[j] -= (uint32_t) clusters[j] == most_moved ? second_max_moved : max_moved;
+		}
 
-	weights = lwalloc(sizeof(int) * k);
+		for (c = 0; c < k; c++)
+		{
+			double gap = DBL_MAX;
+			uint32_t d;
+			for (d = 0; d < k; d++)
+			{
+				double dx = cx[d] - cx[c];
+				double dy = cy[d] - cy[c];
+				double dist = dx * dx + dy * dy;
+				if (d != c && dist < gap)
+					gap = dist;
+			}
+			half_gap[c] = sqrt(gap) / 2;
+		}
 
-	/* previous cluster state array */
-	clusters_last = lwalloc(clusters_sz);
+		/* reassign the points whose bounds do not rule it out */
+		for (j = 0; j < n; j++)
+		{
+			int cluster = clusters[j];
+			double bound = fmax(half_gap[cluster], lower[j]);
+			double dx, dy;
 
-	for (i = 0; i < KMEANS_MAX_ITERATIONS && !converged; i++)
-	{
-		LW_ON_INTERRUPT(break);
+			if (upper[j] <= bound)
+				continue;
 
-		/* store the previous state of the clustering */
-		memcpy(clusters_last, clusters, clusters_sz);
+			/* tighten the upper bound and try again */
+			dx = cx[cluster] - x[j];
+			dy = cy[cluster] - y[j];
+			upper[j] = sqrt(dx * dx + dy * dy);
+			if (upper[j] <= bound)
+				continue;
 
-		update_r(objs, clusters, n, centers, k);
-		update_means(objs, clusters, n, centers, weights, k);
+			kmeans_nearest(x[j], y[j], cx, cy, k, &clusters[j], &upper[j], &lower[j]);
+			if (clusters[j] != cluster)
+				num_changed++;
+		}
 
 		/* if all the cluster numbers are unchanged, we are at a stable solution */
-		converged = memcmp(clusters_last, clusters, clusters_sz) == 0;
+		if (!num_changed)
+		{
+			converged = LW_TRUE;
+			break;
+		}
 	}
 
-	lwfree(clusters_last);
+	lwfree(upper);
+	lwfree(lower);
+	lwfree(half_gap);
+	lwfree(moved);
+	lwfree(sum_x);
+	lwfree(sum_y);
 	lwfree(weights);
 	if (!converged)
 		lwerror("%s did not converge after %d iterations", __func__, i);
 	return converged;
 }
 
+/*
+ * Pick a point with a probability proportional to its squared distance to
+ * the nearest center, or UINT32_MAX if all points sit on a center.
+ */
+static uint32_t
+kmeans_draw(const double* distances, uint32_t n, double total, uint64_t* state)
+{
+	double target = kmeans_random(state) * total;
+	uint32_t j, candidate = UINT32_MAX;
+
+	if (!(total > 0))
+		return UINT32_MAX;
+
+	for (j = 0; j < n; j++)
+	{
+		if (distances[j] == 0)
+			continue;
+		candidate = j;
+		target -= distances[j];
+		if (target < 0)
+			break;
+	}
+	return candidate;
+}
+
+/*
+ * Greedy k-means++ seeding: the first center is the first point, each next
+ * one the best of a few points drawn with a probability proportional to
+ * their squared distance to the nearest center taken so far, the one that
+ * leaves the smallest sum of squared distances.
+ */
 static void
-kmeans_init(POINT2D** objs, int* clusters, uint32_t n, POINT2D** centers, POINT2D* centers_raw, uint32_t k)
+kmeans_init(const double* x, const double* y, uint32_t n, double* cx, double* cy, uint32_t k)
 {
 	double* distances;
-	uint32_t p1 = 0, p2 = 0;
-	uint32_t i, j;
-	uint32_t duplicate_count = 1; /* a point is a duplicate of itself */
-	double max_dst = -1;
-	double dst_p1, dst_p2;
+	double* trial_distances;
+	double* best_distances;
+	double total = 0.0;
+	uint64_t state = KMEANS_SEED;
+	uint32_t duplicate_count = 0;
+	uint32_t num_trials = 2 + (uint32_t) log(k);
+	uint32_t i, j, t;
 
 	/* k=0, k=1: "clustering" is just input validation */
 	assert(k > 1);
 
-	/* k >= 2: find two distant points greedily */
-	for (i = 1; i < n; i++)
-	{
-		/* skip null */
-		if (!objs[i]) continue;
+	/* arrays of minimum squared distance to a point from accepted cluster centers,
+	 * and from them plus the candidate being tried and the best candidate */
+	distances = lwalloc(sizeof(double) * n);
+	trial_distances = lwalloc(sizeof(double) * n);
+	best_distances = lwalloc(sizeof(double) * n);
 
-		/* reinit if first element happened to be null */
-		if (!objs[p1] && !objs[p2])
-		{
-			p1 = i;
-			p2 = i;
-			continue;
-		}
-
-		/* if we found a larger distance, replace our choice */
-		dst_p1 = distance2d_sqr_pt_pt(objs[i], objs[p1]);
-		dst_p2 = distance2d_sqr_pt_pt(objs[i], objs[p2]);
-		if ((dst_p1 > max_dst) || (dst_p2 > max_dst))
-		{
-			max_dst = fmax(dst_p1, dst_p2);
-			if (dst_p1 > dst_p2)
-				p2 = i;
-			else
-				p1 = i;
-		}
-		if ((dst_p1 == 0) || (dst_p2 == 0)) duplicate_count++;
+	cx[0] = x[0];
+	cy[0] = y[0];
+	for (j = 0; j < n; j++)
+	{
+		double dx = x[j] - cx[0];
+		double dy = y[j] - cy[0];
+		distances[j] = dx * dx + dy * dy;
+		total += distances[j];
+		if (distances[j] == 0)
+			duplicate_count++; /* a point is a duplicate of itself */
 	}
 	if (duplicate_count > 1)
 		lwnotice(
@@ -174,85 +270,77 @@ kmeans_init(POINT2D** objs, int* clusters, uint32_t n, POINT2D** centers, POINT2
 		    __func__,
 		    duplicate_count);
 
-	/* by now two points should be found and non-same */
-	assert(p1 != p2 && objs[p1] && objs[p2] && max_dst >= 0);
-
-	/* accept these two points */
-	centers_raw[0] = *((POINT2D *)objs[p1]);
-	centers[0] = &(centers_raw[0]);
-	centers_raw[1] = *((POINT2D *)objs[p2]);
-	centers[1] = &(centers_raw[1]);
-
-	if (k > 2)
+	for (i = 1; i < k; i++)
 	{
-		/* array of minimum distance to a point from accepted cluster centers */
-		distances = lwalloc(sizeof(double) * n);
+		uint32_t best_candidate = UINT32_MAX;
+		double best_total = DBL_MAX;
 
-		/* initialize array with distance to first object */
-		for (j = 0; j < n; j++)
+		for (t = 0; t < num_trials; t++)
 		{
-			if (objs[j])
-				distances[j] = distance2d_sqr_pt_pt(objs[j], centers[0]);
-			else
-				distances[j] = -1;
-		}
-		distances[p1] = -1;
-		distances[p2] = -1;
+			uint32_t candidate = kmeans_draw(distances, n, total, &state);
+			double trial_total = 0.0;
 
-		/* loop i on clusters, skip 0 and 1 as found already */
-		for (i = 2; i < k; i++)
-		{
-			uint32_t candidate_center = 0;
-			double max_distance = -DBL_MAX;
+			if (candidate == UINT32_MAX)
+				break;
 
-			/* loop j on objs */
 			for (j = 0; j < n; j++)
 			{
-				/* empty objs and accepted clusters are already marked with distance = -1 */
-				if (distances[j] < 0) continue;
-
-				/* update minimal distance with previosuly accepted cluster */
-				distances[j] = fmin(distance2d_sqr_pt_pt(objs[j], centers[i - 1]), distances[j]);
-
-				/* greedily take a point that's farthest from any of accepted clusters */
-				if (distances[j] > max_distance)
-				{
-					candidate_center = j;
-					max_distance = distances[j];
-				}
+				double dx = x[j] - x[candidate];
+				double dy = y[j] - y[candidate];
+				trial_distances[j] = fmin(distances[j], dx * dx + dy * dy);
+				trial_total += trial_distances[j];
+			}
+
+			if (trial_total < best_total)
+			{
+				double* swap = best_distances;
+				best_distances = trial_distances;
+				trial_distances = swap;
+				best_candidate = candidate;
+				best_total = trial_total;
 			}
+		}
 
-			/* Checked earlier by counting entries on input, just in case */
-			assert(max_distance >= 0);
+		/* When every point already sits on a center, any will do */
+		if (best_candidate == UINT32_MAX)
+		{
+			cx[i] = x[i];
+			cy[i] = y[i];
+			continue;
+		}
 
-			/* accept candidate to centers */
-			distances[candidate_center] = -1;
-			/* Copy the point coordinates into the initial centers array
-			 * Centers array is an array of pointers to points, not an array of points */
-			centers_raw[i] = *((POINT2D *)objs[candidate_center]);
-			centers[i] = &(centers_raw[i]);
+		/* accept candidate to centers */
+		cx[i] = x[best_candidate];
+		cy[i] = y[best_candidate];
+		{
+			double* swap = distances;
+			distances = best_distances;
+			best_distances = swap;
+			total = best_total;
 		}
-		lwfree(distances);
 	}
+
+	lwfree(distances);
+	lwfree(trial_distances);
+	lwfree(best_distances);
 }
 
 int*
 lwgeom_cluster_2d_kmeans(const LWGEOM** geoms, uint32_t n, uint32_t k)
 {
 	uint32_t i;
-	uint32_t num_centroids = 0;
 	uint32_t num_non_empty = 0;
-	LWGEOM** centroids;
-	POINT2D* centers_raw;
-	const POINT2D* cp;
 	int result = LW_FALSE;
 
-	/* An array of objects to be analyzed.
+	/* Coordinates of the objects to be analyzed, and their input positions.
 	 * All NULL values will be returned in the KMEANS_NULL_CLUSTER. */
-	POINT2D** objs;
+	double* objs_x;
+	double* objs_y;
+	uint32_t* objs_ids;
 
-	/* An array of centers for the algorithm. */
-	POINT2D** centers;
+	/* Coordinates of the centers for the algorithm. */
+	double* centers_x;
+	double* centers_y;
 
 	/* Array to fill in with cluster numbers. */
 	int* clusters;
@@ -267,55 +355,47 @@ lwgeom_cluster_2d_kmeans(const LWGEOM** geoms, uint32_t n, uint32_t k)
 		k = n;
 	}
 
-	/* We'll hold the temporary centroid objects here */
-	centroids = lwalloc(sizeof(LWGEOM*) * n);
-	memset(centroids, 0, sizeof(LWGEOM*) * n);
-
-	/* The vector of cluster means. We have to allocate a chunk of memory for these because we'll be mutating them
-	 * in the kmeans algorithm */
-	centers_raw = lwalloc(sizeof(POINT2D) * k);
-	memset(centers_raw, 0, sizeof(POINT2D) * k);
-
 	/* K-means configuration setup */
-	objs = lwalloc(sizeof(POINT2D*) * n);
+	objs_x = lwalloc(sizeof(double) * n);
+	objs_y = lwalloc(sizeof(double) * n);
+	objs_ids = lwalloc(sizeof(uint32_t) * n);
 	clusters = lwalloc(sizeof(int) * n);
-	centers = lwalloc(sizeof(POINT2D*) * k);
+	centers_x = lwalloc(sizeof(double) * k);
+	centers_y = lwalloc(sizeof(double) * k);
 
-	/* Clean the memory */
-	memset(objs, 0, sizeof(POINT2D*) * n);
-	memset(clusters, 0, sizeof(int) * n);
-	memset(centers, 0, sizeof(POINT2D*) * k);
-
-	/* Prepare the list of object pointers for K-means */
+	/* Gather the coordinates of the objects for K-means */
 	for (i = 0; i < n; i++)
 	{
 		const LWGEOM* geom = geoms[i];
-		LWPOINT* lwpoint;
+		LWGEOM* centroid = NULL;
+		const POINT2D* cp;
 
-		/* Null/empty geometries get a NULL pointer, set earlier with memset */
+		/* Null/empty geometries stay out of the clustering */
+		clusters[i] = KMEANS_NULL_CLUSTER;
 		if ((!geom) || lwgeom_is_empty(geom)) continue;
 
 		/* If the input is a point, use its coordinates */
 		/* If its not a point, convert it to one via centroid */
 		if (lwgeom_get_type(geom) != POINTTYPE)
 		{
-			LWGEOM* centroid = lwgeom_centroid(geom);
+			centroid = lwgeom_centroid(geom);
 			if ((!centroid)) continue;
 			if (lwgeom_is_empty(centroid))
 			{
 				lwgeom_free(centroid);
 				continue;
 			}
-			centroids[num_centroids++] = centroid;
-			lwpoint = lwgeom_as_lwpoint(centroid);
+			geom = centroid;
 		}
-		else
-			lwpoint = lwgeom_as_lwpoint(geom);
 
-		/* Store a pointer to the POINT2D we are interested in */
-		cp = getPoint2d_cp(lwpoint->point, 0);
-		objs[i] = (POINT2D*)cp;
+		cp = getPoint2d_cp(lwgeom_as_lwpoint(geom)->point, 0);
+		objs_x[num_non_empty] = cp->x;
+		objs_y[num_non_empty] = cp->y;
+		objs_ids[num_non_empty] = i;
 		num_non_empty++;
+
+		if (centroid)
+			lwgeom_free(centroid);
 	}
 
 	if (num_non_empty < k)
@@ -326,28 +406,30 @@ lwgeom_cluster_2d_kmeans(const LWGEOM** geoms, uint32_t n, uint32_t k)
 
 	if (k > 1)
 	{
-		kmeans_init(objs, clusters, n, centers, centers_raw, k);
-		result = kmeans(objs, clusters, n, centers, k);
+		int* objs_clusters = lwalloc(sizeof(int) * num_non_empty);
+
+		kmeans_init(objs_x, objs_y, num_non_empty, centers_x, centers_y, k);
+		result = kmeans(objs_x, objs_y, objs_clusters, num_non_empty, centers_x, centers_y, k);
+
+		for (i = 0; i < num_non_empty; i++)
+			clusters[objs_ids[i]] = objs_clusters[i];
+		lwfree(objs_clusters);
 	}
 	else
 	{
 		/* k=0: everythong is unclusterable
 		 * k=1: mark up NULL and non-NULL */
-		for (i = 0; i < n; i++)
-		{
-			if (k == 0 || !objs[i])
-				clusters[i] = KMEANS_NULL_CLUSTER;
-			else
-				clusters[i] = 0;
-		}
+		for (i = 0; i < num_non_empty && k == 1; i++)
+			clusters[objs_ids[i]] = 0;
 		result = LW_TRUE;
 	}
 
 	/* Before error handling, might as well clean up all the inputs */
-	lwfree(objs);
-	lwfree(centers);
-	lwfree(centers_raw);
-	lwfree(centroids);
+	lwfree(objs_x);
+	lwfree(objs_y);
+	lwfree(objs_ids);
+	lwfree(centers_x);
+	lwfree(centers_y);
 
 	/* Good result */
 	if (result) return clusters;
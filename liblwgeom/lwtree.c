@@ -439,6 +439,7 @@ rect_tree_is_area(const RECT_NODE *node)
 	{
 		case POLYGONTYPE:
 		case CURVEPOLYTYPE:
+		case MULTIPOLYGONTYPE:
 		case MULTISURFACETYPE:
 			return LW_TRUE;
 
@@ -763,8 +764,11 @@ rect_tree_from_lwpoly(const LWGEOM *lwgeom)
 		}
 	}
 	tree = rect_nodes_merge(nodes, j);
-	tree->geom_type = lwgeom->type;
 	lwfree(nodes);
+	/* All rings were zero length */
+	if (!tree)
+		return NULL;
+	tree->geom_type = lwgeom->type;
 	return tree;
 }
 
@@ -807,9 +811,11 @@ rect_tree_from_lwcurvepoly(const LWGEOM *lwgeom)
 	qsort(nodes, j, sizeof(RECT_NODE*), rect_node_cmp);
 
 	tree = rect_nodes_merge(nodes, j);
+	lwfree(nodes);
+	if (!tree)
+		return NULL;
 
 	tree->geom_type = lwgeom->type;
-	lwfree(nodes);
 	return tree;
 
 }
@@ -851,9 +857,12 @@ rect_tree_from_lwcollection(const LWGEOM *lwgeom)
 		qsort(nodes, j, sizeof(RECT_NODE*), rect_node_cmp);
 
 	tree = rect_nodes_merge(nodes, j);
+	lwfree(nodes);
+	/* Only empty sub-geometries */
+	if (!tree)
+		return NULL;
 
 	tree->geom_type = lwgeom->type;
-	lwfree(nodes);
 	return tree;
 }
 
@@ -1382,3 +1391,105 @@ double rect_tree_distance_tree(RECT_NODE *n1, RECT_NODE *n2, double threshold)
 	// *p2 = state.p2;
 	return distance;
 }
+
+/*
+* The furthest apart the objects in two nodes can be is the
+* distance between the furthest corners of the nodes
+*/
+static inline double
+rect_node_furthest_distance(const RECT_NODE *n1, const RECT_NODE *n2)
+{
+	double dx = FP_MAX(n1->xmax - n2->xmin, n2->xmax - n1->xmin);
+	double dy = FP_MAX(n1->ymax - n2->ymin, n2->ymax - n1->ymin);
+	return sqrt(dx*dx + dy*dy);
+}
+
+/*
+* The vertices of a leaf, one for points, two for straight
+* edges and three for arcs
+*/
+static inline int
+rect_leaf_node_vertices(const RECT_NODE_LEAF *n, const POINT2D **pts)
+{
+	switch (n->seg_type)
+	{
+		case RECT_NODE_SEG_POINT:
+			pts[0] = getPoint2d_cp(n->pa, n->seg_num);
+			return 1;
+		case RECT_NODE_SEG_LINEAR:
+			pts[0] = getPoint2d_cp(n->pa, n->seg_num);
+			pts[1] = getPoint2d_cp(n->pa, n->seg_num+1);
+			return 2;
+		case RECT_NODE_SEG_CIRCULAR:
+			pts[0] = getPoint2d_cp(n->pa, n->seg_num*2);
+			pts[1] = getPoint2d_cp(n->pa, n->seg_num*2+1);
+			pts[2] = getPoint2d_cp(n->pa, n->seg_num*2+2);
+			return 3;
+		default:
+			lwerror("%s: unsupported seg_type - %d", __func__, n->seg_type);
+			return 0;
+	}
+}
+
+static void
+rect_tree_max_distance_tree_recursive(const RECT_NODE *n1, const RECT_NODE *n2, RECT_TREE_DISTANCE_STATE *state)
+{
+	int i, j;
+
+	/* Short circuit once we've passed a positive threshold */
+	if (state->threshold > 0.0 && state->max_dist > state->threshold)
+		return;
+
+	/* Nothing in here can beat the current winner, or pass the threshold */
+	if (rect_node_furthest_distance(n1, n2) <= FP_MAX(state->max_dist, state->threshold))
+		return;
+
+	/* Both leaf nodes, the furthest pair of vertices */
+	if (rect_node_is_leaf(n1) && rect_node_is_leaf(n2))
+	{
+		const POINT2D *p[3], *q[3];
+		int np = rect_leaf_node_vertices(&n1->l, p);
+		int nq = rect_leaf_node_vertices(&n2->l, q);
+		for (i = 0; i < np; i++)
+		{
+			for (j = 0; j < nq; j++)
+			{
+				double d = distance(p[i]->x, p[i]->y, q[j]->x, q[j]->y);
+				if (d > state->max_dist)
+				{
+					state->max_dist = d;
+					state->p1 = *(p[i]);
+					state->p2 = *(q[j]);
+				}
+			}
+		}
+	}
+	/* Recurse into nodes */
+	else if (rect_node_is_leaf(n1))
+	{
+		for (i = 0; i < n2->i.num_nodes; i++)
+			rect_tree_max_distance_tree_recursive(n1, n2->i.nodes[i], state);
+	}
+	else if (rect_node_is_leaf(n2))
+	{
+		for (i = 0; i < n1->i.num_nodes; i++)
+			rect_tree_max_distance_tree_recursive(n1->i.nodes[i], n2, state);
+	}
+	else
+	{
+		for (i = 0; i < n1->i.num_nodes; i++)
+			for (j = 0; j < n2->i.num_nodes; j++)
+				rect_tree_max_distance_tree_recursive(n1->i.nodes[i], n2->i.nodes[j], state);
+	}
+}
+
+double rect_tree_max_distance_tree(RECT_NODE *n1, RECT_NODE *n2, double threshold)
+{
+	RECT_TREE_DISTANCE_STATE state;
+
+	state.threshold = threshold;
+	state.min_dist = 0.0;
+	state.max_dist = 0.0;
+	rect_tree_max_distance_tree_recursive(n1, n2, &state);
+	return state.max_dist;
+}
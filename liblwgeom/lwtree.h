@@ -102,6 +102,14 @@ int rect_tree_intersects_tree(RECT_NODE *tree1, RECT_NODE *tree2);
 */
 double rect_tree_distance_tree(RECT_NODE *n1, RECT_NODE *n2, double threshold);
 
+/**
+* Return the maximum distance between two RECT_NODE trees. With a
+* positive threshold, return as soon as some distance is past it,
+* or some value no more than threshold if none is. Only exact for
+* trees without arcs.
+*/
+double rect_tree_max_distance_tree(RECT_NODE *n1, RECT_NODE *n2, double threshold);
+
 /**
 * Free the rect-tree memory
 */
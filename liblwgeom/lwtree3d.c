@@ -0,0 +1,612 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************
+ *
+ * ^copyright^
+ *
+ **********************************************************************/
+
+#include "liblwgeom_internal.h"
+#include "lwgeom_log.h"
+#include "lwtree3d.h"
+
+static inline int
+rect3d_node_is_leaf(const RECT3D_NODE *node)
+{
+	return node->type == RECT3D_NODE_LEAF_TYPE;
+}
+
+/*
+* Support qsort of nodes for collection types so nodes
+* are in "spatial adjacent" order prior to merging.
+*/
+static int
+rect3d_node_cmp(const void *pn1, const void *pn2)
+{
+	GBOX b1, b2;
+	RECT3D_NODE *n1 = *((RECT3D_NODE**)pn1);
+	RECT3D_NODE *n2 = *((RECT3D_NODE**)pn2);
+	uint64_t h1, h2;
+	b1.flags = 0;
+	b1.xmin = n1->xmin;
+	b1.xmax = n1->xmax;
+	b1.ymin = n1->ymin;
+	b1.ymax = n1->ymax;
+
+	b2.flags = 0;
+	b2.xmin = n2->xmin;
+	b2.xmax = n2->xmax;
+	b2.ymin = n2->ymin;
+	b2.ymax = n2->ymax;
+
+	h1 = gbox_get_sortable_hash(&b1);
+	h2 = gbox_get_sortable_hash(&b2);
+	return h1 < h2 ? -1 : (h1 > h2 ? 1 : 0);
+}
+
+/**
+* Recurse from top of node tree and free all children.
+* does not free underlying geometry.
+*/
+void
+rect3d_tree_free(RECT3D_NODE *node)
+{
+	int i;
+	if (!node) return;
+	if (!rect3d_node_is_leaf(node))
+	{
+		for (i = 0; i < node->i.num_nodes; i++)
+		{
+			rect3d_tree_free(node->i.nodes[i]);
+			node->i.nodes[i] = NULL;
+		}
+	}
+	else if (node->l.plane)
+	{
+		lwfree(node->l.plane);
+	}
+	lwfree(node);
+}
+
+/*
+* Create a new leaf node for a point or an edge.
+*/
+static RECT3D_NODE *
+rect3d_node_leaf_new(const POINTARRAY *pa, int seg_num, RECT3D_NODE_SEG_TYPE seg_type)
+{
+	POINT3DZ p1, p2;
+	RECT3D_NODE *node;
+
+	getPoint3dz_p(pa, seg_num, &p1);
+	if (seg_type == RECT3D_NODE_SEG_LINEAR)
+	{
+		getPoint3dz_p(pa, seg_num+1, &p2);
+		/* Zero length edge, doesn't get a node */
+		if (p1.x == p2.x && p1.y == p2.y && p1.z == p2.z)
+			return NULL;
+	}
+	else
+	{
+		p2 = p1;
+	}
+
+	node = lwalloc(sizeof(RECT3D_NODE));
+	node->type = RECT3D_NODE_LEAF_TYPE;
+	node->xmin = FP_MIN(p1.x, p2.x);
+	node->xmax = FP_MAX(p1.x, p2.x);
+	node->ymin = FP_MIN(p1.y, p2.y);
+	node->ymax = FP_MAX(p1.y, p2.y);
+	node->zmin = FP_MIN(p1.z, p2.z);
+	node->zmax = FP_MAX(p1.z, p2.z);
+	node->l.pa = pa;
+	node->l.poly = NULL;
+	node->l.plane = NULL;
+	node->l.seg_type = seg_type;
+	node->l.seg_num = seg_num;
+	return node;
+}
+
+/*
+* Create a new leaf node for the inside of a polygon, boxed
+* by its exterior ring.
+*/
+static RECT3D_NODE *
+rect3d_node_face_new(const LWPOLY *poly, const PLANE3D *plane)
+{
+	const POINTARRAY *pa = poly->rings[0];
+	RECT3D_NODE *node = lwalloc(sizeof(RECT3D_NODE));
+	POINT3DZ p;
+	uint32_t i;
+
+	getPoint3dz_p(pa, 0, &p);
+	node->xmin = node->xmax = p.x;
+	node->ymin = node->ymax = p.y;
+	node->zmin = node->zmax = p.z;
+	for (i = 1; i < pa->npoints; i++)
+	{
+		getPoint3dz_p(pa, i, &p);
+		node->xmin = FP_MIN(node->xmin, p.x);
+		node->xmax = FP_MAX(node->xmax, p.x);
+		node->ymin = FP_MIN(node->ymin, p.y);
+		node->ymax = FP_MAX(node->ymax, p.y);
+		node->zmin = FP_MIN(node->zmin, p.z);
+		node->zmax = FP_MAX(node->zmax, p.z);
+	}
+
+	node->type = RECT3D_NODE_LEAF_TYPE;
+	node->l.pa = pa;
+	node->l.poly = poly;
+	node->l.plane = lwalloc(sizeof(PLANE3D));
+	*(node->l.plane) = *plane;
+	node->l.seg_type = RECT3D_NODE_SEG_FACE;
+	node->l.seg_num = 0;
+	return node;
+}
+
+static void
+rect3d_node_internal_add_node(RECT3D_NODE *node, RECT3D_NODE *add)
+{
+	if (rect3d_node_is_leaf(node))
+		lwerror("%s: call on leaf node", __func__);
+	node->xmin = FP_MIN(node->xmin, add->xmin);
+	node->xmax = FP_MAX(node->xmax, add->xmax);
+	node->ymin = FP_MIN(node->ymin, add->ymin);
+	node->ymax = FP_MAX(node->ymax, add->ymax);
+	node->zmin = FP_MIN(node->zmin, add->zmin);
+	node->zmax = FP_MAX(node->zmax, add->zmax);
+	node->i.nodes[node->i.num_nodes++] = add;
+	return;
+}
+
+static RECT3D_NODE *
+rect3d_node_internal_new(const RECT3D_NODE *seed)
+{
+	RECT3D_NODE *node = lwalloc(sizeof(RECT3D_NODE));
+	node->xmin = seed->xmin;
+	node->xmax = seed->xmax;
+	node->ymin = seed->ymin;
+	node->ymax = seed->ymax;
+	node->zmin = seed->zmin;
+	node->zmax = seed->zmax;
+	node->type = RECT3D_NODE_INTERNAL_TYPE;
+	node->i.num_nodes = 0;
+	return node;
+}
+
+/*
+* Same as rect_nodes_merge: the incoming nodes are expected
+* in a spatially coherent order, and get grouped RECT3D_NODE_SIZE
+* at a time until a single root is left.
+*/
+static RECT3D_NODE *
+rect3d_nodes_merge(RECT3D_NODE **nodes, uint32_t num_nodes)
+{
+	if (num_nodes < 1)
+	{
+		return NULL;
+	}
+
+	while (num_nodes > 1)
+	{
+		uint32_t i, k = 0;
+		RECT3D_NODE *node = NULL;
+		for (i = 0; i < num_nodes; i++)
+		{
+			if (!node)
+				node = rect3d_node_internal_new(nodes[i]);
+
+			rect3d_node_internal_add_node(node, nodes[i]);
+
+			if (node->i.num_nodes == RECT3D_NODE_SIZE)
+			{
+				nodes[k++] = node;
+				node = NULL;
+			}
+		}
+		if (node)
+			nodes[k++] = node;
+		num_nodes = k;
+	}
+
+	return nodes[0];
+}
+
+/*
+* Build a tree of nodes from a point array, one node per edge.
+* If every edge is zero length the array is a point.
+*/
+static RECT3D_NODE *
+rect3d_tree_from_ptarray(const POINTARRAY *pa)
+{
+	uint32_t i, j = 0;
+	RECT3D_NODE **nodes;
+	RECT3D_NODE *tree;
+
+	/* Without an edge the distance functions find nothing here */
+	if (pa->npoints < 2)
+		return NULL;
+
+	nodes = lwalloc(sizeof(RECT3D_NODE*) * (pa->npoints - 1));
+	for (i = 0; i < pa->npoints - 1; i++)
+	{
+		RECT3D_NODE *node = rect3d_node_leaf_new(pa, i, RECT3D_NODE_SEG_LINEAR);
+		if (node) /* Not zero length? */
+			nodes[j++] = node;
+	}
+
+	if (j)
+		tree = rect3d_nodes_merge(nodes, j);
+	else
+		tree = rect3d_node_leaf_new(pa, 0, RECT3D_NODE_SEG_POINT);
+
+	lwfree(nodes);
+	return tree;
+}
+
+/*
+* A polygon that defines a plane is its face and the edges of
+* all its rings. One that doesn't is measured as its exterior
+* ring, as lw_dist3d_poly_poly and friends do.
+*/
+static RECT3D_NODE *
+rect3d_tree_from_lwpoly(const LWPOLY *lwpoly)
+{
+	RECT3D_NODE **nodes;
+	RECT3D_NODE *tree;
+	PLANE3D plane;
+	uint32_t i, nrings = 1, j = 0;
+
+	if (lwpoly->nrings < 1)
+		return NULL;
+
+	nodes = lwalloc(sizeof(RECT3D_NODE*) * (lwpoly->nrings + 1));
+	if (define_plane(lwpoly->rings[0], &plane))
+	{
+		nodes[j++] = rect3d_node_face_new(lwpoly, &plane);
+		nrings = lwpoly->nrings;
+	}
+
+	for (i = 0; i < nrings; i++)
+	{
+		RECT3D_NODE *node = rect3d_tree_from_ptarray(lwpoly->rings[i]);
+		if (node)
+			nodes[j++] = node;
+	}
+
+	tree = rect3d_nodes_merge(nodes, j);
+	lwfree(nodes);
+	return tree;
+}
+
+static RECT3D_NODE *
+rect3d_tree_from_lwcollection(const LWCOLLECTION *lwcol)
+{
+	RECT3D_NODE **nodes;
+	RECT3D_NODE *tree;
+	uint32_t i;
+
+	if (lwcol->ngeoms < 1)
+		return NULL;
+
+	/* Build one tree for each sub-geometry, then merge their roots */
+	nodes = lwalloc(sizeof(RECT3D_NODE*) * lwcol->ngeoms);
+	for (i = 0; i < lwcol->ngeoms; i++)
+	{
+		nodes[i] = rect3d_tree_from_lwgeom(lwcol->geoms[i]);
+		/* An empty part stops lw_dist3d_recursive, leave those to it */
+		if (!nodes[i])
+		{
+			while (i > 0)
+				rect3d_tree_free(nodes[--i]);
+			lwfree(nodes);
+			return NULL;
+		}
+	}
+
+	/* Sort the nodes using a z-order curve, so that merging the nodes */
+	/* gives a spatially coherent tree (near things are in near nodes) */
+	qsort(nodes, lwcol->ngeoms, sizeof(RECT3D_NODE*), rect3d_node_cmp);
+
+	tree = rect3d_nodes_merge(nodes, lwcol->ngeoms);
+	lwfree(nodes);
+	return tree;
+}
+
+RECT3D_NODE *
+rect3d_tree_from_lwgeom(const LWGEOM *lwgeom)
+{
+	if (lwgeom_is_empty(lwgeom))
+		return NULL;
+
+	switch(lwgeom->type)
+	{
+		case POINTTYPE:
+			return rect3d_node_leaf_new(((const LWPOINT*)lwgeom)->point, 0, RECT3D_NODE_SEG_POINT);
+		case LINETYPE:
+			return rect3d_tree_from_ptarray(((const LWLINE*)lwgeom)->points);
+		case POLYGONTYPE:
+			return rect3d_tree_from_lwpoly((const LWPOLY*)lwgeom);
+		case MULTIPOINTTYPE:
+		case MULTILINETYPE:
+		case MULTIPOLYGONTYPE:
+		case POLYHEDRALSURFACETYPE:
+		case COLLECTIONTYPE:
+			return rect3d_tree_from_lwcollection((const LWCOLLECTION*)lwgeom);
+		default:
+			/* Not measured in 3D, let the usual code complain */
+			return NULL;
+	}
+	return NULL;
+}
+
+/*
+* The closest any two objects in two nodes can be is the smallest
+* distance between the boxes themselves.
+*/
+static inline double
+rect3d_node_min_distance(const RECT3D_NODE *n1, const RECT3D_NODE *n2)
+{
+	double dx = FP_MAX(0.0, FP_MAX(n1->xmin - n2->xmax, n2->xmin - n1->xmax));
+	double dy = FP_MAX(0.0, FP_MAX(n1->ymin - n2->ymax, n2->ymin - n1->ymax));
+	double dz = FP_MAX(0.0, FP_MAX(n1->zmin - n2->zmax, n2->zmin - n1->zmax));
+	return sqrt(dx*dx + dy*dy + dz*dz);
+}
+
+/*
+* Inside the exterior ring of a face and outside its holes,
+* as lw_dist3d_pt_poly decides it.
+*/
+static int
+rect3d_face_contains_point(const RECT3D_NODE_LEAF *face, const POINT3DZ *p)
+{
+	uint32_t i;
+
+	if (!pt_in_ring_3d(p, face->poly->rings[0], face->plane))
+		return LW_FALSE;
+
+	for (i = 1; i < face->poly->nrings; i++)
+	{
+		if (pt_in_ring_3d(p, face->poly->rings[i], face->plane))
+			return LW_FALSE;
+	}
+	return LW_TRUE;
+}
+
+/*
+* Distance from a point or edge to the inside of a face: zero where
+* the edge crosses the face, or the distance from an end straight
+* above it. Closer places near the rings are found by the edges of
+* the face, so points projecting outside it are skipped here.
+*/
+static void
+rect3d_leaf_face_distance(const RECT3D_NODE_LEAF *n, const RECT3D_NODE_LEAF *face, DISTPTS3D *dl)
+{
+	POINT3DZ p[2], projp[2];
+	double s[2];
+	int i, np = (n->seg_type == RECT3D_NODE_SEG_POINT) ? 1 : 2;
+
+	for (i = 0; i < np; i++)
+	{
+		getPoint3dz_p(n->pa, n->seg_num + i, &(p[i]));
+		/* A point right on the point of the plane is left alone */
+		projp[i] = p[i];
+		/* The sign of s tells us on which side of the plane the point is */
+		s[i] = project_point_on_plane(&(p[i]), face->plane, &(projp[i]));
+	}
+
+	/* The edge goes through the plane, maybe inside the face */
+	if (np == 2 && (s[0] * s[1]) < 0)
+	{
+		double f = fabs(s[0]) / (fabs(s[0]) + fabs(s[1]));
+		POINT3DZ ip;
+
+		ip.x = projp[0].x + f * (projp[1].x - projp[0].x);
+		ip.y = projp[0].y + f * (projp[1].y - projp[0].y);
+		ip.z = projp[0].z + f * (projp[1].z - projp[0].z);
+
+		if (rect3d_face_contains_point(face, &ip))
+		{
+			dl->distance = 0.0;
+			dl->p1 = ip;
+			dl->p2 = ip;
+			return;
+		}
+	}
+
+	for (i = 0; i < np; i++)
+	{
+		double dx = p[i].x - projp[i].x;
+		double dy = p[i].y - projp[i].y;
+		double dz = p[i].z - projp[i].z;
+
+		/* Only worth a point in polygon test if it could be closer */
+		if (sqrt(dx*dx + dy*dy + dz*dz) < dl->distance &&
+		    rect3d_face_contains_point(face, &(projp[i])))
+		{
+			lw_dist3d_pt_pt(&(p[i]), &(projp[i]), dl);
+		}
+	}
+}
+
+/*
+* Leaf nodes are points, straight edges or faces, each pair
+* goes to the matching 3D distance calculation. The points
+* are kept in tree order, first tree first.
+*/
+static void
+rect3d_leaf_node_distance(const RECT3D_NODE_LEAF *n1, const RECT3D_NODE_LEAF *n2, RECT3D_TREE_DISTANCE_STATE *state)
+{
+	POINT3DZ p1, p2, q1, q2;
+	DISTPTS3D dl;
+
+	dl.mode = DIST_MIN;
+	dl.distance = state->min_dist;
+	dl.tolerance = 0.0;
+	dl.twisted = 1;
+
+	if (n1->seg_type == RECT3D_NODE_SEG_FACE || n2->seg_type == RECT3D_NODE_SEG_FACE)
+	{
+		/* Two faces are closest at the edges of one of them */
+		if (n1->seg_type == RECT3D_NODE_SEG_FACE && n2->seg_type == RECT3D_NODE_SEG_FACE)
+			return;
+
+		if (n1->seg_type == RECT3D_NODE_SEG_FACE)
+		{
+			dl.twisted = -1;
+			rect3d_leaf_face_distance(n2, n1, &dl);
+		}
+		else
+		{
+			rect3d_leaf_face_distance(n1, n2, &dl);
+		}
+	}
+	else
+	{
+		getPoint3dz_p(n1->pa, n1->seg_num, &p1);
+		getPoint3dz_p(n2->pa, n2->seg_num, &q1);
+
+		if (n1->seg_type == RECT3D_NODE_SEG_POINT && n2->seg_type == RECT3D_NODE_SEG_POINT)
+		{
+			lw_dist3d_pt_pt(&p1, &q1, &dl);
+		}
+		else if (n1->seg_type == RECT3D_NODE_SEG_POINT)
+		{
+			getPoint3dz_p(n2->pa, n2->seg_num+1, &q2);
+			lw_dist3d_pt_seg(&p1, &q1, &q2, &dl);
+		}
+		else if (n2->seg_type == RECT3D_NODE_SEG_POINT)
+		{
+			getPoint3dz_p(n1->pa, n1->seg_num+1, &p2);
+			dl.twisted = -1;
+			lw_dist3d_pt_seg(&q1, &p1, &p2, &dl);
+		}
+		else
+		{
+			getPoint3dz_p(n1->pa, n1->seg_num+1, &p2);
+			getPoint3dz_p(n2->pa, n2->seg_num+1, &q2);
+			lw_dist3d_seg_seg(&p1, &p2, &q1, &q2, &dl);
+		}
+	}
+
+	/* If this is a new global minima, save it */
+	if (dl.distance < state->min_dist)
+	{
+		state->min_dist = dl.distance;
+		state->p1 = dl.p1;
+		state->p2 = dl.p2;
+	}
+}
+
+typedef struct
+{
+	double d;
+	RECT3D_NODE *n1;
+	RECT3D_NODE *n2;
+} RECT3D_NODE_PAIR;
+
+static int
+rect3d_node_pair_cmp(const void *a, const void *b)
+{
+	const RECT3D_NODE_PAIR *p1 = (const RECT3D_NODE_PAIR*)a;
+	const RECT3D_NODE_PAIR *p2 = (const RECT3D_NODE_PAIR*)b;
+	if (p1->d < p2->d) return -1;
+	else if (p1->d > p2->d) return 1;
+	else return 0;
+}
+
+/*
+* Visit the child pairs nearest box first, and stop at the first
+* pair whose boxes are no closer than the best distance so far.
+*/
+static void
+rect3d_tree_distance_tree_recursive(RECT3D_NODE *n1, RECT3D_NODE *n2, RECT3D_TREE_DISTANCE_STATE *state)
+{
+	RECT3D_NODE_PAIR pairs[RECT3D_NODE_SIZE * RECT3D_NODE_SIZE];
+	int i, j, num_pairs = 0;
+
+	/* Short circuit if we've already hit the threshold */
+	if (state->min_dist <= state->threshold)
+		return;
+
+	/* Both leaf nodes, do a real distance calculation */
+	if (rect3d_node_is_leaf(n1) && rect3d_node_is_leaf(n2))
+	{
+		rect3d_leaf_node_distance(&n1->l, &n2->l, state);
+		return;
+	}
+
+	if (rect3d_node_is_leaf(n1))
+	{
+		for (j = 0; j < n2->i.num_nodes; j++)
+		{
+			pairs[num_pairs].n1 = n1;
+			pairs[num_pairs++].n2 = n2->i.nodes[j];
+		}
+	}
+	else if (rect3d_node_is_leaf(n2))
+	{
+		for (i = 0; i < n1->i.num_nodes; i++)
+		{
+			pairs[num_pairs].n1 = n1->i.nodes[i];
+			pairs[num_pairs++].n2 = n2;
+		}
+	}
+	else
+	{
+		for (i = 0; i < n1->i.num_nodes; i++)
+		{
+			for (j = 0; j < n2->i.num_nodes; j++)
+			{
+				pairs[num_pairs].n1 = n1->i.nodes[i];
+				pairs[num_pairs++].n2 = n2->i.nodes[j];
+			}
+		}
+	}
+
+	for (i = 0; i < num_pairs; i++)
+		pairs[i].d = rect3d_node_min_distance(pairs[i].n1, pairs[i].n2);
+	qsort(pairs, num_pairs, sizeof(RECT3D_NODE_PAIR), rect3d_node_pair_cmp);
+
+	for (i = 0; i < num_pairs; i++)
+	{
+		/* Nothing in here can beat the current winner */
+		if (pairs[i].d >= state->min_dist)
+			break;
+		rect3d_tree_distance_tree_recursive(pairs[i].n1, pairs[i].n2, state);
+		if (state->min_dist <= state->threshold)
+			break;
+	}
+}
+
+double
+rect3d_tree_distance_tree(RECT3D_NODE *n1, RECT3D_NODE *n2, double threshold, POINT3DZ *p1, POINT3DZ *p2)
+{
+	RECT3D_TREE_DISTANCE_STATE state;
+
+	memset(&state, 0, sizeof(RECT3D_TREE_DISTANCE_STATE));
+	state.threshold = threshold;
+	state.min_dist = FLT_MAX;
+	rect3d_tree_distance_tree_recursive(n1, n2, &state);
+
+	if (p1)
+		*p1 = state.p1;
+	if (p2)
+		*p2 = state.p2;
+	return state.min_dist;
+}
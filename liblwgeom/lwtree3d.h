@@ -0,0 +1,112 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************
+ *
+ * ^copyright^
+ *
+ **********************************************************************/
+
+#ifndef _LWTREE3D_H
+#define _LWTREE3D_H 1
+
+#include "measures3d.h"
+
+#define RECT3D_NODE_SIZE 8
+
+typedef enum
+{
+	RECT3D_NODE_INTERNAL_TYPE,
+	RECT3D_NODE_LEAF_TYPE
+} RECT3D_NODE_TYPE;
+
+/*
+* Points and segments are the vertices and edges of the input.
+* A face is the inside of a polygon that defines a plane, its
+* edges are segment leaves of their own.
+*/
+typedef enum
+{
+	RECT3D_NODE_SEG_POINT = 1,
+	RECT3D_NODE_SEG_LINEAR,
+	RECT3D_NODE_SEG_FACE
+} RECT3D_NODE_SEG_TYPE;
+
+typedef struct
+{
+	const POINTARRAY *pa;
+	const LWPOLY *poly;
+	PLANE3D *plane;
+	RECT3D_NODE_SEG_TYPE seg_type;
+	int seg_num;
+} RECT3D_NODE_LEAF;
+
+struct rect3d_node;
+
+typedef struct
+{
+	int num_nodes;
+	struct rect3d_node *nodes[RECT3D_NODE_SIZE];
+} RECT3D_NODE_INTERNAL;
+
+typedef struct rect3d_node
+{
+	RECT3D_NODE_TYPE type;
+	double xmin;
+	double xmax;
+	double ymin;
+	double ymax;
+	double zmin;
+	double zmax;
+	union {
+		RECT3D_NODE_INTERNAL i;
+		RECT3D_NODE_LEAF l;
+	};
+} RECT3D_NODE;
+
+typedef struct rect3d_tree_distance_state
+{
+	double threshold;
+	double min_dist;
+	POINT3DZ p1;
+	POINT3DZ p2;
+} RECT3D_TREE_DISTANCE_STATE;
+
+/**
+* Create a 3D box tree on top of an LWGEOM with Z. Do not free the
+* LWGEOM until the tree is freed. Returns NULL for inputs the 3D
+* distance functions don't measure the usual way: empties, empty
+* parts, and types other than points, lines, polygons and their
+* collections.
+*/
+RECT3D_NODE * rect3d_tree_from_lwgeom(const LWGEOM *geom);
+
+/**
+* Return the 3D distance between two RECT3D_NODE trees, as
+* lwgeom_mindistance3d would. The search stops as soon as some
+* distance is no more than threshold. If p1 and p2 are not NULL
+* they get the closest points, on the first and second tree.
+*/
+double rect3d_tree_distance_tree(RECT3D_NODE *n1, RECT3D_NODE *n2, double threshold, POINT3DZ *p1, POINT3DZ *p2);
+
+/**
+* Free the tree memory
+*/
+void rect3d_tree_free(RECT3D_NODE *node);
+
+#endif /* _LWTREE3D_H */
@@ -108,6 +108,72 @@ UF_union(UNIONFIND* uf, uint32_t i, uint32_t j)
 	uf->num_clusters--;
 }
 
+uint32_t
+UF_atomic_find(UNIONFIND* uf, uint32_t i)
+{
+	uint32_t parent = __atomic_load_n(&uf->clusters[i], __ATOMIC_ACQUIRE);
+
+	/* Path halving: point each visited element at its grandparent. A failed
+	 * exchange only means another thread has already moved it closer. */
+	while (parent != i)
+	{
+		uint32_t grandparent = __atomic_load_n(&uf->clusters[parent], __ATOMIC_ACQUIRE);
+		if (grandparent != parent)
+			__atomic_compare_exchange_n(&uf->clusters[i], &parent, grandparent, LW_FALSE, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+		i = parent;
+		parent = __atomic_load_n(&uf->clusters[i], __ATOMIC_ACQUIRE);
+	}
+
+	return i;
+}
+
+void
+UF_atomic_union(UNIONFIND* uf, uint32_t i, uint32_t j)
+{
+	for (;;)
+	{
+		uint32_t a = UF_atomic_find(uf, i);
+		uint32_t b = UF_atomic_find(uf, j);
+		uint32_t expected;
+
+		if (a == b)
+			return;
+
+		/* Always link the larger root under the smaller one, so no cycle can
+		 * form; retry if the larger one stopped being a root meanwhile. */
+		if (a < b)
+		{
+			expected = b;
+			if (__atomic_compare_exchange_n(&uf->clusters[b], &expected, a, LW_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				return;
+		}
+		else
+		{
+			expected = a;
+			if (__atomic_compare_exchange_n(&uf->clusters[a], &expected, b, LW_FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				return;
+		}
+	}
+}
+
+void
+UF_atomic_finish(UNIONFIND* uf)
+{
+	uint32_t i;
+
+	uf->num_clusters = 0;
+	for (i = 0; i < uf->N; i++)
+		uf->cluster_sizes[i] = 0;
+
+	for (i = 0; i < uf->N; i++)
+	{
+		uint32_t root = UF_find(uf, i);
+		if (root == i)
+			uf->num_clusters++;
+		uf->cluster_sizes[root]++;
+	}
+}
+
 uint32_t*
 UF_ordered_by_cluster(UNIONFIND* uf)
 {
@@ -51,6 +51,21 @@ uint32_t UF_size(UNIONFIND* uf, uint32_t i);
 /* Merge the clusters that contain the two specified component ids */
 void UF_union(UNIONFIND* uf, uint32_t i, uint32_t j);
 
+/* Identify the cluster id associated with specified component id.
+ * Safe to call from several threads at once, along with UF_atomic_union,
+ * as long as no other UF function is used until UF_atomic_finish. */
+uint32_t UF_atomic_find(UNIONFIND* uf, uint32_t i);
+
+/* Merge the clusters that contain the two specified component ids.
+ * Safe to call from several threads at once; the cluster id of the merged
+ * cluster is the smallest of its component ids. Does not maintain
+ * cluster_sizes or num_clusters. */
+void UF_atomic_union(UNIONFIND* uf, uint32_t i, uint32_t j);
+
+/* Compress all paths and recompute cluster_sizes and num_clusters after a
+ * series of UF_atomic_union calls, once the threads making them are done. */
+void UF_atomic_finish(UNIONFIND* uf);
+
 /* Return an array of component ids, where components that are in the
  * same cluster are contiguous in the array */
 uint32_t* UF_ordered_by_cluster(UNIONFIND* uf);
@@ -27,6 +27,13 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <float.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "measures.h"
 #include "lwgeom_log.h"
@@ -1128,6 +1135,270 @@ lw_dist2d_pt_ptarrayarc(const POINT2D *p, const POINTARRAY *pa, DISTPTS *dl)
 
 
 
+/*------------------------------------------------------------------------------------------------------------
+Segment distance kernels
+Squared distances from one segment to a run of segments, several at a time.
+They only screen the segment pairs: the pairs that could come closer than
+the distance found so far are then handed to the usual functions, in the
+usual order, so the distance and the points found are the same.
+--------------------------------------------------------------------------------------------------------------*/
+
+/* Point arrays with fewer segments than this are not worth copying */
+#define DIST_KERNEL_MIN_SEGMENTS 16
+
+/* Number of segments screened in one go */
+#define DIST_KERNEL_BLOCK 32
+
+/*
+* Relative margin on the screening distance. The kernels and the
+* usual functions round differently, this keeps a pair the usual
+* functions would find closer, even by an ulp, from being screened out.
+*/
+#define DIST_KERNEL_MARGIN 1e-9
+
+static inline double
+dist_kernel_pt_seg_sqr(double px, double py, double ax, double ay, double bx, double by)
+{
+	double abx = bx - ax, aby = by - ay;
+	double len2 = abx * abx + aby * aby;
+	double r = ((px - ax) * abx + (py - ay) * aby) / (len2 > DBL_MIN ? len2 : DBL_MIN);
+	double cx, cy;
+	r = r < 0 ? 0 : (r > 1 ? 1 : r);
+	cx = ax + r * abx - px;
+	cy = ay + r * aby - py;
+	return cx * cx + cy * cy;
+}
+
+/* Squared distance between segments AB and CD, zero if they cross */
+static inline double
+dist_kernel_seg_seg_sqr(double ax, double ay, double bx, double by, double cx, double cy, double dx, double dy)
+{
+	double o1 = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+	double o2 = (bx - ax) * (dy - ay) - (by - ay) * (dx - ax);
+	double o3 = (dx - cx) * (ay - cy) - (dy - cy) * (ax - cx);
+	double o4 = (dx - cx) * (by - cy) - (dy - cy) * (bx - cx);
+	double d, dmin;
+
+	if (o1 * o2 <= 0 && o3 * o4 <= 0)
+		return 0;
+
+	dmin = dist_kernel_pt_seg_sqr(ax, ay, cx, cy, dx, dy);
+	d = dist_kernel_pt_seg_sqr(bx, by, cx, cy, dx, dy);
+	if (d < dmin) dmin = d;
+	d = dist_kernel_pt_seg_sqr(cx, cy, ax, ay, bx, by);
+	if (d < dmin) dmin = d;
+	d = dist_kernel_pt_seg_sqr(dx, dy, ax, ay, bx, by);
+	if (d < dmin) dmin = d;
+	return dmin;
+}
+
+#if defined(__AVX__)
+
+static inline __m256d
+dist_kernel_pt_seg_sqr_avx(__m256d px, __m256d py, __m256d ax, __m256d ay, __m256d bx, __m256d by)
+{
+	__m256d abx = _mm256_sub_pd(bx, ax), aby = _mm256_sub_pd(by, ay);
+	__m256d len2 = _mm256_add_pd(_mm256_mul_pd(abx, abx), _mm256_mul_pd(aby, aby));
+	__m256d r = _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(px, ax), abx), _mm256_mul_pd(_mm256_sub_pd(py, ay), aby));
+	__m256d cx, cy;
+	r = _mm256_div_pd(r, _mm256_max_pd(len2, _mm256_set1_pd(DBL_MIN)));
+	r = _mm256_min_pd(_mm256_max_pd(r, _mm256_setzero_pd()), _mm256_set1_pd(1.0));
+	cx = _mm256_sub_pd(_mm256_add_pd(ax, _mm256_mul_pd(r, abx)), px);
+	cy = _mm256_sub_pd(_mm256_add_pd(ay, _mm256_mul_pd(r, aby)), py);
+	return _mm256_add_pd(_mm256_mul_pd(cx, cx), _mm256_mul_pd(cy, cy));
+}
+
+static inline __m256d
+dist_kernel_cross_avx(__m256d ux, __m256d uy, __m256d vx, __m256d vy)
+{
+	return _mm256_sub_pd(_mm256_mul_pd(ux, vy), _mm256_mul_pd(uy, vx));
+}
+
+#elif defined(__SSE2__)
+
+static inline __m128d
+dist_kernel_pt_seg_sqr_sse2(__m128d px, __m128d py, __m128d ax, __m128d ay, __m128d bx, __m128d by)
+{
+	__m128d abx = _mm_sub_pd(bx, ax), aby = _mm_sub_pd(by, ay);
+	__m128d len2 = _mm_add_pd(_mm_mul_pd(abx, abx), _mm_mul_pd(aby, aby));
+	__m128d r = _mm_add_pd(_mm_mul_pd(_mm_sub_pd(px, ax), abx), _mm_mul_pd(_mm_sub_pd(py, ay), aby));
+	__m128d cx, cy;
+	r = _mm_div_pd(r, _mm_max_pd(len2, _mm_set1_pd(DBL_MIN)));
+	r = _mm_min_pd(_mm_max_pd(r, _mm_setzero_pd()), _mm_set1_pd(1.0));
+	cx = _mm_sub_pd(_mm_add_pd(ax, _mm_mul_pd(r, abx)), px);
+	cy = _mm_sub_pd(_mm_add_pd(ay, _mm_mul_pd(r, aby)), py);
+	return _mm_add_pd(_mm_mul_pd(cx, cx), _mm_mul_pd(cy, cy));
+}
+
+static inline __m128d
+dist_kernel_cross_sse2(__m128d ux, __m128d uy, __m128d vx, __m128d vy)
+{
+	return _mm_sub_pd(_mm_mul_pd(ux, vy), _mm_mul_pd(uy, vx));
+}
+
+#endif
+
+/*
+* Squared distances from segment AB to the n segments going from
+* (cx[i], cy[i]) to (dx[i], dy[i]), into d2[i]. Uses AVX or SSE2 when
+* the compiler targets them, four or two segments at a time.
+*/
+static void
+dist_kernel_seg_segs(const POINT2D *A, const POINT2D *B,
+                     const double *cx, const double *cy, const double *dx, const double *dy,
+                     uint32_t n, double *d2)
+{
+	uint32_t i = 0;
+
+#if defined(__AVX__)
+	__m256d ax = _mm256_set1_pd(A->x), ay = _mm256_set1_pd(A->y);
+	__m256d bx = _mm256_set1_pd(B->x), by = _mm256_set1_pd(B->y);
+	__m256d abx = _mm256_sub_pd(bx, ax), aby = _mm256_sub_pd(by, ay);
+	__m256d zero = _mm256_setzero_pd();
+
+	for (; i + 4 <= n; i += 4)
+	{
+		__m256d vcx = _mm256_loadu_pd(cx + i), vcy = _mm256_loadu_pd(cy + i);
+		__m256d vdx = _mm256_loadu_pd(dx + i), vdy = _mm256_loadu_pd(dy + i);
+		__m256d cdx = _mm256_sub_pd(vdx, vcx), cdy = _mm256_sub_pd(vdy, vcy);
+		__m256d o1 = dist_kernel_cross_avx(abx, aby, _mm256_sub_pd(vcx, ax), _mm256_sub_pd(vcy, ay));
+		__m256d o2 = dist_kernel_cross_avx(abx, aby, _mm256_sub_pd(vdx, ax), _mm256_sub_pd(vdy, ay));
+		__m256d o3 = dist_kernel_cross_avx(cdx, cdy, _mm256_sub_pd(ax, vcx), _mm256_sub_pd(ay, vcy));
+		__m256d o4 = dist_kernel_cross_avx(cdx, cdy, _mm256_sub_pd(bx, vcx), _mm256_sub_pd(by, vcy));
+		__m256d cross = _mm256_and_pd(_mm256_cmp_pd(_mm256_mul_pd(o1, o2), zero, _CMP_LE_OQ),
+		                              _mm256_cmp_pd(_mm256_mul_pd(o3, o4), zero, _CMP_LE_OQ));
+		__m256d d = dist_kernel_pt_seg_sqr_avx(ax, ay, vcx, vcy, vdx, vdy);
+		d = _mm256_min_pd(d, dist_kernel_pt_seg_sqr_avx(bx, by, vcx, vcy, vdx, vdy));
+		d = _mm256_min_pd(d, dist_kernel_pt_seg_sqr_avx(vcx, vcy, ax, ay, bx, by));
+		d = _mm256_min_pd(d, dist_kernel_pt_seg_sqr_avx(vdx, vdy, ax, ay, bx, by));
+		_mm256_storeu_pd(d2 + i, _mm256_andnot_pd(cross, d));
+	}
+#elif defined(__SSE2__)
+	__m128d ax = _mm_set1_pd(A->x), ay = _mm_set1_pd(A->y);
+	__m128d bx = _mm_set1_pd(B->x), by = _mm_set1_pd(B->y);
+	__m128d abx = _mm_sub_pd(bx, ax), aby = _mm_sub_pd(by, ay);
+	__m128d zero = _mm_setzero_pd();
+
+	for (; i + 2 <= n; i += 2)
+	{
+		__m128d vcx = _mm_loadu_pd(cx + i), vcy = _mm_loadu_pd(cy + i);
+		__m128d vdx = _mm_loadu_pd(dx + i), vdy = _mm_loadu_pd(dy + i);
+		__m128d cdx = _mm_sub_pd(vdx, vcx), cdy = _mm_sub_pd(vdy, vcy);
+		__m128d o1 = dist_kernel_cross_sse2(abx, aby, _mm_sub_pd(vcx, ax), _mm_sub_pd(vcy, ay));
+		__m128d o2 = dist_kernel_cross_sse2(abx, aby, _mm_sub_pd(vdx, ax), _mm_sub_pd(vdy, ay));
+		__m128d o3 = dist_kernel_cross_sse2(cdx, cdy, _mm_sub_pd(ax, vcx), _mm_sub_pd(ay, vcy));
+		__m128d o4 = dist_kernel_cross_sse2(cdx, cdy, _mm_sub_pd(bx, vcx), _mm_sub_pd(by, vcy));
+		__m128d cross = _mm_and_pd(_mm_cmple_pd(_mm_mul_pd(o1, o2), zero),
+		                           _mm_cmple_pd(_mm_mul_pd(o3, o4), zero));
+		__m128d d = dist_kernel_pt_seg_sqr_sse2(ax, ay, vcx, vcy, vdx, vdy);
+		d = _mm_min_pd(d, dist_kernel_pt_seg_sqr_sse2(bx, by, vcx, vcy, vdx, vdy));
+		d = _mm_min_pd(d, dist_kernel_pt_seg_sqr_sse2(vcx, vcy, ax, ay, bx, by));
+		d = _mm_min_pd(d, dist_kernel_pt_seg_sqr_sse2(vdx, vdy, ax, ay, bx, by));
+		_mm_storeu_pd(d2 + i, _mm_andnot_pd(cross, d));
+	}
+#endif
+
+	for (; i < n; i++)
+		d2[i] = dist_kernel_seg_seg_sqr(A->x, A->y, B->x, B->y, cx[i], cy[i], dx[i], dy[i]);
+}
+
+/*
+* Largest squared kernel distance of a segment pair that may still
+* beat distance. scale is the largest absolute coordinate, which
+* bounds the rounding errors of both sides.
+*/
+static inline double
+dist_kernel_threshold_sqr(double distance, double scale)
+{
+	double t = distance + DIST_KERNEL_MARGIN * (distance + scale);
+	return t * t;
+}
+
+static inline double
+dist_kernel_scale_pt(const POINT2D *p, double scale)
+{
+	if (fabs(p->x) > scale) scale = fabs(p->x);
+	if (fabs(p->y) > scale) scale = fabs(p->y);
+	return scale;
+}
+
+static double
+dist_kernel_scale(const POINTARRAY *pa, double scale)
+{
+	uint32_t i;
+	for (i = 0; i < pa->npoints; i++)
+		scale = dist_kernel_scale_pt(getPoint2d_cp(pa, i), scale);
+	return scale;
+}
+
+/**
+* lw_dist2d_ptarray_ptarray for long l2: each segment of l1 is screened
+* against blocks of segments of l2 by the kernels, and only the pairs
+* that could come closer go through lw_dist2d_seg_seg, in the same order.
+*/
+static int
+lw_dist2d_ptarray_ptarray_screened(POINTARRAY *l1, POINTARRAY *l2, DISTPTS *dl)
+{
+	uint32_t t, u, j;
+	uint32_t nseg1 = l1->npoints - 1;
+	uint32_t nseg2 = l2->npoints - 1;
+	const POINT2D *start, *end, *p;
+	int twist = dl->twisted;
+	double *x, *y;
+	double d2[DIST_KERNEL_BLOCK];
+	double scale = 0;
+	int rv = LW_TRUE;
+
+	/* Already close enough, the first pair has the last word */
+	if (dl->distance <= dl->tolerance && dl->mode == DIST_MIN)
+		return lw_dist2d_seg_seg(getPoint2d_cp(l1, 0), getPoint2d_cp(l1, 1),
+		                         getPoint2d_cp(l2, 0), getPoint2d_cp(l2, 1), dl);
+
+	x = lwalloc(sizeof(double) * l2->npoints * 2);
+	y = x + l2->npoints;
+
+	for (u = 0; u < l2->npoints; u++)
+	{
+		p = getPoint2d_cp(l2, u);
+		x[u] = p->x;
+		y[u] = p->y;
+	}
+	scale = dist_kernel_scale(l2, dist_kernel_scale(l1, scale));
+
+	start = getPoint2d_cp(l1, 0);
+	for (t = 1; t <= nseg1; t++)
+	{
+		end = getPoint2d_cp(l1, t);
+		for (u = 0; u < nseg2; u += DIST_KERNEL_BLOCK)
+		{
+			uint32_t len = nseg2 - u < DIST_KERNEL_BLOCK ? nseg2 - u : DIST_KERNEL_BLOCK;
+			double threshold = dist_kernel_threshold_sqr(dl->distance, scale);
+
+			dist_kernel_seg_segs(start, end, x + u, y + u, x + u + 1, y + u + 1, len, d2);
+			for (j = 0; j < len; j++)
+			{
+				/* The last pair always runs, it leaves dl->twisted behind */
+				if (d2[j] > threshold && !(t == nseg1 && u + j + 1 == nseg2))
+					continue;
+
+				dl->twisted = twist;
+				if (!lw_dist2d_seg_seg(start, end, getPoint2d_cp(l2, u + j), getPoint2d_cp(l2, u + j + 1), dl))
+				{
+					rv = LW_FALSE;
+					goto done;
+				}
+				if (dl->distance <= dl->tolerance && dl->mode == DIST_MIN)
+					goto done; /*just a check if  the answer is already given*/
+			}
+		}
+		start = end;
+	}
+
+done:
+	lwfree(x);
+	return rv;
+}
+
 /**
 * test each segment of l1 against each segment of l2.
 */
@@ -1156,6 +1427,10 @@ lw_dist2d_ptarray_ptarray(POINTARRAY *l1, POINTARRAY *l2,DISTPTS *dl)
 			}
 		}
 	}
+	else if (l1->npoints > 1 && l2->npoints > DIST_KERNEL_MIN_SEGMENTS + 1)
+	{
+		return lw_dist2d_ptarray_ptarray_screened(l1, l2, dl);
+	}
 	else
 	{
 		start = getPoint2d_cp(l1, 0);
@@ -2066,6 +2341,8 @@ struct_cmp_by_measure(const void *a, const void *b)
 		(ia->themeasure > ib->themeasure) ? 1 : ((ia->themeasure < ib->themeasure) ? -1 : 0);
 }
 
+static int lw_dist2d_pre_seg_seg_screened(POINTARRAY *l1, POINTARRAY *l2, LISTSTRUCT *list1, LISTSTRUCT *list2, double k, double maxmeasure, DISTPTS *dl);
+
 /**
 	preparation before lw_dist2d_seg_seg.
 */
@@ -2085,6 +2362,10 @@ lw_dist2d_pre_seg_seg(POINTARRAY *l1, POINTARRAY *l2,LISTSTRUCT *list1, LISTSTRU
 	lw_dist2d_pt_pt(p1, p3, dl);
 	maxmeasure = sqrt(dl->distance*dl->distance + (dl->distance*dl->distance*k*k));
 	twist = dl->twisted; /*to keep the incoming order between iterations*/
+
+	if (n2 - 1 > DIST_KERNEL_MIN_SEGMENTS)
+		return lw_dist2d_pre_seg_seg_screened(l1, l2, list1, list2, k, maxmeasure, dl);
+
 	for (i =(n1-1); i>=0; --i)
 	{
 		/*we break this iteration when we have checked every
@@ -2151,6 +2432,152 @@ lw_dist2d_pre_seg_seg(POINTARRAY *l1, POINTARRAY *l2,LISTSTRUCT *list1, LISTSTRU
 }
 
 
+/**
+	lw_dist2d_pre_seg_seg for long l2: the segments on both sides of the
+	points of l2, in list2 order, are screened by the kernels a block at
+	a time, and only the pairs that could come closer go through
+	lw_dist2d_selected_seg_seg, in the same order.
+*/
+static int
+lw_dist2d_pre_seg_seg_screened(POINTARRAY *l1, POINTARRAY *l2, LISTSTRUCT *list1, LISTSTRUCT *list2, double k, double maxmeasure, DISTPTS *dl)
+{
+	const POINT2D *p1, *p2, *p3, *p01;
+	const POINT2D *last[4] = {NULL, NULL, NULL, NULL};
+	int pnr1, pnr2, pnr3, pnr4, i, r, twist, last_run = LW_TRUE, rv = LW_TRUE;
+	int n1 = l1->npoints;
+	int n2 = l2->npoints;
+	uint32_t u, j, len, filled = 0;
+	double *x3, *y3, *xb, *yb, *xa, *ya;
+	double d2b[DIST_KERNEL_BLOCK], d2a[DIST_KERNEL_BLOCK];
+	const POINT2D **before, **after;
+	double scale = 0;
+
+	x3 = lwalloc(sizeof(double) * n2 * 6);
+	y3 = x3 + n2;
+	xb = y3 + n2;
+	yb = xb + n2;
+	xa = yb + n2;
+	ya = xa + n2;
+	before = lwalloc(sizeof(POINT2D*) * n2 * 2);
+	after = before + n2;
+
+	twist = dl->twisted;
+	for (i =(n1-1); i>=0; --i)
+	{
+		if (((list2[0].themeasure-list1[i].themeasure)) > maxmeasure) break;
+		for (r=-1; r<=1; r +=2)
+		{
+			pnr1 = list1[i].pnr;
+			p1 = getPoint2d_cp(l1, pnr1);
+			if (pnr1+r<0)
+			{
+				p01 = getPoint2d_cp(l1, (n1-1));
+				if (( p1->x == p01->x) && (p1->y == p01->y)) pnr2 = (n1-1);
+				else pnr2 = pnr1;
+			}
+			else if (pnr1+r>(n1-1))
+			{
+				p01 = getPoint2d_cp(l1, 0);
+				if (( p1->x == p01->x) && (p1->y == p01->y)) pnr2 = 0;
+				else pnr2 = pnr1;
+			}
+			else pnr2 = pnr1+r;
+			p2 = getPoint2d_cp(l1, pnr2);
+			/* Only the points reached so far count towards the margin */
+			scale = dist_kernel_scale_pt(p2, dist_kernel_scale_pt(p1, scale));
+
+			for (u = 0; u < (uint32_t)n2; u += len)
+			{
+				double threshold;
+
+				/* The entries still within reach, as things stand */
+				for (len = 0; len < DIST_KERNEL_BLOCK && u + len < (uint32_t)n2; len++)
+					if (((list2[u+len].themeasure-list1[i].themeasure)) >= maxmeasure) break;
+				if (!len) break;
+
+				/* The points of list2 and their neighbours, as far as they are reached */
+				for (; filled < u + len; filled++)
+				{
+					pnr3 = list2[filled].pnr;
+					p3 = getPoint2d_cp(l2, pnr3);
+					if (pnr3==0)
+					{
+						p01 = getPoint2d_cp(l2, (n2-1));
+						if (( p3->x == p01->x) && (p3->y == p01->y)) pnr4 = (n2-1);
+						else pnr4 = pnr3; /* if it is a line and the last and first point is not the same we avoid the edge between start and end this way*/
+					}
+					else pnr4 = pnr3-1;
+					before[filled] = getPoint2d_cp(l2, pnr4);
+
+					if (pnr3>=(n2-1))
+					{
+						p01 = getPoint2d_cp(l2, 0);
+						if (( p3->x == p01->x) && (p3->y == p01->y)) pnr4 = 0;
+						else pnr4 = pnr3; /* if it is a line and the last and first point is not the same we avoid the edge between start and end this way*/
+					}
+					else pnr4 = pnr3+1;
+					after[filled] = getPoint2d_cp(l2, pnr4);
+
+					x3[filled] = p3->x;
+					y3[filled] = p3->y;
+					xb[filled] = before[filled]->x;
+					yb[filled] = before[filled]->y;
+					xa[filled] = after[filled]->x;
+					ya[filled] = after[filled]->y;
+					/* The neighbours are segment ends too, count them in */
+					scale = dist_kernel_scale_pt(p3, scale);
+					scale = dist_kernel_scale_pt(before[filled], scale);
+					scale = dist_kernel_scale_pt(after[filled], scale);
+				}
+				threshold = dist_kernel_threshold_sqr(dl->distance, scale);
+				dist_kernel_seg_segs(p1, p2, x3 + u, y3 + u, xb + u, yb + u, len, d2b);
+				dist_kernel_seg_segs(p1, p2, x3 + u, y3 + u, xa + u, ya + u, len, d2a);
+
+				for (j = 0; j < len; j++)
+				{
+					/* Nearer pairs may have moved the reach in */
+					if (((list2[u+j].themeasure-list1[i].themeasure)) >= maxmeasure)
+						goto next_segment;
+
+					p3 = getPoint2d_cp(l2, list2[u+j].pnr);
+					if (d2b[j] <= threshold)
+					{
+						dl->twisted=twist;
+						if (!lw_dist2d_selected_seg_seg(p1, p2, p3, before[u+j], dl)) { rv = LW_FALSE; goto done; }
+					}
+					if (d2a[j] <= threshold)
+					{
+						dl->twisted=twist;
+						if (!lw_dist2d_selected_seg_seg(p1, p2, p3, after[u+j], dl)) { rv = LW_FALSE; goto done; }
+					}
+
+					/* Remember the last pair, which leaves dl->twisted behind */
+					last[0] = p1;
+					last[1] = p2;
+					last[2] = p3;
+					last[3] = after[u+j];
+					last_run = d2a[j] <= threshold;
+
+					maxmeasure = sqrt(dl->distance*dl->distance + (dl->distance*dl->distance*k*k));/*here we "translate" the found mindistance so it can be compared to our "z"-values*/
+				}
+			}
+next_segment:
+			;
+		}
+	}
+
+	if (!last_run)
+	{
+		dl->twisted = twist;
+		rv = lw_dist2d_selected_seg_seg(last[0], last[1], last[2], last[3], dl);
+	}
+
+done:
+	lwfree(x3);
+	lwfree(before);
+	return rv;
+}
+
 /**
 	This is the same function as lw_dist2d_seg_seg but
 	without any calculations to determine intersection since we
@@ -12,6 +12,8 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "access/hash.h"
+#include "portability/instr_time.h"
 
 #include "../postgis_config.h"
 #include "lwgeom_cache.h"
@@ -47,6 +49,48 @@ typedef struct {
 	GenericCache* entry[NUM_CACHE_ENTRIES];
 } GenericCacheCollection;
 
+/*
+* Per-backend counters, one set per cache type.
+*/
+static CacheStats cache_stats[NUM_CACHE_STATS];
+
+static const char *cache_names[NUM_CACHE_STATS] =
+{
+	[PROJ_CACHE_ENTRY] = "proj",
+	[PREP_CACHE_ENTRY] = "prepared",
+	[RTREE_CACHE_ENTRY] = "rtree",
+	[CIRC_CACHE_ENTRY] = "circtree",
+	[RECT_CACHE_ENTRY] = "recttree",
+	[GEOS_CACHE_ENTRY] = "geos",
+	[RECT3D_CACHE_ENTRY] = "recttree3d",
+	[PREP_BACKEND_CACHE_ENTRY] = "prepared_backend"
+};
+
+CacheStats *
+GetCacheStats(int entry_number)
+{
+	Assert(entry_number >= 0);
+	Assert(entry_number < NUM_CACHE_STATS);
+	return &(cache_stats[entry_number]);
+}
+
+/**
+* Name of a cache type, or NULL for unused entry numbers.
+*/
+const char *
+GetCacheName(int entry_number)
+{
+	if ( entry_number < 0 || entry_number >= NUM_CACHE_STATS )
+		return NULL;
+	return cache_names[entry_number];
+}
+
+void
+ResetCacheStats(void)
+{
+	memset(cache_stats, 0, sizeof(cache_stats));
+}
+
 /**
 * Utility function to read the upper memory context off a function call
 * info data.
@@ -101,11 +145,10 @@ GetPROJ4SRSCache(FunctionCallInfo fcinfo)
 			{
 				cache->PROJ4SRSCache[i].srid = SRID_UNKNOWN;
 				cache->PROJ4SRSCache[i].projection = NULL;
-				cache->PROJ4SRSCache[i].projection_mcxt = NULL;
 			}
 			cache->type = PROJ_CACHE_ENTRY;
 			cache->PROJ4SRSCacheCount = 0;
-			cache->PROJ4SRSCacheContext = FIContext(fcinfo);
+			cache->generation = 0;
 
 			/* Store the pointer in GenericCache */
 			generic_cache->entry[PROJ_CACHE_ENTRY] = (GenericCache*)cache;
@@ -114,132 +157,611 @@ GetPROJ4SRSCache(FunctionCallInfo fcinfo)
 	return cache;
 }
 
+/*
+* Key hashing. The mixing follows xxHash64: four independent
+* lanes over 32-byte stripes, so the loop runs close to memory
+* bandwidth, followed by a final avalanche.
+*/
+#define GC_PRIME1 UINT64CONST(11400714785074694791)
+#define GC_PRIME2 UINT64CONST(14029467366897019727)
+#define GC_PRIME3 UINT64CONST(1609587929392839161)
+#define GC_PRIME4 UINT64CONST(9650029242287828579)
+#define GC_PRIME5 UINT64CONST(2870177450012600261)
+
+static inline uint64
+gc_rotl64(uint64 x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64
+gc_read64(const uint8 *p)
+{
+	uint64 v;
+	memcpy(&v, p, sizeof(uint64));
+	return v;
+}
+
+static inline uint64
+gc_round(uint64 acc, uint64 input)
+{
+	acc += input * GC_PRIME2;
+	acc = gc_rotl64(acc, 31);
+	return acc * GC_PRIME1;
+}
+
+static inline uint64
+gc_merge(uint64 acc, uint64 val)
+{
+	acc ^= gc_round(0, val);
+	return acc * GC_PRIME1 + GC_PRIME4;
+}
+
+static inline uint64
+gc_mix_word(uint64 h, uint64 word)
+{
+	h ^= gc_round(0, word);
+	return gc_rotl64(h, 27) * GC_PRIME1 + GC_PRIME4;
+}
+
+static inline uint64
+gc_avalanche(uint64 h)
+{
+	h ^= h >> 33;
+	h *= GC_PRIME2;
+	h ^= h >> 29;
+	h *= GC_PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
 /**
-* Get an appropriate (based on the entry type number)
-* GeomCache entry from the generic cache if one exists.
-* Returns a cache pointer if there is a cache hit and we have an
-* index built and ready to use. Returns NULL otherwise.
+* Hash of all the serialized bytes of a geometry.
 */
-GeomCache *
-GetGeomCache(FunctionCallInfo fcinfo,
-	     const GeomCacheMethods *cache_methods,
-	     const GSERIALIZED *g1,
-	     const GSERIALIZED *g2)
+uint64
+GeomCacheHash(const GSERIALIZED *g)
 {
-	GeomCache* cache;
-	int cache_hit = 0;
-	MemoryContext old_context;
-	const GSERIALIZED *geom;
-	GenericCacheCollection* generic_cache = GetGenericCacheCollection(fcinfo);
-	int entry_number = cache_methods->entry_number;
+	const uint8 *p = (const uint8 *)g;
+	size_t len = VARSIZE(g);
+	const uint8 *end = p + len;
+	uint64 h;
 
-	Assert(entry_number >= 0);
-	Assert(entry_number < NUM_CACHE_ENTRIES);
+	if ( len >= 32 )
+	{
+		const uint8 *limit = end - 32;
+		uint64 v1 = GC_PRIME1 + GC_PRIME2;
+		uint64 v2 = GC_PRIME2;
+		uint64 v3 = 0;
+		uint64 v4 = 0 - GC_PRIME1;
 
-	cache = (GeomCache*)(generic_cache->entry[entry_number]);
+		do
+		{
+			v1 = gc_round(v1, gc_read64(p));
+			v2 = gc_round(v2, gc_read64(p + 8));
+			v3 = gc_round(v3, gc_read64(p + 16));
+			v4 = gc_round(v4, gc_read64(p + 24));
+			p += 32;
+		}
+		while ( p <= limit );
 
-	if ( ! cache )
+		h = gc_rotl64(v1, 1) + gc_rotl64(v2, 7) + gc_rotl64(v3, 12) + gc_rotl64(v4, 18);
+		h = gc_merge(h, v1);
+		h = gc_merge(h, v2);
+		h = gc_merge(h, v3);
+		h = gc_merge(h, v4);
+	}
+	else
+	{
+		h = GC_PRIME5;
+	}
+
+	h += len;
+
+	while ( p + 8 <= end )
+	{
+		h = gc_mix_word(h, gc_read64(p));
+		p += 8;
+	}
+	while ( p < end )
+	{
+		h ^= (*p) * GC_PRIME5;
+		h = gc_rotl64(h, 11) * GC_PRIME1;
+		p++;
+	}
+
+	return gc_avalanche(h);
+}
+
+/**
+* Fingerprint of the size and first GEOM_CACHE_PREFIX_BYTES
+* bytes of a geometry, enough to tell most keys apart without
+* reading all of them.
+*/
+static uint64
+GeomCachePrefix(const GSERIALIZED *g)
+{
+	const uint8 *p = (const uint8 *)g;
+	size_t len = VARSIZE(g);
+	size_t n = Min(len, GEOM_CACHE_PREFIX_BYTES);
+	uint64 h = GC_PRIME5 + len;
+	size_t i;
+
+	for ( i = 0; i + 8 <= n; i += 8 )
+		h = gc_mix_word(h, gc_read64(p + i));
+	for ( ; i < n; i++ )
+	{
+		h ^= p[i] * GC_PRIME5;
+		h = gc_rotl64(h, 11) * GC_PRIME1;
+	}
+
+	return gc_avalanche(h);
+}
+
+/**
+* Fingerprint of a large geometry: the header and bounding
+* box, then GEOM_CACHE_SAMPLE_WORDS words spread evenly over
+* the rest of it, and the last word.
+*/
+static uint64
+GeomCacheSample(const GSERIALIZED *g)
+{
+	const uint8 *p = (const uint8 *)g;
+	size_t len = VARSIZE(g);
+	size_t stride = (len - 8) / GEOM_CACHE_SAMPLE_WORDS;
+	uint64 h = GC_PRIME5 + len;
+	int i;
+
+	Assert(len > GEOM_CACHE_SAMPLE_BYTES);
+
+	for ( i = 0; i < 4; i++ )
+		h = gc_mix_word(h, gc_read64(p + 8 * i));
+	for ( i = 0; i < GEOM_CACHE_SAMPLE_WORDS; i++ )
+		h = gc_mix_word(h, gc_read64(p + stride * i));
+	h = gc_mix_word(h, gc_read64(p + len - 8));
+
+	return gc_avalanche(h);
+}
+
+/**
+* Get the LRU for the cache type off the statement, allocate
+* a new one if we don't have one already.
+*/
+static GeomCacheLRU *
+GetGeomCacheLRU(FunctionCallInfo fcinfo, int entry_number)
+{
+	GenericCacheCollection* generic_cache = GetGenericCacheCollection(fcinfo);
+	GeomCacheLRU* lru = (GeomCacheLRU*)(generic_cache->entry[entry_number]);
+
+	if ( ! lru )
 	{
-		old_context = MemoryContextSwitchTo(FIContext(fcinfo));
 		/* Allocate in the upper context */
-		cache = cache_methods->GeomCacheAllocator();
-		MemoryContextSwitchTo(old_context);
+		lru = MemoryContextAllocZero(FIContext(fcinfo), sizeof(GeomCacheLRU));
+		lru->type = entry_number;
 		/* Store the pointer in GenericCache */
-		cache->type = entry_number;
-		generic_cache->entry[entry_number] = (GenericCache*)cache;
+		generic_cache->entry[entry_number] = (GenericCache*)lru;
 	}
+	return lru;
+}
+
+/**
+* Hash the key of argument i, noting the hash against the pointer
+* it was passed as for GetGeomCacheKeyHash.
+*/
+static uint64
+GeomCacheHashArg(GeomCacheLRU *lru, int i, const GSERIALIZED *g)
+{
+	GeomCacheKeyHash *last = &(lru->last_hash[i]);
+	last->ptr = g;
+	last->size = VARSIZE(g);
+	last->hash = GeomCacheHash(g);
+	return last->hash;
+}
+
+/**
+* Move the live entry at position i to the front of the list.
+*/
+static void
+GeomCacheTouch(GeomCacheLRU *lru, int i)
+{
+	GeomCache *cache = lru->slots[i];
+	if ( i == 0 ) return;
+	memmove(lru->slots + 1, lru->slots, i * sizeof(GeomCache*));
+	lru->slots[0] = cache;
+}
+
+/**
+* Confirm a candidate hit against the cached copy of the key,
+* if we were built to do so.
+*/
+static inline int
+GeomCacheVerify(const GeomCache *cache, const GSERIALIZED *g)
+{
+#ifdef GEOM_CACHE_VERIFY_KEYS
+	return memcmp(cache->geom, g, cache->geom_size) == 0;
+#else
+	return LW_TRUE;
+#endif
+}
+
+/**
+* Find a live entry last matched with this very pointer, where
+* the key is large enough for a full hash to be worth avoiding.
+* Returns its position or -1 if there isn't one.
+*/
+static int
+GeomCacheFindPointer(const GeomCacheLRU *lru, const GSERIALIZED *g)
+{
+	int i;
+	size_t size = VARSIZE(g);
+	uint64 sample;
+
+	if ( size <= GEOM_CACHE_SAMPLE_BYTES )
+		return -1;
 
-	/* Cache hit on the first argument */
-	if ( g1 &&
-	     cache->argnum != 2 &&
-	     cache->geom1_size == VARSIZE(g1) &&
-	     memcmp(cache->geom1, g1, cache->geom1_size) == 0 )
+	for ( i = 0; i < lru->nentries; i++ )
 	{
-		cache_hit = 1;
-		geom = cache->geom1;
+		const GeomCache *cache = lru->slots[i];
+		if ( cache->geom_ptr != g || cache->geom_size != size )
+			continue;
 
+		/* The memory may have been re-used for another */
+		/* geometry of the same size, so look inside */
+		sample = GeomCacheSample(g);
+		if ( cache->geom_sample == sample &&
+		     GeomCacheVerify(cache, g) )
+			return i;
+		return -1;
 	}
-	/* Cache hit on second argument */
-	else if ( g2 &&
-	          cache->argnum != 1 &&
-	          cache->geom2_size == VARSIZE(g2) &&
-	          memcmp(cache->geom2, g2, cache->geom2_size) == 0 )
+	return -1;
+}
+
+/**
+* Find the live entry keyed by g, returning its position
+* or -1 if there isn't one.
+*/
+static int
+GeomCacheFind(const GeomCacheLRU *lru, const GSERIALIZED *g, uint64 hash)
+{
+	int i;
+	size_t size = VARSIZE(g);
+	for ( i = 0; i < lru->nentries; i++ )
 	{
-		cache_hit = 2;
-		geom = cache->geom2;
+		const GeomCache *cache = lru->slots[i];
+		if ( cache->geom_hash == hash &&
+		     cache->geom_size == size &&
+		     GeomCacheVerify(cache, g) )
+			return i;
 	}
-	/* No cache hit. If we have a tree, free it. */
-	else
+	return -1;
+}
+
+/**
+* Whether a live entry has the size and prefix of a key, which
+* it needs for a full hash of the key to be worth computing.
+*/
+static int
+GeomCacheFindPrefix(const GeomCacheLRU *lru, size_t size, uint64 prefix)
+{
+	int i;
+	for ( i = 0; i < lru->nentries; i++ )
 	{
-		cache_hit = 0;
-		if ( cache->argnum )
-		{
-			cache_methods->GeomIndexFreer(cache);
-			cache->argnum = 0;
-		}
-		if ( cache->lwgeom1 )
-		{
-			lwgeom_free(cache->lwgeom1);
-			cache->lwgeom1 = 0;
-		}
-		if ( cache->lwgeom2 )
+		const GeomCache *cache = lru->slots[i];
+		if ( cache->geom_prefix == prefix && cache->geom_size == size )
+			return LW_TRUE;
+	}
+	return LW_FALSE;
+}
+
+/**
+* Note a key that missed. Returns LW_TRUE if it had already
+* been seen once (so it is now worth building an index for),
+* otherwise remembers it and returns LW_FALSE. Ghosts are only
+* matched on size and prefix: mistaking a key for one seen
+* before only builds an entry early.
+*/
+static int
+GeomCacheGhostSeen(GeomCacheLRU *lru, const GSERIALIZED *g, uint64 prefix)
+{
+	int i;
+	uint32 size = VARSIZE(g);
+	for ( i = 0; i < lru->nghosts; i++ )
+	{
+		GeomCacheGhost *ghost = &(lru->ghosts[i]);
+		if ( ghost->prefix == prefix && ghost->size == size )
 		{
-			lwgeom_free(cache->lwgeom2);
-			cache->lwgeom2 = 0;
+			/* Retire it, the key is about to get a live entry */
+			ghost->prefix = 0;
+			ghost->size = 0;
+			return LW_TRUE;
 		}
 	}
+	lru->ghosts[lru->ghost_next].prefix = prefix;
+	lru->ghosts[lru->ghost_next].size = size;
+	lru->ghost_next = (lru->ghost_next + 1) % GEOM_CACHE_GHOSTS;
+	if ( lru->nghosts < GEOM_CACHE_GHOSTS )
+		lru->nghosts++;
+	return LW_FALSE;
+}
 
-	/* Cache hit, but no tree built yet, build it! */
-	if ( cache_hit && ! cache->argnum )
-	{
-		int rv;
-		LWGEOM *lwgeom;
+/**
+* Drop the least recently used live entry, freeing its index,
+* its key and its LWGEOM. The entry itself stays allocated
+* in the spare part of the slot array.
+*/
+static void
+GeomCacheEvict(GeomCacheLRU *lru, const GeomCacheMethods *cache_methods)
+{
+	GeomCache *cache = lru->slots[lru->nentries - 1];
 
-		/* Save the tree and supporting geometry in the cache */
-		/* memory context */
-		old_context = MemoryContextSwitchTo(FIContext(fcinfo));
-		lwgeom = lwgeom_from_gserialized(geom);
+	POSTGIS_DEBUGF(3, "GeomCacheEvict: evicting entry %p of type %d", cache, lru->type);
+
+	if ( cache->argnum )
+	{
+		cache_methods->GeomIndexFreer(cache);
 		cache->argnum = 0;
+	}
+	/* The index may point into the lwgeom, and the lwgeom into the key */
+	if ( cache->lwgeom )
+	{
+		lwgeom_free(cache->lwgeom);
+		cache->lwgeom = 0;
+	}
+	if ( cache->geom )
+	{
+		pfree(cache->geom);
+		cache->geom = 0;
+	}
+	lru->nbytes -= cache->geom_size;
+	GetCacheStats(lru->type)->evictions++;
+	cache->geom_size = 0;
+	cache->geom_hash = 0;
+	cache->geom_prefix = 0;
+	cache->geom_sample = 0;
+	cache->geom_ptr = NULL;
+	lru->nentries--;
+}
 
-		/* Can't build a tree on a NULL or empty */
-		if ((!lwgeom) || lwgeom_is_empty(lwgeom))
-		{
-			MemoryContextSwitchTo(old_context);
-			return NULL;
-		}
-		rv = cache_methods->GeomIndexBuilder(lwgeom, cache);
+/**
+* Make room for, and add, a live entry keyed by g at the front
+* of the list. Entries are evicted from the back until both the
+* entry count and the key byte budget fit; a single key larger
+* than the budget is still cached on its own.
+*/
+static GeomCache *
+GeomCacheInsert(FunctionCallInfo fcinfo, GeomCacheLRU *lru,
+                const GeomCacheMethods *cache_methods,
+                const GSERIALIZED *g, uint64 hash, uint64 prefix)
+{
+	GeomCache *cache;
+	size_t size = VARSIZE(g);
+
+	while ( lru->nentries > 0 &&
+	        ( lru->nentries >= GEOM_CACHE_MAX_ENTRIES ||
+	          lru->nbytes + size > GEOM_CACHE_MAX_BYTES ) )
+	{
+		GeomCacheEvict(lru, cache_methods);
+	}
+
+	if ( lru->nentries < lru->nslots )
+	{
+		cache = lru->slots[lru->nentries];
+	}
+	else
+	{
+		MemoryContext old_context = MemoryContextSwitchTo(FIContext(fcinfo));
+		cache = cache_methods->GeomCacheAllocator();
 		MemoryContextSwitchTo(old_context);
+		cache->type = lru->type;
+		lru->slots[lru->nslots++] = cache;
+	}
 
-		/* Something went awry in the tree build phase */
-		if ( ! rv )
-			return NULL;
+	cache->geom = MemoryContextAlloc(FIContext(fcinfo), size);
+	memcpy(cache->geom, g, size);
+	cache->geom_size = size;
+	cache->geom_hash = hash;
+	cache->geom_prefix = prefix;
+	cache->geom_sample = size > GEOM_CACHE_SAMPLE_BYTES ? GeomCacheSample(g) : 0;
+	cache->geom_ptr = g;
+	cache->argnum = 0;
+	lru->nbytes += size;
+
+	/* The new entry sits just past the live ones, bring it forward */
+	GeomCacheTouch(lru, lru->nentries++);
+	return cache;
+}
+
+/**
+* Build the index for a live entry that doesn't have one yet.
+*/
+static int
+GeomCacheBuild(FunctionCallInfo fcinfo, GeomCache *cache,
+               const GeomCacheMethods *cache_methods)
+{
+	int rv;
+	MemoryContext old_context;
+	CacheStats *stats = GetCacheStats(cache->type);
+	instr_time start, elapsed;
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	/* Save the tree and supporting geometry in the cache */
+	/* memory context */
+	old_context = MemoryContextSwitchTo(FIContext(fcinfo));
+	if ( ! cache->lwgeom )
+		cache->lwgeom = lwgeom_from_gserialized(cache->geom);
+
+	/* Can't build a tree on a NULL or empty */
+	if ( (!cache->lwgeom) || lwgeom_is_empty(cache->lwgeom) )
+	{
+		MemoryContextSwitchTo(old_context);
+		return LW_FAILURE;
+	}
+	rv = cache_methods->GeomIndexBuilder(cache->lwgeom, cache);
+	MemoryContextSwitchTo(old_context);
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, start);
+	stats->builds++;
+	stats->build_time += INSTR_TIME_GET_MILLISEC(elapsed);
+	stats->bytes += cache->geom_size;
+	return rv;
+}
+
+/**
+* Hash of argument argnum for a cache kept outside of the call
+* site, like the backend prepared geometry cache. A key passed at
+* the same pointer, with the same size, as the last time this call
+* site hashed that argument gets that hash back, with *recalled
+* set. The memory may hold another geometry by now, so callers
+* must confirm what they find with it against the key bytes, and
+* ask again with a NULL recalled, which always hashes, if that
+* fails.
+*/
+uint64
+GetGeomCacheKeyHash(FunctionCallInfo fcinfo, int entry_number,
+		    int argnum, const GSERIALIZED *g, bool *recalled)
+{
+	GeomCacheLRU *lru = GetGeomCacheLRU(fcinfo, entry_number);
+	const GeomCacheKeyHash *last = &(lru->last_hash[argnum - 1]);
+
+	Assert(argnum == 1 || argnum == 2);
 
-		/* Only set an argnum if everything completely successfully */
-		cache->argnum = cache_hit;
+	if ( recalled )
+	{
+		*recalled = last->ptr == g && last->size == VARSIZE(g);
+		if ( *recalled )
+			return last->hash;
 	}
 
-	/* We have a hit and a calculated tree, we're done */
-	if ( cache_hit && cache->argnum )
-		return cache;
+	return GeomCacheHashArg(lru, argnum - 1, g);
+}
+
+/**
+* Look the arguments up in the call site cache, with the hashes of
+* their keys when the caller already has them (known_hash not NULL).
+*/
+static GeomCache *
+GeomCacheLookup(FunctionCallInfo fcinfo,
+		const GeomCacheMethods *cache_methods,
+		const GSERIALIZED *g1,
+		const GSERIALIZED *g2,
+		const uint64 *known_hash)
+{
+	GeomCache* cache = NULL;
+	GeomCacheLRU* lru;
+	const GSERIALIZED *g[2];
+	uint64 hash[2] = {0, 0};
+	uint64 prefix[2] = {0, 0};
+	bool hashed[2] = {false, false};
+	int i, pos, hit = 0;
+	int entry_number = cache_methods->entry_number;
+
+	Assert(entry_number >= 0);
+	Assert(entry_number < NUM_CACHE_ENTRIES);
 
-	/* Argument one didn't match, so copy the new value in. */
-	if ( g1 && cache_hit != 1 )
+	lru = GetGeomCacheLRU(fcinfo, entry_number);
+	g[0] = g1;
+	g[1] = g2;
+
+	/* Cache hit on either argument, first argument preferred */
+	for ( i = 0; i < 2; i++ )
 	{
-		if ( cache->geom1 ) pfree(cache->geom1);
-		cache->geom1_size = VARSIZE(g1);
-		cache->geom1 = MemoryContextAlloc(FIContext(fcinfo), cache->geom1_size);
-		memcpy(cache->geom1, g1, cache->geom1_size);
+		if ( ! g[i] ) continue;
+		/* Same datum as last time? Then skip hashing it all */
+		pos = GeomCacheFindPointer(lru, g[i]);
+		if ( pos < 0 )
+		{
+			prefix[i] = GeomCachePrefix(g[i]);
+			if ( known_hash )
+			{
+				hash[i] = known_hash[i];
+				hashed[i] = true;
+				pos = GeomCacheFind(lru, g[i], hash[i]);
+			}
+			/* Only hash keys a live entry could be for */
+			else if ( GeomCacheFindPrefix(lru, VARSIZE(g[i]), prefix[i]) )
+			{
+				hash[i] = GeomCacheHashArg(lru, i, g[i]);
+				hashed[i] = true;
+				pos = GeomCacheFind(lru, g[i], hash[i]);
+			}
+		}
+		if ( pos < 0 ) continue;
+
+		GeomCacheTouch(lru, pos);
+		cache = lru->slots[0];
+		cache->geom_ptr = g[i];
+		hit = i + 1;
+		break;
 	}
-	/* Argument two didn't match, so copy the new value in. */
-	if ( g2 && cache_hit != 2 )
+
+	/* No live entry, but a second sighting, so make one */
+	if ( ! cache )
 	{
-		if ( cache->geom2 ) pfree(cache->geom2);
-		cache->geom2_size = VARSIZE(g2);
-		cache->geom2 = MemoryContextAlloc(FIContext(fcinfo), cache->geom2_size);
-		memcpy(cache->geom2, g2, cache->geom2_size);
+		GetCacheStats(entry_number)->misses++;
+		for ( i = 0; i < 2; i++ )
+		{
+			if ( ! g[i] ) continue;
+			if ( GeomCacheGhostSeen(lru, g[i], prefix[i]) && ! cache )
+			{
+				if ( ! hashed[i] )
+					hash[i] = GeomCacheHashArg(lru, i, g[i]);
+				cache = GeomCacheInsert(fcinfo, lru, cache_methods, g[i], hash[i], prefix[i]);
+				hit = i + 1;
+			}
+		}
+		if ( ! cache )
+			return NULL;
 	}
 
-	return NULL;
+	/* Cache hit, but no tree built yet, build it! */
+	if ( ! cache->argnum )
+	{
+		/* Something went awry in the tree build phase */
+		if ( ! GeomCacheBuild(fcinfo, cache, cache_methods) )
+		{
+			cache->argnum = 0;
+			return NULL;
+		}
+	}
+	else
+	{
+		GetCacheStats(entry_number)->hits++;
+	}
+
+	/* The same key may be the first argument on one call */
+	/* and the second on the next, so point at this one */
+	cache->argnum = hit;
+	return cache;
 }
 
+/**
+* Get an appropriate (based on the entry type number)
+* GeomCache entry from the generic cache if one exists.
+* Returns a cache pointer if there is a cache hit and we have an
+* index built and ready to use, with argnum set to the argument
+* the index was built from. Returns NULL otherwise.
+*/
+GeomCache *
+GetGeomCache(FunctionCallInfo fcinfo,
+	     const GeomCacheMethods *cache_methods,
+	     const GSERIALIZED *g1,
+	     const GSERIALIZED *g2)
+{
+	return GeomCacheLookup(fcinfo, cache_methods, g1, g2, NULL);
+}
 
+/**
+* GetGeomCache for a caller that has already hashed the keys of
+* both (non-NULL) arguments with GeomCacheHash, so they are not
+* hashed again.
+*/
+GeomCache *
+GetGeomCacheHashed(FunctionCallInfo fcinfo,
+		   const GeomCacheMethods *cache_methods,
+		   const GSERIALIZED *g1,
+		   const GSERIALIZED *g2,
+		   const uint64 hash[2])
+{
+	return GeomCacheLookup(fcinfo, cache_methods, g1, g2, hash);
+}
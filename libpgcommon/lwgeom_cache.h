@@ -26,31 +26,127 @@
 #define RTREE_CACHE_ENTRY 2
 #define CIRC_CACHE_ENTRY 3
 #define RECT_CACHE_ENTRY 4
+#define GEOS_CACHE_ENTRY 5
+#define RECT3D_CACHE_ENTRY 6
 
 #define NUM_CACHE_ENTRIES 16
 
+/*
+* The backend-lifetime prepared geometry cache doesn't hang off
+* fn_extra, but keeps its counters alongside the others.
+*/
+#define PREP_BACKEND_CACHE_ENTRY NUM_CACHE_ENTRIES
+#define NUM_CACHE_STATS (NUM_CACHE_ENTRIES + 1)
+
+/*
+* Counters for each cache type, accumulated over the life of the
+* backend (or since the last ResetCacheStats). A build is an
+* index, tree or projection being made; its time and the bytes of
+* serialized input (or PROJ string) it was made from are added to
+* build_time (in milliseconds) and bytes.
+*/
+typedef struct {
+	int64                       builds;
+	int64                       hits;
+	int64                       misses;
+	int64                       evictions;
+	double                      build_time;
+	int64                       bytes;
+} CacheStats;
+
+
+/*
+* Each call site keeps a small LRU of geometries-with-trees
+* per cache type, so that inputs which repeat, but not on
+* consecutive rows (a nested loop join over a few hundred
+* outer polygons, say), keep their index warm. The list is
+* bounded both by an entry count and by the bytes of
+* serialized keys it holds. Keys seen only once are
+* remembered by size and prefix in a ring of "ghosts", and an
+* entry (with its index) is only built on the second sighting.
+*/
+#define GEOM_CACHE_MAX_ENTRIES 256
+#define GEOM_CACHE_MAX_BYTES (32 * 1024 * 1024)
+#define GEOM_CACHE_GHOSTS 512
+
+/*
+* Keys are matched on size and a 64-bit hash of the serialized
+* bytes. A key is only hashed when a live entry has its size and
+* the same first GEOM_CACHE_PREFIX_BYTES bytes (header, box and
+* first coordinates), so an argument that changes on every row
+* costs a look at its first bytes only. When a call hands us the
+* very same pointer an entry was last matched with (a Const
+* argument, or a datum detoasted once and reused) keys larger than
+* GEOM_CACHE_SAMPLE_BYTES are matched on a fingerprint of
+* GEOM_CACHE_SAMPLE_WORDS words spread across the geometry instead
+* of hashing all of it, which tells a re-used address apart.
+* Define GEOM_CACHE_VERIFY_KEYS to also confirm hash and pointer
+* hits with a full memcmp.
+*/
+#define GEOM_CACHE_PREFIX_BYTES 48
+#define GEOM_CACHE_SAMPLE_BYTES 4096
+#define GEOM_CACHE_SAMPLE_WORDS 64
+/* #define GEOM_CACHE_VERIFY_KEYS 1 */
 
 /*
 * A generic GeomCache just needs space for the cache type,
-* the cache keys (GSERIALIZED geometries), the key sizes,
-* and the argument number the cached index/tree is going
-* to refer to.
+* the cache key (a GSERIALIZED geometry), the key size, hash,
+* prefix and sampled fingerprints, the caller's pointer the key was last
+* matched with, the LWGEOM the index was built from, and the
+* argument number the cached index/tree refers to on the
+* current call.
+* An argnum of zero means no index has been built yet.
 */
 typedef struct {
 	int                         type;
-	GSERIALIZED*                geom1;
-	GSERIALIZED*                geom2;
-	size_t                      geom1_size;
-	size_t                      geom2_size;
-	LWGEOM*                     lwgeom1;
-	LWGEOM*                     lwgeom2;
+	GSERIALIZED*                geom;
+	size_t                      geom_size;
+	uint64                      geom_hash;
+	uint64                      geom_prefix;
+	uint64                      geom_sample;
+	const GSERIALIZED*          geom_ptr;
+	LWGEOM*                     lwgeom;
 	int32                       argnum;
 } GeomCache;
 
+/* Size and prefix of a key that has been seen only once */
+typedef struct {
+	uint64                      prefix;
+	uint32                      size;
+} GeomCacheGhost;
+
+/* Pointer, size and hash of the key last hashed for an argument */
+typedef struct {
+	const GSERIALIZED*          ptr;
+	uint32                      size;
+	uint64                      hash;
+} GeomCacheKeyHash;
+
+/*
+* The per-type LRU. The first nentries slots are live, most
+* recently used first; the slots after them up to nslots were
+* evicted and are kept allocated for re-use, since cache types
+* like PrepGeomCache hang memory contexts off their entries.
+*/
+typedef struct {
+	int                         type;
+	int                         nentries;
+	int                         nslots;
+	size_t                      nbytes;
+	GeomCache*                  slots[GEOM_CACHE_MAX_ENTRIES];
+	GeomCacheGhost              ghosts[GEOM_CACHE_GHOSTS];
+	int                         nghosts;
+	int                         ghost_next;
+	GeomCacheKeyHash            last_hash[2];
+} GeomCacheLRU;
+
 /*
 * Other specific geometry cache types are the
 * RTreeGeomCache - lwgeom_rtree.h
 * PrepGeomCache - lwgeom_geos_prepared.h
+* CircTreeGeomCache - geography_measurement_trees.c
+* RectTreeGeomCache - lwgeom_rectree.c
+* GEOSGeomCache - lwgeom_geos_cache.h
 */
 
 /*
@@ -67,7 +163,7 @@ typedef struct struct_PROJ4SRSCacheItem
 {
 	int srid;
 	projPJ projection;
-	MemoryContext projection_mcxt;
+	int smerc_kind;
 }
 PROJ4SRSCacheItem;
 
@@ -78,13 +174,16 @@ PROJ4SRSCacheItem;
 * The proj4 cache holds a fixed number of reprojection
 * entries. In normal usage we don't expect it to have
 * many entries, so we always linearly scan the list.
+* The projections are owned by the backend PROJ cache
+* (lwgeom_transform.c); when its generation moves on,
+* the ones remembered here may have been freed.
 */
 typedef struct struct_PROJ4PortalCache
 {
 	int type;
 	PROJ4SRSCacheItem PROJ4SRSCache[PROJ4_CACHE_ITEMS];
 	int PROJ4SRSCacheCount;
-	MemoryContext PROJ4SRSCacheContext;
+	uint32 generation;
 }
 PROJ4PortalCache;
 
@@ -108,5 +207,32 @@ GeomCache *GetGeomCache(FunctionCallInfo fcinfo,
 			const GeomCacheMethods *cache_methods,
 			const GSERIALIZED *g1,
 			const GSERIALIZED *g2);
+GeomCache *GetGeomCacheHashed(FunctionCallInfo fcinfo,
+			      const GeomCacheMethods *cache_methods,
+			      const GSERIALIZED *g1,
+			      const GSERIALIZED *g2,
+			      const uint64 hash[2]);
+
+/*
+* Hash of the serialized bytes of a geometry, as used for cache keys
+*/
+uint64 GeomCacheHash(const GSERIALIZED *g);
+
+/*
+* Hash of argument argnum (1 or 2) at a call site, for caches kept
+* outside of it: the hash last computed for the same pointer and
+* size is reused (and *recalled set), so a hit found with it must be
+* confirmed against the key bytes, and the key hashed afresh (with
+* a NULL recalled) when it isn't.
+*/
+uint64 GetGeomCacheKeyHash(FunctionCallInfo fcinfo, int entry_number,
+			   int argnum, const GSERIALIZED *g, bool *recalled);
+
+/*
+* Cache instrumentation
+*/
+CacheStats *GetCacheStats(int entry_number);
+const char *GetCacheName(int entry_number);
+void ResetCacheStats(void);
 
 #endif /* LWGEOM_CACHE_H_ */
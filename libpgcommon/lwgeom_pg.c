@@ -442,3 +442,30 @@ postgis_guc_find_option(const char *name)
 	return 1;
 }
 
+
+#if POSTGIS_PGSQL_VERSION < 100
+/*
+* Core fmgr exports this from PostgreSQL 10 on, so only
+* older servers need our copy.
+*/
+Datum
+CallerFInfoFunctionCall2(PGFunction func, FmgrInfo *flinfo, Oid collation, Datum arg1, Datum arg2)
+{
+	Datum result;
+	FunctionCallInfoData fcinfo;
+
+	InitFunctionCallInfoData(fcinfo, flinfo, 2, collation, NULL, NULL);
+	fcinfo.arg[0] = arg1;
+	fcinfo.arg[1] = arg2;
+	fcinfo.argnull[0] = false;
+	fcinfo.argnull[1] = false;
+
+	result = (*func) (&fcinfo);
+
+	/* Check for null result, since caller is clearly not expecting one */
+	if (fcinfo.isnull)
+		elog(ERROR, "function %p returned NULL", (void *) func);
+
+	return result;
+}
+#endif
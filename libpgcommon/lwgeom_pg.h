@@ -246,4 +246,14 @@ void lwpgerror(const char *fmt, ...);
 void lwpgnotice(const char *fmt, ...);
 void lwpgwarning(const char *fmt, ...);
 
+#if POSTGIS_PGSQL_VERSION < 100
+/**
+* Call a two-argument PG function directly, like DirectFunctionCall2,
+* but hand it the FmgrInfo of the caller, so that fn_extra caches
+* (prepared geometries and friends) survive from call to call.
+* PostgreSQL 10 and up have it in fmgr.
+*/
+Datum CallerFInfoFunctionCall2(PGFunction func, FmgrInfo *flinfo, Oid collation, Datum arg1, Datum arg2);
+#endif
+
 #endif /* !defined _LWGEOM_PG_H */
@@ -19,6 +19,11 @@
 #include "executor/spi.h"
 #include "access/hash.h"
 #include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "catalog/namespace.h"
+#include "lib/ilist.h"
+#include "portability/instr_time.h"
 
 /* PostGIS headers */
 #include "../postgis_config.h"
@@ -48,42 +53,57 @@ int pj_transform_nodatum(projPJ srcdefn, projPJ dstdefn, long point_count, int p
 
 
 /*
- * PROJ 4 backend hash table initial hash size
- * (since 16 is the default portal hash table size, and we would
- * typically have 2 entries per portal
- * then we shall use a default size of 32)
- */
-#define PROJ4_BACKEND_HASH_SIZE	32
-
-
-/**
- * Backend projPJ hash table
+ * Backend PROJ cache
+ *
+ * Parsed projections, and the proj4 strings they are parsed from,
+ * are kept for the life of the backend keyed by SRID, so neither
+ * a statement touching many SRIDs nor many statements touching a
+ * few go back to spatial_ref_sys and pj_init_plus every time.
+ * Strings are cheap, so many more of them are kept than parsed
+ * projections; both are evicted least recently used first.
  *
- * This hash table stores a key/value pair of MemoryContext/projPJ objects.
- * Whenever we create a projPJ object using pj_init(), we create a separate
- * MemoryContext as a child context of the current executor context.
- * The MemoryContext/projPJ object is stored in this hash table so
- * that when PROJ4SRSCacheDelete() is called during query cleanup, we can
- * lookup the projPJ object based upon the MemoryContext parameter and hence
- * pj_free() it.
+ * A trigger on spatial_ref_sys sends a relcache invalidation for
+ * the table when it changes, and our callback marks the cache as
+ * stale. The callback can run in the middle of a lookup (SPI takes
+ * locks, which processes invalidations), so it only sets a flag and
+ * the cache is emptied at the start of the next lookup. The table
+ * is looked up when the first entry is cached; until then there is
+ * nothing read from it to throw away.
+ *
+ * The per-call-site PROJ4PortalCache only remembers the projections
+ * it last used. Freeing any projection bumps the backend generation,
+ * which tells the call-site caches to forget theirs.
  */
-static HTAB *PJHash = NULL;
+#define PROJ_BACKEND_HASH_SIZE 64
+#define PROJ_BACKEND_PROJECTIONS 128
+#define PROJ_BACKEND_STRINGS 2048
 
-typedef struct struct_PJHashEntry
+typedef struct struct_PROJBackendEntry
 {
-	MemoryContext ProjectionContext;
-	projPJ projection;
+	int srid; /* hash key, must be first */
+	char *proj_str;
+	projPJ projection; /* NULL when only the string is cached */
+	int smerc_kind; /* lwproj_smerc_kind of the projection */
+	dlist_node lru_node; /* every entry */
+	dlist_node pj_lru_node; /* entries with a projection */
 }
-PJHashEntry;
-
+PROJBackendEntry;
 
-/* PJ Hash API */
-uint32 mcxt_ptr_hash(const void *key, Size keysize);
+typedef struct struct_PROJBackendCache
+{
+	MemoryContext context;
+	HTAB *hash;
+	dlist_head lru;
+	dlist_head pj_lru;
+	int nstrings;
+	int nprojections;
+	uint32 generation;
+	bool invalid;
+	Oid srs_relid;
+}
+PROJBackendCache;
 
-static HTAB *CreatePJHash(void);
-static void AddPJHashEntry(MemoryContext mcxt, projPJ projection);
-static projPJ GetPJHashEntry(MemoryContext mcxt);
-static void DeletePJHashEntry(MemoryContext mcxt);
+static PROJBackendCache PROJBackend;
 
 /* Internal Cache API */
 /* static PROJ4PortalCache *GetPROJ4SRSCache(FunctionCallInfo fcinfo) ; */
@@ -91,192 +111,210 @@ static bool IsInPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid);
 static projPJ GetProjectionFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid);
 static void AddToPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid, int other_srid);
 static void DeleteFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid);
+static void ResetPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache);
+static char* GetProj4String(int srid);
 
 /* Search path for PROJ.4 library */
 static bool IsPROJ4LibPathSet = false;
 void SetPROJ4LibPath(void);
 
 
-static void
-#if POSTGIS_PGSQL_VERSION < 96
-PROJ4SRSCacheDelete(MemoryContext context)
-{
-#else
-PROJ4SRSCacheDelete(void *ptr)
-{
-	MemoryContext context = (MemoryContext)ptr;
-#endif
-	projPJ projection;
-
-	/* Lookup the projPJ pointer in the global hash table so we can free it */
-	projection = GetPJHashEntry(context);
-
-	if (!projection)
-		elog(ERROR, "PROJ4SRSCacheDelete: Trying to delete non-existant projection object with MemoryContext key (%p)", (void *)context);
-
-	POSTGIS_DEBUGF(3, "deleting projection object (%p) with MemoryContext key (%p)", projection, context);
-	/* Free it */
-	pj_free(projection);
-
-	/* Remove the hash entry as it is no longer needed */
-	DeletePJHashEntry(context);
-}
-
-#if POSTGIS_PGSQL_VERSION < 96
-
-static void
-PROJ4SRSCacheInit(MemoryContext context)
+static uint32
+PROJBackendHash(const void *key, Size keysize)
 {
-	/*
-	 * Do nothing as the cache is initialised when the transform()
-	 * function is first called
-	 */
+	return DatumGetUInt32(hash_uint32((uint32)(*((const int *)key))));
 }
 
 static void
-PROJ4SRSCacheReset(MemoryContext context)
+PROJBackendRelcacheCallback(Datum arg, Oid relid)
 {
-	/*
-	 * Do nothing, but we must supply a function since this call is mandatory according to tgl
-	 * (see postgis-devel archives July 2007)
-	 */
+	/* InvalidOid means every relation, ours included */
+	if ( relid == InvalidOid ||
+	     ( OidIsValid(PROJBackend.srs_relid) && relid == PROJBackend.srs_relid ) )
+	{
+		PROJBackend.invalid = true;
+	}
 }
 
-static bool
-PROJ4SRSCacheIsEmpty(MemoryContext context)
+/**
+ * Find the spatial_ref_sys GetProj4StringSPI reads from: the one in
+ * the PostGIS schema when that is known, else the one on the
+ * search_path. InvalidOid if there is none.
+ */
+static Oid
+PROJBackendSrsRelid(void)
 {
-	/*
-	 * Always return false since this call is mandatory according to tgl
-	 * (see postgis-devel archives July 2007)
-	 */
-	return LW_FALSE;
+	if ( spatialRefSysSchema )
+	{
+		Oid nsp_oid = get_namespace_oid(spatialRefSysSchema, true);
+		return OidIsValid(nsp_oid) ? get_relname_relid("spatial_ref_sys", nsp_oid) : InvalidOid;
+	}
+	return RelnameGetRelid("spatial_ref_sys");
 }
 
 static void
-PROJ4SRSCacheStats(MemoryContext context, int level)
+PROJBackendInit(void)
 {
-	/*
-	 * Simple stats display function - we must supply a function since this call is mandatory according to tgl
-	 * (see postgis-devel archives July 2007)
-	 */
+	HASHCTL ctl;
 
-	fprintf(stderr, "%s: PROJ4 context\n", context->name);
+	PROJBackend.context = AllocSetContextCreate(TopMemoryContext,
+	                          "PostGIS PROJ Backend Cache",
+	                          ALLOCSET_DEFAULT_MINSIZE,
+	                          ALLOCSET_DEFAULT_INITSIZE,
+	                          ALLOCSET_DEFAULT_MAXSIZE);
+
+	memset(&ctl, 0, sizeof(HASHCTL));
+	ctl.keysize = sizeof(int);
+	ctl.entrysize = sizeof(PROJBackendEntry);
+	ctl.hash = PROJBackendHash;
+	ctl.hcxt = PROJBackend.context;
+
+	PROJBackend.hash = hash_create("PostGIS PROJ Backend Cache Hash",
+	                               PROJ_BACKEND_HASH_SIZE, &ctl,
+	                               (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT));
+	dlist_init(&PROJBackend.lru);
+	dlist_init(&PROJBackend.pj_lru);
+
+	CacheRegisterRelcacheCallback(PROJBackendRelcacheCallback, (Datum) 0);
 }
 
-#ifdef MEMORY_CONTEXT_CHECKING
 static void
-PROJ4SRSCacheCheck(MemoryContext context)
+PROJBackendFreeProjection(PROJBackendEntry *pbe)
 {
-	/*
-	 * Do nothing - stub required for when PostgreSQL is compiled
-	 * with MEMORY_CONTEXT_CHECKING defined
-	 */
+	POSTGIS_DEBUGF(3, "freeing projection object (%p) for SRID %d", pbe->projection, pbe->srid);
+
+	pj_free(pbe->projection);
+	pbe->projection = NULL;
+	dlist_delete(&pbe->pj_lru_node);
+	PROJBackend.nprojections--;
+	PROJBackend.generation++;
+	GetCacheStats(PROJ_CACHE_ENTRY)->evictions++;
 }
-#endif
 
-/* Memory context definition must match the current version of PostgreSQL */
-static MemoryContextMethods PROJ4SRSCacheContextMethods =
+static void
+PROJBackendEvict(PROJBackendEntry *pbe)
 {
-	NULL,
-	NULL,
-	NULL,
-	PROJ4SRSCacheInit,
-	PROJ4SRSCacheReset,
-	PROJ4SRSCacheDelete,
-	NULL,
-	PROJ4SRSCacheIsEmpty,
-	PROJ4SRSCacheStats
-#ifdef MEMORY_CONTEXT_CHECKING
-	,PROJ4SRSCacheCheck
-#endif
-};
-
-#endif /* POSTGIS_PGSQL_VERSION < 96 */
-
-/*
- * PROJ4 projPJ Hash Table functions
- */
-
+	int srid = pbe->srid;
+
+	if ( pbe->projection )
+		PROJBackendFreeProjection(pbe);
+	pfree(pbe->proj_str);
+	dlist_delete(&pbe->lru_node);
+	PROJBackend.nstrings--;
+	hash_search(PROJBackend.hash, &srid, HASH_REMOVE, NULL);
+}
 
 /**
- * A version of tag_hash - we specify this here as the implementation
- * has changed over the years....
+ * Make the backend cache ready for lookups, creating it on first
+ * use and emptying it if spatial_ref_sys has changed.
  */
-
-uint32 mcxt_ptr_hash(const void *key, Size keysize)
+static void
+PROJBackendCheck(void)
 {
-	uint32 hashval;
+	if ( ! PROJBackend.hash )
+		PROJBackendInit();
 
-	hashval = DatumGetUInt32(hash_any(key, keysize));
-
-	return hashval;
+	if ( PROJBackend.invalid )
+	{
+		POSTGIS_DEBUG(3, "spatial_ref_sys changed, flushing PROJ backend cache");
+		while ( ! dlist_is_empty(&PROJBackend.lru) )
+		{
+			PROJBackendEvict(dlist_container(PROJBackendEntry, lru_node, dlist_tail_node(&PROJBackend.lru)));
+		}
+		PROJBackend.invalid = false;
+		PROJBackend.generation++;
+		/* The table may have been dropped and created again */
+		PROJBackend.srs_relid = InvalidOid;
+	}
 }
 
-
-static HTAB *CreatePJHash(void)
+/**
+ * Return the entry for srid from the backend cache, reading and
+ * parsing its projection if needed. The projection stays valid
+ * until the next call, which may evict it (but never the one for
+ * the SRID it was most recently called with).
+ */
+static PROJBackendEntry *
+PROJBackendGet(int srid)
 {
-	HASHCTL ctl;
+	PROJBackendEntry *pbe;
+	CacheStats *stats = GetCacheStats(PROJ_CACHE_ENTRY);
 
-	ctl.keysize = sizeof(MemoryContext);
-	ctl.entrysize = sizeof(PJHashEntry);
-	ctl.hash = mcxt_ptr_hash;
+	pbe = hash_search(PROJBackend.hash, &srid, HASH_FIND, NULL);
 
-	return hash_create("PostGIS PROJ4 Backend projPJ MemoryContext Hash", PROJ4_BACKEND_HASH_SIZE, &ctl, (HASH_ELEM | HASH_FUNCTION));
-}
+	if ( ! pbe )
+	{
+		/*
+		** Turn the SRID number into a proj4 string, by reading from spatial_ref_sys
+		** or instantiating a magical value from a negative srid.
+		*/
+		char *proj_str = GetProj4String(srid);
+		if ( ! proj_str )
+		{
+			elog(ERROR, "GetProj4String returned NULL for SRID (%d)", srid);
+		}
 
-static void AddPJHashEntry(MemoryContext mcxt, projPJ projection)
-{
-	bool found;
-	void **key;
-	PJHashEntry *he;
+		if ( PROJBackend.nstrings >= PROJ_BACKEND_STRINGS )
+			PROJBackendEvict(dlist_container(PROJBackendEntry, lru_node, dlist_tail_node(&PROJBackend.lru)));
 
-	/* The hash key is the MemoryContext pointer */
-	key = (void *)&mcxt;
+		pbe = hash_search(PROJBackend.hash, &srid, HASH_ENTER, NULL);
+		pbe->proj_str = MemoryContextStrdup(PROJBackend.context, proj_str);
+		pbe->projection = NULL;
+		dlist_push_head(&PROJBackend.lru, &pbe->lru_node);
+		PROJBackend.nstrings++;
+		pfree(proj_str);
 
-	he = (PJHashEntry *) hash_search(PJHash, key, HASH_ENTER, &found);
-	if (!found)
-	{
-		/* Insert the entry into the new hash element */
-		he->ProjectionContext = mcxt;
-		he->projection = projection;
+		/* So the callback knows which invalidations concern us */
+		if ( ! OidIsValid(PROJBackend.srs_relid) )
+			PROJBackend.srs_relid = PROJBackendSrsRelid();
 	}
 	else
 	{
-		elog(ERROR, "AddPJHashEntry: PROJ4 projection object already exists for this MemoryContext (%p)",
-		     (void *)mcxt);
+		dlist_move_head(&PROJBackend.lru, &pbe->lru_node);
 	}
-}
 
-static projPJ GetPJHashEntry(MemoryContext mcxt)
-{
-	void **key;
-	PJHashEntry *he;
-
-	/* The hash key is the MemoryContext pointer */
-	key = (void *)&mcxt;
-
-	/* Return the projection object from the hash */
-	he = (PJHashEntry *) hash_search(PJHash, key, HASH_FIND, NULL);
-
-	return he->projection;
-}
+	if ( pbe->projection )
+	{
+		stats->hits++;
+		dlist_move_head(&PROJBackend.pj_lru, &pbe->pj_lru_node);
+		return pbe;
+	}
 
+	stats->misses++;
 
-static void DeletePJHashEntry(MemoryContext mcxt)
-{
-	void **key;
-	PJHashEntry *he;
+	{
+		projPJ projection;
+		instr_time start, elapsed;
 
-	/* The hash key is the MemoryContext pointer */
-	key = (void *)&mcxt;
+		INSTR_TIME_SET_CURRENT(start);
+		projection = lwproj_from_string(pbe->proj_str);
+		if ( projection == NULL )
+		{
+			char *pj_errstr = pj_strerrno(*pj_get_errno_ref());
+			if ( ! pj_errstr )
+				pj_errstr = "";
 
-	/* Delete the projection object from the hash */
-	he = (PJHashEntry *) hash_search(PJHash, key, HASH_REMOVE, NULL);
+			elog(ERROR,
+			    "PROJBackendGet: could not parse proj4 string '%s' %s",
+			    pbe->proj_str, pj_errstr);
+		}
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, start);
+		stats->builds++;
+		stats->build_time += INSTR_TIME_GET_MILLISEC(elapsed);
+		stats->bytes += strlen(pbe->proj_str);
+
+		if ( PROJBackend.nprojections >= PROJ_BACKEND_PROJECTIONS )
+			PROJBackendFreeProjection(dlist_container(PROJBackendEntry, pj_lru_node, dlist_tail_node(&PROJBackend.pj_lru)));
+
+		POSTGIS_DEBUGF(3, "adding projection object (%p) for SRID %d to backend cache", projection, srid);
+		pbe->projection = projection;
+		pbe->smerc_kind = lwproj_smerc_kind(projection);
+		dlist_push_head(&PROJBackend.pj_lru, &pbe->pj_lru_node);
+		PROJBackend.nprojections++;
+	}
 
-	if (!he)
-		elog(ERROR, "DeletePJHashEntry: There was an error removing the PROJ4 projection object from this MemoryContext (%p)", (void *)mcxt);
-	else
-		he->projection = NULL;
+	return pbe;
 }
 
 bool
@@ -301,7 +339,10 @@ IsInPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid)
 	for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
 	{
 		if (PROJ4Cache->PROJ4SRSCache[i].srid == srid)
+		{
+			GetCacheStats(PROJ_CACHE_ENTRY)->hits++;
 			return 1;
+		}
 	}
 
 	/* Otherwise not found */
@@ -331,6 +372,20 @@ GetProjectionFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid)
 	return NULL;
 }
 
+int GetSmercKindFromPROJ4Cache(Proj4Cache cache, int srid)
+{
+	PROJ4PortalCache *PROJ4Cache = (PROJ4PortalCache *)cache;
+	int i;
+
+	for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
+	{
+		if (PROJ4Cache->PROJ4SRSCache[i].srid == srid)
+			return PROJ4Cache->PROJ4SRSCache[i].smerc_kind;
+	}
+
+	return LW_SMERC_NONE;
+}
+
 char* GetProj4StringSPI(int srid)
 {
 	static int maxproj4len = 512;
@@ -507,38 +562,15 @@ void AddToPROJ4Cache(Proj4Cache cache, int srid, int other_srid) {
 
 
 /**
- * Add an entry to the local PROJ4 SRS cache. If we need to wrap around then
- * we must make sure the entry we choose to delete does not contain other_srid
- * which is the definition for the other half of the transformation.
+ * Add an entry to the local PROJ4 SRS cache, from the backend cache.
+ * If we need to wrap around then we must make sure the entry we choose
+ * to forget does not contain other_srid which is the definition for
+ * the other half of the transformation.
  */
 static void
 AddToPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid, int other_srid)
 {
-	MemoryContext PJMemoryContext;
-	projPJ projection = NULL;
-	char *proj_str = NULL;
-
-	/*
-	** Turn the SRID number into a proj4 string, by reading from spatial_ref_sys
-	** or instantiating a magical value from a negative srid.
-	*/
-	proj_str = GetProj4String(srid);
-	if ( ! proj_str )
-	{
-		elog(ERROR, "GetProj4String returned NULL for SRID (%d)", srid);
-	}
-
-	projection = lwproj_from_string(proj_str);
-	if ( projection == NULL )
-	{
-		char *pj_errstr = pj_strerrno(*pj_get_errno_ref());
-		if ( ! pj_errstr )
-			pj_errstr = "";
-
-		elog(ERROR,
-		    "AddToPROJ4SRSCache: could not parse proj4 string '%s' %s",
-		    proj_str, pj_errstr);
-	}
+	PROJBackendEntry *pbe = PROJBackendGet(srid);
 
 	/*
 	 * If the cache is already full then find the first entry
@@ -564,53 +596,12 @@ AddToPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid, int other_srid)
 		}
 	}
 
-	/*
-	 * Now create a memory context for this projection and
-	 * store it in the backend hash
-	 */
-	POSTGIS_DEBUGF(3, "adding SRID %d with proj4text \"%s\" to query cache at index %d", srid, proj_str, PROJ4Cache->PROJ4SRSCacheCount);
-
-#if POSTGIS_PGSQL_VERSION < 96
-	PJMemoryContext = MemoryContextCreate(T_AllocSetContext, 8192,
-	                                      &PROJ4SRSCacheContextMethods,
-	                                      PROJ4Cache->PROJ4SRSCacheContext,
-	                                      "PostGIS PROJ4 PJ Memory Context");
-#else
-	PJMemoryContext = AllocSetContextCreate(PROJ4Cache->PROJ4SRSCacheContext,
-	                                        "PostGIS PROJ4 PJ Memory Context",
-	                                        ALLOCSET_SMALL_SIZES);
-
-	/* PgSQL comments suggest allocating callback in the context */
-	/* being managed, so that the callback object gets cleaned along with */
-	/* the context */
-	{
-		MemoryContextCallback *callback = MemoryContextAlloc(PJMemoryContext, sizeof(MemoryContextCallback));
-		callback->arg = (void*)PJMemoryContext;
-		callback->func = PROJ4SRSCacheDelete;
-		MemoryContextRegisterResetCallback(PJMemoryContext, callback);
-	}
-#endif
-
- 	/* Create the backend hash if it doesn't already exist */
-	if (!PJHash)
-		PJHash = CreatePJHash();
-
-	/*
-	 * Add the MemoryContext to the backend hash so we can
-	 * clean up upon portal shutdown
-	 */
-	POSTGIS_DEBUGF(3, "adding projection object (%p) to hash table with MemoryContext key (%p)", projection, PJMemoryContext);
-
-	AddPJHashEntry(PJMemoryContext, projection);
+	POSTGIS_DEBUGF(3, "adding SRID %d to query cache at index %d", srid, PROJ4Cache->PROJ4SRSCacheCount);
 
 	PROJ4Cache->PROJ4SRSCache[PROJ4Cache->PROJ4SRSCacheCount].srid = srid;
-	PROJ4Cache->PROJ4SRSCache[PROJ4Cache->PROJ4SRSCacheCount].projection = projection;
-	PROJ4Cache->PROJ4SRSCache[PROJ4Cache->PROJ4SRSCacheCount].projection_mcxt = PJMemoryContext;
+	PROJ4Cache->PROJ4SRSCache[PROJ4Cache->PROJ4SRSCacheCount].projection = pbe->projection;
+	PROJ4Cache->PROJ4SRSCache[PROJ4Cache->PROJ4SRSCacheCount].smerc_kind = pbe->smerc_kind;
 	PROJ4Cache->PROJ4SRSCacheCount++;
-
-	/* Free the projection string */
-	pfree(proj_str);
-
 }
 
 void DeleteFromPROJ4Cache(Proj4Cache cache, int srid) {
@@ -621,7 +612,8 @@ void DeleteFromPROJ4Cache(Proj4Cache cache, int srid) {
 static void DeleteFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid)
 {
 	/*
-	 * Delete the SRID entry from the cache
+	 * Forget the SRID entry, the projection itself belongs
+	 * to the backend cache
 	 */
 
 	int i;
@@ -632,18 +624,28 @@ static void DeleteFromPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache, int srid)
 		{
 			POSTGIS_DEBUGF(3, "removing query cache entry with SRID %d at index %d", srid, i);
 
-			/*
-			 * Zero out the entries and free the PROJ4 handle
-			 * by deleting the memory context
-			 */
-			MemoryContextDelete(PROJ4Cache->PROJ4SRSCache[i].projection_mcxt);
 			PROJ4Cache->PROJ4SRSCache[i].projection = NULL;
-			PROJ4Cache->PROJ4SRSCache[i].projection_mcxt = NULL;
 			PROJ4Cache->PROJ4SRSCache[i].srid = SRID_UNKNOWN;
 		}
 	}
 }
 
+/**
+ * Forget every entry of the local PROJ4 SRS cache, and note the
+ * backend generation the next entries will come from.
+ */
+static void ResetPROJ4SRSCache(PROJ4PortalCache *PROJ4Cache)
+{
+	int i;
+
+	for (i = 0; i < PROJ4_CACHE_ITEMS; i++)
+	{
+		PROJ4Cache->PROJ4SRSCache[i].projection = NULL;
+		PROJ4Cache->PROJ4SRSCache[i].srid = SRID_UNKNOWN;
+	}
+	PROJ4Cache->PROJ4SRSCacheCount = 0;
+	PROJ4Cache->generation = PROJBackend.generation;
+}
 
 /**
  * Specify an alternate directory for the PROJ.4 grid files
@@ -736,6 +738,11 @@ GetProjectionsUsingFCInfo(FunctionCallInfo fcinfo, int srid1, int srid2, projPJ
 	if ( !proj_cache )
 		return LW_FAILURE;
 
+	/* Projections we remembered may have been freed since */
+	PROJBackendCheck();
+	if ( ((PROJ4PortalCache *)proj_cache)->generation != PROJBackend.generation )
+		ResetPROJ4SRSCache((PROJ4PortalCache *)proj_cache);
+
 	/* Add the output srid to the cache if it's not already there */
 	if (!IsInPROJ4Cache(proj_cache, srid1))
 		AddToPROJ4Cache(proj_cache, srid1, srid2);
@@ -744,6 +751,26 @@ GetProjectionsUsingFCInfo(FunctionCallInfo fcinfo, int srid1, int srid2, projPJ
 	if (!IsInPROJ4Cache(proj_cache, srid2))
 		AddToPROJ4Cache(proj_cache, srid2, srid1);
 
+	/*
+	 * Reading one may have evicted the other from the backend
+	 * cache, if it was only known here. Reading both again leaves
+	 * them at the recently used end, so neither evicts the other.
+	 */
+	if ( ((PROJ4PortalCache *)proj_cache)->generation != PROJBackend.generation )
+	{
+		CacheStats *stats = GetCacheStats(PROJ_CACHE_ENTRY);
+		int64 hits = stats->hits;
+
+		ResetPROJ4SRSCache((PROJ4PortalCache *)proj_cache);
+		AddToPROJ4Cache(proj_cache, srid1, srid2);
+		if ( srid2 != srid1 )
+			AddToPROJ4Cache(proj_cache, srid2, srid1);
+		((PROJ4PortalCache *)proj_cache)->generation = PROJBackend.generation;
+
+		/* Those lookups were counted already, at one level or the other */
+		stats->hits = hits;
+	}
+
 	/* Get the projections */
 	*pj1 = GetProjectionFromPROJ4Cache(proj_cache, srid1);
 	*pj2 = GetProjectionFromPROJ4Cache(proj_cache, srid2);
@@ -43,6 +43,18 @@ the contant search box.
 gserialized_gist_joinsel sums up the product of the overlapping
 cells in each relation's histogram.
 
+When the sample turns out to be concentrated in a few cells of
+the uniform histogram (city-clustered data, say), the ANALYZE
+callback also builds an adaptive, equi-depth histogram whose
+buckets are the leaves of a kd-tree on the sample box centers,
+and stores it in its own stats slot. The estimators use it in
+preference to the uniform grid whenever it is present.
+
+The callback also records how many vertices (and bytes) the sampled
+features have, so the cost support function of the expensive
+predicates (gserialized_supportfn.c) can tell a table of parcels
+from a table of coastlines.
+
 Depending on the operator and type, the mode of selectivity calculation
 will be 2D or ND.
 
@@ -85,7 +97,13 @@ dimensionality cases. (2D geometry) &&& (3D column), etc.
 #include "funcapi.h"
 #include "access/heapam.h"
 #include "catalog/pg_type.h"
+#include "catalog/pg_statistic.h"
 #include "access/relscan.h"
+#if POSTGIS_PGSQL_VERSION >= 120
+#include "access/tableam.h"
+#endif
+#include "storage/bufmgr.h"
+#include "utils/acl.h"
 
 #include "executor/spi.h"
 #include "fmgr.h"
@@ -113,6 +131,7 @@ dimensionality cases. (2D geometry) &&& (3D column), etc.
 #include "liblwgeom.h"
 #include "lwgeom_pg.h"       /* For debugging macros. */
 #include "gserialized_gist.h" /* For index common functions */
+#include "gserialized_estimate.h"
 
 #include <math.h>
 #if HAVE_IEEEFP_H
@@ -151,6 +170,8 @@ Datum _postgis_gserialized_index_extent(PG_FUNCTION_ARGS);
 Datum _postgis_gserialized_sel(PG_FUNCTION_ARGS);
 Datum _postgis_gserialized_joinsel(PG_FUNCTION_ARGS);
 Datum _postgis_gserialized_stats(PG_FUNCTION_ARGS);
+Datum _postgis_gserialized_vertex_stats(PG_FUNCTION_ARGS);
+Datum _postgis_gserialized_stats_refresh(PG_FUNCTION_ARGS);
 
 /* Local prototypes */
 static Oid table_get_spatial_index(Oid tbl_oid, text *col, int *key_type);
@@ -172,8 +193,14 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS);
 */
 #define STATISTIC_KIND_ND 102
 #define STATISTIC_KIND_2D 103
+#define STATISTIC_KIND_ND_ADAPTIVE 104
+#define STATISTIC_KIND_2D_ADAPTIVE 105
+#define STATISTIC_KIND_VERTEX 106
 #define STATISTIC_SLOT_ND 0
 #define STATISTIC_SLOT_2D 1
+#define STATISTIC_SLOT_ND_ADAPTIVE 2
+#define STATISTIC_SLOT_2D_ADAPTIVE 3
+#define STATISTIC_SLOT_VERTEX 4
 
 /*
 * The SD factor restricts the side of the statistics histogram
@@ -216,6 +243,21 @@ Datum geometry_estimated_extent(PG_FUNCTION_ARGS);
 #define FALLBACK_ND_SEL 0.2
 #define FALLBACK_ND_JOINSEL 0.3
 
+/**
+* The adaptive histogram is only built when the uniform one is
+* skewed: when the densest 1% of the grid cells (plus the hard
+* deviants the grid could not hold) account for at least this
+* proportion of the sample.
+*/
+#define ADAPTIVE_SKEW_THRESHOLD 0.5
+
+/**
+* Number of adaptive buckets per unit of statistics target, and
+* the minimum number of sample features we want in a bucket.
+*/
+#define ADAPTIVE_BUCKETS_PER_TARGET 4
+#define ADAPTIVE_MIN_BUCKET_FEATURES 10
+
 /**
 * N-dimensional box type for calculations, to avoid doing
 * explicit axis conversions from GBOX in all calculations
@@ -274,10 +316,88 @@ typedef struct ND_STATS_T
 	/* now always equal histogram_features */
 	float4 cells_covered;
 
-	/* Variable length # of floats for histogram */
+	/* Variable length # of floats for histogram, followed by */
+	/* the summed-area table of the histogram (two floats per cell) */
+	/* and by the table block count the stats last took rows from */
 	float4 value[1];
 } ND_STATS;
 
+/**
+* Size of an #ND_STATS with its summed-area table. Stats gathered
+* before the table was added only hold the histogram values.
+* The table is summed in float8, and each entry is kept as a
+* float4 pair (the float4 nearest the sum, and what is left over)
+* because pg_statistic only stores float4 numbers.
+*/
+#define ND_STATS_SAT_SIZE(ncells) (sizeof(ND_STATS) + ((3 * (ncells) - 1) * sizeof(float4)))
+
+/**
+* Size of a complete #ND_STATS: the summed-area table is followed
+* by the block count of the table, as two 16-bit halves since a
+* float4 only holds integers exactly up to 2^24.
+*/
+#define ND_STATS_SIZE(ncells) (ND_STATS_SAT_SIZE(ncells) + 2 * sizeof(float4))
+
+
+/**
+* One bucket of the adaptive histogram. Rather than storing
+* the bounds of a fixed cell, a bucket stores the extent of the
+* centers of the sample boxes that fell into it, and their
+* average half-width in each dimension.
+*/
+typedef struct ND_BUCKET_T
+{
+	/* Extent of the centers of the boxes in the bucket */
+	ND_BOX centers;
+
+	/* Average half-width of the boxes in the bucket */
+	float4 halfwidth[ND_DIMS];
+
+	/* How many sample features fell into the bucket? */
+	float4 count;
+} ND_BUCKET;
+
+/**
+* Adaptive (equi-depth) statistics structure. The buckets are
+* the leaves of a kd-tree built over the centers of the sample
+* boxes, so dense areas get many small buckets and sparse areas
+* get a few large ones. Stored next to the #ND_STATS grid, and
+* only when the grid turns out to be skewed.
+*/
+typedef struct ND_ASTATS_T
+{
+	/* Dimensionality of the histogram. */
+	float4 ndims;
+
+	/* How many buckets in the histogram? */
+	float4 nbuckets;
+
+	/* How many rows in the table itself? */
+	float4 table_features;
+
+	/* How many rows were in the sample that built this histogram? */
+	float4 sample_features;
+
+	/* How many not-Null/Empty features were in the sample? */
+	float4 not_null_features;
+
+	/* How many features actually got sampled in the histogram? */
+	float4 histogram_features;
+
+	/* Variable length # of buckets */
+	ND_BUCKET bucket[1];
+} ND_ASTATS;
+
+/**
+* Sample feature, as seen by the adaptive histogram builder.
+*/
+typedef struct ND_ASAMPLE_T
+{
+	float4 center[ND_DIMS];
+	float4 halfwidth[ND_DIMS];
+	float4 key;
+} ND_ASAMPLE;
+
 
 
 
@@ -318,6 +438,46 @@ text_p_get_mode(const text *txt)
 	return mode;
 }
 
+/**
+* True if a mode string given to the _postgis_* functions asks,
+* with a 'w', for the cells to be walked one by one instead of
+* read from the summed-area table. Used to test the table.
+*/
+static bool
+text_p_get_walk(const text *txt)
+{
+	return memchr(VARDATA(txt), 'w', VARSIZE(txt) - VARHDRSZ) != NULL;
+}
+
+/**
+* Flag the summed-area table of an #ND_STATS as missing.
+*/
+static void
+nd_stats_drop_sat(ND_STATS *nd_stats)
+{
+	nd_stats->value[(int)roundf(nd_stats->histogram_cells)] = -1.0;
+}
+
+/**
+* Block count of the table when the stats last took in its rows,
+* where postgis_stats_refresh picks up from. InvalidBlockNumber
+* when unknown.
+*/
+static BlockNumber
+nd_stats_get_blocks(const ND_STATS *nd_stats)
+{
+	const float4 *blocks = nd_stats->value + 3 * (int)roundf(nd_stats->histogram_cells);
+	return ((BlockNumber)blocks[0] << 16) | (BlockNumber)blocks[1];
+}
+
+static void
+nd_stats_set_blocks(ND_STATS *nd_stats, BlockNumber nblocks)
+{
+	float4 *blocks = nd_stats->value + 3 * (int)roundf(nd_stats->histogram_cells);
+	blocks[0] = (float4)(nblocks >> 16);
+	blocks[1] = (float4)(nblocks & 0xFFFF);
+}
+
 
 /**
 * Integer comparison function for qsort
@@ -890,204 +1050,993 @@ nd_increment(ND_IBOX *ibox, int ndims, int *counter)
 	return true;
 }
 
-static ND_STATS*
-pg_nd_stats_from_tuple(HeapTuple stats_tuple, int mode)
+/**
+* Fill in the summed-area table that follows the histogram values:
+* each entry holds the sum of the values of all the cells whose
+* indexes are all lower or equal to its own. Built one dimension
+* at a time, as a running sum along that dimension, in float8 so
+* that the inclusion-exclusion over the corners of a box does not
+* cancel away the sum of a few cells in a large table.
+*/
+static void
+nd_stats_build_sat(ND_STATS *nd_stats)
 {
-	int stats_kind = STATISTIC_KIND_ND;
-	int rv;
-	ND_STATS *nd_stats;
-
-	/* If we're in 2D mode, set the kind appropriately */
-	if ( mode == 2 ) stats_kind = STATISTIC_KIND_2D;
-
-    /* Then read the geom status histogram from that */
+	int d, i;
+	int ndims = (int)roundf(nd_stats->ndims);
+	int ncells = (int)roundf(nd_stats->histogram_cells);
+	float4 *sat = nd_stats->value + ncells;
+	float8 *sums = palloc(sizeof(float8) * ncells);
+	int stride = 1;
 
-#if POSTGIS_PGSQL_VERSION < 100
+	for ( i = 0; i < ncells; i++ )
+		sums[i] = nd_stats->value[i];
+	for ( d = 0; d < ndims; d++ )
 	{
-		float4 *floatptr;
-		int nvalues;
-
-		rv = get_attstatsslot(stats_tuple, 0, 0, stats_kind, InvalidOid,
-							NULL, NULL, NULL, &floatptr, &nvalues);
-
-		if ( ! rv ) {
-			POSTGIS_DEBUGF(2, "no slot of kind %d in stats tuple", stats_kind);
-			return NULL;
+		int size = (int)roundf(nd_stats->size[d]);
+		for ( i = 0; i < ncells; i++ )
+		{
+			/* Skip the first cell along this dimension */
+			if ( (i / stride) % size )
+				sums[i] += sums[i - stride];
 		}
-
-		/* Clone the stats here so we can release the attstatsslot immediately */
-		nd_stats = palloc(sizeof(float) * nvalues);
-		memcpy(nd_stats, floatptr, sizeof(float) * nvalues);
-
-		/* Clean up */
-		free_attstatsslot(0, NULL, 0, floatptr, nvalues);
+		stride *= size;
 	}
-#else /* PostgreSQL 10 or higher */
-	{
-		AttStatsSlot sslot;
-		rv = get_attstatsslot(&sslot, stats_tuple, stats_kind, InvalidOid,
-							 ATTSTATSSLOT_NUMBERS);
-		if ( ! rv ) {
-			POSTGIS_DEBUGF(2, "no slot of kind %d in stats tuple", stats_kind);
-			return NULL;
-		}
 
-		/* Clone the stats here so we can release the attstatsslot immediately */
-		nd_stats = palloc(sizeof(float4) * sslot.nnumbers);
-		memcpy(nd_stats, sslot.numbers, sizeof(float4) * sslot.nnumbers);
-
-		free_attstatsslot(&sslot);
+	/* Store each sum as a float4 and its float4 remainder */
+	for ( i = 0; i < ncells; i++ )
+	{
+		sat[2*i] = (float4)sums[i];
+		sat[2*i+1] = (float4)(sums[i] - sat[2*i]);
 	}
-#endif
+	pfree(sums);
+}
 
-	return nd_stats;
+/**
+* Entry i of a summed-area table, see #nd_stats_build_sat.
+*/
+static inline double
+nd_stats_sat_value(const float4 *sat, int i)
+{
+	return (double)sat[2*i] + (double)sat[2*i+1];
 }
 
 /**
-* Pull the stats object from the PgSQL system catalogs. Used
-* by the selectivity functions and the debugging functions.
+* Return the summed-area table of an #ND_STATS, or NULL if the
+* stats have none or have a dimension too narrow to pro-rate cells
+* on, in which case callers fall back to walking the cells.
 */
-static ND_STATS*
-pg_get_nd_stats(const Oid table_oid, AttrNumber att_num, int mode, bool only_parent)
+static const float4*
+nd_stats_sat(const ND_STATS *nd_stats)
 {
-	HeapTuple stats_tuple = NULL;
-	ND_STATS *nd_stats;
+	int d;
+	const float4 *sat = nd_stats->value + (int)roundf(nd_stats->histogram_cells);
 
-	/* First pull the stats tuple for the whole tree */
-	if ( ! only_parent )
-	{
-		POSTGIS_DEBUGF(2, "searching whole tree stats for \"%s\"", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
-		stats_tuple = SearchSysCache3(STATRELATTINH, ObjectIdGetDatum(table_oid), Int16GetDatum(att_num), BoolGetDatum(true));
-		if ( stats_tuple )
-			POSTGIS_DEBUGF(2, "found whole tree stats for \"%s\"", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
-	}
-	/* Fall-back to main table stats only, if not found for whole tree or explicitly ignored */
-	if ( only_parent || ! stats_tuple )
-	{
-		POSTGIS_DEBUGF(2, "searching parent table stats for \"%s\"", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
-		stats_tuple = SearchSysCache3(STATRELATTINH, ObjectIdGetDatum(table_oid), Int16GetDatum(att_num), BoolGetDatum(false));
-		if ( stats_tuple )
-			POSTGIS_DEBUGF(2, "found parent table stats for \"%s\"", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
-	}
-	if ( ! stats_tuple )
-	{
-		POSTGIS_DEBUGF(2, "stats for \"%s\" do not exist", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
+	if ( sat[0] < 0.0 )
 		return NULL;
-	}
 
-	nd_stats = pg_nd_stats_from_tuple(stats_tuple, mode);
-	ReleaseSysCache(stats_tuple);
-	if ( ! nd_stats )
+	for ( d = 0; d < nd_stats->ndims; d++ )
 	{
-		POSTGIS_DEBUGF(2,
-			"histogram for attribute %d of table \"%s\" does not exist?",
-			att_num, get_rel_name(table_oid));
+		if ( nd_stats->extent.max[d] - nd_stats->extent.min[d] < MIN_DIMENSION_WIDTH )
+			return NULL;
 	}
-
-	return nd_stats;
+	return sat;
 }
 
 /**
-* Pull the stats object from the PgSQL system catalogs. The
-* debugging functions are taking human input (table names)
-* and columns, so we have to look those up first.
-* In case of parent tables whith INHERITS, when "only_parent"
-* is true this function only searchs for stats in the parent
-* table ignoring any statistic collected from the children.
+* Sum of the histogram values of the cells between the min and
+* max indexes (inclusive), by inclusion-exclusion over the
+* 2^ndims corners of the summed-area table.
 */
-static ND_STATS*
-pg_get_nd_stats_by_name(const Oid table_oid, const text *att_text, int mode, bool only_parent)
+static double
+nd_stats_sat_range(const ND_STATS *nd_stats, const float4 *sat, const int *min, const int *max)
 {
-	const char *att_name = text_to_cstring(att_text);
-	AttrNumber att_num;
+	int d, corner;
+	int ndims = (int)roundf(nd_stats->ndims);
+	double sum = 0.0;
 
-	/* We know the name? Look up the num */
-	if ( att_text )
+	for ( corner = 0; corner < (1 << ndims); corner++ )
 	{
-		/* Get the attribute number */
-		att_num = get_attnum(table_oid, att_name);
-		if  ( ! att_num ) {
-			elog(ERROR, "attribute \"%s\" does not exist", att_name);
-			return NULL;
+		int at[ND_DIMS];
+		int sign = 1;
+		bool skip = false;
+
+		for ( d = 0; d < ndims; d++ )
+		{
+			if ( corner & (1 << d) )
+			{
+				at[d] = min[d] - 1;
+				sign = -sign;
+				if ( at[d] < 0 )
+				{
+					skip = true;
+					break;
+				}
+			}
+			else
+			{
+				at[d] = max[d];
+			}
 		}
+		if ( ! skip )
+			sum += sign * nd_stats_sat_value(sat, nd_stats_value_index(nd_stats, at));
 	}
-	else
-	{
-		elog(ERROR, "attribute name is null");
-		return NULL;
-	}
-
-	return pg_get_nd_stats(table_oid, att_num, mode, only_parent);
+	return sum;
 }
 
 /**
-* Given two statistics histograms, what is the selectivity
-* of a join driven by the && or &&& operator?
-*
-* Join selectivity is defined as the number of rows returned by the
-* join operator divided by the number of rows that an
-* unconstrained join would return (nrows1*nrows2).
-*
-* To get the estimate of join rows, we walk through the cells
-* of one histogram, and multiply the cell value by the
-* proportion of the cells in the other histogram the cell
-* overlaps: val += val1 * ( val2 * overlap_ratio )
+* Sum of the histogram values of the cells in nd_ibox, each
+* pro-rated by the proportion of the cell covered by nd_box, which
+* is what walking the cells with #nd_box_ratio adds up to.
+* The coverage is a product of per-dimension proportions that is
+* only fractional for the first and last cell on each axis, so each
+* axis splits into at most three runs of cells (partial, full,
+* partial) and the total takes 3^ndims summed-area table lookups,
+* whatever the number of cells.
 */
-static float8
-estimate_join_selectivity(const ND_STATS *s1, const ND_STATS *s2)
+static double
+nd_stats_sat_sum(const ND_STATS *nd_stats, const float4 *sat, const ND_BOX *nd_box, const ND_IBOX *nd_ibox)
 {
-	int ncells1, ncells2;
-	int ndims1, ndims2, ndims;
-	double ntuples_max;
-	double ntuples_not_null1, ntuples_not_null2;
-
-	ND_BOX extent1, extent2;
-	ND_IBOX ibox1, ibox2;
-	int at1[ND_DIMS];
-	int at2[ND_DIMS];
-	double min1[ND_DIMS];
-	double width1[ND_DIMS];
-	double cellsize1[ND_DIMS];
-	int size2[ND_DIMS];
-	double min2[ND_DIMS];
-	double width2[ND_DIMS];
-	double cellsize2[ND_DIMS];
-	int size1[ND_DIMS];
 	int d;
-	double val = 0;
-	float8 selectivity;
+	int ndims = (int)roundf(nd_stats->ndims);
+	int nruns[ND_DIMS];
+	int run_min[ND_DIMS][3];
+	int run_max[ND_DIMS][3];
+	double run_ratio[ND_DIMS][3];
+	int run[ND_DIMS];
+	double total = 0.0;
 
-	/* Drop out on null inputs */
-	if ( ! ( s1 && s2 ) )
+	for ( d = 0; d < ndims; d++ )
 	{
-		elog(NOTICE, " estimate_join_selectivity called with null inputs");
-		return FALLBACK_ND_SEL;
-	}
+		double smin = nd_stats->extent.min[d];
+		double cellsize = (nd_stats->extent.max[d] - smin) / nd_stats->size[d];
+		int lo = nd_ibox->min[d];
+		int hi = nd_ibox->max[d];
+		int k;
 
-	/* We need to know how many cells each side has... */
-	ncells1 = (int)roundf(s1->histogram_cells);
-	ncells2 = (int)roundf(s2->histogram_cells);
+		if ( lo > hi )
+			return 0.0;
 
-	/* ...so that we can drive the summation loop with the smaller histogram. */
-	if ( ncells1 > ncells2 )
-	{
-		const ND_STATS *stats_tmp = s1;
-		s1 = s2;
-		s2 = stats_tmp;
-	}
+		nruns[d] = 0;
+		for ( k = 0; k < 3; k++ )
+		{
+			int at;
+			double cmin, cmax, iwidth;
 
-	POSTGIS_DEBUGF(3, "s1: %s", nd_stats_to_json(s1));
-	POSTGIS_DEBUGF(3, "s2: %s", nd_stats_to_json(s2));
+			/* First cell, interior cells, last cell */
+			if ( k == 0 )
+			{
+				run_min[d][nruns[d]] = run_max[d][nruns[d]] = at = lo;
+			}
+			else if ( k == 1 )
+			{
+				if ( hi - lo < 2 ) continue;
+				run_min[d][nruns[d]] = lo + 1;
+				run_max[d][nruns[d]] = hi - 1;
+				run_ratio[d][nruns[d]] = 1.0;
+				nruns[d]++;
+				continue;
+			}
+			else
+			{
+				if ( hi == lo ) continue;
+				run_min[d][nruns[d]] = run_max[d][nruns[d]] = at = hi;
+			}
 
-	/* Re-read that info after the swap */
-	ncells1 = (int)roundf(s1->histogram_cells);
-	ncells2 = (int)roundf(s2->histogram_cells);
+			cmin = smin + (at+0) * cellsize;
+			cmax = smin + (at+1) * cellsize;
+			iwidth = Min(cmax, nd_box->max[d]) - Max(cmin, nd_box->min[d]);
+			run_ratio[d][nruns[d]] = Max(0.0, iwidth) / cellsize;
+			nruns[d]++;
+		}
+		run[d] = 0;
+	}
 
-	/* Q: What's the largest possible join size these relations can create? */
-	/* A: The product of the # of non-null rows in each relation. */
-	ntuples_not_null1 = s1->table_features * (s1->not_null_features / s1->sample_features);
-	ntuples_not_null2 = s2->table_features * (s2->not_null_features / s2->sample_features);
-	ntuples_max = ntuples_not_null1 * ntuples_not_null2;
+	/* Add up every combination of runs */
+	while ( true )
+	{
+		int min[ND_DIMS], max[ND_DIMS];
+		double ratio = 1.0;
+
+		for ( d = 0; d < ndims; d++ )
+		{
+			min[d] = run_min[d][run[d]];
+			max[d] = run_max[d][run[d]];
+			ratio *= run_ratio[d][run[d]];
+		}
+		if ( ratio > 0.0 )
+			total += ratio * nd_stats_sat_range(nd_stats, sat, min, max);
+
+		/* Next combination */
+		for ( d = 0; d < ndims; d++ )
+		{
+			if ( ++run[d] < nruns[d] )
+				break;
+			run[d] = 0;
+		}
+		if ( d == ndims )
+			break;
+	}
+
+	return total;
+}
+
+/**
+* Float comparison function for qsort, sorts in descending order
+*/
+static int
+cmp_float4_desc(const void *a, const void *b)
+{
+	float4 fa = *((const float4*)a);
+	float4 fb = *((const float4*)b);
+
+	if ( fa == fb )
+		return 0;
+	else if ( fa < fb )
+		return 1;
+	else
+		return -1;
+}
+
+/**
+* How skewed is the uniform grid? Returns the proportion of the
+* non-null sample that either landed in the densest 1% of the
+* cells, or was thrown out of the grid as a hard deviant. A
+* uniform distribution returns something close to 0.01, a
+* distribution where almost everything lands in a few cells
+* returns something close to 1.
+*/
+static double
+nd_stats_skew(const ND_STATS *nd_stats, int notnull_cnt)
+{
+	int i;
+	int ncells = (int)roundf(nd_stats->histogram_cells);
+	int ntop = Max(1, ncells / 100);
+	float4 *values;
+	double top = 0.0;
+	double deviants;
+
+	if ( ! notnull_cnt )
+		return 0.0;
+
+	values = palloc(sizeof(float4) * ncells);
+	memcpy(values, nd_stats->value, sizeof(float4) * ncells);
+	qsort(values, ncells, sizeof(float4), cmp_float4_desc);
+	for ( i = 0; i < ntop; i++ )
+		top += values[i];
+	pfree(values);
+
+	deviants = notnull_cnt - nd_stats->histogram_features;
+	return (top + deviants) / notnull_cnt;
+}
+
+/**
+* Sample comparison function for qsort, orders on the key
+*/
+static int
+cmp_asample_key(const void *a, const void *b)
+{
+	float4 ka = ((const ND_ASAMPLE*)a)->key;
+	float4 kb = ((const ND_ASAMPLE*)b)->key;
+
+	if ( ka == kb )
+		return 0;
+	else if ( ka > kb )
+		return 1;
+	else
+		return -1;
+}
+
+/**
+* Summarize a run of samples into the next free bucket of
+* the adaptive histogram.
+*/
+static void
+nd_astats_add_bucket(ND_ASTATS *nd_astats, const ND_ASAMPLE *samples, int nsamples, int ndims)
+{
+	int d, i;
+	ND_BUCKET *bucket = &(nd_astats->bucket[(int)(nd_astats->nbuckets)]);
+	double halfwidth[ND_DIMS] = {0.0, 0.0, 0.0, 0.0};
+
+	nd_box_init(&(bucket->centers));
+	nd_box_init_bounds(&(bucket->centers));
+	for ( i = 0; i < nsamples; i++ )
+	{
+		for ( d = 0; d < ndims; d++ )
+		{
+			bucket->centers.min[d] = Min(bucket->centers.min[d], samples[i].center[d]);
+			bucket->centers.max[d] = Max(bucket->centers.max[d], samples[i].center[d]);
+			halfwidth[d] += samples[i].halfwidth[d];
+		}
+	}
+	for ( d = 0; d < ND_DIMS; d++ )
+	{
+		if ( d < ndims )
+		{
+			bucket->halfwidth[d] = halfwidth[d] / nsamples;
+		}
+		else
+		{
+			bucket->centers.min[d] = bucket->centers.max[d] = 0.0;
+			bucket->halfwidth[d] = 0.0;
+		}
+	}
+	bucket->count = nsamples;
+	nd_astats->nbuckets += 1;
+}
+
+/**
+* Recursively split a run of samples into nbuckets equi-depth
+* buckets, kd-tree style: each split is made at the median of
+* the dimension in which the centers are the most spread out,
+* relative to the extent of the whole sample.
+*/
+static void
+nd_astats_split(ND_ASTATS *nd_astats, ND_ASAMPLE *samples, int nsamples, int nbuckets,
+                int ndims, const ND_BOX *extent)
+{
+	int d, i;
+	int split_dim = -1;
+	double split_spread = 0.0;
+	int nbuckets_left, split, lo, hi;
+
+	/* Too small to split any further? */
+	if ( nbuckets < 2 || nsamples < 2 * ADAPTIVE_MIN_BUCKET_FEATURES )
+	{
+		nd_astats_add_bucket(nd_astats, samples, nsamples, ndims);
+		return;
+	}
+
+	/* Find the dimension with the widest relative spread of centers */
+	for ( d = 0; d < ndims; d++ )
+	{
+		double width = extent->max[d] - extent->min[d];
+		float4 cmin = FLT_MAX;
+		float4 cmax = -1 * FLT_MAX;
+
+		if ( width < MIN_DIMENSION_WIDTH || width > MAX_DIMENSION_WIDTH )
+			continue;
+
+		for ( i = 0; i < nsamples; i++ )
+		{
+			cmin = Min(cmin, samples[i].center[d]);
+			cmax = Max(cmax, samples[i].center[d]);
+		}
+
+		if ( (cmax - cmin) / width > split_spread )
+		{
+			split_spread = (cmax - cmin) / width;
+			split_dim = d;
+		}
+	}
+
+	/* All the centers are in the same place, nothing to split */
+	if ( split_dim < 0 )
+	{
+		nd_astats_add_bucket(nd_astats, samples, nsamples, ndims);
+		return;
+	}
+
+	for ( i = 0; i < nsamples; i++ )
+		samples[i].key = samples[i].center[split_dim];
+	qsort(samples, nsamples, sizeof(ND_ASAMPLE), cmp_asample_key);
+
+	/*
+	 * Split proportionally to the number of buckets on each side,
+	 * then move the split to the nearest change of key, so that
+	 * equal centers never end up on both sides.
+	 */
+	nbuckets_left = nbuckets / 2;
+	split = (int)(((int64)nsamples * nbuckets_left) / nbuckets);
+	lo = hi = split;
+	while ( lo > 0 && samples[lo].key == samples[lo-1].key )
+		lo--;
+	while ( hi < nsamples && samples[hi].key == samples[hi-1].key )
+		hi++;
+	if ( lo == 0 )
+		split = hi;
+	else if ( hi == nsamples )
+		split = lo;
+	else
+		split = (split - lo <= hi - split) ? lo : hi;
+
+	nd_astats_split(nd_astats, samples, split, nbuckets_left, ndims, extent);
+	nd_astats_split(nd_astats, samples + split, nsamples - split, nbuckets - nbuckets_left, ndims, extent);
+}
+
+/**
+* Build an adaptive histogram of up to nbuckets buckets from
+* the sample boxes. Null entries in the boxes array are skipped.
+* The result is allocated in the current memory context.
+*/
+static ND_ASTATS*
+nd_astats_build(const ND_BOX **sample_boxes, int num_boxes, int ndims, int nbuckets,
+                const ND_BOX *extent, size_t *nd_astats_size)
+{
+	int d, i;
+	int nsamples = 0;
+	ND_ASAMPLE *samples;
+	ND_ASTATS *nd_astats;
+	size_t size;
+
+	samples = palloc(sizeof(ND_ASAMPLE) * num_boxes);
+	for ( i = 0; i < num_boxes; i++ )
+	{
+		const ND_BOX *ndb = sample_boxes[i];
+		if ( ! ndb ) continue;
+
+		for ( d = 0; d < ND_DIMS; d++ )
+		{
+			samples[nsamples].center[d] = (ndb->min[d] + ndb->max[d]) / 2.0;
+			samples[nsamples].halfwidth[d] = (ndb->max[d] - ndb->min[d]) / 2.0;
+		}
+		nsamples++;
+	}
+
+	nbuckets = Max(1, Min(nbuckets, nsamples / ADAPTIVE_MIN_BUCKET_FEATURES));
+	size = sizeof(ND_ASTATS) + ((nbuckets - 1) * sizeof(ND_BUCKET));
+	nd_astats = palloc0(size);
+	nd_astats->ndims = ndims;
+	nd_astats->histogram_features = nsamples;
+
+	if ( nsamples )
+		nd_astats_split(nd_astats, samples, nsamples, nbuckets, ndims, extent);
+
+	pfree(samples);
+
+	/* The split can stop early, only report the buckets we filled */
+	*nd_astats_size = sizeof(ND_ASTATS) + (((int)(nd_astats->nbuckets) - 1) * sizeof(ND_BUCKET));
+	return nd_astats;
+}
+
+/**
+* Proportion of the interval [cmin, cmax] that is covered by
+* [qmin, qmax]. Degenerate intervals are either fully in or out.
+*/
+static inline double
+nd_interval_coverage(double cmin, double cmax, double qmin, double qmax)
+{
+	double width = cmax - cmin;
+	double overlap;
+
+	if ( cmax < qmin || cmin > qmax )
+		return 0.0;
+
+	if ( width < MIN_DIMENSION_WIDTH )
+		return 1.0;
+
+	overlap = Min(cmax, qmax) - Max(cmin, qmin);
+	return Min(1.0, Max(0.0, overlap) / width);
+}
+
+/**
+* Antiderivative of the ramp min(max(u, 0), width), used to
+* integrate the overlap of two uniform intervals.
+*/
+static inline double
+nd_ramp_integral(double u, double width)
+{
+	if ( u <= 0.0 )
+		return 0.0;
+	if ( u <= width )
+		return u * u / 2.0;
+	return width * width / 2.0 + width * (u - width);
+}
+
+/**
+* Given x1 uniformly distributed in [amin, amax] and x2 uniformly
+* distributed in [bmin, bmax], what is the probability that
+* |x1 - x2| <= r? That is the probability that two boxes of
+* combined half-widths r, centered in those intervals, overlap.
+*/
+static double
+nd_interval_pair_prob(double amin, double amax, double bmin, double bmax, double r)
+{
+	double wa = amax - amin;
+	double wb = bmax - bmin;
+	double cdf_hi, cdf_lo;
+
+	/* Degenerate cases are a plain coverage ratio */
+	if ( wa < MIN_DIMENSION_WIDTH )
+		return nd_interval_coverage(bmin, bmax, amin - r, amax + r);
+	if ( wb < MIN_DIMENSION_WIDTH )
+		return nd_interval_coverage(amin, amax, bmin - r, bmax + r);
+
+	/* P(x1 - x2 <= t) = integral over x2 of the covered part of [amin, amax] */
+	cdf_hi = nd_ramp_integral(bmax + r - amin, wa) - nd_ramp_integral(bmin + r - amin, wa);
+	cdf_lo = nd_ramp_integral(bmax - r - amin, wa) - nd_ramp_integral(bmin - r - amin, wa);
+
+	return Min(1.0, Max(0.0, (cdf_hi - cdf_lo) / (wa * wb)));
+}
+
+/**
+* Selectivity of a search box against an adaptive histogram.
+* Within a bucket the box centers are taken to be uniformly
+* distributed, so a feature of the bucket interacts with the
+* search box when its center falls in the search box expanded
+* by the average half-width of the bucket.
+*/
+static float8
+estimate_selectivity_adaptive(const ND_BOX *nd_box, const ND_ASTATS *nd_astats, int ndims)
+{
+	int d, i;
+	int nbuckets = (int)roundf(nd_astats->nbuckets);
+	double total_count = 0.0;
+	float8 selectivity;
+
+	if ( nd_astats->histogram_features <= 0 )
+		return FALLBACK_ND_SEL;
+
+	for ( i = 0; i < nbuckets; i++ )
+	{
+		const ND_BUCKET *bucket = &(nd_astats->bucket[i]);
+		double count = bucket->count;
+
+		for ( d = 0; d < ndims && count > 0.0; d++ )
+		{
+			count *= nd_interval_coverage(bucket->centers.min[d], bucket->centers.max[d],
+			                              nd_box->min[d] - bucket->halfwidth[d],
+			                              nd_box->max[d] + bucket->halfwidth[d]);
+		}
+		total_count += count;
+	}
+
+	selectivity = total_count / nd_astats->histogram_features;
+
+	POSTGIS_DEBUGF(3, " adaptive buckets = %d", nbuckets);
+	POSTGIS_DEBUGF(3, " sum(overlapped bucket counts) = %f", total_count);
+	POSTGIS_DEBUGF(3, " selectivity = %f", selectivity);
+
+	/* Prevent rounding overflows */
+	if (selectivity > 1.0) selectivity = 1.0;
+	else if (selectivity < 0.0) selectivity = 0.0;
+
+	return selectivity;
+}
+
+/**
+* Join selectivity from two adaptive histograms. For each pair
+* of buckets, the expected number of overlapping feature pairs is
+* the product of the counts times the probability that a feature
+* from each bucket overlap, which is the product over dimensions
+* of #nd_interval_pair_prob.
+*/
+static float8
+estimate_join_selectivity_adaptive(const ND_ASTATS *s1, const ND_ASTATS *s2)
+{
+	int d, i, j;
+	int nbuckets1 = (int)roundf(s1->nbuckets);
+	int nbuckets2 = (int)roundf(s2->nbuckets);
+	int ndims = (int)roundf(Min(s1->ndims, s2->ndims));
+	double ntuples_max;
+	double val = 0.0;
+	float8 selectivity;
+
+	ntuples_max = s1->table_features * (s1->not_null_features / s1->sample_features) *
+	              s2->table_features * (s2->not_null_features / s2->sample_features);
+
+	for ( i = 0; i < nbuckets1; i++ )
+	{
+		const ND_BUCKET *b1 = &(s1->bucket[i]);
+		for ( j = 0; j < nbuckets2; j++ )
+		{
+			const ND_BUCKET *b2 = &(s2->bucket[j]);
+			double pairs = b1->count * b2->count;
+
+			for ( d = 0; d < ndims && pairs > 0.0; d++ )
+			{
+				pairs *= nd_interval_pair_prob(b1->centers.min[d], b1->centers.max[d],
+				                               b2->centers.min[d], b2->centers.max[d],
+				                               b1->halfwidth[d] + b2->halfwidth[d]);
+			}
+			val += pairs;
+		}
+	}
+
+	POSTGIS_DEBUGF(3, "val of adaptive histograms = %g", val);
+
+	/* Scale the sample estimate up to the full table size */
+	val *= (s1->table_features / s1->sample_features);
+	val *= (s2->table_features / s2->sample_features);
+
+	selectivity = val / ntuples_max;
+
+	/* Guard against over-estimates and crazy numbers :) */
+	if ( isnan(selectivity) || ! isfinite(selectivity) || selectivity < 0.0 )
+	{
+		selectivity = DEFAULT_ND_JOINSEL;
+	}
+	else if ( selectivity > 1.0 )
+	{
+		selectivity = 1.0;
+	}
+
+	return selectivity;
+}
+
+
+/**
+* Add a feature to the adaptive histogram, in the bucket whose
+* range of box centers holds the feature center. A center out of
+* all ranges goes to the nearest bucket, which grows to take it.
+*/
+static void
+nd_astats_add_box(ND_ASTATS *nd_astats, const ND_BOX *nd_box, double weight)
+{
+	int d, i;
+	int ndims = (int)roundf(nd_astats->ndims);
+	int nbuckets = (int)roundf(nd_astats->nbuckets);
+	int nearest = -1;
+	double nearest_dist = DBL_MAX;
+	double center[ND_DIMS];
+	ND_BUCKET *bucket;
+
+	if ( ! nbuckets )
+		return;
+
+	for ( d = 0; d < ndims; d++ )
+		center[d] = (nd_box->min[d] + nd_box->max[d]) / 2.0;
+
+	for ( i = 0; i < nbuckets; i++ )
+	{
+		double dist = 0.0;
+		bucket = &(nd_astats->bucket[i]);
+		for ( d = 0; d < ndims; d++ )
+		{
+			double delta = 0.0;
+			if ( center[d] < bucket->centers.min[d] )
+				delta = bucket->centers.min[d] - center[d];
+			else if ( center[d] > bucket->centers.max[d] )
+				delta = center[d] - bucket->centers.max[d];
+			dist += delta * delta;
+		}
+		if ( dist < nearest_dist )
+		{
+			nearest_dist = dist;
+			nearest = i;
+			if ( dist == 0.0 ) break;
+		}
+	}
+
+	bucket = &(nd_astats->bucket[nearest]);
+	for ( d = 0; d < ndims; d++ )
+	{
+		bucket->centers.min[d] = Min(bucket->centers.min[d], center[d]);
+		bucket->centers.max[d] = Max(bucket->centers.max[d], center[d]);
+	}
+	bucket->count += weight;
+	nd_astats->histogram_features += weight;
+}
+
+
+/**
+* Copy the numbers of the stats slot of the given kind out of
+* a stats tuple. Returns NULL if there is no such slot.
+*/
+static float4*
+pg_stats_numbers_from_tuple(HeapTuple stats_tuple, int stats_kind, int *nnumbers)
+{
+	int rv;
+	float4 *numbers;
+
+#if POSTGIS_PGSQL_VERSION < 100
+	{
+		float4 *floatptr;
+		int nvalues;
+
+		rv = get_attstatsslot(stats_tuple, 0, 0, stats_kind, InvalidOid,
+							NULL, NULL, NULL, &floatptr, &nvalues);
+
+		if ( ! rv ) {
+			POSTGIS_DEBUGF(2, "no slot of kind %d in stats tuple", stats_kind);
+			return NULL;
+		}
+
+		/* Clone the stats here so we can release the attstatsslot immediately */
+		numbers = palloc(sizeof(float) * nvalues);
+		memcpy(numbers, floatptr, sizeof(float) * nvalues);
+
+		/* Clean up */
+		free_attstatsslot(0, NULL, 0, floatptr, nvalues);
+		if ( nnumbers ) *nnumbers = nvalues;
+	}
+#else /* PostgreSQL 10 or higher */
+	{
+		AttStatsSlot sslot;
+		rv = get_attstatsslot(&sslot, stats_tuple, stats_kind, InvalidOid,
+							 ATTSTATSSLOT_NUMBERS);
+		if ( ! rv ) {
+			POSTGIS_DEBUGF(2, "no slot of kind %d in stats tuple", stats_kind);
+			return NULL;
+		}
+
+		/* Clone the stats here so we can release the attstatsslot immediately */
+		numbers = palloc(sizeof(float4) * sslot.nnumbers);
+		memcpy(numbers, sslot.numbers, sizeof(float4) * sslot.nnumbers);
+		if ( nnumbers ) *nnumbers = sslot.nnumbers;
+
+		free_attstatsslot(&sslot);
+	}
+#endif
+
+	return numbers;
+}
+
+static ND_STATS*
+pg_nd_stats_from_tuple(HeapTuple stats_tuple, int mode)
+{
+	int stats_kind = STATISTIC_KIND_ND;
+	int nnumbers, ncells;
+	ND_STATS *nd_stats;
+
+	/* If we're in 2D mode, set the kind appropriately */
+	if ( mode == 2 ) stats_kind = STATISTIC_KIND_2D;
+
+	/* Then read the geom status histogram from that */
+	nd_stats = (ND_STATS*)pg_stats_numbers_from_tuple(stats_tuple, stats_kind, &nnumbers);
+	if ( ! nd_stats )
+		return NULL;
+
+	/*
+	 * Stats from before the summed-area table was added stop at
+	 * the histogram values: make room for the table anyways and
+	 * flag it as missing, so the estimators take the slow path.
+	 * Same for the block count, which older stats don't carry.
+	 */
+	ncells = (int)roundf(nd_stats->histogram_cells);
+	if ( nnumbers * sizeof(float4) < ND_STATS_SIZE(ncells) )
+	{
+		bool has_sat = nnumbers * sizeof(float4) >= ND_STATS_SAT_SIZE(ncells);
+		nd_stats = repalloc(nd_stats, ND_STATS_SIZE(ncells));
+		if ( ! has_sat )
+			nd_stats_drop_sat(nd_stats);
+		nd_stats_set_blocks(nd_stats, InvalidBlockNumber);
+	}
+
+	return nd_stats;
+}
+
+/**
+* Read the adaptive histogram from a stats tuple. It is only
+* there when ANALYZE found the uniform histogram to be skewed,
+* so a NULL return is the normal case.
+*/
+static ND_ASTATS*
+pg_nd_astats_from_tuple(HeapTuple stats_tuple, int mode)
+{
+	int stats_kind = STATISTIC_KIND_ND_ADAPTIVE;
+
+	if ( mode == 2 ) stats_kind = STATISTIC_KIND_2D_ADAPTIVE;
+
+	return (ND_ASTATS*)pg_stats_numbers_from_tuple(stats_tuple, stats_kind, NULL);
+}
+
+/**
+* Pull the stats object from the PgSQL system catalogs. Used
+* by the selectivity functions and the debugging functions.
+* If nd_astats is not NULL, the adaptive histogram is also
+* read, when there is one.
+*/
+static ND_STATS*
+pg_get_nd_stats(const Oid table_oid, AttrNumber att_num, int mode, bool only_parent, ND_ASTATS **nd_astats)
+{
+	HeapTuple stats_tuple = NULL;
+	ND_STATS *nd_stats;
+
+	if ( nd_astats )
+		*nd_astats = NULL;
+
+	/* First pull the stats tuple for the whole tree */
+	if ( ! only_parent )
+	{
+		POSTGIS_DEBUGF(2, "searching whole tree stats for \"%s\"", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
+		stats_tuple = SearchSysCache3(STATRELATTINH, ObjectIdGetDatum(table_oid), Int16GetDatum(att_num), BoolGetDatum(true));
+		if ( stats_tuple )
+			POSTGIS_DEBUGF(2, "found whole tree stats for \"%s\"", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
+	}
+	/* Fall-back to main table stats only, if not found for whole tree or explicitly ignored */
+	if ( only_parent || ! stats_tuple )
+	{
+		POSTGIS_DEBUGF(2, "searching parent table stats for \"%s\"", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
+		stats_tuple = SearchSysCache3(STATRELATTINH, ObjectIdGetDatum(table_oid), Int16GetDatum(att_num), BoolGetDatum(false));
+		if ( stats_tuple )
+			POSTGIS_DEBUGF(2, "found parent table stats for \"%s\"", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
+	}
+	if ( ! stats_tuple )
+	{
+		POSTGIS_DEBUGF(2, "stats for \"%s\" do not exist", get_rel_name(table_oid)? get_rel_name(table_oid) : "NULL");
+		return NULL;
+	}
+
+	nd_stats = pg_nd_stats_from_tuple(stats_tuple, mode);
+	if ( nd_astats )
+		*nd_astats = nd_stats ? pg_nd_astats_from_tuple(stats_tuple, mode) : NULL;
+	ReleaseSysCache(stats_tuple);
+	if ( ! nd_stats )
+	{
+		POSTGIS_DEBUGF(2,
+			"histogram for attribute %d of table \"%s\" does not exist?",
+			att_num, get_rel_name(table_oid));
+	}
+
+	return nd_stats;
+}
+
+/**
+* Pull the stats object from the PgSQL system catalogs. The
+* debugging functions are taking human input (table names)
+* and columns, so we have to look those up first.
+* In case of parent tables whith INHERITS, when "only_parent"
+* is true this function only searchs for stats in the parent
+* table ignoring any statistic collected from the children.
+*/
+static ND_STATS*
+pg_get_nd_stats_by_name(const Oid table_oid, const text *att_text, int mode, bool only_parent, ND_ASTATS **nd_astats)
+{
+	const char *att_name = text_to_cstring(att_text);
+	AttrNumber att_num;
+
+	/* We know the name? Look up the num */
+	if ( att_text )
+	{
+		/* Get the attribute number */
+		att_num = get_attnum(table_oid, att_name);
+		if  ( ! att_num ) {
+			elog(ERROR, "attribute \"%s\" does not exist", att_name);
+			return NULL;
+		}
+	}
+	else
+	{
+		elog(ERROR, "attribute name is null");
+		return NULL;
+	}
+
+	return pg_get_nd_stats(table_oid, att_num, mode, only_parent, nd_astats);
+}
+
+/**
+* Read the vertex statistics of a column from a stats tuple.
+*/
+static VERTEX_STATS*
+pg_vertex_stats_from_tuple(HeapTuple stats_tuple)
+{
+	int nnumbers;
+	VERTEX_STATS *vertex_stats;
+
+	vertex_stats = (VERTEX_STATS*)pg_stats_numbers_from_tuple(stats_tuple, STATISTIC_KIND_VERTEX, &nnumbers);
+	if ( vertex_stats && nnumbers * sizeof(float4) < sizeof(VERTEX_STATS) )
+	{
+		pfree(vertex_stats);
+		return NULL;
+	}
+	return vertex_stats;
+}
+
+/**
+* Vertex statistics of a planner expression: from pg_statistic
+* for a plain column reference, measured on the spot for a
+* constant. Anything else is an unknown and returns NULL.
+*/
+VERTEX_STATS *
+gserialized_vertex_stats(PlannerInfo *root, Node *node)
+{
+	VERTEX_STATS *vertex_stats = NULL;
+
+	if ( ! node )
+		return NULL;
+
+	if ( IsA(node, Const) )
+	{
+		Const *c = (Const*)node;
+		GSERIALIZED *geom;
+		LWGEOM *lwgeom;
+
+		if ( c->constisnull )
+			return NULL;
+
+		geom = (GSERIALIZED *)PG_DETOAST_DATUM(c->constvalue);
+		lwgeom = lwgeom_from_gserialized(geom);
+		vertex_stats = palloc0(sizeof(VERTEX_STATS));
+		vertex_stats->sample_features = 1;
+		vertex_stats->npoints_avg = vertex_stats->npoints_p95 =
+			vertex_stats->npoints_max = lwgeom_count_vertices(lwgeom);
+		vertex_stats->size_avg = vertex_stats->size_p95 = VARSIZE(geom);
+		lwgeom_free(lwgeom);
+		if ( (Pointer)geom != DatumGetPointer(c->constvalue) )
+			pfree(geom);
+	}
+	else if ( root && IsA(node, Var) )
+	{
+		VariableStatData vardata;
+
+		examine_variable(root, node, 0, &vardata);
+		if ( vardata.statsTuple )
+			vertex_stats = pg_vertex_stats_from_tuple(vardata.statsTuple);
+		ReleaseVariableStats(vardata);
+	}
+
+	return vertex_stats;
+}
+
+/**
+* Given two statistics histograms, what is the selectivity
+* of a join driven by the && or &&& operator?
+*
+* Join selectivity is defined as the number of rows returned by the
+* join operator divided by the number of rows that an
+* unconstrained join would return (nrows1*nrows2).
+*
+* To get the estimate of join rows, we walk through the cells
+* of one histogram, and multiply the cell value by the
+* proportion of the cells in the other histogram the cell
+* overlaps: val += val1 * ( val2 * overlap_ratio )
+* The inner sum is read from the summed-area table of the larger
+* histogram when it has one, see #nd_stats_sat_sum.
+*
+* When both relations have an adaptive histogram we use those
+* instead, see #estimate_join_selectivity_adaptive.
+*/
+static float8
+estimate_join_selectivity(const ND_STATS *s1, const ND_STATS *s2,
+                          const ND_ASTATS *as1, const ND_ASTATS *as2)
+{
+	int ncells1, ncells2;
+	int ndims1, ndims2, ndims;
+	double ntuples_max;
+	double ntuples_not_null1, ntuples_not_null2;
+
+	ND_BOX extent1, extent2;
+	ND_IBOX ibox1, ibox2;
+	int at1[ND_DIMS];
+	int at2[ND_DIMS];
+	double min1[ND_DIMS];
+	double width1[ND_DIMS];
+	double cellsize1[ND_DIMS];
+	int size2[ND_DIMS];
+	double min2[ND_DIMS];
+	double width2[ND_DIMS];
+	double cellsize2[ND_DIMS];
+	int size1[ND_DIMS];
+	int d;
+	double val = 0;
+	float8 selectivity;
+	const float4 *sat2;
+
+	/* Drop out on null inputs */
+	if ( ! ( s1 && s2 ) )
+	{
+		elog(NOTICE, " estimate_join_selectivity called with null inputs");
+		return FALLBACK_ND_SEL;
+	}
+
+	/* Skewed data on both sides? Use the adaptive histograms. */
+	if ( as1 && as2 )
+		return estimate_join_selectivity_adaptive(as1, as2);
+
+	/* We need to know how many cells each side has... */
+	ncells1 = (int)roundf(s1->histogram_cells);
+	ncells2 = (int)roundf(s2->histogram_cells);
+
+	/* ...so that we can drive the summation loop with the smaller histogram. */
+	if ( ncells1 > ncells2 )
+	{
+		const ND_STATS *stats_tmp = s1;
+		s1 = s2;
+		s2 = stats_tmp;
+	}
+
+	POSTGIS_DEBUGF(3, "s1: %s", nd_stats_to_json(s1));
+	POSTGIS_DEBUGF(3, "s2: %s", nd_stats_to_json(s2));
+
+	/* Re-read that info after the swap */
+	ncells1 = (int)roundf(s1->histogram_cells);
+	ncells2 = (int)roundf(s2->histogram_cells);
+
+	/* Q: What's the largest possible join size these relations can create? */
+	/* A: The product of the # of non-null rows in each relation. */
+	ntuples_not_null1 = s1->table_features * (s1->not_null_features / s1->sample_features);
+	ntuples_not_null2 = s2->table_features * (s2->not_null_features / s2->sample_features);
+	ntuples_max = ntuples_not_null1 * ntuples_not_null2;
 
 	/* Get the ndims as ints */
 	ndims1 = (int)roundf(s1->ndims);
@@ -1134,6 +2083,10 @@ estimate_join_selectivity(const ND_STATS *s1, const ND_STATS *s2)
 		cellsize2[d] = width2[d] / size2[d];
 	}
 
+	/* The table of s2, the larger histogram since the swap above. */
+	/* Mixed dimensionality gets the cell walk, which handles it */
+	sat2 = (ndims1 == ndims2) ? nd_stats_sat(s2) : NULL;
+
 	/* For each affected cell of s1... */
 	do
 	{
@@ -1161,6 +2114,14 @@ estimate_join_selectivity(const ND_STATS *s1, const ND_STATS *s2)
 		/* Get the value at this cell */
 		val1 = s1->value[nd_stats_value_index(s1, at1)];
 
+		/* Sum the overlapped cells of s2 in one go */
+		if ( sat2 )
+		{
+			if ( val1 > 0.0 )
+				val += val1 * nd_stats_sat_sum(s2, sat2, &nd_cell1, &ibox2);
+			continue;
+		}
+
 		/* For each overlapped cell of s2... */
 		do
 		{
@@ -1272,27 +2233,22 @@ Datum gserialized_gist_joinsel_2d(PG_FUNCTION_ARGS)
 *
 * joinsel = estimated_nrows / (totalrows1 * totalrows2)
 */
-PG_FUNCTION_INFO_V1(gserialized_gist_joinsel);
-Datum gserialized_gist_joinsel(PG_FUNCTION_ARGS)
+float8
+gserialized_joinsel_internal(PlannerInfo *root, List *args, JoinType jointype, int mode)
 {
-	PlannerInfo *root = (PlannerInfo *) PG_GETARG_POINTER(0);
-	/* Oid operator = PG_GETARG_OID(1); */
-	List *args = (List *) PG_GETARG_POINTER(2);
-	JoinType jointype = (JoinType) PG_GETARG_INT16(3);
-	int mode = PG_GETARG_INT32(4);
-
 	Node *arg1, *arg2;
 	Var *var1, *var2;
 	Oid relid1, relid2;
 
 	ND_STATS *stats1, *stats2;
+	ND_ASTATS *astats1, *astats2;
 	float8 selectivity;
 
 	/* Only respond to an inner join/unknown context join */
 	if (jointype != JOIN_INNER)
 	{
 		elog(DEBUG1, "%s: jointype %d not supported", __func__, jointype);
-		PG_RETURN_FLOAT8(DEFAULT_ND_JOINSEL);
+		return DEFAULT_ND_JOINSEL;
 	}
 
 	/* Find Oids of the geometry columns we are working with */
@@ -1306,7 +2262,7 @@ Datum gserialized_gist_joinsel(PG_FUNCTION_ARGS)
 	if (!IsA(arg1, Var) || !IsA(arg2, Var))
 	{
 		elog(DEBUG1, "%s called with arguments that are not column references", __func__);
-		PG_RETURN_FLOAT8(DEFAULT_ND_JOINSEL);
+		return DEFAULT_ND_JOINSEL;
 	}
 
 	/* What are the Oids of our tables/relations? */
@@ -1317,32 +2273,130 @@ Datum gserialized_gist_joinsel(PG_FUNCTION_ARGS)
 	                 get_rel_name(relid1) ? get_rel_name(relid1) : "NULL", relid1, get_rel_name(relid2) ? get_rel_name(relid2) : "NULL", relid2);
 
 	/* Pull the stats from the stats system. */
-	stats1 = pg_get_nd_stats(relid1, var1->varattno, mode, false);
-	stats2 = pg_get_nd_stats(relid2, var2->varattno, mode, false);
+	stats1 = pg_get_nd_stats(relid1, var1->varattno, mode, false, &astats1);
+	stats2 = pg_get_nd_stats(relid2, var2->varattno, mode, false, &astats2);
 
 	/* If we can't get stats, we have to stop here! */
 	if ( ! stats1 )
 	{
 		POSTGIS_DEBUGF(3, "unable to retrieve stats for \"%s\" Oid(%d)", get_rel_name(relid1) ? get_rel_name(relid1) : "NULL" , relid1);
-		PG_RETURN_FLOAT8(DEFAULT_ND_JOINSEL);
+		return DEFAULT_ND_JOINSEL;
 	}
 	else if ( ! stats2 )
 	{
 		POSTGIS_DEBUGF(3, "unable to retrieve stats for \"%s\" Oid(%d)", get_rel_name(relid2) ? get_rel_name(relid2) : "NULL", relid2);
-		PG_RETURN_FLOAT8(DEFAULT_ND_JOINSEL);
+		return DEFAULT_ND_JOINSEL;
 	}
 
-	selectivity = estimate_join_selectivity(stats1, stats2);
+	selectivity = estimate_join_selectivity(stats1, stats2, astats1, astats2);
 	POSTGIS_DEBUGF(2, "got selectivity %g", selectivity);
 
 	pfree(stats1);
 	pfree(stats2);
-	PG_RETURN_FLOAT8(selectivity);
+	if ( astats1 ) pfree(astats1);
+	if ( astats2 ) pfree(astats2);
+	return selectivity;
+}
+
+PG_FUNCTION_INFO_V1(gserialized_gist_joinsel);
+Datum gserialized_gist_joinsel(PG_FUNCTION_ARGS)
+{
+	PlannerInfo *root = (PlannerInfo *) PG_GETARG_POINTER(0);
+	/* Oid operator = PG_GETARG_OID(1); */
+	List *args = (List *) PG_GETARG_POINTER(2);
+	JoinType jointype = (JoinType) PG_GETARG_INT16(3);
+	int mode = PG_GETARG_INT32(4);
+
+	PG_RETURN_FLOAT8(gserialized_joinsel_internal(root, args, jointype, mode));
 }
 
 
 
 
+/**
+* Add a feature box to the histogram: every cell the box overlaps
+* gets the proportion of the box that falls into it, times the
+* weight. If a feature box is completely inside one cell that cell
+* gets the whole weight, if it is 50% in two cells, each of them
+* gets half. Returns the total added to the cells.
+*/
+static double
+nd_stats_add_box(ND_STATS *nd_stats, const ND_BOX *nd_box, double weight)
+{
+	ND_IBOX nd_ibox;
+	int at[ND_DIMS];
+	int d;
+	int ndims = (int)roundf(nd_stats->ndims);
+	double num_cells = 0;
+	double min[ND_DIMS] = {0.0, 0.0, 0.0, 0.0};
+	double cellsize[ND_DIMS] = {0.0, 0.0, 0.0, 0.0};
+
+	/* Find the cells that overlap with this box and put them into the ND_IBOX */
+	nd_box_overlap(nd_stats, nd_box, &nd_ibox);
+	memset(at, 0, sizeof(int)*ND_DIMS);
+
+	POSTGIS_DEBUGF(3, " feature ibox (%d, %d, %d, %d) (%d, %d, %d, %d)",
+	  nd_ibox.min[0], nd_ibox.min[1], nd_ibox.min[2], nd_ibox.min[3],
+	  nd_ibox.max[0], nd_ibox.max[1], nd_ibox.max[2], nd_ibox.max[3]);
+
+	for ( d = 0; d < ndims; d++ )
+	{
+		/* Initialize the starting values */
+		at[d] = nd_ibox.min[d];
+		min[d] = nd_stats->extent.min[d];
+		cellsize[d] = (nd_stats->extent.max[d] - min[d])/(nd_stats->size[d]);
+	}
+
+	/*
+	 * Move through all the overlaped histogram cells values and
+	 * add the box overlap proportion to them.
+	 */
+	do
+	{
+		ND_BOX nd_cell = { {0.0, 0.0, 0.0, 0.0}, {0.0, 0.0, 0.0, 0.0} };
+		double ratio;
+		/* Create a box for this histogram cell */
+		for ( d = 0; d < ndims; d++ )
+		{
+			nd_cell.min[d] = min[d] + (at[d]+0) * cellsize[d];
+			nd_cell.max[d] = min[d] + (at[d]+1) * cellsize[d];
+		}
+
+		ratio = weight * nd_box_ratio(&nd_cell, nd_box, ndims);
+		nd_stats->value[nd_stats_value_index(nd_stats, at)] += ratio;
+		num_cells += ratio;
+		POSTGIS_DEBUGF(3, "               ratio (%.8g)  num_cells (%.8g)", ratio, num_cells);
+		POSTGIS_DEBUGF(3, "               at (%d, %d, %d, %d)", at[0], at[1], at[2], at[3]);
+	}
+	while ( nd_increment(&nd_ibox, ndims, at) );
+
+	return num_cells;
+}
+
+
+/**
+* Number of blocks of the table being analyzed. Relations without
+* blocks of their own, like partitioned tables, get
+* InvalidBlockNumber.
+*/
+static BlockNumber
+analyze_rel_blocks(const VacAttrStats *stats)
+{
+	Oid relid = stats->attr->attrelid;
+	char relkind = get_rel_relkind(relid);
+	BlockNumber nblocks;
+	Relation rel;
+
+	if ( relkind != RELKIND_RELATION && relkind != RELKIND_MATVIEW )
+		return InvalidBlockNumber;
+
+	/* ANALYZE already holds a lock on it */
+	rel = relation_open(relid, NoLock);
+	nblocks = RelationGetNumberOfBlocks(rel);
+	relation_close(rel, NoLock);
+	return nblocks;
+}
+
 /**
  * The gserialized_analyze_nd sets this function as a
  * callback on the stats object when called by the ANALYZE
@@ -1383,6 +2437,7 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 	ND_BOX stddev;                     /* StdDev of extents of sample boxes */
 
 	const ND_BOX **sample_boxes;       /* ND_BOXes for each of the sample features */
+	const ND_BOX **adaptive_boxes;     /* ND_BOXes for the adaptive histogram, deviants included */
 	ND_BOX sample_extent;              /* Extent of the raw sample */
 	int    histo_size[ND_DIMS];        /* histogram nrows, ncols, etc */
 	ND_BOX histo_extent;               /* Spatial extent of the histogram */
@@ -1399,6 +2454,10 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 	int stats_slot;                     /* What slot is this data going into? (2D vs ND) */
 	int stats_kind;                     /* And this is what? (2D vs ND) */
 
+	ND_ASTATS *nd_astats = NULL;        /* Our adaptive histogram, if the grid is skewed */
+	size_t    nd_astats_size = 0;       /* Size of the adaptive histogram */
+	double    skew;                     /* How concentrated is the sample in the grid? */
+
 	/* Initialize sum and stddev */
 	nd_box_init(&sum);
 	nd_box_init(&stddev);
@@ -1563,6 +2622,13 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 		histo_extent.max[d] = Min(avg.max[d] + SDFACTOR * stddev.max[d], sample_extent.max[d]);
 	}
 
+	/*
+	 * The adaptive histogram copes with outliers by itself, so
+	 * keep the full list of boxes around for it.
+	 */
+	adaptive_boxes = palloc(sizeof(ND_BOX*) * notnull_cnt);
+	memcpy(adaptive_boxes, sample_boxes, sizeof(ND_BOX*) * notnull_cnt);
+
 	/*
 	 * Third scan:
 	 *   o skip hard deviants
@@ -1682,7 +2748,7 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 	 * Create the histogram (ND_STATS) in the stats memory context
 	 */
 	old_context = MemoryContextSwitchTo(stats->anl_context);
-	nd_stats_size = sizeof(ND_STATS) + ((histo_cells - 1) * sizeof(float4));
+	nd_stats_size = ND_STATS_SIZE(histo_cells);
 	nd_stats = palloc(nd_stats_size);
 	memset(nd_stats, 0, nd_stats_size); /* Initialize all values to 0 */
 	MemoryContextSwitchTo(old_context);
@@ -1713,14 +2779,8 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 	for ( i = 0; i < notnull_cnt; i++ )
 	{
 		const ND_BOX *nd_box;
-		ND_IBOX nd_ibox;
-		int at[ND_DIMS];
 		int d;
-		double num_cells = 0;
 		double tmp_volume = 1.0;
-		double min[ND_DIMS] = {0.0, 0.0, 0.0, 0.0};
-		double max[ND_DIMS] = {0.0, 0.0, 0.0, 0.0};
-		double cellsize[ND_DIMS] = {0.0, 0.0, 0.0, 0.0};
 
 		nd_box = sample_boxes[i];
 		if ( ! nd_box ) continue; /* Skip Null'ed out hard deviants */
@@ -1728,59 +2788,16 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 		/* Give backend a chance of interrupting us */
 		vacuum_delay_point();
 
-		/* Find the cells that overlap with this box and put them into the ND_IBOX */
-		nd_box_overlap(nd_stats, nd_box, &nd_ibox);
-		memset(at, 0, sizeof(int)*ND_DIMS);
-
-		POSTGIS_DEBUGF(3, " feature %d: ibox (%d, %d, %d, %d) (%d, %d, %d, %d)", i,
-		  nd_ibox.min[0], nd_ibox.min[1], nd_ibox.min[2], nd_ibox.min[3],
-		  nd_ibox.max[0], nd_ibox.max[1], nd_ibox.max[2], nd_ibox.max[3]);
-
+		/* What's the volume (area) of this feature's box? */
 		for ( d = 0; d < nd_stats->ndims; d++ )
-		{
-			/* Initialize the starting values */
-			at[d] = nd_ibox.min[d];
-			min[d] = nd_stats->extent.min[d];
-			max[d] = nd_stats->extent.max[d];
-			cellsize[d] = (max[d] - min[d])/(nd_stats->size[d]);
-
-			/* What's the volume (area) of this feature's box? */
 			tmp_volume *= (nd_box->max[d] - nd_box->min[d]);
-		}
 
 		/* Add feature volume (area) to our total */
 		total_sample_volume += tmp_volume;
 
-		/*
-		 * Move through all the overlaped histogram cells values and
-		 * add the box overlap proportion to them.
-		 */
-		do
-		{
-			ND_BOX nd_cell = { {0.0, 0.0, 0.0, 0.0}, {0.0, 0.0, 0.0, 0.0} };
-			double ratio;
-			/* Create a box for this histogram cell */
-			for ( d = 0; d < nd_stats->ndims; d++ )
-			{
-				nd_cell.min[d] = min[d] + (at[d]+0) * cellsize[d];
-				nd_cell.max[d] = min[d] + (at[d]+1) * cellsize[d];
-			}
-
-			/*
-			 * If a feature box is completely inside one cell the ratio will be
-			 * 1.0. If a feature box is 50% in two cells, each cell will get
-			 * 0.5 added on.
-			 */
-			ratio = nd_box_ratio(&nd_cell, nd_box, nd_stats->ndims);
-			nd_stats->value[nd_stats_value_index(nd_stats, at)] += ratio;
-			num_cells += ratio;
-			POSTGIS_DEBUGF(3, "               ratio (%.8g)  num_cells (%.8g)", ratio, num_cells);
-			POSTGIS_DEBUGF(3, "               at (%d, %d, %d, %d)", at[0], at[1], at[2], at[3]);
-		}
-		while ( nd_increment(&nd_ibox, nd_stats->ndims, at) );
+		/* Spread the feature over the cells, keep track of overall number of overlaps counted */
+		total_cell_count += nd_stats_add_box(nd_stats, nd_box, 1.0);
 
-		/* Keep track of overall number of overlaps counted */
-		total_cell_count += num_cells;
 		/* How many features have we added to this histogram? */
 		histogram_features++;
 	}
@@ -1802,6 +2819,36 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 	nd_stats->histogram_cells = histo_cells;
 	nd_stats->cells_covered = total_cell_count;
 
+	/* Precompute the summed-area table for the estimators */
+	nd_stats_build_sat(nd_stats);
+
+	/* The sample covers the table as it is now, refreshes go from here */
+	nd_stats_set_blocks(nd_stats, analyze_rel_blocks(stats));
+
+	/*
+	 * Fifth scan:
+	 *  o if most of the sample landed in a handful of cells (or
+	 *    out of the grid altogether), the grid cannot tell dense
+	 *    areas apart, so build an equi-depth histogram as well
+	 */
+	skew = nd_stats_skew(nd_stats, notnull_cnt);
+	POSTGIS_DEBUGF(3, " grid skew: %.6g", skew);
+	if ( skew >= ADAPTIVE_SKEW_THRESHOLD )
+	{
+		int nbuckets = ADAPTIVE_BUCKETS_PER_TARGET * stats->attr->attstattarget;
+
+		old_context = MemoryContextSwitchTo(stats->anl_context);
+		nd_astats = nd_astats_build(adaptive_boxes, notnull_cnt, ndims, nbuckets,
+		                            &sample_extent, &nd_astats_size);
+		MemoryContextSwitchTo(old_context);
+
+		nd_astats->table_features = total_rows;
+		nd_astats->sample_features = sample_rows;
+		nd_astats->not_null_features = notnull_cnt;
+		POSTGIS_DEBUGF(3, " adaptive buckets: %d", (int)roundf(nd_astats->nbuckets));
+	}
+	pfree(adaptive_boxes);
+
 	/* Put this histogram data into the right slot/kind */
 	if ( mode == 2 )
 	{
@@ -1819,6 +2866,18 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 	stats->staop[stats_slot] = InvalidOid;
 	stats->stanumbers[stats_slot] = (float4*)nd_stats;
 	stats->numnumbers[stats_slot] = nd_stats_size/sizeof(float4);
+
+	/* Write the adaptive histogram next to it, if we built one */
+	if ( nd_astats )
+	{
+		stats_slot = (mode == 2) ? STATISTIC_SLOT_2D_ADAPTIVE : STATISTIC_SLOT_ND_ADAPTIVE;
+		stats_kind = (mode == 2) ? STATISTIC_KIND_2D_ADAPTIVE : STATISTIC_KIND_ND_ADAPTIVE;
+		stats->stakind[stats_slot] = stats_kind;
+		stats->staop[stats_slot] = InvalidOid;
+		stats->stanumbers[stats_slot] = (float4*)nd_astats;
+		stats->numnumbers[stats_slot] = nd_astats_size/sizeof(float4);
+	}
+
 	stats->stanullfrac = (float4)null_cnt/sample_rows;
 	stats->stawidth = total_width/notnull_cnt;
 	stats->stadistinct = -1.0;
@@ -1839,6 +2898,119 @@ compute_gserialized_stats_mode(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfu
 }
 
 
+/**
+* Percentile of a sorted array of floats, nearest rank.
+*/
+static float4
+sorted_percentile(const float4 *vals, int nvals, double p)
+{
+	int i = (int)ceil(p * nvals) - 1;
+	if ( i < 0 ) i = 0;
+	if ( i >= nvals ) i = nvals - 1;
+	return vals[i];
+}
+
+static int
+cmp_float4_asc(const void *a, const void *b)
+{
+	float4 fa = *((const float4*)a);
+	float4 fb = *((const float4*)b);
+	return (fa > fb) - (fa < fb);
+}
+
+/**
+* Count the vertices and the raw size of the sampled features
+* and store the summary in the vertex stats slot. The predicates
+* are costed from these (see gserialized_supportfn.c): the work
+* of a GEOS predicate grows with the number of vertices, which
+* the box histograms know nothing about.
+*/
+static void
+compute_gserialized_vertex_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
+                                 int sample_rows)
+{
+	MemoryContext old_context;
+	VERTEX_STATS *vertex_stats;
+	float4 *npoints;
+	float4 *sizes;
+	double npoints_total = 0;
+	double size_total = 0;
+	int nfeatures = 0;
+	int i;
+
+	npoints = palloc(sizeof(float4) * sample_rows);
+	sizes = palloc(sizeof(float4) * sample_rows);
+
+	for ( i = 0; i < sample_rows; i++ )
+	{
+		Datum datum;
+		GSERIALIZED *geom;
+		LWGEOM *lwgeom;
+		bool is_null;
+
+		datum = fetchfunc(stats, i, &is_null);
+		if ( is_null )
+			continue;
+
+		geom = (GSERIALIZED *)PG_DETOAST_DATUM(datum);
+		if ( gserialized_is_empty(geom) )
+		{
+			if ( VARATT_IS_EXTENDED(datum) )
+				pfree(geom);
+			continue;
+		}
+
+		/* Deserialization references the coordinates, it doesn't copy them */
+		lwgeom = lwgeom_from_gserialized(geom);
+		npoints[nfeatures] = lwgeom_count_vertices(lwgeom);
+		sizes[nfeatures] = VARSIZE(geom);
+		lwgeom_free(lwgeom);
+
+		npoints_total += npoints[nfeatures];
+		size_total += sizes[nfeatures];
+		nfeatures++;
+
+		if ( VARATT_IS_EXTENDED(datum) )
+			pfree(geom);
+
+		vacuum_delay_point();
+	}
+
+	if ( ! nfeatures )
+	{
+		POSTGIS_DEBUG(3, " no non-empty features, no vertex stats");
+		pfree(npoints);
+		pfree(sizes);
+		return;
+	}
+
+	qsort(npoints, nfeatures, sizeof(float4), cmp_float4_asc);
+	qsort(sizes, nfeatures, sizeof(float4), cmp_float4_asc);
+
+	old_context = MemoryContextSwitchTo(stats->anl_context);
+	vertex_stats = palloc0(sizeof(VERTEX_STATS));
+	MemoryContextSwitchTo(old_context);
+
+	vertex_stats->sample_features = nfeatures;
+	vertex_stats->npoints_avg = npoints_total / nfeatures;
+	vertex_stats->npoints_p95 = sorted_percentile(npoints, nfeatures, 0.95);
+	vertex_stats->npoints_max = npoints[nfeatures-1];
+	vertex_stats->size_avg = size_total / nfeatures;
+	vertex_stats->size_p95 = sorted_percentile(sizes, nfeatures, 0.95);
+
+	POSTGIS_DEBUGF(3, " vertex stats: avg %g, p95 %g, max %g",
+	               vertex_stats->npoints_avg, vertex_stats->npoints_p95, vertex_stats->npoints_max);
+
+	stats->stakind[STATISTIC_SLOT_VERTEX] = STATISTIC_KIND_VERTEX;
+	stats->staop[STATISTIC_SLOT_VERTEX] = InvalidOid;
+	stats->stanumbers[STATISTIC_SLOT_VERTEX] = (float4*)vertex_stats;
+	stats->numnumbers[STATISTIC_SLOT_VERTEX] = sizeof(VERTEX_STATS)/sizeof(float4);
+
+	pfree(npoints);
+	pfree(sizes);
+}
+
+
 /**
 * In order to do useful selectivity calculations in both 2-D and N-D
 * modes, we actually have to generate two stats objects, one for 2-D
@@ -1864,6 +3036,9 @@ compute_gserialized_stats(VacAttrStats *stats, AnalyzeAttrFetchFunc fetchfunc,
 	compute_gserialized_stats_mode(stats, fetchfunc, sample_rows, total_rows, 2);
 	/* ND Mode */
 	compute_gserialized_stats_mode(stats, fetchfunc, sample_rows, total_rows, 0);
+	/* Vertex counts, only worth keeping next to valid histograms */
+	if ( stats->stats_valid )
+		compute_gserialized_vertex_stats(stats, fetchfunc, sample_rows);
 }
 
 
@@ -1921,6 +3096,26 @@ Datum gserialized_analyze_nd(PG_FUNCTION_ARGS)
 	PG_RETURN_BOOL(true);
 }
 
+/**
+* Scale a sum of histogram values by the number of features
+* in the histogram to get the proportion of the table.
+*/
+static float8
+nd_stats_selectivity(const ND_STATS *nd_stats, double total_count)
+{
+	float8 selectivity = total_count / nd_stats->histogram_features;
+
+	POSTGIS_DEBUGF(3, " nd_stats->histogram_features = %f", nd_stats->histogram_features);
+	POSTGIS_DEBUGF(3, " nd_stats->histogram_cells = %f", nd_stats->histogram_cells);
+	POSTGIS_DEBUGF(3, " selectivity = %f", selectivity);
+
+	/* Prevent rounding overflows */
+	if (selectivity > 1.0) selectivity = 1.0;
+	else if (selectivity < 0.0) selectivity = 0.0;
+
+	return selectivity;
+}
+
 /**
 * This function returns an estimate of the selectivity
 * of a search GBOX by looking at data in the ND_STATS
@@ -1932,12 +3127,16 @@ Datum gserialized_analyze_nd(PG_FUNCTION_ARGS)
 * we need "only" sum up the values * the proportion of each cell
 * in the histogram that falls within the search box, then
 * divide by the number of features that generated the histogram.
+* When the stats carry a summed-area table that sum takes a
+* fixed number of lookups, otherwise we walk the cells.
+*
+* If ANALYZE also left an adaptive histogram, because the data
+* are too skewed for the uniform grid, we use that one instead.
 */
 static float8
-estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
+estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, const ND_ASTATS *nd_astats, int mode)
 {
 	int d; /* counter */
-	float8 selectivity;
 	ND_BOX nd_box;
 	ND_IBOX nd_ibox;
 	int at[ND_DIMS];
@@ -1946,6 +3145,7 @@ estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
 	double max[ND_DIMS];
 	double total_count = 0.0;
 	int ndims_max;
+	const float4 *sat;
 
 	/* Calculate the overlap of the box on the histogram */
 	if ( ! nd_stats )
@@ -1974,6 +3174,14 @@ estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
 	POSTGIS_DEBUGF(3, " nd_stats->extent: %s", nd_box_to_json(&(nd_stats->extent), nd_stats->ndims));
 	POSTGIS_DEBUGF(3, " nd_box: %s", nd_box_to_json(&(nd_box), gbox_ndims(box)));
 
+	/* Skewed data? Only compare the dimensions both sides have. */
+	if ( nd_astats )
+	{
+		int ndims = (mode == 2) ? 2 : Min((int)roundf(nd_astats->ndims), gbox_ndims(box));
+		POSTGIS_DEBUG(3, " using the adaptive histogram");
+		return estimate_selectivity_adaptive(&nd_box, nd_astats, ndims);
+	}
+
 	/*
 	 * Search box completely misses histogram extent?
 	 * We have to intersect in all N dimensions or else we have
@@ -2001,6 +3209,15 @@ estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
 		return FALLBACK_ND_SEL;
 	}
 
+	/* Read the pro-rated sum straight from the summed-area table */
+	sat = nd_stats_sat(nd_stats);
+	if ( sat )
+	{
+		total_count = nd_stats_sat_sum(nd_stats, sat, &nd_box, &nd_ibox);
+		POSTGIS_DEBUGF(3, " sum(summed-area table) = %f", total_count);
+		return nd_stats_selectivity(nd_stats, total_count);
+	}
+
 	/* Work out some measurements of the histogram */
 	for ( d = 0; d < nd_stats->ndims; d++ )
 	{
@@ -2036,19 +3253,8 @@ estimate_selectivity(const GBOX *box, const ND_STATS *nd_stats, int mode)
 	}
 	while ( nd_increment(&nd_ibox, nd_stats->ndims, at) );
 
-	/* Scale by the number of features in our histogram to get the proportion */
-	selectivity = total_count / nd_stats->histogram_features;
-
-	POSTGIS_DEBUGF(3, " nd_stats->histogram_features = %f", nd_stats->histogram_features);
-	POSTGIS_DEBUGF(3, " nd_stats->histogram_cells = %f", nd_stats->histogram_cells);
 	POSTGIS_DEBUGF(3, " sum(overlapped histogram cells) = %f", total_count);
-	POSTGIS_DEBUGF(3, " selectivity = %f", selectivity);
-
-	/* Prevent rounding overflows */
-	if (selectivity > 1.0) selectivity = 1.0;
-	else if (selectivity < 0.0) selectivity = 0.0;
-
-	return selectivity;
+	return nd_stats_selectivity(nd_stats, total_count);
 }
 
 
@@ -2073,7 +3279,7 @@ Datum _postgis_gserialized_stats(PG_FUNCTION_ARGS)
 		mode = text_p_get_mode(PG_GETARG_TEXT_P(2));
 
 	/* Retrieve the stats object */
-	nd_stats = pg_get_nd_stats_by_name(table_oid, att_text, mode, only_parent);
+	nd_stats = pg_get_nd_stats_by_name(table_oid, att_text, mode, only_parent, NULL);
 	if ( ! nd_stats )
 		elog(ERROR, "stats for \"%s.%s\" do not exist", get_rel_name(table_oid), text_to_cstring(att_text));
 
@@ -2086,6 +3292,356 @@ Datum _postgis_gserialized_stats(PG_FUNCTION_ARGS)
 }
 
 
+/**
+* Utility function to print the vertex statistics for a given
+* table/column in JSON. Used for debugging the cost estimates.
+*/
+PG_FUNCTION_INFO_V1(_postgis_gserialized_vertex_stats);
+Datum _postgis_gserialized_vertex_stats(PG_FUNCTION_ARGS)
+{
+	Oid table_oid = PG_GETARG_OID(0);
+	text *att_text = PG_GETARG_TEXT_P(1);
+	const char *att_name = text_to_cstring(att_text);
+	AttrNumber att_num;
+	HeapTuple stats_tuple;
+	VERTEX_STATS *vertex_stats = NULL;
+	stringbuffer_t *sb;
+	text *json;
+
+	att_num = get_attnum(table_oid, att_name);
+	if ( ! att_num )
+		elog(ERROR, "attribute \"%s\" does not exist", att_name);
+
+	stats_tuple = SearchSysCache3(STATRELATTINH, ObjectIdGetDatum(table_oid), Int16GetDatum(att_num), BoolGetDatum(false));
+	if ( stats_tuple )
+	{
+		vertex_stats = pg_vertex_stats_from_tuple(stats_tuple);
+		ReleaseSysCache(stats_tuple);
+	}
+	if ( ! vertex_stats )
+		elog(ERROR, "vertex stats for \"%s.%s\" do not exist", get_rel_name(table_oid), att_name);
+
+	sb = stringbuffer_create();
+	stringbuffer_aprintf(sb, "{\"sample_features\":%d,", (int)roundf(vertex_stats->sample_features));
+	stringbuffer_aprintf(sb, "\"npoints_avg\":%.6g,", vertex_stats->npoints_avg);
+	stringbuffer_aprintf(sb, "\"npoints_p95\":%.6g,", vertex_stats->npoints_p95);
+	stringbuffer_aprintf(sb, "\"npoints_max\":%.6g,", vertex_stats->npoints_max);
+	stringbuffer_aprintf(sb, "\"size_avg\":%.6g,", vertex_stats->size_avg);
+	stringbuffer_aprintf(sb, "\"size_p95\":%.6g}", vertex_stats->size_p95);
+	json = cstring_to_text(stringbuffer_getstring(sb));
+	stringbuffer_destroy(sb);
+	pfree(vertex_stats);
+	PG_RETURN_TEXT_P(json);
+}
+
+
+/**
+* Index of the stats slot holding the given kind, or -1.
+*/
+static int
+pg_stats_slot_of_kind(HeapTuple stats_tuple, int stats_kind)
+{
+	Form_pg_statistic stats = (Form_pg_statistic) GETSTRUCT(stats_tuple);
+	int k;
+
+	for ( k = 0; k < STATISTIC_NUM_SLOTS; k++ )
+	{
+		if ( (&stats->stakind1)[k] == stats_kind )
+			return k;
+	}
+	return -1;
+}
+
+/**
+* Wrap a stats object back up into the float4[] of a stats slot.
+*/
+static Datum
+pg_stats_numbers_datum(const float4 *numbers, size_t size)
+{
+	int nnumbers = size / sizeof(float4);
+	Datum *datums = palloc(sizeof(Datum) * nnumbers);
+	int i;
+
+	for ( i = 0; i < nnumbers; i++ )
+		datums[i] = Float4GetDatum(numbers[i]);
+
+	return PointerGetDatum(construct_array(datums, nnumbers, FLOAT4OID,
+	                       sizeof(float4), FLOAT4PASSBYVAL, 'i'));
+}
+
+/**
+* Weight of each of the freshly sampled features, so that the new
+* rows count as much in the histogram as the old rows do: the
+* histogram holds histogram_features of mass for the not-null rows
+* of the table at the last ANALYZE, and each of the nsamples boxes
+* stands for new_features / nsamples of the new not-null rows.
+*/
+static double
+nd_stats_merge_weight(double histogram_features, double table_features,
+                      double not_null_features, double sample_features,
+                      double new_features, int nsamples)
+{
+	double old_features = table_features;
+
+	if ( sample_features > 0 )
+		old_features *= not_null_features / sample_features;
+	if ( old_features <= 0 || ! nsamples )
+		return 1.0;
+
+	return (histogram_features / old_features) * (new_features / nsamples);
+}
+
+/**
+* Refresh the statistics of an append-mostly table without a full
+* ANALYZE. The rows in the blocks appended since ANALYZE (or the
+* last refresh) are sampled and folded into the existing histograms,
+* weighted against the rows those already describe. Where the stats
+* stop is kept as a block count in the stats slot itself, pg_class is
+* not touched, so the planner row estimates don't move. The histogram
+* extent and grid are left alone, so new features outside of the
+* extent are lost to the grid: when too many of them are, it is time
+* for a real ANALYZE.
+*
+* Only whole new blocks are read: rows that went into the free space
+* of blocks the stats already cover (after a DELETE and VACUUM, say)
+* are not seen until the next ANALYZE.
+*
+* Returns the number of new rows seen.
+*/
+PG_FUNCTION_INFO_V1(_postgis_gserialized_stats_refresh);
+Datum _postgis_gserialized_stats_refresh(PG_FUNCTION_ARGS)
+{
+	Oid table_oid = PG_GETARG_OID(0);
+	text *att_text = PG_GETARG_TEXT_P(1);
+	int max_samples = PG_GETARG_INT32(2);
+	const char *att_name = text_to_cstring(att_text);
+	AttrNumber att_num;
+	Relation rel;
+	TupleDesc tupdesc;
+#if POSTGIS_PGSQL_VERSION >= 120
+	TableScanDesc scan;
+#else
+	HeapScanDesc scan;
+#endif
+	HeapTuple tuple;
+	HeapTuple stats_tuple;
+	BlockNumber start_block, nblocks;
+	ND_STATS *nd_stats;
+
+	GBOX *samples;                      /* Reservoir of new feature boxes */
+	int nsamples = 0;
+	double new_rows = 0;                /* # rows in the new blocks */
+	double new_features = 0;            /* # not null/empty features in the new blocks */
+	int outside = 0;                    /* # samples outside of the 2D histogram extent */
+
+	Datum values[Natts_pg_statistic];
+	bool nulls[Natts_pg_statistic];
+	bool replaces[Natts_pg_statistic];
+	bool replaced = false;
+	int modes[2] = {2, 0};
+	int i, m;
+
+	if ( max_samples < 1 )
+		elog(ERROR, "%s: sample size must be positive", __func__);
+
+	att_num = get_attnum(table_oid, att_name);
+	if ( ! att_num )
+		elog(ERROR, "attribute \"%s\" does not exist", att_name);
+
+	if ( ! pg_class_ownercheck(table_oid, GetUserId()) )
+		ereport(ERROR, (errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+		        errmsg("must be owner of table %s", get_rel_name(table_oid))));
+
+	/* Same lock as ANALYZE takes, we don't want to race it */
+	rel = relation_open(table_oid, ShareUpdateExclusiveLock);
+
+	stats_tuple = SearchSysCache3(STATRELATTINH, ObjectIdGetDatum(table_oid), Int16GetDatum(att_num), BoolGetDatum(false));
+	if ( ! stats_tuple )
+		elog(ERROR, "stats for \"%s.%s\" do not exist, run ANALYZE first", get_rel_name(table_oid), att_name);
+
+	/*
+	 * The blocks past the count kept with the stats were appended
+	 * since; stats from before it was kept make do with relpages,
+	 * which their ANALYZE set.
+	 */
+	start_block = InvalidBlockNumber;
+	nd_stats = pg_nd_stats_from_tuple(stats_tuple, 2);
+	if ( nd_stats )
+	{
+		start_block = nd_stats_get_blocks(nd_stats);
+		pfree(nd_stats);
+	}
+	if ( start_block == InvalidBlockNumber )
+		start_block = rel->rd_rel->relpages;
+	nblocks = RelationGetNumberOfBlocks(rel);
+	if ( nblocks <= start_block )
+	{
+		ReleaseSysCache(stats_tuple);
+		relation_close(rel, NoLock);
+		PG_RETURN_INT64(0);
+	}
+
+	/*
+	 * Scan the new blocks, keeping a uniform sample of the
+	 * feature boxes in a reservoir.
+	 */
+	samples = palloc(sizeof(GBOX) * max_samples);
+	tupdesc = RelationGetDescr(rel);
+#if POSTGIS_PGSQL_VERSION >= 120
+	scan = table_beginscan_strat(rel, GetActiveSnapshot(), 0, NULL, true, false);
+#else
+	scan = heap_beginscan_strat(rel, GetActiveSnapshot(), 0, NULL, true, false);
+#endif
+#if POSTGIS_PGSQL_VERSION >= 95
+	heap_setscanlimits(scan, start_block, nblocks - start_block);
+#endif
+	while ( (tuple = heap_getnext(scan, ForwardScanDirection)) != NULL )
+	{
+		Datum datum;
+		GBOX gbox;
+		bool is_null;
+
+		if ( ItemPointerGetBlockNumber(&(tuple->t_self)) < start_block )
+			continue;
+
+		CHECK_FOR_INTERRUPTS();
+		new_rows++;
+
+		datum = heap_getattr(tuple, att_num, tupdesc, &is_null);
+		if ( is_null )
+			continue;
+		if ( LW_FAILURE == gserialized_datum_get_gbox_p(datum, &gbox) || ! gbox_is_valid(&gbox) )
+			continue;
+
+		new_features++;
+		if ( nsamples < max_samples )
+		{
+			samples[nsamples++] = gbox;
+		}
+		else
+		{
+			long k = random() % (long)new_features;
+			if ( k < max_samples )
+				samples[k] = gbox;
+		}
+	}
+#if POSTGIS_PGSQL_VERSION >= 120
+	table_endscan(scan);
+#else
+	heap_endscan(scan);
+#endif
+
+	POSTGIS_DEBUGF(3, " new rows: %g, new features: %g, samples: %d", new_rows, new_features, nsamples);
+
+	/*
+	 * Fold the samples into the 2D and ND histograms, and
+	 * their adaptive companions, where there are any. Even
+	 * without any samples the row counts and the block count
+	 * move on.
+	 */
+	memset(values, 0, sizeof(values));
+	memset(nulls, 0, sizeof(nulls));
+	memset(replaces, 0, sizeof(replaces));
+	for ( m = 0; m < 2; m++ )
+	{
+		int mode = modes[m];
+		int slot;
+		int ndims, ncells;
+		double weight, aweight = 0.0;
+		double old_features;
+		ND_ASTATS *nd_astats;
+
+		nd_stats = pg_nd_stats_from_tuple(stats_tuple, mode);
+		slot = pg_stats_slot_of_kind(stats_tuple, mode == 2 ? STATISTIC_KIND_2D : STATISTIC_KIND_ND);
+		if ( ! nd_stats || slot < 0 )
+			continue;
+
+		nd_astats = pg_nd_astats_from_tuple(stats_tuple, mode);
+
+		ndims = (int)roundf(nd_stats->ndims);
+		ncells = (int)roundf(nd_stats->histogram_cells);
+		weight = nd_stats_merge_weight(nd_stats->histogram_features, nd_stats->table_features,
+		                               nd_stats->not_null_features, nd_stats->sample_features,
+		                               new_features, nsamples);
+		if ( nd_astats )
+			aweight = nd_stats_merge_weight(nd_astats->histogram_features, nd_astats->table_features,
+			                                nd_astats->not_null_features, nd_astats->sample_features,
+			                                new_features, nsamples);
+
+		for ( i = 0; i < nsamples; i++ )
+		{
+			GBOX gbox = samples[i];
+			ND_BOX nd_box;
+
+			/* If we're in 2D mode, zero out the higher dimensions, as ANALYZE does */
+			if ( mode == 2 )
+				gbox.zmin = gbox.zmax = gbox.mmin = gbox.mmax = 0.0;
+			nd_box_from_gbox(&gbox, &nd_box);
+
+			if ( nd_box_intersects(&(nd_stats->extent), &nd_box, ndims) )
+			{
+				nd_stats->cells_covered += nd_stats_add_box(nd_stats, &nd_box, weight);
+				nd_stats->histogram_features += weight;
+			}
+			else if ( mode == 2 )
+			{
+				outside++;
+			}
+
+			if ( nd_astats )
+				nd_astats_add_box(nd_astats, &nd_box, aweight);
+		}
+
+		/* The table grew, and so did its share of not null features */
+		old_features = nd_stats->table_features * nd_stats->not_null_features / nd_stats->sample_features;
+		nd_stats->table_features += new_rows;
+		nd_stats->not_null_features = nd_stats->sample_features * (old_features + new_features) / nd_stats->table_features;
+		nd_stats_build_sat(nd_stats);
+		nd_stats_set_blocks(nd_stats, nblocks);
+
+		values[Anum_pg_statistic_stanumbers1 - 1 + slot] = pg_stats_numbers_datum((float4*)nd_stats, ND_STATS_SIZE(ncells));
+		replaces[Anum_pg_statistic_stanumbers1 - 1 + slot] = true;
+		replaced = true;
+
+		slot = pg_stats_slot_of_kind(stats_tuple, mode == 2 ? STATISTIC_KIND_2D_ADAPTIVE : STATISTIC_KIND_ND_ADAPTIVE);
+		if ( nd_astats && slot >= 0 )
+		{
+			int nbuckets = (int)roundf(nd_astats->nbuckets);
+			old_features = nd_astats->table_features * nd_astats->not_null_features / nd_astats->sample_features;
+			nd_astats->table_features += new_rows;
+			nd_astats->not_null_features = nd_astats->sample_features * (old_features + new_features) / nd_astats->table_features;
+
+			values[Anum_pg_statistic_stanumbers1 - 1 + slot] = pg_stats_numbers_datum((float4*)nd_astats,
+			    sizeof(ND_ASTATS) + ((nbuckets - 1) * sizeof(ND_BUCKET)));
+			replaces[Anum_pg_statistic_stanumbers1 - 1 + slot] = true;
+		}
+	}
+
+	if ( replaced )
+	{
+		Relation sd = relation_open(StatisticRelationId, RowExclusiveLock);
+		HeapTuple new_tuple = heap_modify_tuple(stats_tuple, RelationGetDescr(sd), values, nulls, replaces);
+#if POSTGIS_PGSQL_VERSION >= 100
+		CatalogTupleUpdate(sd, &new_tuple->t_self, new_tuple);
+#else
+		simple_heap_update(sd, &new_tuple->t_self, new_tuple);
+		CatalogUpdateIndexes(sd, new_tuple);
+#endif
+		heap_freetuple(new_tuple);
+		relation_close(sd, RowExclusiveLock);
+	}
+	ReleaseSysCache(stats_tuple);
+
+	if ( nsamples && outside > nsamples / 10 )
+		elog(NOTICE, "%d%% of the new features of \"%s.%s\" fall outside of the histogram, run ANALYZE to rebuild it",
+		     (int)(100.0 * outside / nsamples), get_rel_name(table_oid), att_name);
+
+	relation_close(rel, NoLock);
+	pfree(samples);
+	PG_RETURN_INT64((int64)new_rows);
+}
+
+
 /**
 * Utility function to read the calculated selectivity for a given search
 * box and table/column. Used for debugging the selectivity code.
@@ -2099,18 +3655,26 @@ Datum _postgis_gserialized_sel(PG_FUNCTION_ARGS)
 	GBOX gbox; /* search box read from gserialized datum */
 	float8 selectivity = 0;
 	ND_STATS *nd_stats;
+	ND_ASTATS *nd_astats;
 	int mode = 2; /* 2D mode by default */
+	bool walk = false;
 
 	/* Check if we've been asked to not use 2d mode */
 	if ( ! PG_ARGISNULL(3) )
+	{
 		mode = text_p_get_mode(PG_GETARG_TEXT_P(3));
+		walk = text_p_get_walk(PG_GETARG_TEXT_P(3));
+	}
 
 	/* Retrieve the stats object */
-	nd_stats = pg_get_nd_stats_by_name(table_oid, att_text, mode, false);
+	nd_stats = pg_get_nd_stats_by_name(table_oid, att_text, mode, false, &nd_astats);
 
 	if ( ! nd_stats )
 		elog(ERROR, "stats for \"%s.%s\" do not exist", get_rel_name(table_oid), text_to_cstring(att_text));
 
+	if ( walk )
+		nd_stats_drop_sat(nd_stats);
+
 	/* Calculate the gbox */
 	if ( ! gserialized_datum_get_gbox_p(geom_datum, &gbox) )
 		elog(ERROR, "unable to calculate bounding box from geometry");
@@ -2118,9 +3682,10 @@ Datum _postgis_gserialized_sel(PG_FUNCTION_ARGS)
 	POSTGIS_DEBUGF(3, " %s", gbox_to_string(&gbox));
 
 	/* Do the estimation */
-	selectivity = estimate_selectivity(&gbox, nd_stats, mode);
+	selectivity = estimate_selectivity(&gbox, nd_stats, nd_astats, mode);
 
 	pfree(nd_stats);
+	if ( nd_astats ) pfree(nd_astats);
 	PG_RETURN_FLOAT8(selectivity);
 }
 
@@ -2137,13 +3702,14 @@ Datum _postgis_gserialized_joinsel(PG_FUNCTION_ARGS)
 	Oid table_oid2 = PG_GETARG_OID(2);
 	text *att_text2 = PG_GETARG_TEXT_P(3);
 	ND_STATS *nd_stats1, *nd_stats2;
+	ND_ASTATS *nd_astats1, *nd_astats2;
 	float8 selectivity = 0;
 	int mode = 2; /* 2D mode by default */
 
 
 	/* Retrieve the stats object */
-	nd_stats1 = pg_get_nd_stats_by_name(table_oid1, att_text1, mode, false);
-	nd_stats2 = pg_get_nd_stats_by_name(table_oid2, att_text2, mode, false);
+	nd_stats1 = pg_get_nd_stats_by_name(table_oid1, att_text1, mode, false, &nd_astats1);
+	nd_stats2 = pg_get_nd_stats_by_name(table_oid2, att_text2, mode, false, &nd_astats2);
 
 	if ( ! nd_stats1 )
 		elog(ERROR, "stats for \"%s.%s\" do not exist", get_rel_name(table_oid1), text_to_cstring(att_text1));
@@ -2158,13 +3724,20 @@ Datum _postgis_gserialized_joinsel(PG_FUNCTION_ARGS)
 		char *modestr = text_to_cstring(modetxt);
 		if ( modestr[0] == 'N' )
 			mode = 0;
+		if ( text_p_get_walk(modetxt) )
+		{
+			nd_stats_drop_sat(nd_stats1);
+			nd_stats_drop_sat(nd_stats2);
+		}
 	}
 
 	/* Do the estimation */
-	selectivity = estimate_join_selectivity(nd_stats1, nd_stats2);
+	selectivity = estimate_join_selectivity(nd_stats1, nd_stats2, nd_astats1, nd_astats2);
 
 	pfree(nd_stats1);
 	pfree(nd_stats2);
+	if ( nd_astats1 ) pfree(nd_astats1);
+	if ( nd_astats2 ) pfree(nd_astats2);
 	PG_RETURN_FLOAT8(selectivity);
 }
 
@@ -2210,25 +3783,26 @@ Datum gserialized_gist_sel_nd(PG_FUNCTION_ARGS)
  * This function just tries to find the search_box, loads the statistics
  * and invoke the work-horse.
  *
+ * The planner support function of the spatial predicates calls in
+ * here too, in which case a third argument can carry the search
+ * distance of ST_DWithin, which grows the search box.
+ *
  */
-PG_FUNCTION_INFO_V1(gserialized_gist_sel);
-Datum gserialized_gist_sel(PG_FUNCTION_ARGS)
+float8
+gserialized_sel_internal(PlannerInfo *root, List *args, int varRelid, int mode)
 {
-	PlannerInfo *root = (PlannerInfo *) PG_GETARG_POINTER(0);
-	/* Oid operator_oid = PG_GETARG_OID(1); */
-	List *args = (List *) PG_GETARG_POINTER(2);
-	/* int varRelid = PG_GETARG_INT32(3); */
-	int mode = PG_GETARG_INT32(4);
-
 	VariableStatData vardata;
 	ND_STATS *nd_stats = NULL;
+	ND_ASTATS *nd_astats = NULL;
 
 	Node *other;
 	Var *self;
 	GBOX search_box;
 	float8 selectivity = 0;
 
-	POSTGIS_DEBUG(2, "gserialized_gist_sel called");
+	double expand = 0.0;
+
+	POSTGIS_DEBUG(2, "gserialized_sel_internal called");
 
 	/*
 	 * TODO: This is a big one,
@@ -2240,10 +3814,22 @@ Datum gserialized_gist_sel(PG_FUNCTION_ARGS)
 	 */
 
 	/* Fail if not a binary opclause (probably shouldn't happen) */
-	if (list_length(args) != 2)
+	if (list_length(args) < 2 || list_length(args) > 3)
 	{
-		POSTGIS_DEBUG(3, "gserialized_gist_sel: not a binary opclause");
-		PG_RETURN_FLOAT8(DEFAULT_ND_SEL);
+		POSTGIS_DEBUG(3, "gserialized_sel_internal: not a binary opclause");
+		return DEFAULT_ND_SEL;
+	}
+
+	/* A third argument is a search distance, as in ST_DWithin */
+	if (list_length(args) == 3)
+	{
+		Node *dist = (Node *) lthird(args);
+		if ( ! IsA(dist, Const) || ((Const*)dist)->constisnull )
+		{
+			POSTGIS_DEBUG(3, " search distance is not constant - returning a default selectivity");
+			return DEFAULT_ND_SEL;
+		}
+		expand = DatumGetFloat8(((Const*)dist)->constvalue);
 	}
 
 	/* Find the constant part */
@@ -2261,38 +3847,55 @@ Datum gserialized_gist_sel(PG_FUNCTION_ARGS)
 	if ( ! IsA(other, Const) )
 	{
 		POSTGIS_DEBUG(3, " no constant arguments - returning a default selectivity");
-		PG_RETURN_FLOAT8(DEFAULT_ND_SEL);
+		return DEFAULT_ND_SEL;
 	}
 
 	/* Convert the constant to a BOX */
 	if( ! gserialized_datum_get_gbox_p(((Const*)other)->constvalue, &search_box) )
 	{
 		POSTGIS_DEBUG(3, "search box is EMPTY");
-		PG_RETURN_FLOAT8(0.0);
+		return 0.0;
 	}
+	if ( expand > 0 )
+		gbox_expand(&search_box, expand);
 	POSTGIS_DEBUGF(4, " requested search box is: %s", gbox_to_string(&search_box));
 
 	/* Get pg_statistic row */
-	examine_variable(root, (Node*)self, 0, &vardata);
+	examine_variable(root, (Node*)self, varRelid, &vardata);
 	if ( vardata.statsTuple ) {
 		nd_stats = pg_nd_stats_from_tuple(vardata.statsTuple, mode);
+		if ( nd_stats )
+			nd_astats = pg_nd_astats_from_tuple(vardata.statsTuple, mode);
 	}
 	ReleaseVariableStats(vardata);
 
 	if ( ! nd_stats )
 	{
 		POSTGIS_DEBUG(3, " unable to load stats from syscache, not analyzed yet?");
-		PG_RETURN_FLOAT8(FALLBACK_ND_SEL);
+		return FALLBACK_ND_SEL;
 	}
 
 	POSTGIS_DEBUGF(4, " got stats:\n%s", nd_stats_to_json(nd_stats));
 
 	/* Do the estimation! */
-	selectivity = estimate_selectivity(&search_box, nd_stats, mode);
+	selectivity = estimate_selectivity(&search_box, nd_stats, nd_astats, mode);
 	POSTGIS_DEBUGF(3, " returning computed value: %f", selectivity);
 
 	pfree(nd_stats);
-	PG_RETURN_FLOAT8(selectivity);
+	if ( nd_astats ) pfree(nd_astats);
+	return selectivity;
+}
+
+PG_FUNCTION_INFO_V1(gserialized_gist_sel);
+Datum gserialized_gist_sel(PG_FUNCTION_ARGS)
+{
+	PlannerInfo *root = (PlannerInfo *) PG_GETARG_POINTER(0);
+	/* Oid operator_oid = PG_GETARG_OID(1); */
+	List *args = (List *) PG_GETARG_POINTER(2);
+	int varRelid = PG_GETARG_INT32(3);
+	int mode = PG_GETARG_INT32(4);
+
+	PG_RETURN_FLOAT8(gserialized_sel_internal(root, args, varRelid, mode));
 }
 
 
@@ -2363,7 +3966,7 @@ Datum gserialized_estimated_extent(PG_FUNCTION_ARGS)
 	if (!gbox)
 	{
 		/* Estimated extent only returns 2D bounds, so use mode 2 */
-		nd_stats = pg_get_nd_stats_by_name(tbl_oid, col, 2, only_parent);
+		nd_stats = pg_get_nd_stats_by_name(tbl_oid, col, 2, only_parent, NULL);
 
 		/* Error out on no stats */
 		if ( ! nd_stats ) {
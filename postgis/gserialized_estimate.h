@@ -0,0 +1,73 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************
+ *
+ * ^copyright^
+ *
+ **********************************************************************/
+
+#ifndef _GSERIALIZED_ESTIMATE_H
+#define _GSERIALIZED_ESTIMATE_H 1
+
+#include "postgres.h"
+#if PG_VERSION_NUM < 120000
+#include "nodes/relation.h"
+#else
+#include "nodes/pathnodes.h"
+#endif
+
+/**
+* Vertex count and size statistics of a geometry column, gathered
+* by ANALYZE next to the histograms. Like the histograms it is
+* stored as an array of float4 in a pg_statistic slot, so every
+* member has to be a float4.
+*/
+typedef struct VERTEX_STATS_T
+{
+	/* Number of sampled features (not null, not empty) */
+	float4 sample_features;
+
+	/* Vertex counts */
+	float4 npoints_avg;
+	float4 npoints_p95;
+	float4 npoints_max;
+
+	/* Raw (uncompressed, detoasted) serialized size, in bytes */
+	float4 size_avg;
+	float4 size_p95;
+}
+VERTEX_STATS;
+
+/**
+* Read the vertex statistics for a planner expression. Var nodes
+* are looked up in the column statistics, Const nodes are measured
+* directly. Returns a palloc'ed VERTEX_STATS, or NULL when nothing
+* is known about the expression.
+*/
+extern VERTEX_STATS *gserialized_vertex_stats(PlannerInfo *root, Node *node);
+
+/**
+* Restriction and join selectivity of the && (mode 2) and &&&
+* (mode 0) operators, for callers that are not operators, like
+* the planner support functions of the spatial predicates.
+*/
+extern float8 gserialized_sel_internal(PlannerInfo *root, List *args, int varRelid, int mode);
+extern float8 gserialized_joinsel_internal(PlannerInfo *root, List *args, JoinType jointype, int mode);
+
+#endif /* _GSERIALIZED_ESTIMATE_H */
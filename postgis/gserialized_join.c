@@ -0,0 +1,803 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************
+ *
+ * ^copyright^
+ *
+ **********************************************************************/
+
+#include "../postgis_config.h"
+
+/* PostgreSQL */
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "gserialized_join.h"
+
+#if POSTGIS_PGSQL_VERSION >= 96
+
+#include <math.h>
+
+#include "access/htup_details.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_type.h"
+#include "executor/executor.h"
+#include "executor/tuptable.h"
+#include "miscadmin.h"
+#include "nodes/extensible.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/pg_list.h"
+#include "optimizer/cost.h"
+#include "optimizer/pathnode.h"
+#include "optimizer/paths.h"
+#include "optimizer/restrictinfo.h"
+#if POSTGIS_PGSQL_VERSION >= 120
+#include "optimizer/optimizer.h"
+#endif
+#include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/syscache.h"
+
+/* PostGIS */
+#include "liblwgeom.h"
+#include "lwgeom_pg.h"
+#include "gserialized_gist.h"
+#include "gserialized_supportfn.h"
+
+/*
+** The SpatialJoin custom scan answers an inner join with a
+** geometry && geometry clause between plain columns of its two
+** sides, or (PostgreSQL 12+) with a predicate like ST_Intersects
+** that implies one. It reads the inner side once, packs the boxes of its rows
+** into an STR tree, then streams the outer rows through the tree.
+** Each outer row is paired with its candidates one after another,
+** so its geometry repeats across the calls of the join clauses and
+** the prepared geometry and rect-tree caches pick it up. All the
+** join clauses, the key included, are checked on the candidate pairs.
+**
+** A partial outer path gets a partial SpatialJoin too, every worker
+** packing its own copy of the inner side, the way a parallel hash
+** join without a shared table works.
+*/
+
+/* Entries per node of the STR tree */
+#define SPATIAL_JOIN_FANOUT 16
+
+/* Deep enough for any tree of less than 2^32 entries */
+#define SPATIAL_JOIN_MAX_DEPTH 8
+
+static bool enable_spatial_join = false;
+static set_join_pathlist_hook_type prev_set_join_pathlist_hook = NULL;
+
+/*
+* A node of the STR tree. The first nodes are the entries, one per
+* inner row with a non-empty key, the parents of each level follow
+* the level below and the root comes last.
+*/
+typedef struct
+{
+	BOX2DF box;
+	uint32 first;	/* first child node, or inner row number of an entry */
+	uint32 count;	/* number of children, zero for an entry */
+} SpatialJoinNode;
+
+typedef struct
+{
+	CustomScanState css;
+
+	AttrNumber outer_key;	/* key column in the outer rows */
+	AttrNumber inner_key;	/* key column in the inner rows */
+	int outer_natts;
+	int inner_natts;
+
+	/* The inner side, filled on the first call */
+	bool built;
+	MemoryContext build_cxt;
+	MinimalTuple *tuples;
+	uint32 num_tuples;
+	SpatialJoinNode *nodes;
+	uint32 num_entries;
+	uint32 root;
+	TupleTableSlot *inner_slot;
+
+	/* The current outer row and its candidates */
+	TupleTableSlot *outer_slot;
+	uint32 *matches;
+	uint32 matches_size;
+	uint32 num_matches;
+	uint32 next_match;
+} SpatialJoinState;
+
+static Plan *spatial_join_plan(PlannerInfo *root, RelOptInfo *rel, CustomPath *best_path, List *tlist, List *clauses, List *custom_plans);
+static Node *spatial_join_create_state(CustomScan *cscan);
+static void spatial_join_begin(CustomScanState *node, EState *estate, int eflags);
+static TupleTableSlot *spatial_join_exec(CustomScanState *node);
+static void spatial_join_end(CustomScanState *node);
+static void spatial_join_rescan(CustomScanState *node);
+
+static CustomPathMethods spatial_join_path_methods = {
+	.CustomName = "SpatialJoin",
+	.PlanCustomPath = spatial_join_plan
+};
+
+static CustomScanMethods spatial_join_scan_methods = {
+	.CustomName = "SpatialJoin",
+	.CreateCustomScanState = spatial_join_create_state
+};
+
+static CustomExecMethods spatial_join_exec_methods = {
+	.CustomName = "SpatialJoin",
+	.BeginCustomScan = spatial_join_begin,
+	.ExecCustomScan = spatial_join_exec,
+	.EndCustomScan = spatial_join_end,
+	.ReScanCustomScan = spatial_join_rescan
+};
+
+/***********************************************************************
+* Planning
+*/
+
+/*
+* The && of a geometry type, looked up in the schema of the type so
+* that a && of another type or extension is never taken for it.
+* Returns InvalidOid if typoid is not a geometry.
+*/
+static Oid
+spatial_join_overlaps_operator(Oid typoid)
+{
+	static Oid cached_typoid = InvalidOid;
+	static Oid cached_opno = InvalidOid;
+	HeapTuple tuple;
+	Oid opno = InvalidOid;
+
+	if (typoid == cached_typoid)
+		return cached_opno;
+
+	tuple = SearchSysCache1(TYPEOID, ObjectIdGetDatum(typoid));
+	if (HeapTupleIsValid(tuple))
+	{
+		Form_pg_type typ = (Form_pg_type) GETSTRUCT(tuple);
+		if (strcmp(NameStr(typ->typname), "geometry") == 0)
+		{
+			List *opname = list_make2(makeString(get_namespace_name(typ->typnamespace)), makeString("&&"));
+			opno = OpernameGetOprid(opname, typoid, typoid);
+		}
+		ReleaseSysCache(tuple);
+	}
+
+	cached_typoid = typoid;
+	cached_opno = opno;
+	return opno;
+}
+
+/*
+* Is clause a join key between two geometry columns, the &&
+* operator or a predicate that is only true when && is?
+* Sets args to its two column arguments.
+*/
+static bool
+spatial_join_is_overlaps(Expr *clause, List **args)
+{
+	Oid typoid;
+
+	if (IsA(clause, OpExpr))
+		*args = ((OpExpr *) clause)->args;
+#if POSTGIS_PGSQL_VERSION >= 120
+	else if (IsA(clause, FuncExpr))
+		*args = ((FuncExpr *) clause)->args;
+#endif
+	else
+		return false;
+
+	if (list_length(*args) != 2)
+		return false;
+	typoid = exprType(linitial(*args));
+	if (typoid != exprType(lsecond(*args)) || !OidIsValid(spatial_join_overlaps_operator(typoid)))
+		return false;
+
+	if (IsA(clause, OpExpr))
+		return ((OpExpr *) clause)->opno == spatial_join_overlaps_operator(typoid);
+#if POSTGIS_PGSQL_VERSION >= 120
+	return postgis_supportfn_implies_overlaps(((FuncExpr *) clause)->funcid);
+#else
+	return false;
+#endif
+}
+
+static Var *
+spatial_join_var(Node *node)
+{
+	if (node && IsA(node, RelabelType))
+		node = (Node *) ((RelabelType *) node)->arg;
+	if (node && IsA(node, Var) && ((Var *) node)->varlevelsup == 0)
+		return (Var *) node;
+	return NULL;
+}
+
+/*
+* Find a join key (see spatial_join_is_overlaps) between columns
+* of the two sides of the join in restrictlist, and the column of
+* each side.
+*/
+static RestrictInfo *
+spatial_join_key(List *restrictlist, Relids outer_relids, Relids inner_relids, Var **outer_var, Var **inner_var)
+{
+	ListCell *lc;
+
+	foreach(lc, restrictlist)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		List *args;
+		Var *left, *right;
+
+		if (!spatial_join_is_overlaps(rinfo->clause, &args))
+			continue;
+
+		left = spatial_join_var(linitial(args));
+		right = spatial_join_var(lsecond(args));
+		if (!left || !right)
+			continue;
+
+		if (bms_is_member(left->varno, outer_relids) && bms_is_member(right->varno, inner_relids))
+		{
+			*outer_var = left;
+			*inner_var = right;
+		}
+		else if (bms_is_member(right->varno, outer_relids) && bms_is_member(left->varno, inner_relids))
+		{
+			*outer_var = right;
+			*inner_var = left;
+		}
+		else
+			continue;
+
+		return rinfo;
+	}
+
+	return NULL;
+}
+
+/*
+* Packing the inner side costs a sort of its boxes, each outer row
+* then descends the tree and every candidate pair gets the join
+* clauses checked. The candidates are the pairs passing && alone.
+*/
+static CustomPath *
+spatial_join_path(PlannerInfo *root, RelOptInfo *joinrel, Path *outer_path, Path *inner_path,
+		  List *restrictlist, Selectivity key_selec, double rows)
+{
+	CustomPath *cpath = makeNode(CustomPath);
+	double outer_rows = outer_path->rows;
+	double inner_rows = Max(inner_path->rows, 1.0);
+	double depth = ceil(log(Max(inner_rows, 2.0)) / log(SPATIAL_JOIN_FANOUT));
+	double candidates = clamp_row_est(outer_rows * inner_rows * key_selec);
+	QualCost qual_cost;
+
+	cost_qual_eval(&qual_cost, restrictlist, root);
+
+	cpath->path.pathtype = T_CustomScan;
+	cpath->path.parent = joinrel;
+	cpath->path.pathtarget = joinrel->reltarget;
+	cpath->path.param_info = NULL;
+	cpath->path.parallel_aware = false;
+	cpath->path.parallel_safe = joinrel->consider_parallel &&
+		outer_path->parallel_safe && inner_path->parallel_safe;
+	cpath->path.parallel_workers = outer_path->parallel_workers;
+	cpath->path.pathkeys = NIL;
+	cpath->path.rows = rows;
+
+	cpath->path.startup_cost = inner_path->total_cost + outer_path->startup_cost + qual_cost.startup +
+		inner_rows * (cpu_tuple_cost + log2(Max(inner_rows, 2.0)) * cpu_operator_cost);
+	cpath->path.total_cost = cpath->path.startup_cost +
+		(outer_path->total_cost - outer_path->startup_cost) +
+		outer_rows * depth * SPATIAL_JOIN_FANOUT * cpu_operator_cost +
+		candidates * (cpu_tuple_cost + qual_cost.per_tuple) +
+		rows * joinrel->reltarget->cost.per_tuple;
+
+	cpath->flags = 0;
+	cpath->custom_paths = list_make2(outer_path, inner_path);
+	cpath->custom_private = restrictlist;
+	cpath->methods = &spatial_join_path_methods;
+
+	return cpath;
+}
+
+static void
+spatial_join_pathlist(PlannerInfo *root, RelOptInfo *joinrel, RelOptInfo *outerrel, RelOptInfo *innerrel,
+		      JoinType jointype, JoinPathExtraData *extra)
+{
+	RestrictInfo *key;
+	Var *outer_var, *inner_var;
+	Path *outer_path, *inner_path;
+	Selectivity key_selec;
+
+	if (prev_set_join_pathlist_hook)
+		prev_set_join_pathlist_hook(root, joinrel, outerrel, innerrel, jointype, extra);
+
+	if (!enable_spatial_join || jointype != JOIN_INNER)
+		return;
+
+	/* No row locking, the rows of a join have no EvalPlanQual recheck here */
+	if (root->parse->commandType != CMD_SELECT || root->parse->rowMarks != NIL)
+		return;
+
+	key = spatial_join_key(extra->restrictlist, outerrel->relids, innerrel->relids, &outer_var, &inner_var);
+	if (!key)
+		return;
+
+	outer_path = outerrel->cheapest_total_path;
+	inner_path = innerrel->cheapest_total_path;
+	if (!outer_path || !inner_path || outer_path->param_info || inner_path->param_info)
+		return;
+
+	key_selec = clause_selectivity(root, (Node *) key, 0, JOIN_INNER, extra->sjinfo);
+
+	add_path(joinrel, (Path *) spatial_join_path(root, joinrel, outer_path, inner_path,
+						     extra->restrictlist, key_selec, joinrel->rows));
+
+	/* Each worker joins its share of the outer rows to the whole inner side */
+	if (joinrel->consider_parallel && outerrel->partial_pathlist != NIL && inner_path->parallel_safe)
+	{
+		Path *partial_path = (Path *) linitial(outerrel->partial_pathlist);
+		double rows = clamp_row_est(joinrel->rows * partial_path->rows / Max(outer_path->rows, 1.0));
+
+		if (!partial_path->param_info)
+			add_partial_path(joinrel, (Path *) spatial_join_path(root, joinrel, partial_path, inner_path,
+									    extra->restrictlist, key_selec, rows));
+	}
+}
+
+/* Position of var in the targetlist of a child plan */
+static AttrNumber
+spatial_join_key_position(List *tlist, Var *var)
+{
+	ListCell *lc;
+
+	foreach(lc, tlist)
+	{
+		TargetEntry *tle = (TargetEntry *) lfirst(lc);
+		Var *tvar = spatial_join_var((Node *) tle->expr);
+		if (tvar && tvar->varno == var->varno && tvar->varattno == var->varattno)
+			return tle->resno;
+	}
+
+	return InvalidAttrNumber;
+}
+
+/*
+* The scan tuple is the outer row followed by the inner row, the
+* targetlist and the join clauses read it through custom_scan_tlist.
+*/
+static Plan *
+spatial_join_plan(PlannerInfo *root, RelOptInfo *rel, CustomPath *best_path, List *tlist, List *clauses, List *custom_plans)
+{
+	CustomScan *cscan = makeNode(CustomScan);
+	Plan *outer_plan = (Plan *) linitial(custom_plans);
+	Plan *inner_plan = (Plan *) lsecond(custom_plans);
+	Relids outer_relids = ((Path *) linitial(best_path->custom_paths))->parent->relids;
+	Relids inner_relids = ((Path *) lsecond(best_path->custom_paths))->parent->relids;
+	List *restrictlist = best_path->custom_private;
+	List *scan_tlist = NIL;
+	List *quals = NIL;
+	AttrNumber outer_key, inner_key, resno = 1;
+	Var *outer_var, *inner_var;
+	ListCell *lc;
+
+	if (!spatial_join_key(restrictlist, outer_relids, inner_relids, &outer_var, &inner_var))
+		elog(ERROR, "%s: join clause is missing", __func__);
+
+	outer_key = spatial_join_key_position(outer_plan->targetlist, outer_var);
+	inner_key = spatial_join_key_position(inner_plan->targetlist, inner_var);
+	if (outer_key == InvalidAttrNumber || inner_key == InvalidAttrNumber)
+		elog(ERROR, "%s: join column is not in the join inputs", __func__);
+
+	foreach(lc, outer_plan->targetlist)
+	{
+		TargetEntry *tle = (TargetEntry *) lfirst(lc);
+		scan_tlist = lappend(scan_tlist, makeTargetEntry((Expr *) copyObject(tle->expr), resno++, NULL, false));
+	}
+	foreach(lc, inner_plan->targetlist)
+	{
+		TargetEntry *tle = (TargetEntry *) lfirst(lc);
+		scan_tlist = lappend(scan_tlist, makeTargetEntry((Expr *) copyObject(tle->expr), resno++, NULL, false));
+	}
+
+	/* Pseudoconstant clauses too, there is no gating Result above a join scan */
+	foreach(lc, restrictlist)
+		quals = lappend(quals, ((RestrictInfo *) lfirst(lc))->clause);
+
+	cscan->scan.plan.targetlist = tlist;
+	cscan->scan.plan.qual = quals;
+	cscan->scan.scanrelid = 0;
+	cscan->flags = best_path->flags;
+	cscan->custom_plans = custom_plans;
+	cscan->custom_exprs = NIL;
+	cscan->custom_private = list_make2(makeInteger(outer_key), makeInteger(inner_key));
+	cscan->custom_scan_tlist = scan_tlist;
+	cscan->custom_relids = rel->relids;
+	cscan->methods = &spatial_join_scan_methods;
+
+	return &cscan->scan.plan;
+}
+
+/***********************************************************************
+* Execution
+*/
+
+static Node *
+spatial_join_create_state(CustomScan *cscan)
+{
+	SpatialJoinState *sjs = (SpatialJoinState *) palloc0(sizeof(SpatialJoinState));
+
+	NodeSetTag(sjs, T_CustomScanState);
+	sjs->css.flags = cscan->flags;
+	sjs->css.methods = &spatial_join_exec_methods;
+
+	return (Node *) sjs;
+}
+
+static void
+spatial_join_begin(CustomScanState *node, EState *estate, int eflags)
+{
+	SpatialJoinState *sjs = (SpatialJoinState *) node;
+	CustomScan *cscan = (CustomScan *) node->ss.ps.plan;
+	PlanState *outer_ps, *inner_ps;
+	TupleDesc inner_desc;
+
+	eflags &= ~(EXEC_FLAG_REWIND | EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK);
+	outer_ps = ExecInitNode((Plan *) linitial(cscan->custom_plans), estate, eflags);
+	inner_ps = ExecInitNode((Plan *) lsecond(cscan->custom_plans), estate, eflags);
+	node->custom_ps = list_make2(outer_ps, inner_ps);
+
+	sjs->outer_key = intVal(linitial(cscan->custom_private));
+	sjs->inner_key = intVal(lsecond(cscan->custom_private));
+	sjs->outer_natts = ExecGetResultType(outer_ps)->natts;
+	inner_desc = ExecGetResultType(inner_ps);
+	sjs->inner_natts = inner_desc->natts;
+
+#if POSTGIS_PGSQL_VERSION >= 120
+	sjs->inner_slot = MakeSingleTupleTableSlot(inner_desc, &TTSOpsMinimalTuple);
+#else
+	sjs->inner_slot = MakeSingleTupleTableSlot(inner_desc);
+#endif
+
+	sjs->build_cxt = AllocSetContextCreate(estate->es_query_cxt, "PostGIS spatial join", ALLOCSET_DEFAULT_SIZES);
+	sjs->built = false;
+}
+
+static int
+spatial_join_cmp_x(const void *a, const void *b)
+{
+	const BOX2DF *ba = &((const SpatialJoinNode *) a)->box;
+	const BOX2DF *bb = &((const SpatialJoinNode *) b)->box;
+	double ca = (double) ba->xmin + ba->xmax;
+	double cb = (double) bb->xmin + bb->xmax;
+	return ca < cb ? -1 : (ca > cb ? 1 : 0);
+}
+
+static int
+spatial_join_cmp_y(const void *a, const void *b)
+{
+	const BOX2DF *ba = &((const SpatialJoinNode *) a)->box;
+	const BOX2DF *bb = &((const SpatialJoinNode *) b)->box;
+	double ca = (double) ba->ymin + ba->ymax;
+	double cb = (double) bb->ymin + bb->ymax;
+	return ca < cb ? -1 : (ca > cb ? 1 : 0);
+}
+
+/*
+* Sort-Tile-Recursive packing, one level at a time: the nodes of a
+* level are sorted into vertical slices by x, each slice by y, and
+* every run of SPATIAL_JOIN_FANOUT of them gets a parent.
+*/
+static void
+spatial_join_pack(SpatialJoinState *sjs)
+{
+	uint32 level_start = 0;
+	uint32 level_count = sjs->num_entries;
+	uint32 num_nodes = sjs->num_entries;
+	uint32 i;
+
+	while (level_count > 1)
+	{
+		uint32 num_parents = (level_count + SPATIAL_JOIN_FANOUT - 1) / SPATIAL_JOIN_FANOUT;
+		uint32 slice_size = (uint32) ceil(sqrt((double) num_parents)) * SPATIAL_JOIN_FANOUT;
+		SpatialJoinNode *level = sjs->nodes + level_start;
+
+		qsort(level, level_count, sizeof(SpatialJoinNode), spatial_join_cmp_x);
+		for (i = 0; i < level_count; i += slice_size)
+			qsort(level + i, Min(slice_size, level_count - i), sizeof(SpatialJoinNode), spatial_join_cmp_y);
+
+		for (i = 0; i < level_count; i += SPATIAL_JOIN_FANOUT)
+		{
+			SpatialJoinNode *parent = &sjs->nodes[num_nodes++];
+			uint32 j;
+
+			parent->first = level_start + i;
+			parent->count = Min(SPATIAL_JOIN_FANOUT, level_count - i);
+			parent->box = sjs->nodes[parent->first].box;
+			for (j = 1; j < parent->count; j++)
+				box2df_merge(&parent->box, &sjs->nodes[parent->first + j].box);
+		}
+
+		level_start += level_count;
+		level_count = num_parents;
+	}
+
+	sjs->root = level_start;
+}
+
+/* Read the inner side and pack the boxes of its keys */
+static void
+spatial_join_build(SpatialJoinState *sjs)
+{
+	PlanState *inner_ps = (PlanState *) lsecond(sjs->css.custom_ps);
+	ExprContext *econtext = sjs->css.ss.ps.ps_ExprContext;
+	uint32 size = 1024;
+
+	MemoryContextReset(sjs->build_cxt);
+	sjs->tuples = MemoryContextAlloc(sjs->build_cxt, size * sizeof(MinimalTuple));
+	sjs->nodes = MemoryContextAlloc(sjs->build_cxt, size * sizeof(SpatialJoinNode));
+	sjs->num_tuples = 0;
+
+	for (;;)
+	{
+		TupleTableSlot *slot = ExecProcNode(inner_ps);
+		MemoryContext old_context;
+		SpatialJoinNode *entry;
+		BOX2DF box;
+		Datum key;
+		bool isnull;
+		int found;
+
+		if (TupIsNull(slot))
+			break;
+
+		key = slot_getattr(slot, sjs->inner_key, &isnull);
+		if (isnull)
+			continue;
+
+		/* Only the box is kept, the detoasted header goes right away */
+		old_context = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+		found = gserialized_datum_get_box2df_p(key, &box);
+		MemoryContextSwitchTo(old_context);
+		ResetExprContext(econtext);
+		if (found == LW_FAILURE)
+			continue;
+
+		if (sjs->num_tuples == size)
+		{
+			if (size >= MaxAllocSize / 2 / sizeof(SpatialJoinNode))
+				elog(ERROR, "%s: too many rows on the inner side", __func__);
+			size *= 2;
+			sjs->tuples = repalloc(sjs->tuples, size * sizeof(MinimalTuple));
+			sjs->nodes = repalloc(sjs->nodes, size * sizeof(SpatialJoinNode));
+		}
+
+		entry = &sjs->nodes[sjs->num_tuples];
+		entry->box = box;
+		entry->first = sjs->num_tuples;
+		entry->count = 0;
+
+		old_context = MemoryContextSwitchTo(sjs->build_cxt);
+		sjs->tuples[sjs->num_tuples++] = ExecCopySlotMinimalTuple(slot);
+		MemoryContextSwitchTo(old_context);
+	}
+
+	/* Room for the parents, less than one per entry */
+	sjs->num_entries = sjs->num_tuples;
+	sjs->nodes = repalloc(sjs->nodes, Max(2 * sjs->num_entries, 1) * sizeof(SpatialJoinNode));
+	spatial_join_pack(sjs);
+
+	sjs->matches_size = 64;
+	sjs->matches = MemoryContextAlloc(sjs->build_cxt, sjs->matches_size * sizeof(uint32));
+	sjs->num_matches = 0;
+	sjs->next_match = 0;
+	sjs->built = true;
+}
+
+/* Collect the inner rows whose box overlaps box */
+static void
+spatial_join_query(SpatialJoinState *sjs, const BOX2DF *box)
+{
+	uint32 stack[SPATIAL_JOIN_FANOUT * SPATIAL_JOIN_MAX_DEPTH];
+	int depth = 0;
+
+	sjs->num_matches = 0;
+	sjs->next_match = 0;
+	if (sjs->num_entries == 0)
+		return;
+
+	stack[depth++] = sjs->root;
+	while (depth > 0)
+	{
+		SpatialJoinNode *n = &sjs->nodes[stack[--depth]];
+		uint32 i;
+
+		if (!box2df_overlaps(&n->box, box))
+			continue;
+
+		if (n->count == 0)
+		{
+			if (sjs->num_matches == sjs->matches_size)
+			{
+				sjs->matches_size *= 2;
+				sjs->matches = repalloc(sjs->matches, sjs->matches_size * sizeof(uint32));
+			}
+			sjs->matches[sjs->num_matches++] = n->first;
+			continue;
+		}
+
+		for (i = n->count; i > 0; i--)
+			stack[depth++] = n->first + i - 1;
+	}
+}
+
+/* Next outer row and candidate pair, as a scan tuple */
+static TupleTableSlot *
+spatial_join_next(CustomScanState *node)
+{
+	SpatialJoinState *sjs = (SpatialJoinState *) node;
+	TupleTableSlot *scan_slot = node->ss.ss_ScanTupleSlot;
+	PlanState *outer_ps = (PlanState *) linitial(node->custom_ps);
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+
+	if (!sjs->built)
+		spatial_join_build(sjs);
+
+	for (;;)
+	{
+		TupleTableSlot *outer_slot;
+		MemoryContext old_context;
+		BOX2DF box;
+		Datum key;
+		bool isnull;
+		int found;
+
+		if (sjs->next_match < sjs->num_matches)
+		{
+			MinimalTuple tuple = sjs->tuples[sjs->matches[sjs->next_match++]];
+
+			ExecClearTuple(scan_slot);
+			slot_getallattrs(sjs->outer_slot);
+			ExecStoreMinimalTuple(tuple, sjs->inner_slot, false);
+			slot_getallattrs(sjs->inner_slot);
+			memcpy(scan_slot->tts_values, sjs->outer_slot->tts_values, sjs->outer_natts * sizeof(Datum));
+			memcpy(scan_slot->tts_isnull, sjs->outer_slot->tts_isnull, sjs->outer_natts * sizeof(bool));
+			memcpy(scan_slot->tts_values + sjs->outer_natts, sjs->inner_slot->tts_values, sjs->inner_natts * sizeof(Datum));
+			memcpy(scan_slot->tts_isnull + sjs->outer_natts, sjs->inner_slot->tts_isnull, sjs->inner_natts * sizeof(bool));
+			return ExecStoreVirtualTuple(scan_slot);
+		}
+
+		outer_slot = ExecProcNode(outer_ps);
+		if (TupIsNull(outer_slot))
+			return ExecClearTuple(scan_slot);
+		sjs->outer_slot = outer_slot;
+		sjs->num_matches = 0;
+		sjs->next_match = 0;
+
+		key = slot_getattr(outer_slot, sjs->outer_key, &isnull);
+		if (isnull)
+			continue;
+
+		old_context = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+		found = gserialized_datum_get_box2df_p(key, &box);
+		MemoryContextSwitchTo(old_context);
+		if (found == LW_FAILURE)
+			continue;
+
+		spatial_join_query(sjs, &box);
+	}
+}
+
+static bool
+spatial_join_recheck(CustomScanState *node, TupleTableSlot *slot)
+{
+	return true;
+}
+
+static TupleTableSlot *
+spatial_join_exec(CustomScanState *node)
+{
+	return ExecScan(&node->ss,
+			(ExecScanAccessMtd) spatial_join_next,
+			(ExecScanRecheckMtd) spatial_join_recheck);
+}
+
+static void
+spatial_join_end(CustomScanState *node)
+{
+	SpatialJoinState *sjs = (SpatialJoinState *) node;
+
+	ExecEndNode((PlanState *) linitial(node->custom_ps));
+	ExecEndNode((PlanState *) lsecond(node->custom_ps));
+	ExecDropSingleTupleTableSlot(sjs->inner_slot);
+	MemoryContextDelete(sjs->build_cxt);
+}
+
+/*
+* The packed inner side is kept unless a parameter it depends on
+* changed. Parameter changes are passed down here, the executor
+* only does that for lefttree and righttree.
+*/
+static void
+spatial_join_rescan(CustomScanState *node)
+{
+	SpatialJoinState *sjs = (SpatialJoinState *) node;
+	PlanState *outer_ps = (PlanState *) linitial(node->custom_ps);
+	PlanState *inner_ps = (PlanState *) lsecond(node->custom_ps);
+
+	if (node->ss.ps.chgParam != NULL)
+	{
+		UpdateChangedParamSet(outer_ps, node->ss.ps.chgParam);
+		UpdateChangedParamSet(inner_ps, node->ss.ps.chgParam);
+	}
+
+	if (inner_ps->chgParam != NULL)
+	{
+		ExecClearTuple(sjs->inner_slot);
+		sjs->built = false;
+	}
+
+	if (outer_ps->chgParam == NULL)
+		ExecReScan(outer_ps);
+
+	sjs->num_matches = 0;
+	sjs->next_match = 0;
+}
+
+void
+gserialized_join_init(void)
+{
+	static const char *guc_name = "postgis.enable_spatial_join";
+
+	/* A prior copy of the library may already have defined */
+	/* the GUC and registered the scan during an upgrade; */
+	/* this copy then leaves joins alone until the next connection. */
+	if ( postgis_guc_find_option(guc_name) )
+		return;
+
+	DefineCustomBoolVariable( guc_name, /* name */
+				"Enables the planner's use of spatial join plans.", /* short_desc */
+				"Inner joins on geometry && geometry between columns may be planned as a SpatialJoin custom scan, which packs the rows of one side in an in-memory tree and streams the other side through it.", /* long_desc */
+				&enable_spatial_join, /* valueAddr */
+				false, /* bootValue */
+				PGC_USERSET, /* GucContext context */
+				0, /* int flags */
+				NULL, /* GucBoolCheckHook check_hook */
+				NULL, /* GucBoolAssignHook assign_hook */
+				NULL  /* GucShowHook show_hook */
+				);
+
+	RegisterCustomScanMethods(&spatial_join_scan_methods);
+
+	prev_set_join_pathlist_hook = set_join_pathlist_hook;
+	set_join_pathlist_hook = spatial_join_pathlist;
+}
+
+#else /* POSTGIS_PGSQL_VERSION < 96 */
+
+void
+gserialized_join_init(void)
+{
+}
+
+#endif /* POSTGIS_PGSQL_VERSION >= 96 */
@@ -0,0 +1,37 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************
+ *
+ * ^copyright^
+ *
+ **********************************************************************/
+
+
+#ifndef GSERIALIZED_JOIN_H_
+#define GSERIALIZED_JOIN_H_ 1
+
+/**
+* Define the postgis.enable_spatial_join setting and install the
+* planner hook offering the SpatialJoin custom scan for joins on
+* geometry && geometry, or on the predicates implying it. Does
+* nothing before PostgreSQL 9.6.
+*/
+void gserialized_join_init(void);
+
+#endif /* GSERIALIZED_JOIN_H_ */
@@ -0,0 +1,439 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************
+ *
+ * ^copyright^
+ *
+ **********************************************************************/
+
+#include "../postgis_config.h"
+
+/* PostgreSQL */
+#include "postgres.h"
+#include "fmgr.h"
+
+#if POSTGIS_PGSQL_VERSION >= 120
+
+#include "access/htup_details.h"
+#include "access/stratnum.h"
+#include "catalog/namespace.h"
+#include "catalog/pg_am.h"
+#include "catalog/pg_opfamily.h"
+#include "catalog/pg_type.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/nodes.h"
+#include "nodes/pg_list.h"
+#include "nodes/primnodes.h"
+#include "nodes/supportnodes.h"
+#include "optimizer/cost.h"
+#include "optimizer/optimizer.h"
+#include "parser/parse_func.h"
+#include "utils/lsyscache.h"
+#include "utils/syscache.h"
+
+/* PostGIS */
+#include "liblwgeom.h"
+#include "lwgeom_pg.h"
+#include "gserialized_estimate.h"
+#include "gserialized_supportfn.h"
+
+/*
+* The procost of the predicates (_COST_GEOS_LOW and friends) is
+* tuned for a "typical" pair of features with about this many
+* vertices between them. The support function scales the procost
+* by the actual vertex counts relative to it.
+*/
+#define SUPPORTFN_REFERENCE_NPOINTS 64.0
+
+/*
+* Never cost a call at less than this fraction of the procost,
+* there is a fixed overhead of detoasting and deserializing no
+* matter how small the features are.
+*/
+#define SUPPORTFN_MIN_COST_SCALE 0.125
+
+Datum postgis_supportfn(PG_FUNCTION_ARGS);
+
+/*
+* The spatial predicates that can be answered in part by an index,
+* with the index strategy that finds the candidates and, for the
+* distance predicates, the (1-based) position of the distance
+* argument the non-indexed side has to be expanded by.
+*/
+typedef struct
+{
+	const char *fn_name;
+	StrategyNumber strategy;
+	int expand_arg;
+}
+INDEXABLE_FUNCTION;
+
+static const INDEXABLE_FUNCTION IndexableFunctions[] = {
+	{"st_intersects", RTOverlapStrategyNumber, 0},
+	{"st_dwithin", RTOverlapStrategyNumber, 3},
+	{"st_contains", RTContainsStrategyNumber, 0},
+	{"st_containsproperly", RTContainsStrategyNumber, 0},
+	{"st_covers", RTContainsStrategyNumber, 0},
+	{"st_within", RTContainedByStrategyNumber, 0},
+	{"st_coveredby", RTContainedByStrategyNumber, 0},
+	{"st_touches", RTOverlapStrategyNumber, 0},
+	{"st_crosses", RTOverlapStrategyNumber, 0},
+	{"st_overlaps", RTOverlapStrategyNumber, 0},
+	{"st_equals", RTSameStrategyNumber, 0},
+	{NULL, 0, 0}
+};
+
+/**
+* Arguments of the function call the planner is asking about.
+*/
+static List *
+supportfn_node_args(Node *node)
+{
+	if ( ! node )
+		return NIL;
+	if ( IsA(node, FuncExpr) )
+		return ((FuncExpr *)node)->args;
+	if ( IsA(node, OpExpr) )
+		return ((OpExpr *)node)->args;
+	return NIL;
+}
+
+/**
+* Work out how much more (or less) expensive than the procost
+* one call will be, from the vertex counts of the two geometry
+* arguments. Returns false when neither argument is known, so
+* the caller can leave the procost alone.
+*/
+static bool
+supportfn_cost_scale(PlannerInfo *root, Node *node, double *scale)
+{
+	List *args = supportfn_node_args(node);
+	double npoints = 0.0;
+	int nknown = 0;
+	int i;
+
+	if ( list_length(args) < 2 )
+		return false;
+
+	/* All the supported functions take their geometries first */
+	for ( i = 0; i < 2; i++ )
+	{
+		VERTEX_STATS *vertex_stats = gserialized_vertex_stats(root, (Node *)list_nth(args, i));
+		if ( vertex_stats )
+		{
+			npoints += vertex_stats->npoints_avg;
+			nknown++;
+			pfree(vertex_stats);
+		}
+		else
+		{
+			npoints += SUPPORTFN_REFERENCE_NPOINTS / 2;
+		}
+	}
+
+	if ( ! nknown )
+		return false;
+
+	*scale = Max(npoints / SUPPORTFN_REFERENCE_NPOINTS, SUPPORTFN_MIN_COST_SCALE);
+	POSTGIS_DEBUGF(3, "postgis_supportfn: npoints %g, cost scale %g", npoints, *scale);
+	return true;
+}
+
+/**
+* Find the function in the list of index-assisted predicates.
+* Returns NULL for the functions that only get costed, like the
+* underscored _ST_* variants, which must never use an index, and
+* ST_Disjoint and ST_Distance, which no box strategy can answer.
+*/
+static const INDEXABLE_FUNCTION *
+supportfn_indexable_function(Oid funcid)
+{
+	const INDEXABLE_FUNCTION *idxfn;
+	char *fn_name = get_func_name(funcid);
+
+	if ( ! fn_name )
+		return NULL;
+
+	for ( idxfn = IndexableFunctions; idxfn->fn_name; idxfn++ )
+	{
+		if ( strcmp(idxfn->fn_name, fn_name) == 0 )
+			break;
+	}
+	pfree(fn_name);
+
+	return idxfn->fn_name ? idxfn : NULL;
+}
+
+bool
+postgis_supportfn_implies_overlaps(Oid funcid)
+{
+	const INDEXABLE_FUNCTION *idxfn;
+	Oid supportid = get_func_support(funcid);
+	char *supportname;
+	bool ours;
+
+	/* Only our own predicates, not some other st_intersects */
+	if ( ! OidIsValid(supportid) )
+		return false;
+	supportname = get_func_name(supportid);
+	ours = supportname && strcmp(supportname, "postgis_supportfn") == 0;
+	if ( supportname )
+		pfree(supportname);
+	if ( ! ours )
+		return false;
+
+	idxfn = supportfn_indexable_function(funcid);
+	return idxfn && ! idxfn->expand_arg;
+}
+
+/**
+* Access method of an operator family. The GiST, SP-GiST and BRIN
+* opclasses of geometry all know our box operators, a btree or
+* hash opclass is no use for a spatial predicate.
+*/
+static Oid
+supportfn_opfamily_am(Oid opfamilyoid)
+{
+	Oid opfamilyam = InvalidOid;
+	HeapTuple tuple = SearchSysCache1(OPFAMILYOID, ObjectIdGetDatum(opfamilyoid));
+
+	if ( HeapTupleIsValid(tuple) )
+	{
+		opfamilyam = ((Form_pg_opfamily) GETSTRUCT(tuple))->opfmethod;
+		ReleaseSysCache(tuple);
+	}
+	return opfamilyam;
+}
+
+/**
+* The 2D box operator of an index strategy. The ND opfamilies put
+* their own operators (&&&, &/&, ...) under the same strategy
+* numbers, and those compare Z and M as well.
+*/
+static const char *
+supportfn_strategy_opname(StrategyNumber strategy)
+{
+	switch ( strategy )
+	{
+		case RTOverlapStrategyNumber:
+			return "&&";
+		case RTContainsStrategyNumber:
+			return "~";
+		case RTContainedByStrategyNumber:
+			return "@";
+		case RTSameStrategyNumber:
+			return "~=";
+		default:
+			return NULL;
+	}
+}
+
+/**
+* The ST_Expand(geometry, float8) that lives next to the predicate
+* being planned, so the index condition of ST_DWithin refers to our
+* own function and not to whatever is first in the search_path.
+*/
+static Oid
+supportfn_expand_oid(Oid geomtype, Oid callingfunc)
+{
+	Oid expand_args[2] = {geomtype, FLOAT8OID};
+	char *nspname = get_namespace_name(get_func_namespace(callingfunc));
+	List *expand_name = list_make2(makeString(nspname), makeString("st_expand"));
+	Oid expand_oid = LookupFuncName(expand_name, 2, expand_args, true);
+
+	if ( ! OidIsValid(expand_oid) )
+	{
+		expand_name = list_make1(makeString("st_expand"));
+		expand_oid = LookupFuncName(expand_name, 2, expand_args, true);
+	}
+	return expand_oid;
+}
+
+/**
+* Build the index condition for a predicate call: the box operator
+* of the index opfamily that matches the predicate, applied to the
+* indexed argument and the other one, expanded by the distance for
+* ST_DWithin. Returns NULL when no condition can be built.
+*/
+static List *
+supportfn_index_condition(SupportRequestIndexCondition *req, const INDEXABLE_FUNCTION *idxfn)
+{
+	FuncExpr *clause = (FuncExpr *) req->node;
+	Node *leftarg, *rightarg;
+	Oid leftdatatype, rightdatatype;
+	Oid oproid;
+	Oid opfamilyam = supportfn_opfamily_am(req->opfamily);
+	const char *opname = supportfn_strategy_opname(idxfn->strategy);
+	char *oprname;
+	bool is_2d;
+	Expr *expr;
+
+	if ( opfamilyam != GIST_AM_OID &&
+	     opfamilyam != SPGIST_AM_OID &&
+	     opfamilyam != BRIN_AM_OID )
+		return NIL;
+
+	/* Only the two geometry arguments can be matched to the index */
+	if ( req->indexarg > 1 || list_length(clause->args) < Max(2, idxfn->expand_arg) )
+		return NIL;
+
+	/*
+	* Put the indexed argument on the left. The commuted operator
+	* takes care of the asymmetric predicates: ST_Contains(g, col)
+	* becomes col @ g.
+	*/
+	if ( req->indexarg == 0 )
+	{
+		leftarg = linitial(clause->args);
+		rightarg = lsecond(clause->args);
+	}
+	else
+	{
+		leftarg = lsecond(clause->args);
+		rightarg = linitial(clause->args);
+	}
+	leftdatatype = exprType(leftarg);
+	rightdatatype = exprType(rightarg);
+
+	/*
+	* The && of a 2D opfamily, or nothing: the predicates are 2D,
+	* so the &&& of an ND opfamily would drop rows the predicate
+	* is true for, whose Z or M ranges don't overlap.
+	*/
+	oproid = get_opfamily_member(req->opfamily, leftdatatype, rightdatatype, idxfn->strategy);
+	if ( ! OidIsValid(oproid) || ! opname )
+		return NIL;
+	oprname = get_opname(oproid);
+	is_2d = oprname && strcmp(oprname, opname) == 0;
+	if ( oprname )
+		pfree(oprname);
+	if ( ! is_2d )
+		return NIL;
+	if ( req->indexarg == 1 )
+	{
+		oproid = get_commutator(oproid);
+		if ( ! OidIsValid(oproid) )
+			return NIL;
+	}
+
+	/* ST_DWithin(col, g, d) yields col && ST_Expand(g, d) */
+	if ( idxfn->expand_arg )
+	{
+		Node *radiusarg = (Node *) list_nth(clause->args, idxfn->expand_arg - 1);
+		Oid expand_oid = supportfn_expand_oid(rightdatatype, clause->funcid);
+
+		if ( ! OidIsValid(expand_oid) )
+			return NIL;
+
+		rightarg = (Node *) makeFuncExpr(expand_oid, rightdatatype,
+		                                 list_make2(rightarg, radiusarg),
+		                                 InvalidOid, InvalidOid, COERCE_EXPLICIT_CALL);
+	}
+
+	/* The other side has to be fixed for the duration of the scan */
+#if POSTGIS_PGSQL_VERSION >= 140
+	if ( ! is_pseudo_constant_for_index(req->root, rightarg, req->index) )
+		return NIL;
+#else
+	if ( ! is_pseudo_constant_for_index(rightarg, req->index) )
+		return NIL;
+#endif
+
+	expr = make_opclause(oproid, BOOLOID, false,
+	                     (Expr *) leftarg, (Expr *) rightarg,
+	                     InvalidOid, InvalidOid);
+
+	return list_make1(expr);
+}
+
+/**
+* Planner support function for the expensive geometry predicates
+* and measures.
+*
+* The planner calls it with a SupportRequestCost to get a per-call
+* cost that reflects the size of the features at hand, instead of
+* the flat procost: an ST_Intersects against a table of coastlines
+* costs orders of magnitude more than against a table of parcels,
+* and the planner should know that when it orders quals or decides
+* whether a parallel plan is worth it.
+*
+* For the ST_* predicates it also answers SupportRequestIndexCondition,
+* handing back the box operator condition (col && g, col ~ g, ...)
+* a spatial index can answer, and SupportRequestSelectivity, from
+* the && selectivity estimators. That used to be done by inlining
+* SQL wrappers, which does not happen through views, with
+* non-inlinable arguments, and which evaluates expressions twice.
+*/
+PG_FUNCTION_INFO_V1(postgis_supportfn);
+Datum postgis_supportfn(PG_FUNCTION_ARGS)
+{
+	Node *rawreq = (Node *) PG_GETARG_POINTER(0);
+	Node *ret = NULL;
+
+	if ( IsA(rawreq, SupportRequestCost) )
+	{
+		SupportRequestCost *req = (SupportRequestCost *) rawreq;
+		double scale;
+
+		if ( supportfn_cost_scale(req->root, req->node, &scale) )
+		{
+			req->startup = 0;
+			req->per_tuple = get_func_cost(req->funcid) * cpu_operator_cost * scale;
+			ret = (Node *) req;
+		}
+	}
+	else if ( IsA(rawreq, SupportRequestSelectivity) )
+	{
+		SupportRequestSelectivity *req = (SupportRequestSelectivity *) rawreq;
+
+		if ( supportfn_indexable_function(req->funcid) )
+		{
+			/* The predicates are (at most) as selective as the && they imply */
+			if ( req->is_join )
+				req->selectivity = gserialized_joinsel_internal(req->root, req->args, req->jointype, 2);
+			else
+				req->selectivity = gserialized_sel_internal(req->root, req->args, req->varRelid, 2);
+
+			POSTGIS_DEBUGF(2, "postgis_supportfn: selectivity %g", req->selectivity);
+			ret = (Node *) req;
+		}
+	}
+	else if ( IsA(rawreq, SupportRequestIndexCondition) )
+	{
+		SupportRequestIndexCondition *req = (SupportRequestIndexCondition *) rawreq;
+
+		if ( is_funcclause(req->node) )
+		{
+			const INDEXABLE_FUNCTION *idxfn = supportfn_indexable_function(((FuncExpr *) req->node)->funcid);
+			List *conds = idxfn ? supportfn_index_condition(req, idxfn) : NIL;
+
+			if ( conds )
+			{
+				/* The index only finds candidates, the predicate still has to run */
+				req->lossy = true;
+				ret = (Node *) conds;
+			}
+		}
+	}
+
+	PG_RETURN_POINTER(ret);
+}
+
+#endif /* POSTGIS_PGSQL_VERSION >= 120 */
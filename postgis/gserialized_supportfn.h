@@ -0,0 +1,43 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************
+ *
+ * ^copyright^
+ *
+ **********************************************************************/
+
+
+#ifndef GSERIALIZED_SUPPORTFN_H_
+#define GSERIALIZED_SUPPORTFN_H_ 1
+
+#include "postgres.h"
+
+#if POSTGIS_PGSQL_VERSION >= 120
+
+/**
+* Whether funcid is one of the predicates of postgis_supportfn that
+* can only be true for geometries whose 2D boxes overlap, so that
+* candidates for it can be found with &&. ST_DWithin, which needs
+* an expanded box, is not one of them.
+*/
+bool postgis_supportfn_implies_overlaps(Oid funcid);
+
+#endif
+
+#endif /* GSERIALIZED_SUPPORTFN_H_ */
@@ -27,6 +27,8 @@
 #include "fmgr.h"
 #include "funcapi.h"
 #include "access/tupmacs.h"
+#include "miscadmin.h"
+#include "nodes/pg_list.h"
 #include "utils/datum.h"
 #include "utils/array.h"
 #include "utils/lsyscache.h"
@@ -44,6 +46,11 @@ Datum PGISDirectFunctionCall2(PGFunction func, Datum arg1, Datum arg2);
 Datum pgis_geometry_accum_transfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_accum_finalfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_union_finalfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_union_parallel_transfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_union_parallel_combinefn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_union_parallel_serialfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_union_parallel_deserialfn(PG_FUNCTION_ARGS);
+Datum pgis_geometry_union_parallel_finalfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_collect_finalfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_polygonize_finalfn(PG_FUNCTION_ARGS);
 Datum pgis_geometry_makeline_finalfn(PG_FUNCTION_ARGS);
@@ -247,6 +254,304 @@ pgis_geometry_union_finalfn(PG_FUNCTION_ARGS)
 	PG_RETURN_DATUM(result);
 }
 
+/**
+** The ST_Union aggregate keeps its own state, so that parallel workers
+** can each union their share and so that long inputs do not have to be
+** held in memory all at once. Inputs are kept as a list of detoasted
+** copies; once they take up more than work_mem, and more than twice
+** what the last batch union left behind, the list is cascade-unioned
+** down to a single geometry. The doubling keeps a large partial result
+** from being re-unioned for every few new inputs.
+*/
+
+typedef struct
+{
+	List *geoms;        /* GSERIALIZED inputs, or partial unions of them */
+	Size size;          /* bytes held in geoms */
+	Size flushed_size;  /* bytes left after the last batch union */
+	Oid elemtype;       /* geometry type oid, to build arrays with */
+}
+pgis_union_state;
+
+/**
+** Union the geometries of the state with pgis_union_geometry_array,
+** returning a copy in mctx. Returns NULL if they were all NULL.
+*/
+static GSERIALIZED *
+pgis_union_state_union(const pgis_union_state *state, MemoryContext mctx)
+{
+	int ngeoms = list_length(state->geoms);
+	Datum *elems;
+	ArrayType *array;
+	ListCell *lc;
+	Datum result;
+	GSERIALIZED *gser = NULL;
+	int i = 0;
+
+	if ( ngeoms == 0 )
+		return NULL;
+
+	elems = palloc(sizeof(Datum) * ngeoms);
+	foreach(lc, state->geoms)
+		elems[i++] = PointerGetDatum(lfirst(lc));
+
+	array = construct_array(elems, ngeoms, state->elemtype, -1, false, 'd');
+	result = PGISDirectFunctionCall1(pgis_union_geometry_array, PointerGetDatum(array));
+	if ( result )
+	{
+		Size size = VARSIZE(DatumGetPointer(result));
+		gser = MemoryContextAlloc(mctx, size);
+		memcpy(gser, DatumGetPointer(result), size);
+	}
+
+	pfree(array);
+	pfree(elems);
+	return gser;
+}
+
+/**
+** Replace the geometries of the state by their union, kept in aggcontext
+*/
+static void
+pgis_union_state_flush(pgis_union_state *state, MemoryContext aggcontext)
+{
+	MemoryContext old;
+	GSERIALIZED *gser;
+
+	if ( list_length(state->geoms) < 2 )
+		return;
+
+	gser = pgis_union_state_union(state, aggcontext);
+
+	list_free_deep(state->geoms);
+	state->geoms = NIL;
+	state->size = 0;
+	if ( gser )
+	{
+		old = MemoryContextSwitchTo(aggcontext);
+		state->geoms = list_make1(gser);
+		MemoryContextSwitchTo(old);
+		state->size = VARSIZE(gser);
+	}
+	state->flushed_size = state->size;
+}
+
+/**
+** Add a GSERIALIZED already allocated in aggcontext to the state,
+** and union the batch if it got too large
+*/
+static void
+pgis_union_state_add(pgis_union_state *state, GSERIALIZED *gser, MemoryContext aggcontext)
+{
+	MemoryContext old = MemoryContextSwitchTo(aggcontext);
+	state->geoms = lappend(state->geoms, gser);
+	MemoryContextSwitchTo(old);
+	state->size += VARSIZE(gser);
+
+	if ( state->size > Max((Size) work_mem * 1024L, 2 * state->flushed_size) )
+		pgis_union_state_flush(state, aggcontext);
+}
+
+static pgis_union_state *
+pgis_union_state_create(Oid elemtype, MemoryContext aggcontext)
+{
+	pgis_union_state *state = MemoryContextAllocZero(aggcontext, sizeof(pgis_union_state));
+	state->geoms = NIL;
+	state->elemtype = elemtype;
+	return state;
+}
+
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_transfn);
+Datum
+pgis_geometry_union_parallel_transfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext, old;
+	pgis_union_state *state;
+	GSERIALIZED *gser;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	if ( PG_ARGISNULL(0) )
+	{
+		Oid arg1_typeid = get_fn_expr_argtype(fcinfo->flinfo, 1);
+		if (arg1_typeid == InvalidOid)
+			ereport(ERROR,
+			        (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			         errmsg("could not determine input data type")));
+		state = pgis_union_state_create(arg1_typeid, aggcontext);
+	}
+	else
+	{
+		state = (pgis_union_state*) PG_GETARG_POINTER(0);
+	}
+
+	/* NULL inputs are left out of the union */
+	if ( ! PG_ARGISNULL(1) )
+	{
+		old = MemoryContextSwitchTo(aggcontext);
+		gser = PG_GETARG_GSERIALIZED_P_COPY(1);
+		MemoryContextSwitchTo(old);
+		pgis_union_state_add(state, gser, aggcontext);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_combinefn);
+Datum
+pgis_geometry_union_parallel_combinefn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext;
+	pgis_union_state *state1 = NULL, *state2 = NULL;
+	ListCell *lc;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	if ( ! PG_ARGISNULL(0) )
+		state1 = (pgis_union_state*) PG_GETARG_POINTER(0);
+	if ( ! PG_ARGISNULL(1) )
+		state2 = (pgis_union_state*) PG_GETARG_POINTER(1);
+
+	if ( ! state2 )
+	{
+		if ( ! state1 )
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(state1);
+	}
+
+	if ( ! state1 )
+		state1 = pgis_union_state_create(state2->elemtype, aggcontext);
+
+	foreach(lc, state2->geoms)
+	{
+		GSERIALIZED *gser = lfirst(lc);
+		GSERIALIZED *copy = MemoryContextAlloc(aggcontext, VARSIZE(gser));
+		memcpy(copy, gser, VARSIZE(gser));
+		pgis_union_state_add(state1, copy, aggcontext);
+	}
+
+	PG_RETURN_POINTER(state1);
+}
+
+/**
+** The state is serialized as the element type oid and the number of
+** geometries, then the length and bytes of each geometry
+*/
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_serialfn);
+Datum
+pgis_geometry_union_parallel_serialfn(PG_FUNCTION_ARGS)
+{
+	pgis_union_state *state;
+	uint32 ngeoms;
+	Size size;
+	bytea *result;
+	char *ptr;
+	ListCell *lc;
+
+	if ( ! AggCheckCallContext(fcinfo, NULL) )
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	if ( PG_ARGISNULL(0) )
+	{
+		bytea *emptybuf = palloc(VARHDRSZ);
+		SET_VARSIZE(emptybuf, VARHDRSZ);
+		PG_RETURN_BYTEA_P(emptybuf);
+	}
+
+	state = (pgis_union_state*) PG_GETARG_POINTER(0);
+	ngeoms = list_length(state->geoms);
+	size = VARHDRSZ + sizeof(Oid) + sizeof(uint32) + ngeoms * sizeof(uint32) + state->size;
+
+	result = palloc(size);
+	SET_VARSIZE(result, size);
+	ptr = VARDATA(result);
+	memcpy(ptr, &(state->elemtype), sizeof(Oid));
+	ptr += sizeof(Oid);
+	memcpy(ptr, &ngeoms, sizeof(uint32));
+	ptr += sizeof(uint32);
+
+	foreach(lc, state->geoms)
+	{
+		GSERIALIZED *gser = lfirst(lc);
+		uint32 gsize = VARSIZE(gser);
+		memcpy(ptr, &gsize, sizeof(uint32));
+		ptr += sizeof(uint32);
+		memcpy(ptr, gser, gsize);
+		ptr += gsize;
+	}
+
+	PG_RETURN_BYTEA_P(result);
+}
+
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_deserialfn);
+Datum
+pgis_geometry_union_parallel_deserialfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext aggcontext, old;
+	pgis_union_state *state;
+	bytea *buf;
+	const char *ptr;
+	Oid elemtype;
+	uint32 ngeoms, i;
+
+	if ( ! AggCheckCallContext(fcinfo, &aggcontext) )
+		elog(ERROR, "%s called in non-aggregate context", __func__);
+
+	buf = PG_GETARG_BYTEA_P(0);
+
+	/* An empty buffer is a state that never saw a row */
+	if ( VARSIZE(buf) == VARHDRSZ )
+		PG_RETURN_NULL();
+
+	ptr = VARDATA(buf);
+	memcpy(&elemtype, ptr, sizeof(Oid));
+	ptr += sizeof(Oid);
+	memcpy(&ngeoms, ptr, sizeof(uint32));
+	ptr += sizeof(uint32);
+
+	state = pgis_union_state_create(elemtype, aggcontext);
+	old = MemoryContextSwitchTo(aggcontext);
+	for ( i = 0; i < ngeoms; i++ )
+	{
+		uint32 gsize;
+		GSERIALIZED *gser;
+		memcpy(&gsize, ptr, sizeof(uint32));
+		ptr += sizeof(uint32);
+		gser = palloc(gsize);
+		memcpy(gser, ptr, gsize);
+		ptr += gsize;
+		state->geoms = lappend(state->geoms, gser);
+		state->size += gsize;
+	}
+	MemoryContextSwitchTo(old);
+
+	PG_RETURN_POINTER(state);
+}
+
+/**
+** The final function unions whatever is left in the state, without
+** changing it, as window aggregates may call it more than once
+*/
+PG_FUNCTION_INFO_V1(pgis_geometry_union_parallel_finalfn);
+Datum
+pgis_geometry_union_parallel_finalfn(PG_FUNCTION_ARGS)
+{
+	pgis_union_state *state;
+	GSERIALIZED *result;
+
+	if ( PG_ARGISNULL(0) )
+		PG_RETURN_NULL();   /* returns null iff no input values */
+
+	state = (pgis_union_state*) PG_GETARG_POINTER(0);
+	result = pgis_union_state_union(state, CurrentMemoryContext);
+	if ( ! result )
+		PG_RETURN_NULL();
+
+	PG_RETURN_POINTER(result);
+}
+
 /**
 * The "collect" final function passes the geometry[] to a geometrycollection
 * conversion before returning the result.
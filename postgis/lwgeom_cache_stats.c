@@ -0,0 +1,110 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************
+ *
+ * ^copyright^
+ *
+ **********************************************************************/
+
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "fmgr.h"
+#include "access/htup_details.h"
+#include "utils/builtins.h"
+
+#include "../postgis_config.h"
+#include "lwgeom_pg.h"
+#include "lwgeom_cache.h"
+
+
+/* Prototypes */
+Datum postgis_cache_stats(PG_FUNCTION_ARGS);
+Datum postgis_cache_stats_reset(PG_FUNCTION_ARGS);
+
+
+/**
+* One row per cache type, with the counters gathered by this
+* backend: (cache, builds, hits, misses, evictions, build_time,
+* bytes). Unused entry numbers are skipped.
+*/
+PG_FUNCTION_INFO_V1(postgis_cache_stats);
+Datum postgis_cache_stats(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	int *entry_number;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc tupdesc;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if ( get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE )
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		entry_number = palloc0(sizeof(int));
+		funcctx->user_fctx = entry_number;
+
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	entry_number = funcctx->user_fctx;
+
+	/* Skip over the unused entry numbers */
+	while ( *entry_number < NUM_CACHE_STATS && ! GetCacheName(*entry_number) )
+		(*entry_number)++;
+
+	if ( *entry_number < NUM_CACHE_STATS )
+	{
+		CacheStats *stats = GetCacheStats(*entry_number);
+		HeapTuple tuple;
+		Datum values[7];
+		bool nulls[7];
+
+		memset(nulls, 0, sizeof(nulls));
+		values[0] = CStringGetTextDatum(GetCacheName(*entry_number));
+		values[1] = Int64GetDatum(stats->builds);
+		values[2] = Int64GetDatum(stats->hits);
+		values[3] = Int64GetDatum(stats->misses);
+		values[4] = Int64GetDatum(stats->evictions);
+		values[5] = Float8GetDatum(stats->build_time);
+		values[6] = Int64GetDatum(stats->bytes);
+
+		(*entry_number)++;
+		tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
+
+/**
+* Zero all the cache counters of this backend.
+*/
+PG_FUNCTION_INFO_V1(postgis_cache_stats_reset);
+Datum postgis_cache_stats_reset(PG_FUNCTION_ARGS)
+{
+	ResetCacheStats();
+	PG_RETURN_VOID();
+}
@@ -34,6 +34,7 @@
 #include "../postgis_config.h"
 #include "liblwgeom.h"
 #include "lwgeom_pg.h"
+#include "lwgeom_rectree.h"
 
 #include <math.h>
 #include <float.h>
@@ -708,7 +709,9 @@ Datum LWGEOM_mindistance2d(PG_FUNCTION_ARGS)
 
 	error_if_srid_mismatch(lwgeom1->srid, lwgeom2->srid);
 
-	mindist = lwgeom_mindistance2d(lwgeom1, lwgeom2);
+	/* Against a repeated argument, use its cached tree */
+	if (!RectTreeCachedDistance(fcinfo, geom1, geom2, lwgeom1, lwgeom2, LW_FALSE, 0.0, &mindist))
+		mindist = lwgeom_mindistance2d(lwgeom1, lwgeom2);
 
 	lwgeom_free(lwgeom1);
 	lwgeom_free(lwgeom2);
@@ -746,7 +749,10 @@ Datum LWGEOM_dwithin(PG_FUNCTION_ARGS)
 
 	error_if_srid_mismatch(lwgeom1->srid, lwgeom2->srid);
 
-	mindist = lwgeom_mindistance2d_tolerance(lwgeom1,lwgeom2,tolerance);
+	/* Against a repeated argument, use its cached tree, */
+	/* stopping as soon as something is within tolerance */
+	if (!RectTreeCachedDistance(fcinfo, geom1, geom2, lwgeom1, lwgeom2, LW_FALSE, tolerance, &mindist))
+		mindist = lwgeom_mindistance2d_tolerance(lwgeom1,lwgeom2,tolerance);
 
 	PG_FREE_IF_COPY(geom1, 0);
 	PG_FREE_IF_COPY(geom2, 1);
@@ -778,7 +784,10 @@ Datum LWGEOM_dfullywithin(PG_FUNCTION_ARGS)
 
 	error_if_srid_mismatch(lwgeom1->srid, lwgeom2->srid);
 
-	maxdist = lwgeom_maxdistance2d_tolerance(lwgeom1, lwgeom2, tolerance);
+	/* Against a repeated argument, use its cached tree, */
+	/* stopping as soon as something is beyond tolerance */
+	if (!RectTreeCachedDistance(fcinfo, geom1, geom2, lwgeom1, lwgeom2, LW_TRUE, tolerance, &maxdist))
+		maxdist = lwgeom_maxdistance2d_tolerance(lwgeom1, lwgeom2, tolerance);
 
 	PG_FREE_IF_COPY(geom1, 0);
 	PG_FREE_IF_COPY(geom2, 1);
@@ -829,10 +838,16 @@ Datum LWGEOM_closestpoint3d(PG_FUNCTION_ARGS)
 	LWGEOM *point;
 	LWGEOM *lwgeom1 = lwgeom_from_gserialized(geom1);
 	LWGEOM *lwgeom2 = lwgeom_from_gserialized(geom2);
+	POINT3DZ p1, p2;
+	double mindist;
 
 	error_if_srid_mismatch(lwgeom1->srid, lwgeom2->srid);
 
-	point = lwgeom_closest_point_3d(lwgeom1, lwgeom2);
+	/* Against a repeated argument, use its cached tree */
+	if (RectTree3DCachedDistance(fcinfo, geom1, geom2, lwgeom1, lwgeom2, 0.0, &mindist, &p1, &p2))
+		point = (LWGEOM *)lwpoint_make3dz(lwgeom1->srid, p1.x, p1.y, p1.z);
+	else
+		point = lwgeom_closest_point_3d(lwgeom1, lwgeom2);
 	// point = lw_dist3d_distancepoint(lwgeom1, lwgeom2, lwgeom1->srid, DIST_MIN);
 
 	if (lwgeom_is_empty(point))
@@ -861,10 +876,23 @@ Datum LWGEOM_shortestline3d(PG_FUNCTION_ARGS)
 	LWGEOM *theline;
 	LWGEOM *lwgeom1 = lwgeom_from_gserialized(geom1);
 	LWGEOM *lwgeom2 = lwgeom_from_gserialized(geom2);
+	POINT3DZ p1, p2;
+	double mindist;
 
 	error_if_srid_mismatch(lwgeom1->srid, lwgeom2->srid);
 
-	theline = lwgeom_closest_line_3d(lwgeom1, lwgeom2);
+	/* Against a repeated argument, use its cached tree */
+	if (RectTree3DCachedDistance(fcinfo, geom1, geom2, lwgeom1, lwgeom2, 0.0, &mindist, &p1, &p2))
+	{
+		LWPOINT *lwpoints[2];
+		lwpoints[0] = lwpoint_make3dz(lwgeom1->srid, p1.x, p1.y, p1.z);
+		lwpoints[1] = lwpoint_make3dz(lwgeom1->srid, p2.x, p2.y, p2.z);
+		theline = (LWGEOM *)lwline_from_ptarray(lwgeom1->srid, 2, lwpoints);
+		lwpoint_free(lwpoints[0]);
+		lwpoint_free(lwpoints[1]);
+	}
+	else
+		theline = lwgeom_closest_line_3d(lwgeom1, lwgeom2);
 	// theline = lw_dist3d_distanceline(lwgeom1, lwgeom2, lwgeom1->srid, DIST_MIN);
 
 	if (lwgeom_is_empty(theline))
@@ -926,7 +954,9 @@ Datum LWGEOM_mindistance3d(PG_FUNCTION_ARGS)
 
 	error_if_srid_mismatch(lwgeom1->srid, lwgeom2->srid);
 
-	mindist = lwgeom_mindistance3d(lwgeom1, lwgeom2);
+	/* Against a repeated argument, use its cached tree */
+	if (!RectTree3DCachedDistance(fcinfo, geom1, geom2, lwgeom1, lwgeom2, 0.0, &mindist, NULL, NULL))
+		mindist = lwgeom_mindistance3d(lwgeom1, lwgeom2);
 
 	PG_FREE_IF_COPY(geom1, 0);
 	PG_FREE_IF_COPY(geom2, 1);
@@ -961,7 +991,10 @@ Datum LWGEOM_dwithin3d(PG_FUNCTION_ARGS)
 
 	error_if_srid_mismatch(lwgeom1->srid, lwgeom2->srid);
 
-	mindist = lwgeom_mindistance3d_tolerance(lwgeom1,lwgeom2,tolerance);
+	/* Against a repeated argument, use its cached tree, */
+	/* stopping as soon as something is within tolerance */
+	if (!RectTree3DCachedDistance(fcinfo, geom1, geom2, lwgeom1, lwgeom2, tolerance, &mindist, NULL, NULL))
+		mindist = lwgeom_mindistance3d_tolerance(lwgeom1,lwgeom2,tolerance);
 
 	PG_FREE_IF_COPY(geom1, 0);
 	PG_FREE_IF_COPY(geom2, 1);
@@ -36,6 +36,8 @@
 #include "utils/numeric.h"
 
 #include "access/htup_details.h"
+#include "catalog/pg_type.h"
+#include "miscadmin.h"
 
 
 /* PostGIS */
@@ -44,6 +46,7 @@
 #include "liblwgeom.h"
 #include "lwgeom_rtree.h"
 #include "lwgeom_geos_prepared.h"
+#include "lwgeom_geos_cache.h"
 
 #include "float.h" /* for DBL_DIG */
 
@@ -63,6 +66,9 @@
 		PG_RETURN_NULL(); \
 	}
 
+/* Polygon unions of at least this many inputs go cluster by cluster */
+#define UNION_CLUSTERED_MIN_GEOMS 32
+
 /*
 ** Prototypes for SQL-bound functions
 */
@@ -74,6 +80,7 @@ Datum geos_intersects(PG_FUNCTION_ARGS);
 Datum crosses(PG_FUNCTION_ARGS);
 Datum contains(PG_FUNCTION_ARGS);
 Datum containsproperly(PG_FUNCTION_ARGS);
+Datum within(PG_FUNCTION_ARGS);
 Datum covers(PG_FUNCTION_ARGS);
 Datum overlaps(PG_FUNCTION_ARGS);
 Datum isvalid(PG_FUNCTION_ARGS);
@@ -105,6 +112,8 @@ Datum ST_UnaryUnion(PG_FUNCTION_ARGS);
 Datum ST_Equals(PG_FUNCTION_ARGS);
 Datum ST_BuildArea(PG_FUNCTION_ARGS);
 Datum ST_DelaunayTriangles(PG_FUNCTION_ARGS);
+Datum ST_IntersectsMany(PG_FUNCTION_ARGS);
+Datum ST_ContainsMany(PG_FUNCTION_ARGS);
 
 Datum pgis_union_geometry_array(PG_FUNCTION_ARGS);
 
@@ -145,7 +154,18 @@ pip_short_circuit(RTREE_POLY_CACHE* poly_cache, LWPOINT* point, GSERIALIZED* gpo
 
 	if ( poly_cache && poly_cache->ringIndices )
 	{
-        result = point_in_multipolygon_rtree(poly_cache->ringIndices, poly_cache->polyCount, poly_cache->ringCounts, point);
+		result = RTREE_GRID_UNKNOWN;
+
+		/* Large polygons mostly answer from their grid */
+		if ( poly_cache->grid )
+		{
+			POINT2D pt;
+			getPoint2d_p(point->point, 0, &pt);
+			result = RTreeGridPointInPolygon(poly_cache->grid, &pt);
+		}
+
+		if ( result == RTREE_GRID_UNKNOWN )
+			result = point_in_multipolygon_rtree(poly_cache->ringIndices, poly_cache->polyCount, poly_cache->ringCounts, point);
 	}
 	else
 	{
@@ -337,7 +357,8 @@ Datum ST_FrechetDistance(PG_FUNCTION_ARGS)
  * 			aggregate. Will have as input an array of Geometries.
  * 			Will iteratively call GEOSUnion on the GEOS-converted
  * 			versions of them and return PGIS-converted version back.
- * 			Changing combination order *might* speed up performance.
+ * 			Large sets of polygons are unioned cluster by cluster,
+ * 			in spatially coherent blocks, see union_clustered_polygons.
  */
 PG_FUNCTION_INFO_V1(pgis_union_geometry_array);
 Datum pgis_union_geometry_array(PG_FUNCTION_ARGS)
@@ -348,7 +369,7 @@ Datum pgis_union_geometry_array(PG_FUNCTION_ARGS)
 	Datum value;
 	bool isnull;
 
-	int is3d = LW_FALSE, gotsrid = LW_FALSE;
+	int is3d = LW_FALSE, gotsrid = LW_FALSE, allpolys = LW_TRUE;
 	int nelems = 0, geoms_size = 0, curgeom = 0, count = 0;
 
 	GSERIALIZED *gser_out = NULL;
@@ -356,6 +377,7 @@ Datum pgis_union_geometry_array(PG_FUNCTION_ARGS)
 	GEOSGeometry *g = NULL;
 	GEOSGeometry *g_union = NULL;
 	GEOSGeometry **geoms = NULL;
+	GBOX *boxes = NULL;
 
 	int srid = SRID_UNKNOWN;
 
@@ -407,6 +429,7 @@ Datum pgis_union_geometry_array(PG_FUNCTION_ARGS)
 	*/
 	geoms_size = nelems;
 	geoms = palloc(sizeof(GEOSGeometry*) * geoms_size);
+	boxes = palloc(sizeof(GBOX) * geoms_size);
 
 	/*
 	** We need to convert the array of GSERIALIZED into a GEOS collection.
@@ -465,8 +488,12 @@ Datum pgis_union_geometry_array(PG_FUNCTION_ARGS)
 			{
 				geoms_size *= 2;
 				geoms = repalloc( geoms, sizeof(GEOSGeometry*) * geoms_size );
+				boxes = repalloc( boxes, sizeof(GBOX) * geoms_size );
 			}
 
+			if ( ! is_poly(gser_in) || gserialized_get_gbox_p(gser_in, &boxes[curgeom]) == LW_FAILURE )
+				allpolys = LW_FALSE;
+
 			geoms[curgeom] = g;
 			curgeom++;
 		}
@@ -478,7 +505,16 @@ Datum pgis_union_geometry_array(PG_FUNCTION_ARGS)
 	** Take our GEOS geometries and turn them into a GEOS collection,
 	** then pass that into cascaded union.
 	*/
-	if (curgeom > 0)
+	if (curgeom >= UNION_CLUSTERED_MIN_GEOMS && allpolys)
+	{
+		g_union = union_clustered_polygons(geoms, boxes, curgeom);
+		if (!g_union) HANDLE_GEOS_ERROR("GEOSUnaryUnion");
+
+		GEOSSetSRID(g_union, srid);
+		gser_out = GEOS2POSTGIS(g_union, is3d);
+		GEOSGeom_destroy(g_union);
+	}
+	else if (curgeom > 0)
 	{
 		g = GEOSGeom_createCollection(GEOS_GEOMETRYCOLLECTION, geoms, curgeom);
 		if (!g) HANDLE_GEOS_ERROR("Could not create GEOS COLLECTION from geometry array");
@@ -825,6 +861,7 @@ Datum buffer(PG_FUNCTION_ARGS)
 	char *param;
 	char *params = NULL;
 	LWGEOM *lwg;
+	GEOSGeomCache *geos_cache;
 
 	geom1 = PG_GETARG_GSERIALIZED_P(0);
 	size = PG_GETARG_FLOAT8(1);
@@ -842,7 +879,12 @@ Datum buffer(PG_FUNCTION_ARGS)
 
 	initGEOS(lwpgnotice, lwgeom_geos_error);
 
-	g1 = POSTGIS2GEOS(geom1);
+	/* The same geometry buffered over and over (by several distances, say) */
+	geos_cache = GetGEOSGeomCache(fcinfo, geom1, NULL, LW_FALSE);
+	if ( geos_cache )
+		g1 = geos_cache->geom;
+	else
+		g1 = POSTGIS2GEOS(geom1);
 	if (!g1)
 		HANDLE_GEOS_ERROR("First argument geometry could not be converted to GEOS");
 
@@ -997,7 +1039,8 @@ Datum buffer(PG_FUNCTION_ARGS)
 		lwpgerror("Error setting buffer parameters.");
 	}
 
-	GEOSGeom_destroy(g1);
+	if ( ! geos_cache )
+		GEOSGeom_destroy(g1);
 
 	if (!g3) HANDLE_GEOS_ERROR("GEOSBuffer");
 
@@ -1186,6 +1229,65 @@ Datum ST_OffsetCurve(PG_FUNCTION_ARGS)
 }
 
 
+/*
+* Run a GEOS overlay of geom1 and geom2 if one of them repeats
+* across calls and has its GEOS geometry cached, converting only
+* the other one. Returns NULL when there is nothing cached, or
+* on any trouble, for the caller to go the usual liblwgeom way,
+* which has the rules for empties and reports the errors.
+*/
+static GSERIALIZED *
+cached_geos_overlay(FunctionCallInfo fcinfo, GSERIALIZED *geom1, GSERIALIZED *geom2,
+                    GEOSGeometry *(*overlay)(const GEOSGeometry *, const GEOSGeometry *))
+{
+	GEOSGeomCache *geos_cache;
+	const GSERIALIZED *other;
+	LWGEOM *lwother;
+	GEOSGeometry *g_other, *g3;
+	GSERIALIZED *result;
+	int32_t srid = gserialized_get_srid(geom1);
+
+	if ( gserialized_is_empty(geom1) || gserialized_is_empty(geom2) ||
+	     srid != gserialized_get_srid(geom2) )
+		return NULL;
+
+	initGEOS(lwpgnotice, lwgeom_geos_error);
+
+	/* Same autofix as lwgeom_intersection and lwgeom_difference, */
+	/* for the cached argument and for the other one */
+	geos_cache = GetGEOSGeomCache(fcinfo, geom1, geom2, LW_TRUE);
+	if ( ! geos_cache )
+		return NULL;
+
+	other = geos_cache->gcache.argnum == 1 ? geom2 : geom1;
+	lwother = lwgeom_from_gserialized(other);
+	g_other = LWGEOM2GEOS(lwother, LW_TRUE);
+	lwgeom_free(lwother);
+	if ( ! g_other )
+		return NULL;
+
+	if ( geos_cache->gcache.argnum == 1 )
+		g3 = overlay(geos_cache->geom, g_other);
+	else
+		g3 = overlay(g_other, geos_cache->geom);
+	GEOSGeom_destroy(g_other);
+
+	if ( ! g3 )
+	{
+		/* Don't start over if we were cancelled */
+		if ( strstr(lwgeom_geos_errmsg, "InterruptedException") )
+			ereport(ERROR,
+				(errcode(ERRCODE_QUERY_CANCELED), errmsg("canceling statement due to user request")));
+		return NULL;
+	}
+
+	GEOSSetSRID(g3, srid);
+	result = GEOS2POSTGIS(g3, gserialized_has_z(geom1) || gserialized_has_z(geom2));
+	GEOSGeom_destroy(g3);
+
+	return result;
+}
+
 PG_FUNCTION_INFO_V1(geos_intersection);
 Datum geos_intersection(PG_FUNCTION_ARGS)
 {
@@ -1197,6 +1299,15 @@ Datum geos_intersection(PG_FUNCTION_ARGS)
 	geom1 = PG_GETARG_GSERIALIZED_P(0);
 	geom2 = PG_GETARG_GSERIALIZED_P(1);
 
+	/* Clipping many geometries against the same one? */
+	result = cached_geos_overlay(fcinfo, geom1, geom2, GEOSIntersection);
+	if ( result )
+	{
+		PG_FREE_IF_COPY(geom1, 0);
+		PG_FREE_IF_COPY(geom2, 1);
+		PG_RETURN_POINTER(result);
+	}
+
 	lwgeom1 = lwgeom_from_gserialized(geom1) ;
 	lwgeom2 = lwgeom_from_gserialized(geom2) ;
 
@@ -1229,6 +1340,15 @@ Datum geos_difference(PG_FUNCTION_ARGS)
 	geom1 = PG_GETARG_GSERIALIZED_P(0);
 	geom2 = PG_GETARG_GSERIALIZED_P(1);
 
+	/* Cutting many geometries with the same one, or the reverse? */
+	result = cached_geos_overlay(fcinfo, geom1, geom2, GEOSDifference);
+	if ( result )
+	{
+		PG_FREE_IF_COPY(geom1, 0);
+		PG_FREE_IF_COPY(geom2, 1);
+		PG_RETURN_POINTER(result);
+	}
+
 	lwgeom1 = lwgeom_from_gserialized(geom1) ;
 	lwgeom2 = lwgeom_from_gserialized(geom2) ;
 
@@ -1952,10 +2072,15 @@ Datum covers(PG_FUNCTION_ARGS)
 
 /**
 * ST_Within(A, B) => ST_Contains(B, A) so we just delegate this calculation to the
-* Contains implementation.
+* Contains implementation, passing our own FmgrInfo along so the prepared
+* geometry cache keeps working.
+*/
 PG_FUNCTION_INFO_V1(within);
 Datum within(PG_FUNCTION_ARGS)
-*/
+{
+	PG_RETURN_DATUM(CallerFInfoFunctionCall2(contains, fcinfo->flinfo, InvalidOid,
+		PG_GETARG_DATUM(1), PG_GETARG_DATUM(0)));
+}
 
 /*
  * Described at:
@@ -2263,6 +2388,301 @@ Datum geos_intersects(PG_FUNCTION_ARGS)
 }
 
 
+/*
+** The batched predicates test their first argument against every
+** element of the second, an array, in a single call. The scalar
+** argument is deserialized, indexed for point-in-polygon tests and
+** prepared for GEOS once, each only when an element first needs it.
+*/
+#define BATCH_INTERSECTS 0
+#define BATCH_CONTAINS 1
+
+typedef struct
+{
+	GSERIALIZED *geom;
+	GBOX box;
+	int has_box;
+	int is_poly;
+	int is_point;
+	LWGEOM *lwgeom;
+	RTREE_POLY_CACHE *poly_index;
+	GEOSGeometry *geos;
+	const GEOSPreparedGeometry *prepared;
+} BatchPredicateArg;
+
+/*
+* Points of gpoint against the indexed scalar polygon: intersects
+* if one is not outside, contains if none is outside and one is
+* inside.
+*/
+static int
+batch_pip_points(BatchPredicateArg *arg, GSERIALIZED *gpoint, int predicate)
+{
+	LWGEOM *lwpoints = lwgeom_from_gserialized(gpoint);
+	LWPOINT *point, **points;
+	uint32_t npoints, i;
+	int inside = LW_FALSE, outside = LW_FALSE, touches = LW_FALSE;
+
+	if (!arg->lwgeom)
+		arg->lwgeom = lwgeom_from_gserialized(arg->geom);
+	if (!arg->poly_index)
+		arg->poly_index = RTreePolyCacheCreate(arg->lwgeom);
+
+	if (lwpoints->type == POINTTYPE)
+	{
+		point = lwgeom_as_lwpoint(lwpoints);
+		points = &point;
+		npoints = 1;
+	}
+	else
+	{
+		points = lwgeom_as_lwmpoint(lwpoints)->geoms;
+		npoints = lwgeom_as_lwmpoint(lwpoints)->ngeoms;
+	}
+
+	for (i = 0; i < npoints; i++)
+	{
+		int pip_result;
+
+		if (lwgeom_is_empty(lwpoint_as_lwgeom(points[i])))
+			continue;
+		pip_result = pip_short_circuit(arg->poly_index, points[i], arg->geom);
+		if (pip_result == 1)
+			inside = LW_TRUE;
+		else if (pip_result == 0)
+			touches = LW_TRUE;
+		else
+			outside = LW_TRUE;
+
+		if (predicate == BATCH_INTERSECTS && (inside || touches))
+			break;
+		if (predicate == BATCH_CONTAINS && outside)
+			break;
+	}
+
+	lwgeom_free(lwpoints);
+
+	if (predicate == BATCH_INTERSECTS)
+		return inside || touches;
+	return inside && !outside;
+}
+
+/*
+* The scalar point(s) against an element polygon, which is only
+* used once so goes through the plain point-in-polygon code.
+*/
+static int
+batch_pip_polygon(BatchPredicateArg *arg, GSERIALIZED *gpoly)
+{
+	LWPOINT *point, **points;
+	uint32_t npoints, i;
+
+	if (!arg->lwgeom)
+		arg->lwgeom = lwgeom_from_gserialized(arg->geom);
+
+	if (arg->lwgeom->type == POINTTYPE)
+	{
+		point = lwgeom_as_lwpoint(arg->lwgeom);
+		points = &point;
+		npoints = 1;
+	}
+	else
+	{
+		points = lwgeom_as_lwmpoint(arg->lwgeom)->geoms;
+		npoints = lwgeom_as_lwmpoint(arg->lwgeom)->ngeoms;
+	}
+
+	for (i = 0; i < npoints; i++)
+	{
+		if (!lwgeom_is_empty(lwpoint_as_lwgeom(points[i])) && pip_short_circuit(NULL, points[i], gpoly) != -1)
+			return LW_TRUE;
+	}
+	return LW_FALSE;
+}
+
+/*
+* Evaluate the predicate between the scalar argument and geom.
+* Returns 2 on a GEOS error, like the GEOS predicates.
+*/
+static char
+batch_predicate(BatchPredicateArg *arg, GSERIALIZED *geom, int predicate)
+{
+	GEOSGeometry *g;
+	GBOX box;
+	char result;
+
+	error_if_srid_mismatch(gserialized_get_srid(arg->geom), gserialized_get_srid(geom));
+	if (predicate == BATCH_CONTAINS)
+		errorIfGeometryCollection(arg->geom, geom);
+
+	/* A.Intersects(Empty) == A.Contains(Empty) == FALSE */
+	if (gserialized_is_empty(arg->geom) || gserialized_is_empty(geom))
+		return LW_FALSE;
+
+	if (arg->has_box && gserialized_get_gbox_p(geom, &box))
+	{
+		if (predicate == BATCH_INTERSECTS && !gbox_overlaps_2d(&arg->box, &box))
+			return LW_FALSE;
+		if (predicate == BATCH_CONTAINS && !gbox_contains_2d(&arg->box, &box))
+			return LW_FALSE;
+	}
+
+	if (arg->is_poly && is_point(geom))
+		return batch_pip_points(arg, geom, predicate);
+
+	if (predicate == BATCH_INTERSECTS && arg->is_point && is_poly(geom))
+		return batch_pip_polygon(arg, geom);
+
+	if (!arg->prepared)
+	{
+		initGEOS(lwpgnotice, lwgeom_geos_error);
+		arg->geos = POSTGIS2GEOS(arg->geom);
+		if (!arg->geos)
+			return 2;
+		arg->prepared = GEOSPrepare(arg->geos);
+		if (!arg->prepared)
+			return 2;
+	}
+
+	g = POSTGIS2GEOS(geom);
+	if (!g)
+		return 2;
+	if (predicate == BATCH_INTERSECTS)
+		result = GEOSPreparedIntersects(arg->prepared, g);
+	else
+		result = GEOSPreparedContains(arg->prepared, g);
+	GEOSGeom_destroy(g);
+
+	return result;
+}
+
+/*
+* Free the GEOS copies of the scalar argument, which live outside
+* of the memory contexts and are not cleaned up on an ERROR.
+*/
+static void
+batch_predicate_free_geos(BatchPredicateArg *arg)
+{
+	if (arg->prepared)
+		GEOSPreparedGeom_destroy(arg->prepared);
+	if (arg->geos)
+		GEOSGeom_destroy(arg->geos);
+	arg->prepared = NULL;
+	arg->geos = NULL;
+}
+
+/*
+* Run the predicate between the geometry and the elements of the
+* array arguments, returning an array of the same shape with NULL
+* for the NULL elements.
+*/
+static Datum
+batch_predicate_garray(FunctionCallInfo fcinfo, int predicate, const char *label)
+{
+	GSERIALIZED *geom = PG_GETARG_GSERIALIZED_P(0);
+	ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+	int nelems = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+	BatchPredicateArg *arg;
+	ArrayIterator iterator;
+	ArrayType *result;
+	Datum *values;
+	bool *nulls;
+	Datum value;
+	bool isnull;
+	bool geos_failed = false;
+	int i = 0;
+
+	if (nelems == 0)
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(BOOLOID));
+
+	arg = palloc0(sizeof(BatchPredicateArg));
+	arg->geom = geom;
+	arg->has_box = !gserialized_is_empty(geom) && gserialized_get_gbox_p(geom, &arg->box) == LW_SUCCESS;
+	arg->is_poly = is_poly(geom);
+	arg->is_point = is_point(geom);
+
+	values = palloc(sizeof(Datum) * nelems);
+	nulls = palloc(sizeof(bool) * nelems);
+
+#if POSTGIS_PGSQL_VERSION >= 95
+	iterator = array_create_iterator(array, 0, NULL);
+#else
+	iterator = array_create_iterator(array, 0);
+#endif
+
+	PG_TRY();
+	{
+		while (array_iterate(iterator, &value, &isnull))
+		{
+			nulls[i] = isnull;
+			values[i] = BoolGetDatum(false);
+
+			if (!isnull)
+			{
+				GSERIALIZED *elem = (GSERIALIZED *)PG_DETOAST_DATUM(value);
+				char r = batch_predicate(arg, elem, predicate);
+				if (r == 2)
+				{
+					/* Report it once out of the PG_TRY */
+					geos_failed = true;
+					break;
+				}
+
+				values[i] = BoolGetDatum(r);
+				if ((Pointer)elem != DatumGetPointer(value))
+					pfree(elem);
+			}
+
+			CHECK_FOR_INTERRUPTS();
+			i++;
+		}
+	}
+	PG_CATCH();
+	{
+		batch_predicate_free_geos(arg);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	array_free_iterator(iterator);
+
+	batch_predicate_free_geos(arg);
+	if (geos_failed)
+		HANDLE_GEOS_ERROR(label);
+	if (arg->poly_index)
+		RTreePolyCacheFree(arg->poly_index);
+	if (arg->lwgeom)
+		lwgeom_free(arg->lwgeom);
+	pfree(arg);
+
+	result = construct_md_array(values, nulls, ARR_NDIM(array), ARR_DIMS(array), ARR_LBOUND(array),
+	                            BOOLOID, 1, true, 'c');
+
+	PG_FREE_IF_COPY(geom, 0);
+	PG_RETURN_ARRAYTYPE_P(result);
+}
+
+/**
+* ST_IntersectsMany(geom, geom[]) is ST_Intersects(geom, geom[i])
+* for each element of the array.
+*/
+PG_FUNCTION_INFO_V1(ST_IntersectsMany);
+Datum ST_IntersectsMany(PG_FUNCTION_ARGS)
+{
+	return batch_predicate_garray(fcinfo, BATCH_INTERSECTS, "GEOSPreparedIntersects");
+}
+
+/**
+* ST_ContainsMany(geom, geom[]) is ST_Contains(geom, geom[i])
+* for each element of the array.
+*/
+PG_FUNCTION_INFO_V1(ST_ContainsMany);
+Datum ST_ContainsMany(PG_FUNCTION_ARGS)
+{
+	return batch_predicate_garray(fcinfo, BATCH_CONTAINS, "GEOSPreparedContains");
+}
+
+
 PG_FUNCTION_INFO_V1(touches);
 Datum touches(PG_FUNCTION_ARGS)
 {
@@ -50,4 +50,7 @@ Datum LWGEOM_mindistance3d(PG_FUNCTION_ARGS);
 void errorIfGeometryCollection(GSERIALIZED *g1, GSERIALIZED *g2);
 uint32_t array_nelems_not_null(ArrayType* array);
 
+/* Define the postgis.cluster_threads setting, see lwgeom_window.c */
+void lwgeom_init_cluster_threads(void);
+
 #endif /* LWGEOM_GEOS_H_ */
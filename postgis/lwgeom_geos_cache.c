@@ -0,0 +1,154 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************
+ *
+ * ^copyright^
+ *
+ **********************************************************************/
+
+
+#include "postgres.h"
+#include "utils/memutils.h"
+
+#include "../postgis_config.h"
+#include "lwgeom_geos_cache.h"
+
+
+#if POSTGIS_PGSQL_VERSION >= 95
+
+/**
+* Reset callback of the statement context: the entry is
+* about to be freed with it, so destroy the GEOS geometry
+* it holds.
+*/
+static void
+GEOSGeomCacheDelete(void *ptr)
+{
+	GEOSGeomCache *geoscache = (GEOSGeomCache*)ptr;
+
+	POSTGIS_DEBUGF(3, "GEOSGeomCacheDelete: destroying geom %p of entry %p", geoscache->geom, geoscache);
+
+	if ( geoscache->geom )
+		GEOSGeom_destroy(geoscache->geom);
+	geoscache->geom = NULL;
+}
+
+/**
+* Builders, freeer and allocator for GetGeomCache: the
+* "index" of a GEOSGeomCache is just the GEOS geometry,
+* converted with or without autofix as the caller would
+* have converted it uncached.
+*/
+static int
+GEOSGeomCacheBuild(const LWGEOM *lwgeom, GeomCache *cache, uint8_t autofix)
+{
+	GEOSGeomCache *geoscache = (GEOSGeomCache*)cache;
+
+	if ( geoscache->geom )
+	{
+		lwpgerror("GEOSGeomCacheBuilder asked to build new geoscache where one already exists.");
+		return LW_FAILURE;
+	}
+
+	geoscache->geom = LWGEOM2GEOS(lwgeom, autofix);
+	if ( ! geoscache->geom )
+		return LW_FAILURE;
+
+	return LW_SUCCESS;
+}
+
+static int
+GEOSGeomCacheBuilder(const LWGEOM *lwgeom, GeomCache *cache)
+{
+	return GEOSGeomCacheBuild(lwgeom, cache, LW_FALSE);
+}
+
+static int
+GEOSGeomCacheBuilderAutofix(const LWGEOM *lwgeom, GeomCache *cache)
+{
+	return GEOSGeomCacheBuild(lwgeom, cache, LW_TRUE);
+}
+
+static int
+GEOSGeomCacheFreer(GeomCache *cache)
+{
+	GEOSGeomCache *geoscache = (GEOSGeomCache*)cache;
+
+	if ( ! geoscache )
+		return LW_FAILURE;
+
+	if ( geoscache->geom )
+		GEOSGeom_destroy(geoscache->geom);
+	geoscache->geom = NULL;
+	geoscache->gcache.argnum = 0;
+
+	return LW_SUCCESS;
+}
+
+static GeomCache*
+GEOSGeomCacheAllocator(void)
+{
+	GEOSGeomCache *geoscache = palloc0(sizeof(GEOSGeomCache));
+	geoscache->gcache.type = GEOS_CACHE_ENTRY;
+
+	/* Entries live as long as the statement context, so clean up with it */
+	geoscache->callback.func = GEOSGeomCacheDelete;
+	geoscache->callback.arg = (void*)geoscache;
+	MemoryContextRegisterResetCallback(CurrentMemoryContext, &(geoscache->callback));
+
+	return (GeomCache*)geoscache;
+}
+
+static GeomCacheMethods GEOSGeomCacheMethods =
+{
+	GEOS_CACHE_ENTRY,
+	GEOSGeomCacheBuilder,
+	GEOSGeomCacheFreer,
+	GEOSGeomCacheAllocator
+};
+
+static GeomCacheMethods GEOSGeomCacheMethodsAutofix =
+{
+	GEOS_CACHE_ENTRY,
+	GEOSGeomCacheBuilderAutofix,
+	GEOSGeomCacheFreer,
+	GEOSGeomCacheAllocator
+};
+
+GEOSGeomCache *
+GetGEOSGeomCache(FunctionCallInfo fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, uint8_t autofix)
+{
+	return (GEOSGeomCache*)GetGeomCache(fcinfo,
+	        autofix ? &GEOSGeomCacheMethodsAutofix : &GEOSGeomCacheMethods, g1, g2);
+}
+
+#else /* POSTGIS_PGSQL_VERSION < 95 */
+
+/*
+* Without memory context reset callbacks there is no
+* cheap way to destroy the GEOS geometries at the end of
+* the statement, so nothing is cached.
+*/
+GEOSGeomCache *
+GetGEOSGeomCache(FunctionCallInfo fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, uint8_t autofix)
+{
+	return NULL;
+}
+
+#endif /* POSTGIS_PGSQL_VERSION < 95 */
@@ -0,0 +1,72 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************
+ *
+ * ^copyright^
+ *
+ **********************************************************************/
+
+
+#ifndef LWGEOM_GEOS_CACHE_H_
+#define LWGEOM_GEOS_CACHE_H_ 1
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "lwgeom_pg.h"
+#include "liblwgeom.h"
+#include "lwgeom_geos.h"
+#include "lwgeom_cache.h"
+
+/*
+* Cache structure for the plain GEOS geometry of an argument,
+* for the operations that have no prepared form (overlays,
+* buffer) but are often run many times against one geometry,
+* like clipping a table of features to a single mask.
+*
+* GEOS allocates the geometry outside of PgSQL's memory
+* contexts, so each entry registers a reset callback on the
+* statement context that destroys it along with the entry.
+*
+* The leading GeomCache is the common structure and has to
+* remain first, see lwgeom_cache.h.
+*/
+typedef struct {
+	GeomCache                   gcache;
+#if POSTGIS_PGSQL_VERSION >= 95
+	MemoryContextCallback       callback;
+#endif
+	GEOSGeometry*               geom;
+} GEOSGeomCache;
+
+/*
+** Get the cache entry for whichever of the input geometries
+** repeats, building its GEOS geometry if necessary. Returns NULL
+** when neither is cached; otherwise gcache.argnum says which
+** argument geom stands for. The geometry belongs to the cache,
+** callers must not destroy it.
+**
+** If you are only caching one argument (e.g., in buffer) supply
+** NULL as the value for g2. The geometry is converted by
+** LWGEOM2GEOS with the given autofix, which has to match what
+** the uncached path of the caller uses. Call initGEOS first.
+*/
+GEOSGeomCache *GetGEOSGeomCache(FunctionCallInfo fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2, uint8_t autofix);
+
+#endif /* LWGEOM_GEOS_CACHE_H_ */
@@ -26,6 +26,14 @@
 
 
 #include <assert.h>
+#include <limits.h>
+
+#include "postgres.h"
+#include "funcapi.h"
+#include "access/htup_details.h"
+#include "lib/ilist.h"
+#include "portability/instr_time.h"
+#include "utils/guc.h"
 
 #include "../postgis_config.h"
 #include "lwgeom_geos_prepared.h"
@@ -160,8 +168,12 @@ PreparedCacheStats(MemoryContext context, int level)
 	/*
 	 * Simple stats display function - we must supply a function since this call is mandatory according to tgl
 	 * (see postgis-devel archives July 2007)
-	   fprintf(stderr, "%s: Prepared context\n", context->name);
 	 */
+	CacheStats *stats = GetCacheStats(PREP_CACHE_ENTRY);
+
+	fprintf(stderr, "%s: Prepared context: " INT64_FORMAT " builds, " INT64_FORMAT " hits, "
+	        INT64_FORMAT " misses, " INT64_FORMAT " evictions, %.3f ms building\n",
+	        context->name, stats->builds, stats->hits, stats->misses, stats->evictions, stats->build_time);
 }
 
 #ifdef MEMORY_CONTEXT_CHECKING
@@ -437,6 +449,383 @@ static GeomCacheMethods PrepGeomCacheMethods =
 };
 
 
+/***********************************************************************
+**
+**  Backend-lifetime prepared geometry cache.
+**
+**  The caches above live in the fn_extra of one call site, so
+**  they are gone at the end of the statement. Workloads that run
+**  many short statements against the same few reference polygons
+**  can opt in to a second cache, owned by the backend and sized
+**  by postgis.prepared_cache_size (in kB, 0 disables it).
+**
+**  Entries are keyed by the size and hash of the serialized
+**  geometry and kept in least-recently-used order. As with the
+**  call site caches, a geometry is only prepared the second time
+**  it is seen, here in any statement. The hash is the one the
+**  call site keeps for the argument, so a constant geometry is
+**  only hashed once per statement; every entry keeps a copy of
+**  its key to confirm hits against. The GEOS objects are
+**  malloc'ed by GEOS, so they are only ever freed on eviction.
+**
+**/
+
+/* kB, set from postgis.prepared_cache_size */
+int prep_backend_cache_size = 0;
+
+/* Initial hash table size, and direct-mapped seen-once table size */
+#define PREP_BACKEND_HASH_SIZE 64
+#define PREP_BACKEND_GHOSTS 1024
+
+/*
+* GEOS doesn't tell what it allocates for a geometry and its
+* prepared index, so that part of an entry's charge is only an
+* estimate, a multiple of the serialized size: a copy of the
+* coordinates plus an index over the segments. The copy of the
+* key is charged at its actual size.
+*/
+#define PREP_BACKEND_GEOS_ESTIMATE_FACTOR 2
+
+typedef struct
+{
+	uint64 hash;
+	uint64 size;
+}
+PrepBackendKey;
+
+typedef struct
+{
+	PrepBackendKey key; /* hash key, must be first */
+	dlist_node lru_node;
+	GEOSGeometry* geom;
+	const GEOSPreparedGeometry* prepared_geom;
+	size_t charge; /* key copy plus GEOS estimate */
+	GSERIALIZED* gser;
+}
+PrepBackendEntry;
+
+typedef struct
+{
+	MemoryContext context;
+	HTAB* hash;
+	dlist_head lru;
+	int64 nentries;
+	int64 nbytes;
+	PrepBackendKey ghosts[PREP_BACKEND_GHOSTS];
+}
+PrepBackendCache;
+
+static PrepBackendCache PrepBackend;
+
+/*
+* Backend cache hits are handed back to the caller through
+* this, which stays valid until the next GetPrepGeomCache call.
+*/
+static PrepGeomCache PrepBackendProxy;
+
+static uint32
+PrepBackendKeyHash(const void *key, Size keysize)
+{
+	/* The key is a hash already */
+	return (uint32)(((const PrepBackendKey *)key)->hash);
+}
+
+static void
+PrepBackendInit(void)
+{
+	HASHCTL ctl;
+
+	PrepBackend.context = AllocSetContextCreate(TopMemoryContext,
+	                          "PostGIS Prepared Geometry Backend Cache",
+	                          ALLOCSET_DEFAULT_MINSIZE,
+	                          ALLOCSET_DEFAULT_INITSIZE,
+	                          ALLOCSET_DEFAULT_MAXSIZE);
+
+	memset(&ctl, 0, sizeof(HASHCTL));
+	ctl.keysize = sizeof(PrepBackendKey);
+	ctl.entrysize = sizeof(PrepBackendEntry);
+	ctl.hash = PrepBackendKeyHash;
+	ctl.hcxt = PrepBackend.context;
+
+	PrepBackend.hash = hash_create("PostGIS Prepared Geometry Backend Cache Hash",
+	                               PREP_BACKEND_HASH_SIZE, &ctl,
+	                               (HASH_ELEM | HASH_FUNCTION | HASH_CONTEXT));
+	dlist_init(&PrepBackend.lru);
+}
+
+static void
+PrepBackendEvict(PrepBackendEntry *pbe)
+{
+	POSTGIS_DEBUGF(3, "PrepBackendEvict: evicting %p", pbe);
+
+	if ( pbe->prepared_geom )
+		GEOSPreparedGeom_destroy(pbe->prepared_geom);
+	if ( pbe->geom )
+		GEOSGeom_destroy(pbe->geom);
+	if ( pbe->gser )
+		pfree(pbe->gser);
+
+	dlist_delete(&pbe->lru_node);
+	PrepBackend.nentries--;
+	PrepBackend.nbytes -= pbe->charge;
+	GetCacheStats(PREP_BACKEND_CACHE_ENTRY)->evictions++;
+	hash_search(PrepBackend.hash, &pbe->key, HASH_REMOVE, NULL);
+}
+
+/**
+* Evict least recently used entries until the cache holds
+* no more than limit bytes.
+*/
+static void
+PrepBackendTrim(int64 limit)
+{
+	while ( PrepBackend.nbytes > limit && ! dlist_is_empty(&PrepBackend.lru) )
+	{
+		PrepBackendEntry *pbe = dlist_container(PrepBackendEntry, lru_node, dlist_tail_node(&PrepBackend.lru));
+		PrepBackendEvict(pbe);
+	}
+}
+
+/**
+* Find the entry for g, confirming the hash with its bytes:
+* the hash may have been recalled for a pointer that holds
+* another geometry by now.
+*/
+static PrepBackendEntry *
+PrepBackendLookup(const GSERIALIZED *g, const PrepBackendKey *key)
+{
+	PrepBackendEntry *pbe = hash_search(PrepBackend.hash, key, HASH_FIND, NULL);
+
+	if ( ! pbe || memcmp(pbe->gser, g, key->size) != 0 )
+		return NULL;
+
+	GetCacheStats(PREP_BACKEND_CACHE_ENTRY)->hits++;
+	dlist_move_head(&PrepBackend.lru, &pbe->lru_node);
+	return pbe;
+}
+
+/**
+* Note a key that missed. Returns LW_TRUE if it was seen once
+* before (so it is worth preparing now), otherwise remembers it
+* and returns LW_FALSE. Colliding keys simply overwrite each other.
+*/
+static int
+PrepBackendGhostSeen(const PrepBackendKey *key)
+{
+	PrepBackendKey *ghost = &(PrepBackend.ghosts[key->hash % PREP_BACKEND_GHOSTS]);
+
+	if ( ghost->hash == key->hash && ghost->size == key->size )
+	{
+		ghost->hash = 0;
+		ghost->size = 0;
+		return LW_TRUE;
+	}
+	*ghost = *key;
+	return LW_FALSE;
+}
+
+static PrepBackendEntry *
+PrepBackendInsert(const GSERIALIZED *g, const PrepBackendKey *key, int64 limit)
+{
+	PrepBackendEntry *pbe;
+	LWGEOM *lwgeom;
+	GEOSGeometry *geom;
+	const GEOSPreparedGeometry *prepared_geom;
+	size_t charge = key->size * (1 + PREP_BACKEND_GEOS_ESTIMATE_FACTOR);
+	bool found;
+	CacheStats *stats = GetCacheStats(PREP_BACKEND_CACHE_ENTRY);
+	instr_time start, elapsed;
+
+	/* Would never fit, don't bother */
+	if ( (int64)charge > limit )
+		return NULL;
+
+	INSTR_TIME_SET_CURRENT(start);
+
+	/* Can't prepare a NULL or empty */
+	lwgeom = lwgeom_from_gserialized(g);
+	if ( (!lwgeom) || lwgeom_is_empty(lwgeom) )
+	{
+		if ( lwgeom ) lwgeom_free(lwgeom);
+		return NULL;
+	}
+	geom = LWGEOM2GEOS(lwgeom, 0);
+	lwgeom_free(lwgeom);
+	if ( ! geom )
+		return NULL;
+	prepared_geom = GEOSPrepare(geom);
+	if ( ! prepared_geom )
+	{
+		GEOSGeom_destroy(geom);
+		return NULL;
+	}
+
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, start);
+	stats->builds++;
+	stats->build_time += INSTR_TIME_GET_MILLISEC(elapsed);
+	stats->bytes += key->size;
+
+	PrepBackendTrim(limit - charge);
+
+	pbe = hash_search(PrepBackend.hash, key, HASH_ENTER, &found);
+	if ( found )
+	{
+		/* Only a hash collision gets here */
+		GEOSPreparedGeom_destroy(prepared_geom);
+		GEOSGeom_destroy(geom);
+		return NULL;
+	}
+	pbe->geom = geom;
+	pbe->prepared_geom = prepared_geom;
+	pbe->charge = charge;
+	pbe->gser = MemoryContextAlloc(PrepBackend.context, key->size);
+	memcpy(pbe->gser, g, key->size);
+	dlist_push_head(&PrepBackend.lru, &pbe->lru_node);
+	PrepBackend.nentries++;
+	PrepBackend.nbytes += charge;
+
+	return pbe;
+}
+
+/**
+* Look both geometries up in the backend cache, preparing one
+* of them if it has been seen before. Returns the proxy cache
+* structure on a hit, NULL otherwise. A call counts one hit or
+* one miss, whichever of the arguments it was for. On a miss
+* with the cache turned on, hash gets the key hashes of the
+* arguments and *hashed is set.
+*/
+static PrepGeomCache *
+GetPrepBackendCache(FunctionCallInfo fcinfo, const GSERIALIZED *g1, const GSERIALIZED *g2,
+		    uint64 *hash, bool *hashed)
+{
+	const GSERIALIZED *g[2];
+	PrepBackendKey key[2];
+	PrepBackendEntry *pbe = NULL;
+	int64 limit = (int64)prep_backend_cache_size * 1024;
+	int i, hit = 0;
+
+	if ( prep_backend_cache_size <= 0 )
+	{
+		/* Turned off after being used? Free everything. */
+		if ( PrepBackend.nentries )
+			PrepBackendTrim(0);
+		return NULL;
+	}
+
+	if ( ! PrepBackend.hash )
+		PrepBackendInit();
+
+	/* In case the limit was lowered */
+	PrepBackendTrim(limit);
+
+	g[0] = g1;
+	g[1] = g2;
+	memset(key, 0, sizeof(key));
+
+	for ( i = 0; i < 2 && ! pbe; i++ )
+	{
+		bool recalled;
+		if ( ! g[i] ) continue;
+		key[i].hash = GetGeomCacheKeyHash(fcinfo, PREP_CACHE_ENTRY, i + 1, g[i], &recalled);
+		key[i].size = VARSIZE(g[i]);
+		pbe = PrepBackendLookup(g[i], &key[i]);
+		if ( ! pbe && recalled )
+		{
+			/* Same pointer, but maybe not the same geometry any more */
+			key[i].hash = GetGeomCacheKeyHash(fcinfo, PREP_CACHE_ENTRY, i + 1, g[i], NULL);
+			pbe = PrepBackendLookup(g[i], &key[i]);
+		}
+		if ( pbe ) hit = i + 1;
+	}
+
+	if ( ! pbe )
+		GetCacheStats(PREP_BACKEND_CACHE_ENTRY)->misses++;
+
+	for ( i = 0; i < 2 && ! pbe; i++ )
+	{
+		if ( ! g[i] ) continue;
+		if ( PrepBackendGhostSeen(&key[i]) )
+			pbe = PrepBackendInsert(g[i], &key[i], limit);
+		if ( pbe ) hit = i + 1;
+	}
+
+	if ( ! pbe )
+	{
+		/* The lookups hashed both keys, the call site cache can use them */
+		hash[0] = key[0].hash;
+		hash[1] = key[1].hash;
+		*hashed = true;
+		return NULL;
+	}
+
+	memset(&PrepBackendProxy, 0, sizeof(PrepGeomCache));
+	PrepBackendProxy.gcache.type = PREP_CACHE_ENTRY;
+	PrepBackendProxy.gcache.argnum = hit;
+	PrepBackendProxy.geom = pbe->geom;
+	PrepBackendProxy.prepared_geom = pbe->prepared_geom;
+	return &PrepBackendProxy;
+}
+
+/**
+* Define the postgis.prepared_cache_size setting. Called
+* once, when the library is loaded.
+*/
+void
+lwgeom_init_prepared_cache(void)
+{
+	static const char *guc_name = "postgis.prepared_cache_size";
+
+	/* #2382 A prior copy of the library may already have defined */
+	/* the GUC during an upgrade; it then keeps the cache off */
+	/* in this copy until the next connection. */
+	if ( postgis_guc_find_option(guc_name) )
+		return;
+
+	DefineCustomIntVariable( guc_name, /* name */
+				"Sets the size of the backend prepared geometry cache.", /* short_desc */
+				"Prepared geometries kept across statements, for reference polygons that many statements test against. Zero disables the cache.", /* long_desc */
+				&prep_backend_cache_size, /* valueAddr */
+				0, /* bootValue */
+				0, /* minValue */
+				INT_MAX / 1024, /* maxValue */
+				PGC_USERSET, /* GucContext context */
+				GUC_UNIT_KB, /* int flags */
+				NULL, /* GucIntCheckHook check_hook */
+				NULL, /* GucIntAssignHook assign_hook */
+				NULL  /* GucShowHook show_hook */
+				);
+}
+
+/**
+* Counters of the backend prepared geometry cache, as a
+* (hits, misses, evictions, entries, bytes) record.
+*/
+PG_FUNCTION_INFO_V1(postgis_prepared_cache_stats);
+Datum postgis_prepared_cache_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupdesc;
+	HeapTuple tuple;
+	Datum values[5];
+	bool nulls[5];
+	CacheStats *stats = GetCacheStats(PREP_BACKEND_CACHE_ENTRY);
+
+	if ( get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE )
+		elog(ERROR, "return type must be a row type");
+	BlessTupleDesc(tupdesc);
+
+	memset(nulls, 0, sizeof(nulls));
+	values[0] = Int64GetDatum(stats->hits);
+	values[1] = Int64GetDatum(stats->misses);
+	values[2] = Int64GetDatum(stats->evictions);
+	values[3] = Int64GetDatum(PrepBackend.nentries);
+	values[4] = Int64GetDatum(PrepBackend.nbytes);
+
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+	PG_RETURN_DATUM(HeapTupleGetDatum(tuple));
+}
+
 /**
 * Given a couple potential geometries and a function
 * call context, return a prepared structure for one
@@ -451,6 +840,16 @@ static GeomCacheMethods PrepGeomCacheMethods =
 PrepGeomCache *
 GetPrepGeomCache(FunctionCallInfo fcinfo, GSERIALIZED *g1, GSERIALIZED *g2)
 {
+	uint64 hash[2];
+	bool hashed = false;
+
+	/* The backend cache, when turned on, is checked first */
+	PrepGeomCache *prepcache = GetPrepBackendCache(fcinfo, g1, g2, hash, &hashed);
+	if ( prepcache )
+		return prepcache;
+
+	if ( hashed )
+		return (PrepGeomCache*)GetGeomCacheHashed(fcinfo, &PrepGeomCacheMethods, g1, g2, hash);
 	return (PrepGeomCache*)GetGeomCache(fcinfo, &PrepGeomCacheMethods, g1, g2);
 }
 
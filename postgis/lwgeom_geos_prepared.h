@@ -40,7 +40,7 @@
 
 /*
 * Cache structure. We use GSERIALIZED as keys so no transformations
-* are needed before we memcmp them with other keys. We store the
+* are needed before we hash them and compare with other keys. We store the
 * size to avoid having to calculate the size every time.
 * The argnum gives the number of function arguments we are caching.
 * Intersects requires that both arguments be checked for cacheability,
@@ -48,10 +48,11 @@
 * Both the Geometry and the PreparedGeometry have to be cached,
 * because the PreparedGeometry contains a reference to the geometry.
 *
-* Note that the first 6 entries are part of the common GeomCache
-* structure and have to remain in order to allow the overall caching
-* system to share code (the cache checking code is common between
-* prepared geometry, circtrees, recttrees, and rtrees).
+* Note that the leading GeomCache is the common structure and has
+* to remain first to allow the overall caching system to share code
+* (the cache checking code is common between prepared geometry,
+* circtrees, recttrees, and rtrees). A call site may hold several
+* PrepGeomCache entries at once, one per geometry in its LRU.
 */
 typedef struct {
 	GeomCache                   gcache;
@@ -72,4 +73,10 @@ typedef struct {
 */
 PrepGeomCache *GetPrepGeomCache(FunctionCallInfo fcinfo, GSERIALIZED *pg_geom1, GSERIALIZED *pg_geom2);
 
+/*
+** Define the postgis.prepared_cache_size setting, which sizes the
+** backend-lifetime prepared geometry cache consulted by GetPrepGeomCache.
+*/
+void lwgeom_init_prepared_cache(void);
+
 #endif /* LWGEOM_GEOS_PREPARED_H_ */
@@ -23,19 +23,36 @@
  **********************************************************************/
 
 
+#include "../postgis_config.h"
+
+#include <float.h>
+
 #include "postgres.h"
 #include "funcapi.h"
 #include "fmgr.h"
+#include "miscadmin.h"
+#include "catalog/pg_type.h"
+#include "utils/array.h"
 #include "liblwgeom.h"
 #include "liblwgeom_internal.h"  /* For FP comparators. */
 #include "lwgeom_pg.h"
 #include "lwtree.h"
+#include "lwtree3d.h"
 #include "lwgeom_cache.h"
+#include "lwgeom_rectree.h"
 
 
 /* Prototypes */
 Datum ST_DistanceRectTree(PG_FUNCTION_ARGS);
 Datum ST_DistanceRectTreeCached(PG_FUNCTION_ARGS);
+Datum ST_DWithinMany(PG_FUNCTION_ARGS);
+
+/*
+* The cached distances still tree the other argument on every
+* call, which only pays off when the cached one has enough
+* vertices to make a brute force distance slow.
+*/
+#define RECT_TREE_CACHE_MIN_VERTICES 64
 
 
 /**********************************************************************
@@ -112,6 +129,234 @@ GetRectTreeGeomCache(FunctionCallInfo fcinfo, const GSERIALIZED *g1, const GSERI
 }
 
 
+/**********************************************************************
+* Cached distance for ST_Distance, ST_DWithin and ST_DFullyWithin
+**********************************************************************/
+
+static int
+rect_tree_is_multi(const LWGEOM *lwgeom)
+{
+	switch (lwgeom->type)
+	{
+		case MULTIPOINTTYPE:
+		case MULTILINETYPE:
+		case MULTIPOLYGONTYPE:
+		case MULTICURVETYPE:
+		case MULTISURFACETYPE:
+			return ((const LWCOLLECTION*)lwgeom)->ngeoms > 1;
+		default:
+			return LW_FALSE;
+	}
+}
+
+/*
+* The tree distance only tests one point of each input for
+* containment in the other, so it can only be trusted when an
+* areal input faces a single part. Triangles, TINs, polyhedral
+* surfaces and generic collections are left to the usual code.
+*/
+static int
+rect_tree_distance_supported(const LWGEOM *lwg1, const LWGEOM *lwg2)
+{
+	const LWGEOM *g[2];
+	int i, area[2];
+
+	g[0] = lwg1;
+	g[1] = lwg2;
+
+	/* Two points, nothing to gain */
+	if (lwg1->type == POINTTYPE && lwg2->type == POINTTYPE)
+		return LW_FALSE;
+
+	for (i = 0; i < 2; i++)
+	{
+		switch (g[i]->type)
+		{
+			case POINTTYPE:
+			case LINETYPE:
+			case CIRCSTRINGTYPE:
+			case COMPOUNDTYPE:
+			case MULTIPOINTTYPE:
+			case MULTILINETYPE:
+			case MULTICURVETYPE:
+				area[i] = LW_FALSE;
+				break;
+			case POLYGONTYPE:
+			case CURVEPOLYTYPE:
+			case MULTIPOLYGONTYPE:
+			case MULTISURFACETYPE:
+				area[i] = LW_TRUE;
+				break;
+			default:
+				return LW_FALSE;
+		}
+	}
+
+	if (area[0] && rect_tree_is_multi(lwg2))
+		return LW_FALSE;
+	if (area[1] && rect_tree_is_multi(lwg1))
+		return LW_FALSE;
+
+	return LW_TRUE;
+}
+
+int
+RectTreeCachedDistance(FunctionCallInfo fcinfo,
+                       const GSERIALIZED *g1, const GSERIALIZED *g2,
+                       const LWGEOM *lwg1, const LWGEOM *lwg2,
+                       int maximum, double threshold, double *distance)
+{
+	RectTreeGeomCache *tree_cache;
+	RECT_NODE *n;
+	uint32_t nv1, nv2;
+
+	if (lwgeom_is_empty(lwg1) || lwgeom_is_empty(lwg2))
+		return LW_FAILURE;
+
+	/* Not worth a lookup unless one side is complex */
+	nv1 = lwgeom_count_vertices(lwg1);
+	nv2 = lwgeom_count_vertices(lwg2);
+	if (nv1 < RECT_TREE_CACHE_MIN_VERTICES && nv2 < RECT_TREE_CACHE_MIN_VERTICES)
+		return LW_FAILURE;
+
+	if (!rect_tree_distance_supported(lwg1, lwg2))
+		return LW_FAILURE;
+
+	/* The furthest vertices are only the furthest points without arcs */
+	if (maximum && (lwgeom_has_arc(lwg1) || lwgeom_has_arc(lwg2)))
+		return LW_FAILURE;
+
+	tree_cache = GetRectTreeGeomCache(fcinfo, g1, g2);
+	if (!tree_cache || !tree_cache->gcache.argnum)
+		return LW_FAILURE;
+
+	/* The repeated side may be the simple one */
+	if ((tree_cache->gcache.argnum == 1 ? nv1 : nv2) < RECT_TREE_CACHE_MIN_VERTICES)
+		return LW_FAILURE;
+
+	/* Tree the other argument for this call only */
+	n = rect_tree_from_lwgeom(tree_cache->gcache.argnum == 1 ? lwg2 : lwg1);
+	if (!n)
+		return LW_FAILURE;
+
+	if (maximum)
+		*distance = rect_tree_max_distance_tree(tree_cache->index, n, threshold);
+	else
+		*distance = rect_tree_distance_tree(tree_cache->index, n, threshold);
+
+	rect_tree_free(n);
+	return LW_SUCCESS;
+}
+
+
+/**********************************************************************
+* Cached 3D distance for ST_3DDistance, ST_3DDWithin and friends
+**********************************************************************/
+
+typedef struct {
+	GeomCache           gcache;
+	RECT3D_NODE         *index;
+} RectTree3DGeomCache;
+
+static int
+RectTree3DBuilder(const LWGEOM *lwgeom, GeomCache *cache)
+{
+	RectTree3DGeomCache *rect_cache = (RectTree3DGeomCache*)cache;
+	RECT3D_NODE *tree = rect3d_tree_from_lwgeom(lwgeom);
+
+	if ( rect_cache->index )
+	{
+		rect3d_tree_free(rect_cache->index);
+		rect_cache->index = 0;
+	}
+	if ( ! tree )
+		return LW_FAILURE;
+
+	rect_cache->index = tree;
+	return LW_SUCCESS;
+}
+
+static int
+RectTree3DFreer(GeomCache *cache)
+{
+	RectTree3DGeomCache *rect_cache = (RectTree3DGeomCache*)cache;
+	if ( rect_cache->index )
+	{
+		rect3d_tree_free(rect_cache->index);
+		rect_cache->index = 0;
+		rect_cache->gcache.argnum = 0;
+	}
+	return LW_SUCCESS;
+}
+
+static GeomCache *
+RectTree3DAllocator(void)
+{
+	RectTree3DGeomCache *cache = palloc(sizeof(RectTree3DGeomCache));
+	memset(cache, 0, sizeof(RectTree3DGeomCache));
+	return (GeomCache*)cache;
+}
+
+static GeomCacheMethods RectTree3DCacheMethods =
+{
+	RECT3D_CACHE_ENTRY,
+	RectTree3DBuilder,
+	RectTree3DFreer,
+	RectTree3DAllocator
+};
+
+int
+RectTree3DCachedDistance(FunctionCallInfo fcinfo,
+                         const GSERIALIZED *g1, const GSERIALIZED *g2,
+                         const LWGEOM *lwg1, const LWGEOM *lwg2,
+                         double threshold, double *distance,
+                         POINT3DZ *p1, POINT3DZ *p2)
+{
+	RectTree3DGeomCache *tree_cache;
+	RECT3D_NODE *n;
+	uint32_t nv1, nv2;
+
+	/* Without Z the 3D functions measure in 2D */
+	if (!lwgeom_has_z(lwg1) || !lwgeom_has_z(lwg2))
+		return LW_FAILURE;
+
+	if (lwgeom_is_empty(lwg1) || lwgeom_is_empty(lwg2))
+		return LW_FAILURE;
+
+	/* Two points, nothing to gain */
+	if (lwg1->type == POINTTYPE && lwg2->type == POINTTYPE)
+		return LW_FAILURE;
+
+	/* Not worth a lookup unless one side is complex */
+	nv1 = lwgeom_count_vertices(lwg1);
+	nv2 = lwgeom_count_vertices(lwg2);
+	if (nv1 < RECT_TREE_CACHE_MIN_VERTICES && nv2 < RECT_TREE_CACHE_MIN_VERTICES)
+		return LW_FAILURE;
+
+	tree_cache = (RectTree3DGeomCache*)GetGeomCache(fcinfo, &RectTree3DCacheMethods, g1, g2);
+	if (!tree_cache || !tree_cache->gcache.argnum)
+		return LW_FAILURE;
+
+	/* The repeated side may be the simple one */
+	if ((tree_cache->gcache.argnum == 1 ? nv1 : nv2) < RECT_TREE_CACHE_MIN_VERTICES)
+		return LW_FAILURE;
+
+	/* Tree the other argument for this call only */
+	n = rect3d_tree_from_lwgeom(tree_cache->gcache.argnum == 1 ? lwg2 : lwg1);
+	if (!n)
+		return LW_FAILURE;
+
+	/* Keep the first argument first, for the closest points */
+	if (tree_cache->gcache.argnum == 1)
+		*distance = rect3d_tree_distance_tree(tree_cache->index, n, threshold, p1, p2);
+	else
+		*distance = rect3d_tree_distance_tree(n, tree_cache->index, threshold, p1, p2);
+
+	rect3d_tree_free(n);
+	return LW_SUCCESS;
+}
+
+
 /**********************************************************************
 * ST_DistanceRectTree
 **********************************************************************/
@@ -196,3 +441,125 @@ Datum ST_DistanceRectTreeCached(PG_FUNCTION_ARGS)
 
 	PG_RETURN_NULL();
 }
+
+
+/**********************************************************************
+* ST_DWithinMany
+**********************************************************************/
+
+/**
+* ST_DWithinMany(geom, geom[], tolerance) is ST_DWithin(geom, geom[i],
+* tolerance) for each element of the array, with NULL for the NULL
+* elements. The first argument is deserialized and treed only once
+* for the whole array.
+*/
+PG_FUNCTION_INFO_V1(ST_DWithinMany);
+Datum ST_DWithinMany(PG_FUNCTION_ARGS)
+{
+	GSERIALIZED *geom = PG_GETARG_GSERIALIZED_P(0);
+	ArrayType *array = PG_GETARG_ARRAYTYPE_P(1);
+	double tolerance = PG_GETARG_FLOAT8(2);
+	int nelems = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+	LWGEOM *lwgeom;
+	RECT_NODE *tree = NULL;
+	GBOX box;
+	int has_box;
+	ArrayIterator iterator;
+	ArrayType *result;
+	Datum *values;
+	bool *nulls;
+	Datum value;
+	bool isnull;
+	int i = 0;
+
+	if ( tolerance < 0 )
+	{
+		elog(ERROR,"Tolerance cannot be less than zero\n");
+		PG_RETURN_NULL();
+	}
+
+	if (nelems == 0)
+		PG_RETURN_ARRAYTYPE_P(construct_empty_array(BOOLOID));
+
+	lwgeom = lwgeom_from_gserialized(geom);
+
+	/* Nothing further than tolerance from the box can be within it */
+	has_box = !lwgeom_is_empty(lwgeom) && gserialized_get_gbox_p(geom, &box) == LW_SUCCESS;
+	if (has_box)
+		gbox_expand(&box, tolerance);
+
+	values = palloc(sizeof(Datum) * nelems);
+	nulls = palloc(sizeof(bool) * nelems);
+
+#if POSTGIS_PGSQL_VERSION >= 95
+	iterator = array_create_iterator(array, 0, NULL);
+#else
+	iterator = array_create_iterator(array, 0);
+#endif
+
+	while (array_iterate(iterator, &value, &isnull))
+	{
+		GSERIALIZED *elem;
+		LWGEOM *lwelem;
+		GBOX elem_box;
+		double mindist;
+
+		nulls[i] = isnull;
+		values[i] = BoolGetDatum(false);
+		if (isnull)
+		{
+			i++;
+			continue;
+		}
+
+		elem = (GSERIALIZED *)PG_DETOAST_DATUM(value);
+		error_if_srid_mismatch(gserialized_get_srid(geom), gserialized_get_srid(elem));
+
+		if (has_box && gserialized_get_gbox_p(elem, &elem_box) == LW_SUCCESS &&
+		    !gbox_overlaps_2d(&box, &elem_box))
+		{
+			mindist = FLT_MAX;
+		}
+		else
+		{
+			lwelem = lwgeom_from_gserialized(elem);
+
+			if (!lwgeom_is_empty(lwgeom) && !lwgeom_is_empty(lwelem) &&
+			    rect_tree_distance_supported(lwgeom, lwelem))
+			{
+				RECT_NODE *n = rect_tree_from_lwgeom(lwelem);
+				if (!tree)
+					tree = rect_tree_from_lwgeom(lwgeom);
+				mindist = (tree && n) ? rect_tree_distance_tree(tree, n, tolerance) :
+				          lwgeom_mindistance2d_tolerance(lwgeom, lwelem, tolerance);
+				if (n)
+					rect_tree_free(n);
+			}
+			else
+			{
+				/* Empties come back as FLT_MAX, so false */
+				mindist = lwgeom_mindistance2d_tolerance(lwgeom, lwelem, tolerance);
+			}
+
+			lwgeom_free(lwelem);
+		}
+
+		values[i] = BoolGetDatum(tolerance >= mindist);
+		if ((Pointer)elem != DatumGetPointer(value))
+			pfree(elem);
+
+		CHECK_FOR_INTERRUPTS();
+		i++;
+	}
+
+	array_free_iterator(iterator);
+	if (tree)
+		rect_tree_free(tree);
+	lwgeom_free(lwgeom);
+
+	result = construct_md_array(values, nulls, ARR_NDIM(array), ARR_DIMS(array), ARR_LBOUND(array),
+	                            BOOLOID, 1, true, 'c');
+
+	PG_FREE_IF_COPY(geom, 0);
+	PG_RETURN_ARRAYTYPE_P(result);
+}
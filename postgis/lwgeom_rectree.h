@@ -0,0 +1,61 @@
+/**********************************************************************
+ *
+ * PostGIS - Spatial Types for PostgreSQL
+ * http://postgis.net
+ *
+ * PostGIS is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * PostGIS is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with PostGIS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ **********************************************************************
+ *
+ * ^copyright^
+ *
+ **********************************************************************/
+
+
+#ifndef LWGEOM_RECTREE_H_
+#define LWGEOM_RECTREE_H_ 1
+
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "liblwgeom.h"
+
+/**
+* 2D distance of g1 and g2 (lwg1 and lwg2 deserialized) through the
+* cached rect-tree of whichever of them repeats across calls. The
+* minimum distance search stops once under threshold, the maximum
+* distance one (with maximum set) once over a positive threshold.
+* Returns LW_FAILURE, leaving distance alone, if there is no tree
+* (yet) or the tree can't answer exactly for these inputs.
+*/
+int RectTreeCachedDistance(FunctionCallInfo fcinfo,
+                           const GSERIALIZED *g1, const GSERIALIZED *g2,
+                           const LWGEOM *lwg1, const LWGEOM *lwg2,
+                           int maximum, double threshold, double *distance);
+
+/**
+* 3D distance of g1 and g2 (lwg1 and lwg2 deserialized) through the
+* cached 3D tree of whichever of them repeats across calls, stopping
+* once under threshold. If p1 and p2 are not NULL they get the
+* closest points, on g1 and on g2. Returns LW_FAILURE, leaving
+* everything alone, if there is no tree (yet) or the inputs are not
+* both 3D points, lines, polygons or collections of those.
+*/
+int RectTree3DCachedDistance(FunctionCallInfo fcinfo,
+                             const GSERIALIZED *g1, const GSERIALIZED *g2,
+                             const LWGEOM *lwg1, const LWGEOM *lwg2,
+                             double threshold, double *distance,
+                             POINT3DZ *p1, POINT3DZ *p2);
+
+#endif /* LWGEOM_RECTREE_H_ */
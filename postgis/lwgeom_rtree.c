@@ -24,6 +24,8 @@
 
 
 #include <assert.h>
+#include <float.h>
+#include <math.h>
 
 #include "../postgis_config.h"
 #include "lwgeom_pg.h"
@@ -31,10 +33,12 @@
 #include "liblwgeom_internal.h"         /* For FP comparators. */
 #include "lwgeom_cache.h"
 #include "lwgeom_rtree.h"
+#include "lwgeom_functions_analytic.h"
 
 
 /* Prototypes */
 static void RTreeFree(RTREE_NODE* root);
+static void RTreeGridFree(RTREE_GRID* grid);
 
 /**
 * Allocate a fresh clean RTREE_POLY_CACHE
@@ -88,9 +92,12 @@ RTreeCacheClear(RTREE_POLY_CACHE* cache)
 	}
 	lwfree(cache->ringIndices);
 	lwfree(cache->ringCounts);
+	if (cache->grid)
+		RTreeGridFree(cache->grid);
 	cache->ringIndices = 0;
 	cache->ringCounts = 0;
 	cache->polyCount = 0;
+	cache->grid = 0;
 }
 
 
@@ -308,32 +315,346 @@ RTreeMergeMultiLines(LWMLINE *line1, LWMLINE *line2)
 
 
 /**
-* Callback function sent into the GetGeomCache generic caching system. Given a
-* LWGEOM* this function builds and stores an RTREE_POLY_CACHE into the provided
-* GeomCache object.
+* Frees a grid and its arrays.
+*/
+static void
+RTreeGridFree(RTREE_GRID* grid)
+{
+	lwfree(grid->cells);
+	lwfree(grid->edge_offsets);
+	lwfree(grid->edge_ids);
+	lwfree(grid->points);
+	lwfree(grid);
+}
+
+/**
+* Index of the row or column holding value, clamped to the grid.
+*/
+static inline uint32_t
+RTreeGridIndex(double value, double min, double size, uint32_t n)
+{
+	double f = floor((value - min) / size);
+	if (!(f > 0))
+		return 0;
+	if (f >= n)
+		return n - 1;
+	return (uint32_t)f;
+}
+
+/**
+* Returns 1 if the segments a1-a2 and b1-b2 touch or cross, 0 otherwise.
 */
 static int
-RTreeBuilder(const LWGEOM* lwgeom, GeomCache* cache)
+RTreeGridSegmentsTouch(const POINT2D *a1, const POINT2D *a2, const POINT2D *b1, const POINT2D *b2)
+{
+	double s1, s2;
+
+	if (FP_MAX(a1->x, a2->x) < FP_MIN(b1->x, b2->x) ||
+	    FP_MIN(a1->x, a2->x) > FP_MAX(b1->x, b2->x) ||
+	    FP_MAX(a1->y, a2->y) < FP_MIN(b1->y, b2->y) ||
+	    FP_MIN(a1->y, a2->y) > FP_MAX(b1->y, b2->y))
+		return 0;
+
+	s1 = (b2->x - b1->x) * (a1->y - b1->y) - (a1->x - b1->x) * (b2->y - b1->y);
+	s2 = (b2->x - b1->x) * (a2->y - b1->y) - (a2->x - b1->x) * (b2->y - b1->y);
+	if ((s1 > 0 && s2 > 0) || (s1 < 0 && s2 < 0))
+		return 0;
+
+	s1 = (a2->x - a1->x) * (b1->y - a1->y) - (b1->x - a1->x) * (a2->y - a1->y);
+	s2 = (a2->x - a1->x) * (b2->y - a1->y) - (b2->x - a1->x) * (a2->y - a1->y);
+	if ((s1 > 0 && s2 > 0) || (s1 < 0 && s2 < 0))
+		return 0;
+
+	return 1;
+}
+
+/**
+* Registers the edge starting at points[edge] with every cell it may
+* touch. Cells are widened by a small slack, so that rounding never
+* leaves out a cell the edge actually reaches. Without fill, the edges
+* of each cell are only counted in edge_offsets[cell+1].
+*/
+static void
+RTreeGridAddEdge(RTREE_GRID *grid, uint32_t edge, uint32_t *fill)
+{
+	const POINT2D *p1 = &(grid->points[edge]);
+	const POINT2D *p2 = &(grid->points[edge + 1]);
+	double slack_x = grid->cell_width * 1e-6 + FP_MAX(fabs(grid->xmin), fabs(grid->xmax)) * 1e-12;
+	double slack_y = grid->cell_height * 1e-6 + FP_MAX(fabs(grid->ymin), fabs(grid->ymax)) * 1e-12;
+	double exmin = FP_MIN(p1->x, p2->x);
+	double exmax = FP_MAX(p1->x, p2->x);
+	double eymin = FP_MIN(p1->y, p2->y) - slack_y;
+	double eymax = FP_MAX(p1->y, p2->y) + slack_y;
+	double dx = p2->x - p1->x;
+	double dy = p2->y - p1->y;
+	uint32_t i, i0, i1, j, j0, j1;
+
+	i0 = RTreeGridIndex(exmin - slack_x, grid->xmin, grid->cell_width, grid->nx);
+	i1 = RTreeGridIndex(exmax + slack_x, grid->xmin, grid->cell_width, grid->nx);
+
+	for (i = i0; i <= i1; i++)
+	{
+		double ylo = eymin;
+		double yhi = eymax;
+
+		/* Only the rows the part of the edge within this column spans */
+		if (i0 != i1)
+		{
+			double xl = FP_MAX(exmin, grid->xmin + i * grid->cell_width - slack_x);
+			double xr = FP_MIN(exmax, grid->xmin + (i + 1) * grid->cell_width + slack_x);
+			double yl = p1->y + (xl - p1->x) * dy / dx;
+			double yr = p1->y + (xr - p1->x) * dy / dx;
+			/* Steep edges amplify the rounding of xl and xr */
+			double err = 4 * DBL_EPSILON * fabs(dy) * (fabs(p1->x) + fabs(xl) + fabs(xr)) / fabs(dx);
+
+			ylo = FP_MAX(ylo, FP_MIN(yl, yr) - slack_y - err);
+			yhi = FP_MIN(yhi, FP_MAX(yl, yr) + slack_y + err);
+		}
+
+		j0 = RTreeGridIndex(ylo, grid->ymin, grid->cell_height, grid->ny);
+		j1 = RTreeGridIndex(yhi, grid->ymin, grid->cell_height, grid->ny);
+		for (j = j0; j <= j1; j++)
+		{
+			uint32_t cell = j * grid->nx + i;
+			if (fill)
+				grid->edge_ids[fill[cell]++] = edge;
+			else
+				grid->edge_offsets[cell + 1]++;
+		}
+	}
+}
+
+/**
+* Full P-i-P test of the center of a cell, through the rtree.
+*/
+static int
+RTreeGridCellCenter(const RTREE_GRID *grid, RTREE_POLY_CACHE *index, uint32_t cell)
+{
+	LWPOINT *point;
+	int result;
+
+	point = lwpoint_make2d(SRID_UNKNOWN,
+	                       grid->xmin + (cell % grid->nx + 0.5) * grid->cell_width,
+	                       grid->ymin + (cell / grid->nx + 0.5) * grid->cell_height);
+	result = point_in_multipolygon_rtree(index->ringIndices, index->polyCount, index->ringCounts, point);
+	lwpoint_free(point);
+	return result;
+}
+
+/**
+* Builds the grid of a (multi)polygon already indexed by the rtree, or
+* returns NULL for polygons that are small or flat.
+*
+* A cell no edge touches has the same P-i-P result in all its points,
+* as have its neighbours touched by no edge either, so each such group
+* of cells is flood filled from a single test of its first center. The
+* other cells keep the result of their center, which also holds for any
+* point of the cell the center can be joined to without meeting an edge.
+*/
+static RTREE_GRID*
+RTreeGridCreate(LWPOLY **polys, uint32_t npolys, RTREE_POLY_CACHE *index)
+{
+	RTREE_GRID *grid;
+	uint32_t p, r, k, c, npoints = 0, nedges = 0, ncells, edge;
+	uint32_t *fill, *queue;
+	double width, height;
+
+	for (p = 0; p < npolys; p++)
+	{
+		for (r = 0; r < polys[p]->nrings; r++)
+		{
+			if (polys[p]->rings[r]->npoints < 2)
+				continue;
+			npoints += polys[p]->rings[r]->npoints;
+			nedges += polys[p]->rings[r]->npoints - 1;
+		}
+	}
+
+	if (nedges < RTREE_GRID_MIN_EDGES)
+		return NULL;
+
+	grid = lwalloc(sizeof(RTREE_GRID));
+	memset(grid, 0, sizeof(RTREE_GRID));
+	grid->points = lwalloc(sizeof(POINT2D) * npoints);
+	grid->xmin = grid->ymin = DBL_MAX;
+	grid->xmax = grid->ymax = -DBL_MAX;
+
+	/* Copy the vertices, noting the first vertex of each edge */
+	fill = lwalloc(sizeof(uint32_t) * nedges);
+	npoints = nedges = 0;
+	for (p = 0; p < npolys; p++)
+	{
+		for (r = 0; r < polys[p]->nrings; r++)
+		{
+			POINTARRAY *pa = polys[p]->rings[r];
+			if (pa->npoints < 2)
+				continue;
+			for (k = 0; k < pa->npoints; k++)
+			{
+				POINT2D *pt = &(grid->points[npoints + k]);
+				getPoint2d_p(pa, k, pt);
+				grid->xmin = FP_MIN(grid->xmin, pt->x);
+				grid->xmax = FP_MAX(grid->xmax, pt->x);
+				grid->ymin = FP_MIN(grid->ymin, pt->y);
+				grid->ymax = FP_MAX(grid->ymax, pt->y);
+				if (k + 1 < pa->npoints)
+					fill[nedges++] = npoints + k;
+			}
+			npoints += pa->npoints;
+		}
+	}
+
+	width = grid->xmax - grid->xmin;
+	height = grid->ymax - grid->ymin;
+	if (!(width > 0 && height > 0))
+	{
+		lwfree(fill);
+		lwfree(grid->points);
+		lwfree(grid);
+		return NULL;
+	}
+
+	/* About one cell per edge, about square */
+	ncells = FP_MIN(nedges, RTREE_GRID_MAX_CELLS);
+	grid->nx = (uint32_t)FP_MIN(ncells, FP_MAX(1, ceil(sqrt(ncells * width / height))));
+	grid->ny = FP_MAX(1, ncells / grid->nx);
+	grid->cell_width = width / grid->nx;
+	grid->cell_height = height / grid->ny;
+	ncells = grid->nx * grid->ny;
+
+	POSTGIS_DEBUGF(3, "RTreeGridCreate %d edges on a %d x %d grid", nedges, grid->nx, grid->ny);
+
+	/* Count the edges of each cell, then lay them out cell by cell */
+	grid->edge_offsets = lwalloc(sizeof(uint32_t) * (ncells + 1));
+	memset(grid->edge_offsets, 0, sizeof(uint32_t) * (ncells + 1));
+	for (edge = 0; edge < nedges; edge++)
+		RTreeGridAddEdge(grid, fill[edge], NULL);
+	for (c = 0; c < ncells; c++)
+		grid->edge_offsets[c + 1] += grid->edge_offsets[c];
+
+	queue = lwalloc(sizeof(uint32_t) * ncells);
+	memcpy(queue, grid->edge_offsets, sizeof(uint32_t) * ncells);
+	grid->edge_ids = lwalloc(sizeof(uint32_t) * FP_MAX(1, grid->edge_offsets[ncells]));
+	for (edge = 0; edge < nedges; edge++)
+		RTreeGridAddEdge(grid, fill[edge], queue);
+	lwfree(fill);
+
+	/* Classify the cells, RTREE_GRID_BOUNDARY + 1 marks the ones not done yet */
+	grid->cells = lwalloc(ncells);
+	memset(grid->cells, RTREE_GRID_BOUNDARY + 1, ncells);
+	for (c = 0; c < ncells; c++)
+	{
+		uint32_t head, tail;
+		uint8_t state;
+		int result;
+
+		if (grid->cells[c] != RTREE_GRID_BOUNDARY + 1)
+			continue;
+
+		result = RTreeGridCellCenter(grid, index, c);
+
+		if (grid->edge_offsets[c] != grid->edge_offsets[c + 1])
+		{
+			grid->cells[c] = result == 1 ? RTREE_GRID_BOUNDARY_INSIDE :
+			                 result == -1 ? RTREE_GRID_BOUNDARY_OUTSIDE : RTREE_GRID_BOUNDARY;
+			continue;
+		}
+
+		/* Should not happen with no edge around, but play safe */
+		if (result == 0)
+		{
+			grid->cells[c] = RTREE_GRID_BOUNDARY;
+			continue;
+		}
+
+		state = result == 1 ? RTREE_GRID_INSIDE : RTREE_GRID_OUTSIDE;
+		grid->cells[c] = state;
+		head = tail = 0;
+		queue[tail++] = c;
+		while (head < tail)
+		{
+			uint32_t cur = queue[head++];
+			uint32_t col = cur % grid->nx;
+			uint32_t next[4];
+			int n = 0;
+
+			if (col > 0) next[n++] = cur - 1;
+			if (col + 1 < grid->nx) next[n++] = cur + 1;
+			if (cur >= grid->nx) next[n++] = cur - grid->nx;
+			if (cur + grid->nx < ncells) next[n++] = cur + grid->nx;
+
+			while (n-- > 0)
+			{
+				uint32_t nb = next[n];
+				if (grid->cells[nb] == RTREE_GRID_BOUNDARY + 1 &&
+				    grid->edge_offsets[nb] == grid->edge_offsets[nb + 1])
+				{
+					grid->cells[nb] = state;
+					queue[tail++] = nb;
+				}
+			}
+		}
+	}
+	lwfree(queue);
+
+	return grid;
+}
+
+int
+RTreeGridPointInPolygon(const RTREE_GRID *grid, const POINT2D *pt)
+{
+	uint32_t i, j, cell, k;
+	POINT2D center;
+
+	if (isnan(pt->x) || isnan(pt->y))
+		return RTREE_GRID_UNKNOWN;
+
+	/* Beyond the extent of the vertices no ring winds around the point */
+	if (pt->x < grid->xmin || pt->x > grid->xmax ||
+	    pt->y < grid->ymin || pt->y > grid->ymax)
+		return -1;
+
+	i = RTreeGridIndex(pt->x, grid->xmin, grid->cell_width, grid->nx);
+	j = RTreeGridIndex(pt->y, grid->ymin, grid->cell_height, grid->ny);
+	cell = j * grid->nx + i;
+
+	switch (grid->cells[cell])
+	{
+		case RTREE_GRID_OUTSIDE:
+			return -1;
+		case RTREE_GRID_INSIDE:
+			return 1;
+		case RTREE_GRID_BOUNDARY:
+			return RTREE_GRID_UNKNOWN;
+		default:
+			break;
+	}
+
+	center.x = grid->xmin + (i + 0.5) * grid->cell_width;
+	center.y = grid->ymin + (j + 0.5) * grid->cell_height;
+	for (k = grid->edge_offsets[cell]; k < grid->edge_offsets[cell + 1]; k++)
+	{
+		const POINT2D *seg = &(grid->points[grid->edge_ids[k]]);
+		if (RTreeGridSegmentsTouch(&center, pt, seg, seg + 1))
+			return RTREE_GRID_UNKNOWN;
+	}
+
+	return grid->cells[cell] == RTREE_GRID_BOUNDARY_INSIDE ? 1 : -1;
+}
+
+
+RTREE_POLY_CACHE *
+RTreePolyCacheCreate(const LWGEOM* lwgeom)
 {
 	uint32_t i, p, r;
 	LWMPOLY *mpoly;
 	LWPOLY *poly;
 	int nrings;
-	RTreeGeomCache* rtree_cache = (RTreeGeomCache*)cache;
 	RTREE_POLY_CACHE* currentCache;
 
-	if ( ! cache )
-		return LW_FAILURE;
-
-	if ( rtree_cache->index )
-	{
-		lwpgerror("RTreeBuilder asked to build index where one already exists.");
-		return LW_FAILURE;
-	}
-
 	if (lwgeom->type == MULTIPOLYGONTYPE)
 	{
-		POSTGIS_DEBUG(2, "RTreeBuilder MULTIPOLYGON");
+		POSTGIS_DEBUG(2, "RTreePolyCacheCreate MULTIPOLYGON");
 		mpoly = (LWMPOLY *)lwgeom;
 		nrings = 0;
 		/*
@@ -361,11 +682,12 @@ RTreeBuilder(const LWGEOM* lwgeom, GeomCache* cache)
 				i++;
 			}
 		}
-		rtree_cache->index = currentCache;
+		currentCache->grid = RTreeGridCreate(mpoly->geoms, mpoly->ngeoms, currentCache);
+		return currentCache;
 	}
 	else if ( lwgeom->type == POLYGONTYPE )
 	{
-		POSTGIS_DEBUG(2, "RTreeBuilder POLYGON");
+		POSTGIS_DEBUG(2, "RTreePolyCacheCreate POLYGON");
 		poly = (LWPOLY *)lwgeom;
 		currentCache = RTreeCacheCreate();
 		currentCache->polyCount = 1;
@@ -379,9 +701,43 @@ RTreeBuilder(const LWGEOM* lwgeom, GeomCache* cache)
 		{
 			currentCache->ringIndices[i] = RTreeCreate(poly->rings[i]);
 		}
-		rtree_cache->index = currentCache;
+		currentCache->grid = RTreeGridCreate(&poly, 1, currentCache);
+		return currentCache;
+	}
+
+	return NULL;
+}
+
+void
+RTreePolyCacheFree(RTREE_POLY_CACHE* index)
+{
+	if ( ! index )
+		return;
+	RTreeCacheClear(index);
+	lwfree(index);
+}
+
+/**
+* Callback function sent into the GetGeomCache generic caching system. Given a
+* LWGEOM* this function builds and stores an RTREE_POLY_CACHE into the provided
+* GeomCache object.
+*/
+static int
+RTreeBuilder(const LWGEOM* lwgeom, GeomCache* cache)
+{
+	RTreeGeomCache* rtree_cache = (RTreeGeomCache*)cache;
+
+	if ( ! cache )
+		return LW_FAILURE;
+
+	if ( rtree_cache->index )
+	{
+		lwpgerror("RTreeBuilder asked to build index where one already exists.");
+		return LW_FAILURE;
 	}
-	else
+
+	rtree_cache->index = RTreePolyCacheCreate(lwgeom);
+	if ( ! rtree_cache->index )
 	{
 		/* Uh oh, shouldn't be here. */
 		lwpgerror("RTreeBuilder got asked to build index on non-polygon");
@@ -404,8 +760,7 @@ RTreeFreer(GeomCache* cache)
 
 	if ( rtree_cache->index )
 	{
-		RTreeCacheClear(rtree_cache->index);
-		lwfree(rtree_cache->index);
+		RTreePolyCacheFree(rtree_cache->index);
 		rtree_cache->index = 0;
 		rtree_cache->gcache.argnum = 0;
 	}
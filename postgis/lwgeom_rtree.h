@@ -53,13 +53,65 @@ typedef struct rtree_node
 RTREE_NODE;
 
 /**
-* The tree structure used for fast P-i-P tests by point_in_multipolygon_rtree()
+* States of the cells of an RTREE_GRID. Cells crossed by no edge are
+* wholly outside or inside. The other cells record whether their center
+* is outside or inside, or that it sits on the boundary.
+*/
+#define RTREE_GRID_OUTSIDE 0
+#define RTREE_GRID_INSIDE 1
+#define RTREE_GRID_BOUNDARY_OUTSIDE 2
+#define RTREE_GRID_BOUNDARY_INSIDE 3
+#define RTREE_GRID_BOUNDARY 4
+
+/**
+* Returned by RTreeGridPointInPolygon() when the grid cannot answer
+* and the point has to go through point_in_multipolygon_rtree()
+*/
+#define RTREE_GRID_UNKNOWN 2
+
+/**
+* Polygons with fewer edges than this are only indexed by the rtree
+*/
+#define RTREE_GRID_MIN_EDGES 512
+
+/**
+* Upper bound on the number of cells of an RTREE_GRID
+*/
+#define RTREE_GRID_MAX_CELLS (1<<20)
+
+/**
+* A regular grid over the extent of a (multi)polygon, about one cell per
+* edge, for constant time P-i-P tests on large polygons. The edges
+* touching a cell are listed in edge_ids[edge_offsets[cell]] up to
+* edge_ids[edge_offsets[cell+1]], as indexes of their first vertex in
+* points, which holds the vertices of all the rings one after another.
+*/
+typedef struct
+{
+	double xmin;
+	double ymin;
+	double xmax;
+	double ymax;
+	double cell_width;
+	double cell_height;
+	uint32_t nx;
+	uint32_t ny;
+	uint8_t *cells;
+	uint32_t *edge_offsets;
+	uint32_t *edge_ids;
+	POINT2D *points;
+} RTREE_GRID;
+
+/**
+* The tree structure used for fast P-i-P tests by point_in_multipolygon_rtree(),
+* and the grid used ahead of it on large polygons.
 */
 typedef struct
 {
 	RTREE_NODE **ringIndices;
 	int* ringCounts;
 	int polyCount;
+	RTREE_GRID *grid;
 } RTREE_POLY_CACHE;
 
 
@@ -75,6 +127,23 @@ typedef struct
 LWMLINE *RTreeFindLineSegments(RTREE_NODE *root, double value);
 
 
+/**
+* Locates a point in the grid of a large polygon. Returns -1 outside,
+* 1 inside, or RTREE_GRID_UNKNOWN when the point is close enough to
+* the boundary to need the full test. Never returns 0 (on the boundary).
+*/
+int RTreeGridPointInPolygon(const RTREE_GRID *grid, const POINT2D *pt);
+
+
+/**
+* Builds the P-i-P index of a polygon or multipolygon outside of any
+* cache, for callers testing many points against it in one call.
+* Returns NULL for other types. Free with RTreePolyCacheFree().
+*/
+RTREE_POLY_CACHE *RTreePolyCacheCreate(const LWGEOM *lwgeom);
+void RTreePolyCacheFree(RTREE_POLY_CACHE *index);
+
+
 /**
 * Checks for a cache hit against the provided geometry and returns
 * a pre-built index structure (RTREE_POLY_CACHE) if one exists. Otherwise
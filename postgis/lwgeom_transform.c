@@ -25,7 +25,9 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "commands/trigger.h"
 #include "utils/builtins.h"
+#include "utils/inval.h"
 
 #include "../postgis_config.h"
 #include "liblwgeom.h"
@@ -35,6 +37,7 @@
 Datum transform(PG_FUNCTION_ARGS);
 Datum transform_geom(PG_FUNCTION_ARGS);
 Datum postgis_proj_version(PG_FUNCTION_ARGS);
+Datum postgis_srs_cache_invalidate(PG_FUNCTION_ARGS);
 
 
 
@@ -52,6 +55,8 @@ Datum transform(PG_FUNCTION_ARGS)
 	LWGEOM *lwgeom;
 	projPJ input_pj, output_pj;
 	int32 output_srid, input_srid;
+	Proj4Cache proj_cache;
+	int input_kind, output_kind;
 
 	output_srid = PG_GETARG_INT32(1);
 	if (output_srid == SRID_UNKNOWN)
@@ -81,9 +86,19 @@ Datum transform(PG_FUNCTION_ARGS)
 		PG_RETURN_NULL();
 	}
 
+	/* Between WGS84 and web mercator we can skip PROJ */
+	proj_cache = GetPROJ4Cache(fcinfo);
+	input_kind = GetSmercKindFromPROJ4Cache(proj_cache, input_srid);
+	output_kind = GetSmercKindFromPROJ4Cache(proj_cache, output_srid);
+
 	/* now we have a geometry, and input/output PJ structs. */
 	lwgeom = lwgeom_from_gserialized(geom);
-	lwgeom_transform(lwgeom, input_pj, output_pj);
+	if ( input_kind == LW_SMERC_LONGLAT && output_kind == LW_SMERC_MERCATOR )
+		lwgeom_transform_smerc(lwgeom, input_pj, output_pj, LW_TRUE);
+	else if ( input_kind == LW_SMERC_MERCATOR && output_kind == LW_SMERC_LONGLAT )
+		lwgeom_transform_smerc(lwgeom, input_pj, output_pj, LW_FALSE);
+	else
+		lwgeom_transform(lwgeom, input_pj, output_pj);
 	lwgeom->srid = output_srid;
 
 	/* Re-compute bbox if input had one (COMPUTE_BBOX TAINTING) */
@@ -203,3 +218,23 @@ Datum postgis_proj_version(PG_FUNCTION_ARGS)
 	text *result = cstring_to_text(ver);
 	PG_RETURN_POINTER(result);
 }
+
+
+/**
+ * Statement trigger on spatial_ref_sys. Queues a relcache
+ * invalidation of the table, which every backend (this one
+ * included) receives once the change is committed, and which
+ * empties its backend PROJ cache.
+ */
+PG_FUNCTION_INFO_V1(postgis_srs_cache_invalidate);
+Datum postgis_srs_cache_invalidate(PG_FUNCTION_ARGS)
+{
+	TriggerData *trigdata = (TriggerData *) fcinfo->context;
+
+	if (!CALLED_AS_TRIGGER(fcinfo))
+		elog(ERROR, "postgis_srs_cache_invalidate: not fired by trigger manager");
+
+	CacheInvalidateRelcache(trigdata->tg_relation);
+
+	return PointerGetDatum(NULL);
+}
@@ -29,6 +29,7 @@
 #include "postgres.h"
 #include "funcapi.h"
 #include "windowapi.h"
+#include "utils/guc.h"
 
 /* PostGIS */
 #include "liblwgeom.h"
@@ -61,6 +62,41 @@ typedef struct
 	dbscan_cluster_result cluster_assignments[1];
 } dbscan_context;
 
+/* Threads used by ST_ClusterDBSCAN and ST_ClusterWithin, see union_dbscan */
+static int cluster_threads = 1;
+
+static void
+assign_cluster_threads(int newval, void *extra)
+{
+	lwgeom_set_cluster_threads(newval);
+}
+
+void
+lwgeom_init_cluster_threads(void)
+{
+	static const char *guc_name = "postgis.cluster_threads";
+
+	/* A prior copy of the library may already have defined */
+	/* the GUC during an upgrade; this copy then clusters on */
+	/* one thread until the next connection. */
+	if ( postgis_guc_find_option(guc_name) )
+		return;
+
+	DefineCustomIntVariable( guc_name, /* name */
+				"Sets the number of threads used to cluster points.", /* short_desc */
+				"ST_ClusterDBSCAN and ST_ClusterWithin search the neighbours of large sets of points on up to this many threads. One disables threading.", /* long_desc */
+				&cluster_threads, /* valueAddr */
+				1, /* bootValue */
+				1, /* minValue */
+				CLUSTER_MAX_THREADS, /* maxValue */
+				PGC_USERSET, /* GucContext context */
+				0, /* int flags */
+				NULL, /* GucIntCheckHook check_hook */
+				assign_cluster_threads, /* GucIntAssignHook assign_hook */
+				NULL  /* GucShowHook show_hook */
+				);
+}
+
 static LWGEOM*
 read_lwgeom_from_partition(WindowObject win_obj, uint32_t i, bool* is_null)
 {
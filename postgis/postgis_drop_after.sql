@@ -191,6 +191,20 @@ IF _postgis_scripts_pgsql_version()::integer >= 96 THEN
         EXCEPTION WHEN OTHERS THEN
             RAISE DEBUG 'Could not update st_union(geometry): %', SQLERRM;
         END;
+-- switch ST_Union agg over to the partial union functions of 2.5.3
+-- without dropping it, as it is often used in views
+        BEGIN
+            UPDATE pg_aggregate SET
+                aggtransfn = 'pgis_geometry_union_parallel_transfn(internal, geometry)'::regprocedure::oid::regproc,
+                aggfinalfn = 'pgis_geometry_union_parallel_finalfn(internal)'::regprocedure::oid::regproc,
+                aggcombinefn = 'pgis_geometry_union_parallel_combinefn(internal, internal)'::regprocedure::oid::regproc,
+                aggserialfn = 'pgis_geometry_union_parallel_serialfn(internal)'::regprocedure::oid::regproc,
+                aggdeserialfn = 'pgis_geometry_union_parallel_deserialfn(bytea, internal)'::regprocedure::oid::regproc
+            WHERE aggfnoid = 'st_union(geometry)'::regprocedure
+              AND aggtransfn::oid = 'pgis_geometry_accum_transfn(internal, geometry)'::regprocedure::oid;
+        EXCEPTION WHEN OTHERS THEN
+            RAISE DEBUG 'Could not update st_union(geometry): %', SQLERRM;
+        END;
 END IF;
 END;
 $$;
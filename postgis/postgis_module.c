@@ -35,6 +35,9 @@
 #include "lwgeom_pg.h"
 #include "geos_c.h"
 #include "lwgeom_backend_api.h"
+#include "lwgeom_geos_prepared.h"
+#include "lwgeom_geos.h"
+#include "gserialized_join.h"
 
 #ifdef HAVE_WAGYU
 #include "lwgeom_wagyu.h"
@@ -75,6 +78,15 @@ _PG_init(void)
 
     /* initialize geometry backend */
     lwgeom_init_backend();
+
+    /* define the backend prepared geometry cache setting */
+    lwgeom_init_prepared_cache();
+
+    /* define the clustering threads setting */
+    lwgeom_init_cluster_threads();
+
+    /* define the spatial join setting and its planner hook */
+    gserialized_join_init();
 }
 
 /*
@@ -203,3 +203,27 @@ select 'ST_PointN9', ST_AsText(ST_PointN('LINESTRING(0 0 0, 1 1 1,2 2 2,3 3 3,4
 
 -- issues with EMPTY --
 select 'ST_Buffer(empty)', ST_AsText(ST_Buffer('POLYGON EMPTY'::geometry, 0.5));
+
+-- coordinate conversion to and from GEOS --
+select 'geosnoop1', ST_AsEWKT(postgis_geos_noop('SRID=4326;LINESTRING(0 0,1.5 2,-3 4)'::geometry));
+select 'geosnoop2', ST_AsEWKT(postgis_geos_noop('POLYGON Z((0 0 1,0 10 2,10 10 3,10 0 4,0 0 1),(1 1 5,1 2 6,2 2 7,1 1 5))'::geometry));
+select 'geosnoop3', ST_AsEWKT(postgis_geos_noop('LINESTRING M(0 0 1,1 1 2)'::geometry));
+select 'geosnoop4', ST_AsEWKT(postgis_geos_noop('MULTIPOLYGON ZM(((0 0 1 9,0 1 2 9,1 1 3 9,0 0 1 9)))'::geometry));
+select 'geosnoop5', ST_AsEWKT(postgis_geos_noop('GEOMETRYCOLLECTION(POINT(1 2),MULTIPOINT(3 4,5 6),LINESTRING EMPTY)'::geometry));
+
+-- ST_Union aggregate, unioning batches along the way --
+SET work_mem = '64kB';
+select 'unionagg1', ST_Area(ST_SymDifference(u, ST_Union(a))) < 1e-6, ST_NumGeometries(u), ST_SRID(u)
+from ( select ST_Union(g) as u, array_agg(g) as a
+       from ( select ST_Buffer(ST_SetSRID(ST_MakePoint(i % 50, i / 50), 3857), 0.6, 8) as g from generate_series(0, 1999) i
+              union all select NULL ) as f ) as f;
+select 'unionagg2', ST_AsText(ST_Union(g)) from ( values (NULL::geometry), (NULL) ) as f(g);
+select 'unionagg3', ST_AsText(ST_Union(g)) from ( values ('POINT EMPTY'::geometry), ('LINESTRING EMPTY') ) as f(g);
+select 'unionagg4', ST_AsText(ST_Union(g)) from ( values ('POINT(1 2)'::geometry) ) as f(g);
+select 'unionagg5', ST_Union(g) from ( select ST_SetSRID(ST_MakePoint(i, i), i / 1000) as g from generate_series(1, 2000) i ) as f;
+RESET work_mem;
+select 'unionagg6', ST_Equals(ST_Union(g), ST_UnaryUnion(ST_Collect(g))), ST_NumGeometries(ST_Union(g)), ST_Area(ST_Union(g))
+from ( select ST_MakeEnvelope((i * 7) % 40, 0, (i * 7) % 40 + 2, 2) as g from generate_series(0, 39) i
+       union all select ST_MakeEnvelope(100, 100, 101, 101)
+       union all select 'MULTIPOLYGON(((300 0,302 0,302 2,300 2,300 0)),((301 0,303 0,303 2,301 2,301 0)))'
+       union all select ST_MakeEnvelope(200, 0, 201, 1) ) as f;
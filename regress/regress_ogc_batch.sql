@@ -0,0 +1,44 @@
+-- Points inside, on the boundary, outside, NULL and empty
+SELECT 'intersects1', ST_IntersectsMany('POLYGON((0 0,10 0,10 10,0 10,0 0))',
+	ARRAY['POINT(5 5)', 'POINT(10 5)', 'POINT(20 5)', NULL, 'POINT EMPTY']::geometry[]);
+SELECT 'contains1', ST_ContainsMany('POLYGON((0 0,10 0,10 10,0 10,0 0))',
+	ARRAY['POINT(5 5)', 'POINT(10 5)', 'POINT(20 5)', NULL, 'POINT EMPTY']::geometry[]);
+SELECT 'dwithin1', ST_DWithinMany('POLYGON((0 0,10 0,10 10,0 10,0 0))',
+	ARRAY['POINT(5 5)', 'POINT(11 5)', 'POINT(20 5)', NULL, 'POINT EMPTY']::geometry[], 1);
+
+-- Multipoints
+SELECT 'intersects2', ST_IntersectsMany('POLYGON((0 0,10 0,10 10,0 10,0 0))',
+	ARRAY['MULTIPOINT(20 20,10 5)', 'MULTIPOINT(20 20,30 30)']::geometry[]);
+SELECT 'contains2', ST_ContainsMany('POLYGON((0 0,10 0,10 10,0 10,0 0))',
+	ARRAY['MULTIPOINT(5 5,10 5)', 'MULTIPOINT(10 5,10 6)', 'MULTIPOINT(5 5,20 5)']::geometry[]);
+
+-- Other types go through GEOS
+SELECT 'intersects3', ST_IntersectsMany('POLYGON((0 0,10 0,10 10,0 10,0 0))',
+	ARRAY['LINESTRING(5 5,20 20)', 'LINESTRING(20 20,30 30)', 'POLYGON((10 10,20 10,20 20,10 10))']::geometry[]);
+SELECT 'contains3', ST_ContainsMany('POLYGON((0 0,10 0,10 10,0 10,0 0))',
+	ARRAY['LINESTRING(1 1,2 2)', 'LINESTRING(5 5,20 20)', 'POLYGON((1 1,2 1,2 2,1 1))']::geometry[]);
+SELECT 'dwithin3', ST_DWithinMany('LINESTRING(0 0,10 0)',
+	ARRAY['LINESTRING(0 2,10 2)', 'LINESTRING(0 3,10 3)', 'POLYGON((-1 -1,11 -1,11 1,-1 1,-1 -1))']::geometry[], 2);
+
+-- A point against polygons
+SELECT 'intersects4', ST_IntersectsMany('POINT(5 5)',
+	ARRAY['POLYGON((0 0,10 0,10 10,0 10,0 0))', 'POLYGON((0 0,1 0,1 1,0 1,0 0))', 'MULTIPOLYGON(((0 0,1 0,1 1,0 0)),((5 5,6 5,6 6,5 5)))']::geometry[]);
+
+-- Empty scalar, empty and multidimensional arrays
+SELECT 'empty1', ST_IntersectsMany('POLYGON EMPTY', ARRAY['POINT(5 5)', NULL]::geometry[]);
+SELECT 'empty2', ST_ContainsMany('POLYGON((0 0,10 0,10 10,0 10,0 0))', '{}'::geometry[]);
+SELECT 'dims', ST_IntersectsMany('POLYGON((0 0,10 0,10 10,0 10,0 0))',
+	ARRAY[['POINT(5 5)', 'POINT(20 5)'], ['POINT(20 20)', 'POINT(1 1)']]::geometry[]);
+SELECT 'lbound', array_lower(ST_DWithinMany('POINT(0 0)', '[3:4]={POINT(0 0),POINT(5 5)}'::geometry[], 1), 1);
+
+-- Same answers as the scalar functions, on a polygon with a hole
+WITH
+poly AS (SELECT 'POLYGON((0 0,10 0,10 10,0 10,0 0),(3 3,7 3,7 7,3 7,3 3))'::geometry AS g),
+pts AS (SELECT array_agg(ST_MakePoint(x * 0.5, y * 0.5) ORDER BY x, y) AS a
+	FROM generate_series(-4, 24) x, generate_series(-4, 24) y)
+SELECT 'scalar', count(*), sum(i::int), sum(c::int), sum(d::int)
+FROM poly, pts,
+	unnest(pts.a, ST_IntersectsMany(poly.g, pts.a), ST_ContainsMany(poly.g, pts.a), ST_DWithinMany(poly.g, pts.a, 1)) AS u(p, i, c, d)
+WHERE i = ST_Intersects(poly.g, p) AND c = ST_Contains(poly.g, p) AND d = ST_DWithin(poly.g, p, 1);
+
+SELECT 'srid', ST_IntersectsMany('SRID=4326;POINT(0 0)', ARRAY['POINT(0 0)']::geometry[]);
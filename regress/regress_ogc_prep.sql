@@ -292,3 +292,91 @@ SELECT 'covers311', ST_Covers('POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))', p) FROM
 ('LINESTRING(1 10, 10 10, 10 8)'),('LINESTRING(1 10, 10 10, 10 8)'),('LINESTRING(1 10, 10 10, 10 8)')
 ) AS v(p);
 
+
+-- Repeated but interleaved inputs, served from several cache entries
+SELECT 'contains320', count(*) FROM generate_series(1,30) AS i
+WHERE ST_Contains(ST_MakeEnvelope(10*(i%3), 0, 10*(i%3)+5, 5), ST_MakePoint(10*(i%3) + CASE WHEN i%2 = 0 THEN 1 ELSE 7 END, 1));
+SELECT 'intersects321', count(*) FROM generate_series(1,30) AS i
+WHERE ST_Intersects(ST_MakePoint(10*(i%3) + CASE WHEN i%2 = 0 THEN 1 ELSE 7 END, 1), ST_MakeEnvelope(10*(i%3), 0, 10*(i%3)+5, 5));
+-- Large constant key, matched by pointer and fingerprint after the first rows
+SELECT 'contains322', count(*) FROM generate_series(1,20) AS i
+WHERE ST_Contains(ST_Buffer('POINT(0 0)'::geometry, 10, 200), ST_MakePoint(i, 0));
+
+-- Backend prepared geometry cache, across statements
+SET postgis.prepared_cache_size = '1MB';
+SELECT 'backendcache330', ST_Contains('POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))', 'LINESTRING(1 1, 2 2)');
+SELECT 'backendcache331', ST_Contains('POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))', 'LINESTRING(1 1, 3 3)');
+SELECT 'backendcache332', ST_Contains('POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))', 'LINESTRING(1 1, 9 9)');
+SELECT 'backendcache333', hits, misses, evictions, entries FROM postgis_prepared_cache_stats();
+SET postgis.prepared_cache_size = 0;
+SELECT 'backendcache334', ST_Contains('POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))', 'LINESTRING(1 1, 2 2)');
+SELECT 'backendcache335', evictions, entries, bytes FROM postgis_prepared_cache_stats();
+RESET postgis.prepared_cache_size;
+
+-- Cache instrumentation
+SELECT 'cachestats340', count(*) FROM postgis_cache_stats();
+SELECT 'cachestats341', postgis_cache_stats_reset();
+SELECT 'cachestats342', ST_Contains('POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))', p) FROM ( VALUES
+('LINESTRING(1 1, 2 2)'),('LINESTRING(1 1, 3 3)'),('LINESTRING(1 1, 4 4)')
+) AS v(p);
+SELECT 'cachestats343', builds, hits, misses, evictions FROM postgis_cache_stats() WHERE cache = 'prepared';
+
+-- GEOS geometry cache, one mask against many geometries
+SELECT 'geoscache350', sum(ST_Area(ST_Intersection(ST_MakeEnvelope(i, i, i+2, i+2), 'POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))'::geometry)))
+FROM generate_series(1,12) AS i;
+SELECT 'geoscache351', sum(ST_Area(ST_Difference('POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))'::geometry, ST_MakeEnvelope(i, i, i+2, i+2))))
+FROM generate_series(1,12) AS i;
+SELECT 'geoscache352', sum(ST_Area(ST_Buffer('POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))'::geometry, i, 'join=mitre')))
+FROM generate_series(1,3) AS i;
+SELECT 'geoscache353', ST_Area(g), ST_IsEmpty(g) FROM (
+SELECT ST_Intersection(ST_MakeEnvelope(i, i, i+2, i+2), 'POLYGON((0 0, 0 10, 10 10, 10 0, 0 0))'::geometry) AS g
+FROM generate_series(9,12) AS i ) AS f;
+
+-- Gridded point in polygon, checked against the GEOS relate matrix
+SELECT 'pipgrid360',
+sum(CASE WHEN ST_Intersects(g, p) = NOT ST_Relate(g, p, 'FF*FF****') THEN 0 ELSE 1 END),
+sum(CASE WHEN ST_Contains(g, p) = ST_Relate(g, p, 'T*****FF*') THEN 0 ELSE 1 END),
+sum(CASE WHEN ST_Within(p, g) = ST_Relate(p, g, 'T*F**F***') THEN 0 ELSE 1 END)
+FROM ( SELECT ST_Difference(ST_Buffer('POINT(0 0)'::geometry, 100, 200), ST_Buffer('POINT(10 10)'::geometry, 30, 100)) AS g ) AS poly,
+LATERAL ( SELECT ST_MakePoint(x, y) AS p FROM generate_series(-110, 110, 5) AS x, generate_series(-110, 110, 5) AS y
+UNION ALL SELECT (ST_DumpPoints(g)).geom ) AS pts;
+SELECT 'pipgrid361',
+sum(CASE WHEN ST_Intersects(g, p) = NOT ST_Relate(g, p, 'FF*FF****') THEN 0 ELSE 1 END),
+sum(CASE WHEN ST_Contains(g, p) = ST_Relate(g, p, 'T*****FF*') THEN 0 ELSE 1 END)
+FROM ( SELECT ST_Collect(ST_Buffer('POINT(0 0)'::geometry, 50, 100), ST_Buffer('POINT(150 0)'::geometry, 50, 100)) AS g ) AS poly,
+LATERAL ( SELECT ST_MakePoint(x, y) AS p FROM generate_series(-60, 210, 3) AS x, generate_series(-60, 60, 3) AS y
+UNION ALL SELECT ST_MakePoint(x, 0) FROM generate_series(-50, 200, 50) AS x ) AS pts;
+
+-- Cached rect-tree distances, checked against the uncached measures
+SELECT 'recttree370',
+sum(CASE WHEN abs(ST_Distance(g, p) - ST_Length(ST_ShortestLine(g, p))) < 1e-9 THEN 0 ELSE 1 END),
+sum(CASE WHEN ST_DWithin(g, p, 2.7) = (ST_Length(ST_ShortestLine(g, p)) <= 2.7) THEN 0 ELSE 1 END),
+sum(CASE WHEN ST_DFullyWithin(g, p, 150.3) = (ST_MaxDistance(g, p) <= 150.3) THEN 0 ELSE 1 END)
+FROM ( SELECT ST_Difference(ST_Buffer('POINT(0 0)'::geometry, 50, 50), ST_Buffer('POINT(10 0)'::geometry, 20, 50)) AS g ) AS poly,
+LATERAL ( SELECT ST_MakePoint(x, y) AS p FROM generate_series(-60, 60, 7) AS x, generate_series(-60, 60, 7) AS y ) AS pts;
+SELECT 'recttree371',
+sum(CASE WHEN abs(ST_Distance(g, p) - ST_Length(ST_ShortestLine(g, p))) < 1e-9 THEN 0 ELSE 1 END),
+sum(CASE WHEN ST_DWithin(p, g, 1.3) = (ST_Length(ST_ShortestLine(g, p)) <= 1.3) THEN 0 ELSE 1 END),
+sum(CASE WHEN ST_DFullyWithin(p, g, 30.3) = (ST_MaxDistance(g, p) <= 30.3) THEN 0 ELSE 1 END)
+FROM ( SELECT ST_Segmentize('LINESTRING(0 0,10 10,20 0,30 10,40 0)'::geometry, 0.5) AS g ) AS line,
+LATERAL ( SELECT ST_MakeLine(ST_MakePoint(x, y), ST_MakePoint(x + 3, y - 2)) AS p FROM generate_series(-5, 45, 4) AS x, generate_series(-5, 15, 2) AS y
+UNION ALL SELECT ST_Collect(ST_MakePoint(x, 5), ST_MakePoint(x, -5)) FROM generate_series(-5, 45, 4) AS x ) AS pts;
+SELECT 'recttree372', builds > 0 FROM postgis_cache_stats() WHERE cache = 'recttree';
+-- A dynamic statement gets a fresh plan, and so no cache, every call
+CREATE FUNCTION recttree_3ddistance(g geometry, p geometry) RETURNS float8 AS $$
+DECLARE
+	d float8;
+BEGIN
+	EXECUTE 'SELECT ST_3DDistance($1, $2)' INTO d USING g, p;
+	RETURN d;
+END;
+$$ LANGUAGE 'plpgsql';
+SELECT 'recttree373',
+sum(CASE WHEN abs(ST_3DDistance(g, p) - recttree_3ddistance(g, p)) < 1e-9 THEN 0 ELSE 1 END),
+sum(CASE WHEN abs(ST_3DDistance(g, p) - ST_3DDistance(ST_3DClosestPoint(g, p), p)) < 1e-9 THEN 0 ELSE 1 END),
+sum(CASE WHEN abs(ST_3DDistance(g, p) - ST_3DLength(ST_3DShortestLine(g, p))) < 1e-9 THEN 0 ELSE 1 END),
+sum(CASE WHEN ST_3DDWithin(p, g, 4.5) = (recttree_3ddistance(g, p) <= 4.5) THEN 0 ELSE 1 END)
+FROM ( SELECT ST_Segmentize('POLYGON((0 0 0,20 0 10,20 20 10,0 20 0,0 0 0),(5 5 2.5,5 15 2.5,15 15 7.5,15 5 7.5,5 5 2.5))'::geometry, 1.0) AS g ) AS poly,
+LATERAL ( SELECT ST_MakePoint(x, y, z) AS p FROM generate_series(-3, 23, 4) AS x, generate_series(-3, 23, 4) AS y, generate_series(-4, 14, 6) AS z ) AS pts;
+SELECT 'recttree374', builds > 0 FROM postgis_cache_stats() WHERE cache = 'recttree3d';
+DROP FUNCTION recttree_3ddistance(geometry, geometry);
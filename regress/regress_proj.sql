@@ -56,5 +56,23 @@ SELECT 12, ST_AsEWKT(ST_Transform(
            ST_GeomFromEWKT('SRID=100002;POINT(16 48)'),
            'invalid projection'));
 
+--- test #13: a change to spatial_ref_sys reaches the cached projections
+UPDATE spatial_ref_sys SET proj4text = '+proj=longlat +ellps=WGS84 +datum=WGS84 +no_defs ' WHERE srid = 100001;
+SELECT 13,ST_AsEWKT(ST_SnapToGrid(ST_transform(ST_GeomFromEWKT('SRID=100002;POINT(16 48)'),100001),10));
+
+--- test #14: web mercator, built in between it and WGS84
+INSERT INTO "spatial_ref_sys" ("srid","auth_name","auth_srid","proj4text") VALUES (100003,'EPSG',100003,'+proj=merc +a=6378137 +b=6378137 +lat_ts=0.0 +lon_0=0.0 +x_0=0.0 +y_0=0 +k=1.0 +units=m +nadgrids=@null +wktext +no_defs');
+SELECT 14,ST_AsEWKT(ST_SnapToGrid(ST_transform(ST_GeomFromEWKT('SRID=100002;LINESTRING(16 48, -73.98 40.75)'),100003),0.01));
+
+--- test #15: same as going through PROJ
+SELECT 15,abs(ST_X(a) - ST_X(b)) < 1e-9, abs(ST_Y(a) - ST_Y(b)) < 1e-9
+FROM ( SELECT ST_transform(g, 100003) a, ST_Transform(g, p1, p3) b
+       FROM ( SELECT ST_GeomFromEWKT('SRID=100002;POINT(16 48)') g,
+              (SELECT proj4text FROM spatial_ref_sys WHERE srid = 100002) p1,
+              (SELECT proj4text FROM spatial_ref_sys WHERE srid = 100003) p3 ) i ) o;
+
+--- test #16: and back
+SELECT 16,round(ST_X(ST_transform(ST_transform(ST_GeomFromEWKT('SRID=100002;POINT(16 48)'),100003), 100002))::numeric,8),round(ST_Y(ST_transform(ST_transform(ST_GeomFromEWKT('SRID=100002;POINT(16 48)'),100003), 100002))::numeric,8);
+
 DELETE FROM spatial_ref_sys WHERE srid >= 100000;
 
@@ -2180,7 +2180,72 @@ select 'selectivity_09', 'estimated', _postgis_selectivity('regular_overdots','g
 select 'selectivity_10', 'actual', 1;
 select 'selectivity_09', 'estimated', _postgis_selectivity('regular_overdots','g','LINESTRING(0 0, 12 12)');
 
+-- Summed-area table against walking the histogram cells
+select 'selectivity_sat_01', count(*) from (values
+  ('LINESTRING(0 0, 11 3.5)'::geometry), ('LINESTRING(5.5 5.5, 11 11)'),
+  ('LINESTRING(1.5 1.5, 2.5 2.5)'), ('LINESTRING(0.3 7.7, 9.1 8.2)'),
+  ('LINESTRING(3.33 0.01, 3.34 10.9)')) as b(g)
+  where abs(_postgis_selectivity('regular_overdots','g',g) -
+            _postgis_selectivity('regular_overdots','g',g,'2w')) > 1e-9;
+select 'selectivity_sat_02', abs(
+  _postgis_join_selectivity('regular_overdots','g','regular_overdots','g') -
+  _postgis_join_selectivity('regular_overdots','g','regular_overdots','g','2w')) < 1e-9;
+
+-- Table with 90% of the features packed in a tiny cluster,
+-- the rest spread over a wide area, which the uniform histogram
+-- cannot resolve, so an adaptive one gets built too
+create table skewed_overdots as
+  select st_makepoint(2 + (i % 100) * 0.0001, 3 + (i / 100) * 0.0001) as g
+  from generate_series(0, 8999) i
+  union all
+  select st_makepoint(-10 + (i % 32) * 0.625, -10 + (i / 32) * 0.625) as g
+  from generate_series(0, 999) i;
+analyze skewed_overdots;
+
+select 'selectivity_skew_01', abs(
+  _postgis_selectivity('skewed_overdots','g','LINESTRING(2 3, 2.005 3.0045)') -
+  (select count(*) from skewed_overdots where g && 'LINESTRING(2 3, 2.005 3.0045)') / 10000.0) < 0.02;
+select 'selectivity_skew_02', abs(
+  _postgis_selectivity('skewed_overdots','g','LINESTRING(2.0025 3.002, 2.1 3.1)') -
+  (select count(*) from skewed_overdots where g && 'LINESTRING(2.0025 3.002, 2.1 3.1)') / 10000.0) < 0.02;
+select 'selectivity_skew_03', abs(
+  _postgis_selectivity('skewed_overdots','g','LINESTRING(-10 -10, 0 0)') -
+  (select count(*) from skewed_overdots where g && 'LINESTRING(-10 -10, 0 0)') / 10000.0) < 0.02;
+
+-- Vertex count statistics, 90% two-point lines and 10% fifty-point lines
+create table vertex_counts as
+  select case when i < 900
+    then st_makeline(st_makepoint(0, i), st_makepoint(1, i))
+    else (select st_makeline(st_makepoint(j, i)) from generate_series(1, 50) j)
+  end as g
+  from generate_series(0, 999) i;
+analyze vertex_counts;
+
+select 'vertex_stats_01', j->>'sample_features', j->>'npoints_avg', j->>'npoints_p95', j->>'npoints_max'
+  from (select _postgis_vertex_stats('vertex_counts', 'g')::json as j) s;
+
+-- Incremental refresh, table first analyzed with one quadrant
+-- empty, then the quadrant is filled in by appended rows
+create table appended_dots as
+  select st_makepoint(0.1 + (i % 100) * 0.2, 0.1 + (i / 100) * 0.2) as g
+  from generate_series(0, 9999) i
+  where (i % 100) < 50 or (i / 100) < 50;
+analyze appended_dots;
+insert into appended_dots
+  select st_makepoint(0.1 + (i % 100) * 0.2, 0.1 + (i / 100) * 0.2) as g
+  from generate_series(0, 9999) i
+  where (i % 100) >= 50 and (i / 100) >= 50;
+
+select 'stats_refresh_01', _postgis_selectivity('appended_dots','g','LINESTRING(10 10, 20 20)') < 0.05;
+select 'stats_refresh_02', postgis_stats_refresh('appended_dots', 'g') > 2000;
+select 'stats_refresh_03', _postgis_selectivity('appended_dots','g','LINESTRING(10 10, 20 20)') between 0.15 and 0.35;
+select 'stats_refresh_04', (_postgis_stats('appended_dots', 'g')::json->>'table_features')::integer > 9500;
+select 'stats_refresh_05', postgis_stats_refresh('appended_dots', 'g');
+
 -- Clean
+drop table if exists appended_dots;
+drop table if exists vertex_counts;
+drop table if exists skewed_overdots;
 drop table if exists regular_overdots;
 drop table if exists regular_overdots_ab;
 
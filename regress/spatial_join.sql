@@ -0,0 +1,45 @@
+CREATE TABLE spatial_join_points(id int, g geometry);
+INSERT INTO spatial_join_points
+SELECT x * 100 + y, ST_MakePoint(x, y)
+FROM generate_series(1, 30) x, generate_series(1, 30) y;
+INSERT INTO spatial_join_points VALUES (-1, NULL), (-2, 'POINT EMPTY');
+
+CREATE TABLE spatial_join_squares(id int, g geometry);
+INSERT INTO spatial_join_squares
+SELECT i * 10 + j, ST_MakeEnvelope(i * 5, j * 5, i * 5 + 3, j * 5 + 3)
+FROM generate_series(0, 5) i, generate_series(0, 5) j;
+INSERT INTO spatial_join_squares VALUES (-1, NULL), (-2, 'POLYGON EMPTY');
+
+ANALYZE spatial_join_points;
+ANALYZE spatial_join_squares;
+
+SET postgis.enable_spatial_join = on;
+SET enable_nestloop = off;
+SET enable_hashjoin = off;
+SET enable_mergejoin = off;
+
+CREATE FUNCTION spatial_join_planned(query text) RETURNS boolean AS $$
+DECLARE
+	line text;
+BEGIN
+	FOR line IN EXECUTE 'EXPLAIN (COSTS OFF) ' || query LOOP
+		IF line LIKE '%SpatialJoin%' THEN
+			RETURN true;
+		END IF;
+	END LOOP;
+	RETURN false;
+END;
+$$ LANGUAGE plpgsql;
+
+SELECT 'plan', spatial_join_planned('SELECT p.id, s.id FROM spatial_join_points p JOIN spatial_join_squares s ON p.g && s.g');
+SELECT '&&', count(*), sum(p.id * s.id)
+FROM spatial_join_points p JOIN spatial_join_squares s ON p.g && s.g;
+SELECT 'plan_intersects', spatial_join_planned('SELECT p.id, s.id FROM spatial_join_points p JOIN spatial_join_squares s ON ST_Intersects(s.g, p.g)');
+SELECT 'intersects', count(*), sum(p.id * s.id)
+FROM spatial_join_points p JOIN spatial_join_squares s ON ST_Intersects(s.g, p.g);
+SELECT 'filter', count(*)
+FROM spatial_join_points p JOIN spatial_join_squares s ON p.g && s.g AND p.id % 2 = s.id % 2;
+
+DROP FUNCTION spatial_join_planned(text);
+DROP TABLE spatial_join_points;
+DROP TABLE spatial_join_squares;
@@ -0,0 +1,70 @@
+-- Index conditions added by the planner support function
+
+CREATE TABLE supportfn_pts AS
+SELECT i AS id, ST_MakePoint(i % 100, i / 100) AS g
+FROM generate_series(0, 9999) i;
+CREATE INDEX supportfn_pts_gix ON supportfn_pts USING GIST (g);
+ANALYZE supportfn_pts;
+
+-- Same points, spread over Z, under an n-d index
+CREATE TABLE supportfn_pts_nd AS
+SELECT i AS id, ST_MakePoint(i % 100, i / 100, (i % 7) * 10) AS g
+FROM generate_series(0, 9999) i;
+CREATE INDEX supportfn_pts_nd_gix ON supportfn_pts_nd USING GIST (g gist_geometry_ops_nd);
+ANALYZE supportfn_pts_nd;
+
+CREATE FUNCTION supportfn_index_cond(query text, cond text) RETURNS boolean AS $$
+DECLARE
+	line text;
+BEGIN
+	FOR line IN EXECUTE 'EXPLAIN (COSTS OFF) ' || query LOOP
+		IF line LIKE '%Index Cond: ' || cond || '%' THEN
+			RETURN true;
+		END IF;
+	END LOOP;
+	RETURN false;
+END;
+$$ LANGUAGE plpgsql;
+
+SET enable_seqscan = off;
+
+SELECT 'plan_intersects', supportfn_index_cond('SELECT id FROM supportfn_pts WHERE ST_Intersects(g, ''POLYGON((10 10,10 20,20 20,20 10,10 10))'')', '(g && ');
+SELECT 'plan_intersects_commuted', supportfn_index_cond('SELECT id FROM supportfn_pts WHERE ST_Intersects(''POLYGON((10 10,10 20,20 20,20 10,10 10))'', g)', '(g && ');
+SELECT 'plan_contains_commuted', supportfn_index_cond('SELECT id FROM supportfn_pts WHERE ST_Contains(''POLYGON((10 10,10 20,20 20,20 10,10 10))'', g)', '(g @ ');
+SELECT 'plan_within', supportfn_index_cond('SELECT id FROM supportfn_pts WHERE ST_Within(g, ''POLYGON((10 10,10 20,20 20,20 10,10 10))'')', '(g @ ');
+SELECT 'plan_dwithin', supportfn_index_cond('SELECT id FROM supportfn_pts WHERE ST_DWithin(g, ''POINT(50 50)'', 5)', '(g && st_expand(');
+SELECT 'plan_dwithin_commuted', supportfn_index_cond('SELECT id FROM supportfn_pts WHERE ST_DWithin(''POINT(50 50)'', g, 5)', '(g && st_expand(');
+-- No &&& for the 2D predicates
+SELECT 'plan_nd_intersects', supportfn_index_cond('SELECT id FROM supportfn_pts_nd WHERE ST_Intersects(g, ''POLYGON((10 10 500,10 20 500,20 20 500,20 10 500,10 10 500))'')', '(g &&& ');
+SELECT 'plan_nd_dwithin', supportfn_index_cond('SELECT id FROM supportfn_pts_nd WHERE ST_DWithin(g, ''POINT(50 50 1000)'', 5)', '(g &&& ');
+
+-- Same rows with and without the index
+SELECT 'intersects_idx', count(*) FROM supportfn_pts WHERE ST_Intersects(g, 'POLYGON((10 10,10 20,20 20,20 10,10 10))');
+SELECT 'intersects_commuted_idx', count(*) FROM supportfn_pts WHERE ST_Intersects('POLYGON((10 10,10 20,20 20,20 10,10 10))', g);
+SELECT 'contains_commuted_idx', count(*) FROM supportfn_pts WHERE ST_Contains('POLYGON((10 10,10 20,20 20,20 10,10 10))', g);
+SELECT 'within_idx', count(*) FROM supportfn_pts WHERE ST_Within(g, 'POLYGON((10 10,10 20,20 20,20 10,10 10))');
+SELECT 'dwithin_idx', count(*) FROM supportfn_pts WHERE ST_DWithin(g, 'POINT(50 50)', 5);
+SELECT 'dwithin_commuted_idx', count(*) FROM supportfn_pts WHERE ST_DWithin('POINT(50 50)', g, 5);
+SELECT 'nd_intersects_idx', count(*) FROM supportfn_pts_nd WHERE ST_Intersects(g, 'POLYGON((10 10 500,10 20 500,20 20 500,20 10 500,10 10 500))');
+SELECT 'nd_dwithin_idx', count(*) FROM supportfn_pts_nd WHERE ST_DWithin(g, 'POINT(50 50 1000)', 5);
+
+SET enable_seqscan = on;
+SET enable_indexscan = off;
+SET enable_bitmapscan = off;
+
+SELECT 'intersects_seq', count(*) FROM supportfn_pts WHERE ST_Intersects(g, 'POLYGON((10 10,10 20,20 20,20 10,10 10))');
+SELECT 'intersects_commuted_seq', count(*) FROM supportfn_pts WHERE ST_Intersects('POLYGON((10 10,10 20,20 20,20 10,10 10))', g);
+SELECT 'contains_commuted_seq', count(*) FROM supportfn_pts WHERE ST_Contains('POLYGON((10 10,10 20,20 20,20 10,10 10))', g);
+SELECT 'within_seq', count(*) FROM supportfn_pts WHERE ST_Within(g, 'POLYGON((10 10,10 20,20 20,20 10,10 10))');
+SELECT 'dwithin_seq', count(*) FROM supportfn_pts WHERE ST_DWithin(g, 'POINT(50 50)', 5);
+SELECT 'dwithin_commuted_seq', count(*) FROM supportfn_pts WHERE ST_DWithin('POINT(50 50)', g, 5);
+SELECT 'nd_intersects_seq', count(*) FROM supportfn_pts_nd WHERE ST_Intersects(g, 'POLYGON((10 10 500,10 20 500,20 20 500,20 10 500,10 10 500))');
+SELECT 'nd_dwithin_seq', count(*) FROM supportfn_pts_nd WHERE ST_DWithin(g, 'POINT(50 50 1000)', 5);
+
+RESET enable_seqscan;
+RESET enable_indexscan;
+RESET enable_bitmapscan;
+
+DROP FUNCTION supportfn_index_cond(text, text);
+DROP TABLE supportfn_pts;
+DROP TABLE supportfn_pts_nd;
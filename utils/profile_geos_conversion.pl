@@ -0,0 +1,113 @@
+#!/usr/bin/perl -w
+
+#
+# Measure the cost of converting geometries to and from GEOS, by
+# comparing postgis_geos_noop, which round trips every geometry
+# through a GEOS geometry, with postgis_noop, which only
+# deserializes and serializes it. Reports the difference in
+# nanoseconds per vertex for 2D and 3D lines.
+#
+
+use Pg;
+use Time::HiRes("gettimeofday");
+
+$VERBOSE = 0;
+$ROWS = 1000;
+$VERTICES = 1000;
+$RUNS = 3;
+
+sub usage
+{
+	local($me) = `basename $0`;
+	chop($me);
+	print STDERR "$me [-v] [-rows <n>] [-vertices <n>] [-runs <n>]\n";
+}
+
+for ($i=0; $i<@ARGV; $i++)
+{
+	if ( $ARGV[$i] eq '-v' )
+	{
+		$VERBOSE++;
+	}
+	elsif ( $ARGV[$i] eq '-rows' )
+	{
+		$ROWS = $ARGV[++$i];
+	}
+	elsif ( $ARGV[$i] eq '-vertices' )
+	{
+		$VERTICES = $ARGV[++$i];
+	}
+	elsif ( $ARGV[$i] eq '-runs' )
+	{
+		$RUNS = $ARGV[++$i];
+	}
+	else
+	{
+		print STDERR "Unknown option $ARGV[$i]:\n";
+		usage();
+		exit(1);
+	}
+}
+
+#connect
+$conn = Pg::connectdb("");
+if ( $conn->status != PGRES_CONNECTION_OK ) {
+        print STDERR $conn->errorMessage;
+	exit(1);
+}
+
+sub run
+{
+	local($query) = @_;
+	local($res);
+
+	print "$query\n" if ( $VERBOSE );
+	$res = $conn->exec($query);
+	if ( $res->resultStatus != PGRES_TUPLES_OK &&
+	     $res->resultStatus != PGRES_COMMAND_OK )  {
+		print STDERR $conn->errorMessage;
+		exit(1);
+	}
+	return $res;
+}
+
+# time the best of $RUNS runs of a query
+sub best_time
+{
+	local($query) = @_;
+	local($best, $run, $t0, $t1);
+
+	for ($run=0; $run<$RUNS; $run++)
+	{
+		$t0 = gettimeofday;
+		run($query);
+		$t1 = gettimeofday;
+		$best = $t1 - $t0 if ( ! defined($best) || $t1 - $t0 < $best );
+	}
+	return $best;
+}
+
+run("CREATE TEMP TABLE profile_geos_2d AS SELECT ".
+	"ST_MakeLine(ARRAY(SELECT ST_MakePoint(random(), random()) ".
+	"FROM generate_series(1, $VERTICES) WHERE i > 0)) AS g ".
+	"FROM generate_series(1, $ROWS) i");
+run("CREATE TEMP TABLE profile_geos_3d AS SELECT ".
+	"ST_MakeLine(ARRAY(SELECT ST_MakePoint(random(), random(), random()) ".
+	"FROM generate_series(1, $VERTICES) WHERE i > 0)) AS g ".
+	"FROM generate_series(1, $ROWS) i");
+
+print "  Rows: $ROWS\n";
+print "  Vertices: $VERTICES\n";
+print "  dims\tnoop\tgeos\tns/vertex\n";
+print "----------------------------------------------------------\n";
+
+foreach $t ( [ 'profile_geos_2d', '2d' ], [ 'profile_geos_3d', '3d' ] )
+{
+	local($table, $label) = @$t;
+	local($tn, $tg);
+
+	$tn = best_time("SELECT count(postgis_noop(g)) FROM $table");
+	$tg = best_time("SELECT count(postgis_geos_noop(g)) FROM $table");
+	printf("  %s\t%.3f\t%.3f\t%.1f\n", $label, $tn, $tg,
+		($tg - $tn) * 1e9 / ($ROWS * $VERTICES));
+}
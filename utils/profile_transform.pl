@@ -0,0 +1,140 @@
+#!/usr/bin/perl -w
+
+#
+# Compare ST_Transform between EPSG:4326 and EPSG:3857 by SRID,
+# which uses the built-in spherical mercator formulas, with the
+# same transformation given as proj4 strings, which goes through
+# PROJ. Reports the time of both and the largest difference.
+#
+
+use Pg;
+use Time::HiRes("gettimeofday");
+
+$VERBOSE = 0;
+$POINTS = 100000;
+$VERTICES = 2;
+$RUNS = 3;
+
+sub usage
+{
+	local($me) = `basename $0`;
+	chop($me);
+	print STDERR "$me [-v] [-points <n>] [-vertices <n>] [-runs <n>]\n";
+}
+
+for ($i=0; $i<@ARGV; $i++)
+{
+	if ( $ARGV[$i] eq '-v' )
+	{
+		$VERBOSE++;
+	}
+	elsif ( $ARGV[$i] eq '-points' )
+	{
+		$POINTS = $ARGV[++$i];
+	}
+	elsif ( $ARGV[$i] eq '-vertices' )
+	{
+		$VERTICES = $ARGV[++$i];
+	}
+	elsif ( $ARGV[$i] eq '-runs' )
+	{
+		$RUNS = $ARGV[++$i];
+	}
+	else
+	{
+		print STDERR "Unknown option $ARGV[$i]:\n";
+		usage();
+		exit(1);
+	}
+}
+
+#connect
+$conn = Pg::connectdb("");
+if ( $conn->status != PGRES_CONNECTION_OK ) {
+        print STDERR $conn->errorMessage;
+	exit(1);
+}
+
+sub run
+{
+	local($query) = @_;
+	local($res);
+
+	print "$query\n" if ( $VERBOSE );
+	$res = $conn->exec($query);
+	if ( $res->resultStatus != PGRES_TUPLES_OK &&
+	     $res->resultStatus != PGRES_COMMAND_OK )  {
+		print STDERR $conn->errorMessage;
+		exit(1);
+	}
+	return $res;
+}
+
+sub proj4text
+{
+	local($srid) = @_;
+	local($res);
+
+	$res = run("SELECT proj4text FROM spatial_ref_sys WHERE srid = $srid");
+	die "SRID $srid not found in spatial_ref_sys\n" if ( $res->ntuples < 1 );
+	return $res->getvalue(0, 0);
+}
+
+# time the best of $RUNS runs of a query
+sub best_time
+{
+	local($query) = @_;
+	local($best, $run, $t0, $t1);
+
+	for ($run=0; $run<$RUNS; $run++)
+	{
+		$t0 = gettimeofday;
+		run($query);
+		$t1 = gettimeofday;
+		$best = $t1 - $t0 if ( ! defined($best) || $t1 - $t0 < $best );
+	}
+	return $best;
+}
+
+$P4326 = proj4text(4326);
+$P3857 = proj4text(3857);
+$P4326 =~ s/'/''/g;
+$P3857 =~ s/'/''/g;
+
+# random lines, all within the mercator latitude range
+run("CREATE TEMP TABLE profile_transform AS SELECT ".
+	"ST_SetSRID(ST_MakeLine(ARRAY(SELECT ST_MakePoint(random()*360-180, random()*170-85) ".
+	"FROM generate_series(1, $VERTICES) WHERE i > 0)), 4326) AS g ".
+	"FROM generate_series(1, $POINTS) i");
+run("CREATE TEMP TABLE profile_transform_3857 AS SELECT ST_Transform(g, 3857) AS g FROM profile_transform");
+
+print "  Rows: $POINTS\n";
+print "  Vertices: $VERTICES\n";
+print "  direction\tbuiltin\tproj\tproj/builtin\n";
+print "----------------------------------------------------------\n";
+
+foreach $dir ( [ 'profile_transform', 3857, $P4326, $P3857, '4326->3857' ],
+               [ 'profile_transform_3857', 4326, $P3857, $P4326, '3857->4326' ] )
+{
+	local($table, $srid, $from, $to, $label) = @$dir;
+	local($tb, $tp);
+
+	$tb = best_time("SELECT count(ST_Transform(g, $srid)) FROM $table");
+	$tp = best_time("SELECT count(ST_Transform(g, '$from', '$to')) FROM $table");
+	printf("  %s\t%.3f\t%.3f\t%.2f\n", $label, $tb, $tp, $tp / $tb);
+}
+
+# largest difference between the two, per vertex
+$res = run("SELECT max(greatest(abs(ST_X(a.geom) - ST_X(b.geom)), abs(ST_Y(a.geom) - ST_Y(b.geom)))) ".
+	"FROM profile_transform, ".
+	"ST_DumpPoints(ST_Transform(g, 3857)) a, ".
+	"ST_DumpPoints(ST_Transform(g, '$P4326', '$P3857')) b ".
+	"WHERE a.path = b.path");
+print "\n  Max difference 4326->3857: ".$res->getvalue(0, 0)."\n";
+
+$res = run("SELECT max(greatest(abs(ST_X(a.geom) - ST_X(b.geom)), abs(ST_Y(a.geom) - ST_Y(b.geom)))) ".
+	"FROM profile_transform_3857, ".
+	"ST_DumpPoints(ST_Transform(g, 4326)) a, ".
+	"ST_DumpPoints(ST_Transform(g, '$P3857', '$P4326')) b ".
+	"WHERE a.path = b.path");
+print "  Max difference 3857->4326: ".$res->getvalue(0, 0)."\n";